@@ -0,0 +1,103 @@
+/* Compare the vectorized UTF-16 to UTF-8 transcoder with the scalar one on
+ * the kinds of two byte strings found in heaps.
+ *
+ * Build with `./gyp_llnode -Dllnode_bench=1 && make -C out/ utf16-bench`.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "src/llutf8.h"
+
+using llnode::Utf16ToUtf8;
+using llnode::Utf16ToUtf8Scalar;
+using llnode::Utf8Capacity;
+
+// Two byte strings in a heap are a few hundred bytes on average.
+static const size_t kStringLength = 512;
+static const size_t kStrings = 4096;
+static const int kRounds = 20;
+
+
+static void Append(std::string& out, uint16_t unit) {
+  out.push_back(static_cast<char>(unit & 0xff));
+  out.push_back(static_cast<char>(unit >> 8));
+}
+
+
+/* `kStrings` strings of `kStringLength` code units, a `non_ascii` fraction of
+ * them CJK characters or, when `emoji` is set, surrogate pairs.
+ */
+static std::vector<std::string> MakeStrings(double non_ascii, bool emoji) {
+  std::vector<std::string> strings;
+  uint32_t seed = 1;
+  for (size_t s = 0; s < kStrings; s++) {
+    std::string str;
+    while (str.size() < kStringLength * 2) {
+      seed = seed * 1103515245 + 12345;
+      double r = static_cast<double>((seed >> 8) & 0xffff) / 0x10000;
+      if (r >= non_ascii) {
+        Append(str, 'a' + (seed >> 24) % 26);
+      } else if (emoji) {
+        Append(str, 0xd83d);
+        Append(str, 0xde00 + (seed >> 24) % 0x40);
+      } else {
+        Append(str, 0x4e00 + (seed >> 16) % 0x5000);
+      }
+    }
+    str.resize(kStringLength * 2);
+    strings.push_back(str);
+  }
+  return strings;
+}
+
+
+template <class Transcoder>
+static double Run(const std::vector<std::string>& strings, Transcoder t,
+                  std::string& out) {
+  std::string buf(Utf8Capacity(kStringLength), '\0');
+  auto start = std::chrono::steady_clock::now();
+  for (int round = 0; round < kRounds; round++) {
+    out.clear();
+    for (const std::string& str : strings) {
+      size_t n = t(str.data(), str.size() / 2, &buf[0]);
+      out.append(buf, 0, n);
+    }
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+
+  double bytes = static_cast<double>(kRounds) * kStrings * kStringLength * 2;
+  return bytes / elapsed.count() / (1024 * 1024);
+}
+
+
+int main() {
+  struct {
+    const char* name;
+    double non_ascii;
+    bool emoji;
+  } cases[] = {{"ascii", 0, false},
+               {"json, 1% cjk", 0.01, false},
+               {"json, 1% emoji", 0.01, true},
+               {"cjk", 1, false}};
+
+  printf("%-16s %12s %12s\n", "input", "scalar MB/s", "vector MB/s");
+  for (auto const& c : cases) {
+    std::vector<std::string> strings = MakeStrings(c.non_ascii, c.emoji);
+    std::string scalar_out;
+    std::string vector_out;
+    double scalar = Run(strings, Utf16ToUtf8Scalar, scalar_out);
+    double vector = Run(strings, Utf16ToUtf8, vector_out);
+    if (scalar_out != vector_out) {
+      fprintf(stderr, "%s: transcoders disagree\n", c.name);
+      return 1;
+    }
+    printf("%-16s %12.0f %12.0f\n", c.name, scalar, vector);
+  }
+  return 0;
+}
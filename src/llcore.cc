@@ -0,0 +1,480 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <set>
+
+#include "src/llcore.h"
+
+namespace llnode {
+
+using lldb::SBError;
+using lldb::SBProcess;
+
+// ELF constants, defined here as not every platform ships <elf.h>.
+static const uint8_t kElfMagic[] = {0x7f, 'E', 'L', 'F'};
+static const uint8_t kElfClass32 = 1;
+static const uint8_t kElfClass64 = 2;
+static const uint8_t kElfDataLSB = 1;
+static const uint16_t kElfTypeCore = 4;
+static const uint32_t kPTLoad = 1;
+static const uint32_t kPTNote = 4;
+static const uint16_t kPNXNum = 0xffff;
+static const uint32_t kNTPRStatus = 1;
+static const uint32_t kNTFile = 0x46494c45;
+
+
+const char* CoreSegment::KindName(Kind kind) {
+  switch (kind) {
+    case kReadOnly:
+      return "read-only";
+    case kFileBacked:
+      return "file-backed";
+    case kAnonymous:
+      return "anonymous";
+    case kStack:
+      return "stack";
+    case kV8HeapCandidate:
+      return "v8-heap";
+  }
+  return "unknown";
+}
+
+
+bool CoreFile::Open(const char* path) {
+  Close();
+
+  // Don't open (and possibly block on) devices or fifos.
+  struct stat st;
+  if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) return false;
+
+  fd_ = open(path, O_RDONLY);
+  if (fd_ == -1) return false;
+
+  path_ = path;
+  file_size_ = st.st_size;
+
+  if (!ReadHeaders()) {
+    Close();
+    return false;
+  }
+
+#ifdef POSIX_FADV_SEQUENTIAL
+  // The heap scan reads the segments front to back.
+  posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif  // POSIX_FADV_SEQUENTIAL
+
+  return true;
+}
+
+
+void CoreFile::Close() {
+  if (fd_ != -1) close(fd_);
+  fd_ = -1;
+  path_.clear();
+  file_size_ = 0;
+  pid_ = 0;
+  segments_.clear();
+  mapped_files_.clear();
+}
+
+
+bool CoreFile::ReadAt(uint64_t offset, void* buf, size_t size) {
+  uint8_t* p = static_cast<uint8_t*>(buf);
+  while (size > 0) {
+    ssize_t n = pread(fd_, p, size, offset);
+    if (n <= 0) return false;
+    p += n;
+    offset += n;
+    size -= n;
+  }
+  return true;
+}
+
+
+uint16_t CoreFile::Read16(const uint8_t* p) const {
+  uint16_t v;
+  memcpy(&v, p, sizeof(v));
+  return swap_bytes_ ? __builtin_bswap16(v) : v;
+}
+
+
+uint32_t CoreFile::Read32(const uint8_t* p) const {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return swap_bytes_ ? __builtin_bswap32(v) : v;
+}
+
+
+uint64_t CoreFile::Read64(const uint8_t* p) const {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return swap_bytes_ ? __builtin_bswap64(v) : v;
+}
+
+
+bool CoreFile::ReadHeaders() {
+  uint8_t ehdr[64];
+  if (!ReadAt(0, ehdr, sizeof(ehdr))) return false;
+  if (memcmp(ehdr, kElfMagic, sizeof(kElfMagic)) != 0) return false;
+
+  if (ehdr[4] == kElfClass64)
+    is_64bit_ = true;
+  else if (ehdr[4] == kElfClass32)
+    is_64bit_ = false;
+  else
+    return false;
+
+  union {
+    uint8_t a[2];
+    uint16_t b;
+  } u = {{0, 1}};
+  bool host_big_endian = u.b == 1;
+  swap_bytes_ = (ehdr[5] == kElfDataLSB) == host_big_endian;
+
+  if (Read16(ehdr + 16) != kElfTypeCore) return false;
+
+  uint64_t phoff;
+  uint64_t shoff;
+  uint16_t phentsize;
+  uint32_t phnum;
+  if (is_64bit_) {
+    phoff = Read64(ehdr + 32);
+    shoff = Read64(ehdr + 40);
+    phentsize = Read16(ehdr + 54);
+    phnum = Read16(ehdr + 56);
+  } else {
+    phoff = Read32(ehdr + 28);
+    shoff = Read32(ehdr + 32);
+    phentsize = Read16(ehdr + 42);
+    phnum = Read16(ehdr + 44);
+  }
+
+  if (phentsize < (is_64bit_ ? 56 : 32)) return false;
+
+  // Cores with more than 65534 mappings keep the real count in the
+  // sh_info field of the first section header.
+  if (phnum == kPNXNum) {
+    uint8_t shdr[64];
+    if (shoff == 0 || !ReadAt(shoff, shdr, sizeof(shdr))) return false;
+    phnum = Read32(shdr + (is_64bit_ ? 44 : 28));
+  }
+
+  // Don't let a corrupt count allocate more than the file holds.
+  if (phoff > file_size_ ||
+      static_cast<uint64_t>(phnum) * phentsize > file_size_ - phoff) {
+    return false;
+  }
+
+  std::vector<uint8_t> phdrs(static_cast<size_t>(phnum) * phentsize);
+  if (!ReadAt(phoff, phdrs.data(), phdrs.size())) return false;
+
+  for (uint32_t i = 0; i < phnum; i++) {
+    const uint8_t* phdr = &phdrs[static_cast<size_t>(i) * phentsize];
+
+    uint32_t type = Read32(phdr);
+    uint32_t flags;
+    uint64_t offset;
+    uint64_t vaddr;
+    uint64_t filesz;
+    uint64_t memsz;
+    if (is_64bit_) {
+      flags = Read32(phdr + 4);
+      offset = Read64(phdr + 8);
+      vaddr = Read64(phdr + 16);
+      filesz = Read64(phdr + 32);
+      memsz = Read64(phdr + 40);
+    } else {
+      offset = Read32(phdr + 4);
+      vaddr = Read32(phdr + 8);
+      filesz = Read32(phdr + 16);
+      memsz = Read32(phdr + 20);
+      flags = Read32(phdr + 24);
+    }
+
+    if (type == kPTNote) {
+      // A broken note shouldn't stop us from using the segments.
+      ReadNotes(offset, filesz);
+      continue;
+    }
+
+    if (type != kPTLoad || memsz == 0) continue;
+
+    /* Cores get truncated due to file size limits and coredump_filter
+     * leaves segments out entirely, only trust the bytes that are actually
+     * in the file.
+     */
+    uint64_t present = 0;
+    if (offset < file_size_) present = std::min(filesz, file_size_ - offset);
+
+    segments_.push_back(CoreSegment(vaddr, memsz, offset, present, flags));
+  }
+
+  std::sort(segments_.begin(), segments_.end(),
+            [](const CoreSegment& a, const CoreSegment& b) {
+              return a.start_ < b.start_;
+            });
+
+  return !segments_.empty();
+}
+
+
+bool CoreFile::ReadNotes(uint64_t offset, uint64_t size) {
+  if (offset >= file_size_) return false;
+  size = std::min(size, file_size_ - offset);
+
+  std::vector<uint8_t> notes(size);
+  if (!ReadAt(offset, notes.data(), notes.size())) return false;
+
+  // Core file notes are 4 byte aligned on both 32 and 64 bit.
+  uint64_t pos = 0;
+  while (pos + 12 <= size) {
+    uint32_t namesz = Read32(&notes[pos]);
+    uint32_t descsz = Read32(&notes[pos + 4]);
+    uint32_t type = Read32(&notes[pos + 8]);
+    pos += 12;
+
+    uint64_t name_pos = pos;
+    pos += (static_cast<uint64_t>(namesz) + 3) & ~3ULL;
+    uint64_t desc_pos = pos;
+    pos += (static_cast<uint64_t>(descsz) + 3) & ~3ULL;
+    if (desc_pos + descsz > size) return false;
+
+    bool is_core = namesz >= 4 && memcmp(&notes[name_pos], "CORE", 4) == 0;
+    if (!is_core) continue;
+
+    // pr_pid follows the siginfo, cursig and the two signal sets.
+    uint64_t pid_offset = is_64bit_ ? 32 : 24;
+    if (type == kNTPRStatus && pid_ == 0 && descsz >= pid_offset + 4)
+      pid_ = Read32(&notes[desc_pos + pid_offset]);
+    if (type == kNTFile && !ReadFileNote(&notes[desc_pos], descsz))
+      return false;
+  }
+
+  return true;
+}
+
+
+/* NT_FILE layout:
+ *   count, page_size,
+ *   count * (start, end, offset in pages),
+ *   count * NUL terminated path
+ */
+bool CoreFile::ReadFileNote(const uint8_t* desc, uint64_t size) {
+  const uint64_t word = is_64bit_ ? 8 : 4;
+  if (size < 2 * word) return false;
+
+  uint64_t count = ReadWord(desc);
+  uint64_t page_size = ReadWord(desc + word);
+  if (count > (size - 2 * word) / (3 * word)) return false;
+
+  // Cores can have more than one NT_FILE note, name this one's entries.
+  size_t first = mapped_files_.size();
+  const uint8_t* entry = desc + 2 * word;
+  for (uint64_t i = 0; i < count; i++, entry += 3 * word) {
+    uint64_t start = ReadWord(entry);
+    uint64_t end = ReadWord(entry + word);
+    uint64_t file_offset = ReadWord(entry + 2 * word) * page_size;
+    mapped_files_.push_back(CoreMappedFile(start, end, file_offset));
+  }
+
+  const char* name = reinterpret_cast<const char*>(entry);
+  const char* end = reinterpret_cast<const char*>(desc + size);
+  for (uint64_t i = 0; i < count && name < end; i++) {
+    size_t len = strnlen(name, end - name);
+    mapped_files_[first + i].path_.assign(name, len);
+    name += len + 1;
+  }
+
+  std::sort(mapped_files_.begin(), mapped_files_.end(),
+            [](const CoreMappedFile& a, const CoreMappedFile& b) {
+              return a.start_ < b.start_;
+            });
+  return true;
+}
+
+
+void CoreFile::ClassifySegments(const std::vector<uint64_t>& stack_pointers) {
+  // Both lists are sorted by address so walk them together.
+  std::vector<CoreMappedFile>::const_iterator file = mapped_files_.begin();
+
+  for (CoreSegment& segment : segments_) {
+    while (file != mapped_files_.end() && file->end_ <= segment.start_) ++file;
+
+    if (!segment.IsWritable()) {
+      segment.kind_ = CoreSegment::kReadOnly;
+    } else if (file != mapped_files_.end() && file->start_ < segment.end()) {
+      segment.kind_ = CoreSegment::kFileBacked;
+    } else if (std::any_of(stack_pointers.begin(), stack_pointers.end(),
+                           [&segment](uint64_t sp) {
+                             return sp >= segment.start_ && sp < segment.end();
+                           })) {
+      segment.kind_ = CoreSegment::kStack;
+    } else if ((segment.start_ & (kV8PageAlignment - 1)) == 0 ||
+               (segment.end() & (kV8PageAlignment - 1)) == 0) {
+      // The kernel merges adjacent anonymous mappings so a run of V8 pages
+      // may only be aligned at one end.
+      segment.kind_ = CoreSegment::kV8HeapCandidate;
+    } else {
+      segment.kind_ = CoreSegment::kAnonymous;
+    }
+  }
+}
+
+
+const CoreSegment* CoreFile::FindSegment(uint64_t address) const {
+  auto it = std::upper_bound(segments_.begin(), segments_.end(), address,
+                             [](uint64_t address, const CoreSegment& segment) {
+                               return address < segment.start_;
+                             });
+  if (it == segments_.begin()) return nullptr;
+  --it;
+  if (address >= it->start_ + it->file_length_) return nullptr;
+  return &*it;
+}
+
+
+bool CoreFile::ReadMemory(uint64_t address, void* buf, size_t size) {
+  const CoreSegment* segment = FindSegment(address);
+  if (segment == nullptr) return false;
+  if (address + size > segment->start_ + segment->file_length_) return false;
+
+  return ReadAt(segment->file_offset_ + (address - segment->start_), buf,
+                size);
+}
+
+
+void CoreFile::Prefetch(uint64_t address, uint64_t size) {
+#ifdef POSIX_FADV_WILLNEED
+  const CoreSegment* segment = FindSegment(address);
+  if (segment == nullptr) return;
+
+  uint64_t offset = address - segment->start_;
+  size = std::min(size, segment->file_length_ - offset);
+  posix_fadvise(fd_, segment->file_offset_ + offset, size,
+                POSIX_FADV_WILLNEED);
+#endif  // POSIX_FADV_WILLNEED
+}
+
+
+/* Compare words from several writable segments of the core file with what
+ * lldb reads from the process. The first pages of the executable and of
+ * libraries are the same in every core of the same binary, leave out pages
+ * starting with an ELF header and words that are 0.
+ */
+bool CoreFile::MatchesProcess(SBProcess process) {
+  static const size_t kMaxSegments = 8;
+  static const uint64_t kWordsPerSegment = 4;
+
+  // lldb takes the pid of a core from its NT_PRSTATUS note too.
+  lldb::pid_t pid = process.GetProcessID();
+  if (pid_ != 0 && pid != LLDB_INVALID_PROCESS_ID && pid != pid_)
+    return false;
+
+  size_t segments = 0;
+  uint64_t matched = 0;
+  for (const CoreSegment& segment : segments_) {
+    if (segments == kMaxSegments) break;
+    if (!segment.IsWritable() || segment.file_length_ < 4096) continue;
+
+    uint8_t magic[sizeof(kElfMagic)];
+    if (!ReadAt(segment.file_offset_, magic, sizeof(magic))) return false;
+    if (memcmp(magic, kElfMagic, sizeof(kElfMagic)) == 0) continue;
+
+    bool readable = false;
+    for (uint64_t i = 0; i < kWordsPerSegment; i++) {
+      // Spread the words over the segment, 8 byte aligned.
+      uint64_t offset =
+          (segment.file_length_ - sizeof(uint64_t)) * i / kWordsPerSegment;
+      offset &= ~static_cast<uint64_t>(sizeof(uint64_t) - 1);
+
+      uint64_t expected;
+      if (!ReadAt(segment.file_offset_ + offset, &expected, sizeof(expected)))
+        return false;
+
+      uint64_t actual;
+      SBError sberr;
+      process.ReadMemory(segment.start_ + offset, &actual, sizeof(actual),
+                         sberr);
+      if (sberr.Fail()) continue;
+
+      readable = true;
+      if (actual != expected) return false;
+      if (actual != 0) matched++;
+    }
+    if (readable) segments++;
+  }
+  return matched != 0;
+}
+
+
+// The kernel marks the paths of files removed since they were opened.
+static std::string StripDeleted(std::string path) {
+  static const char kDeleted[] = " (deleted)";
+  const size_t length = sizeof(kDeleted) - 1;
+  if (path.size() > length &&
+      path.compare(path.size() - length, length, kDeleted) == 0) {
+    path.resize(path.size() - length);
+  }
+  return path;
+}
+
+
+bool CoreFile::OpenForProcess(SBProcess process) {
+  const char* plugin = process.GetPluginName();
+  if (plugin == nullptr || strcmp(plugin, "elf-core") != 0) return false;
+
+  std::set<std::string> candidates;
+
+  // lldb either keeps the core open or maps it into memory.
+  DIR* dir = opendir("/proc/self/fd");
+  if (dir != nullptr) {
+    struct dirent* ent;
+    while ((ent = readdir(dir)) != nullptr) {
+      std::string link = std::string("/proc/self/fd/") + ent->d_name;
+      char buf[4096];
+      ssize_t len = readlink(link.c_str(), buf, sizeof(buf) - 1);
+      if (len <= 0 || buf[0] != '/') continue;
+      candidates.insert(StripDeleted(std::string(buf, len)));
+    }
+    closedir(dir);
+  }
+
+  std::ifstream maps("/proc/self/maps");
+  std::string line;
+  while (std::getline(maps, line)) {
+    size_t slash = line.find('/');
+    if (slash != std::string::npos)
+      candidates.insert(StripDeleted(line.substr(slash)));
+  }
+
+  // The same file can show up under several paths.
+  std::set<std::pair<dev_t, ino_t>> files;
+  std::string match;
+  for (const std::string& candidate : candidates) {
+    struct stat st;
+    if (stat(candidate.c_str(), &st) != 0) continue;
+    if (!files.insert(std::make_pair(st.st_dev, st.st_ino)).second) continue;
+    if (!Open(candidate.c_str()) || !MatchesProcess(process)) continue;
+
+    // Reading the wrong core would go unnoticed, rather read through lldb.
+    if (!match.empty()) {
+      Close();
+      return false;
+    }
+    match = candidate;
+  }
+
+  if (match.empty() || !Open(match.c_str())) {
+    Close();
+    return false;
+  }
+  return true;
+}
+
+}  // namespace llnode
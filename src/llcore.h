@@ -0,0 +1,144 @@
+#ifndef SRC_LLCORE_H_
+#define SRC_LLCORE_H_
+
+#include <string>
+#include <vector>
+
+#include <lldb/API/LLDB.h>
+
+namespace llnode {
+
+/* A PT_LOAD segment of an ELF core file, classified by what it most likely
+ * holds so the heap scan can skip memory that can't contain V8 objects.
+ */
+class CoreSegment {
+ public:
+  enum Kind {
+    kReadOnly,
+    kFileBacked,
+    kAnonymous,
+    kStack,
+    kV8HeapCandidate
+  };
+
+  CoreSegment(uint64_t start, uint64_t length, uint64_t file_offset,
+              uint64_t file_length, uint32_t flags)
+      : start_(start),
+        length_(length),
+        file_offset_(file_offset),
+        file_length_(file_length),
+        flags_(flags),
+        kind_(kAnonymous) {}
+
+  inline uint64_t end() const { return start_ + length_; }
+  inline bool IsWritable() const { return (flags_ & kFlagWrite) != 0; }
+
+  /* Only the bytes actually present in the core file can be scanned. */
+  inline bool IsScannable() const {
+    return file_length_ != 0 && (kind_ == kAnonymous || kind_ == kStack ||
+                                 kind_ == kV8HeapCandidate);
+  }
+
+  static const char* KindName(Kind kind);
+
+  static const uint32_t kFlagExecute = 1;
+  static const uint32_t kFlagWrite = 2;
+  static const uint32_t kFlagRead = 4;
+
+  uint64_t start_;
+  uint64_t length_;
+  uint64_t file_offset_;
+  uint64_t file_length_;
+  uint32_t flags_;
+  Kind kind_;
+};
+
+/* An NT_FILE entry, a file mapped into the address space of the process. */
+class CoreMappedFile {
+ public:
+  CoreMappedFile(uint64_t start, uint64_t end, uint64_t file_offset)
+      : start_(start), end_(end), file_offset_(file_offset) {}
+
+  uint64_t start_;
+  uint64_t end_;
+  uint64_t file_offset_;
+  std::string path_;
+};
+
+/* Reads the program headers and notes of an ELF core file directly, this
+ * replaces the readelf2segments.py script and the LLNODE_RANGESFILE
+ * environment variable on systems where lldb can't tell us about memory
+ * regions.
+ */
+class CoreFile {
+ public:
+  CoreFile()
+      : fd_(-1), file_size_(0), pid_(0), is_64bit_(true), swap_bytes_(false) {}
+  ~CoreFile() { Close(); }
+
+  bool Open(const char* path);
+  void Close();
+
+  /* Locate the core file lldb has loaded for `process`. lldb doesn't expose
+   * the path through the SB API so look for an open (or mapped) ELF core in
+   * our own address space and check its contents match the process. Fails
+   * when more than one core matches.
+   */
+  bool OpenForProcess(lldb::SBProcess process);
+
+  /* Mark segments as read only, file backed, stacks or likely V8 heap pages.
+   * `stack_pointers` holds the stack pointer of every thread.
+   */
+  void ClassifySegments(const std::vector<uint64_t>& stack_pointers);
+
+  /* Read process memory straight from the core file, bypassing lldb. Safe to
+   * call from any thread. Fails unless the whole range is present in the
+   * core.
+   */
+  bool ReadMemory(uint64_t address, void* buf, size_t size);
+
+  /* Hint the kernel to start paging in the part of the core file holding
+   * `size` bytes at `address`.
+   */
+  void Prefetch(uint64_t address, uint64_t size);
+
+  inline bool IsOpen() const { return fd_ != -1; }
+  inline const std::string& path() const { return path_; }
+  inline const std::vector<CoreSegment>& segments() const { return segments_; }
+  inline const std::vector<CoreMappedFile>& mapped_files() const {
+    return mapped_files_;
+  }
+
+  // V8 pages are at least 256KB and aligned to their size.
+  static const uint64_t kV8PageAlignment = 256 * 1024;
+
+ private:
+  bool ReadHeaders();
+  bool ReadNotes(uint64_t offset, uint64_t size);
+  bool ReadFileNote(const uint8_t* desc, uint64_t size);
+  bool MatchesProcess(lldb::SBProcess process);
+  const CoreSegment* FindSegment(uint64_t address) const;
+
+  bool ReadAt(uint64_t offset, void* buf, size_t size);
+  uint16_t Read16(const uint8_t* p) const;
+  uint32_t Read32(const uint8_t* p) const;
+  uint64_t Read64(const uint8_t* p) const;
+  inline uint64_t ReadWord(const uint8_t* p) const {
+    return is_64bit_ ? Read64(p) : Read32(p);
+  }
+
+  int fd_;
+  std::string path_;
+  uint64_t file_size_;
+  // From the first NT_PRSTATUS note, 0 when there was none.
+  uint64_t pid_;
+  bool is_64bit_;
+  bool swap_bytes_;
+
+  std::vector<CoreSegment> segments_;
+  std::vector<CoreMappedFile> mapped_files_;
+};
+
+}  // namespace llnode
+
+#endif  // SRC_LLCORE_H_
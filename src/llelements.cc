@@ -0,0 +1,466 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <cinttypes>
+
+#include "src/llelements.h"
+#include "src/llv8-inl.h"
+#include "src/llv8.h"
+
+namespace llnode {
+
+using lldb::SBCommandReturnObject;
+using lldb::SBDebugger;
+using lldb::SBTarget;
+using lldb::eReturnStatusFailed;
+using lldb::eReturnStatusSuccessFinishResult;
+
+// Defined in llnode.cc
+extern v8::LLV8 llv8;
+// Defined in llscan.cc
+extern LLScan llscan;
+
+
+ElementsReader::ElementsReader(LLScan* scan, v8::LLV8* llv8, SBTarget target)
+    : WordReader(scan, llv8, target), hole_(0) {
+  elements_offset_ = llv8->js_object()->kElementsOffset;
+  array_length_offset_ = llv8->js_array()->kLengthOffset;
+  header_size_ =
+      std::max(std::max(map_offset_, elements_offset_), array_length_offset_) +
+      pointer_size_;
+  length_offset_ = llv8->fixed_array_base()->kLengthOffset;
+  data_offset_ = llv8->fixed_array()->kDataOffset;
+  dictionary_elements_ = llv8->map()->kDictionaryElements;
+  number_of_elements_index_ = llv8->name_dictionary()->kNumberOfElementsIndex;
+  capacity_index_ = llv8->name_dictionary()->kCapacityIndex;
+  entry_size_ = llv8->name_dictionary()->kEntrySize;
+  llv8->oddball();
+}
+
+
+ElementsReader::Kind ElementsReader::GetKind(int64_t elements_kind) const {
+  // The fast kinds have come first, in this order, in every V8 with
+  // postmortem data.
+  if (elements_kind >= kPackedSmi && elements_kind <= kHoleyDouble)
+    return static_cast<Kind>(elements_kind);
+  if (elements_kind == dictionary_elements_) return kDictionary;
+  return kOther;
+}
+
+
+const char* ElementsReader::KindName(Kind kind) {
+  switch (kind) {
+    case kPackedSmi:
+      return "packed smi";
+    case kHoleySmi:
+      return "holey smi";
+    case kPacked:
+      return "packed";
+    case kHoley:
+      return "holey";
+    case kPackedDouble:
+      return "packed double";
+    case kHoleyDouble:
+      return "holey double";
+    case kDictionary:
+      return "dictionary";
+    default:
+      return "other";
+  }
+}
+
+
+void ElementsReader::AddMap(uint64_t map, Kind kind, bool is_array) {
+  Shape& shape = shapes_[map];
+  shape.kind = kind;
+  shape.is_array = is_array;
+}
+
+
+bool ElementsReader::IsHole(uint64_t word) {
+  if (IsSmi(word)) return false;
+  uint64_t hole = hole_;
+  if (hole != 0) return word == hole;
+
+  // There is one hole, once it's known the check is a comparison.
+  std::lock_guard<std::mutex> lock(mutex_);
+  v8::Error err;
+  bool is_hole = v8::Value(llv8_, word).IsHole(err);
+  if (err.Fail() || !is_hole) return false;
+  hole_ = word;
+  return true;
+}
+
+
+bool ElementsReader::CountUsed(uint64_t data, uint64_t slots, bool is_double,
+                               std::vector<unsigned char>* buf,
+                               uint64_t* used) {
+  uint64_t slot_size = is_double ? sizeof(double) : pointer_size_;
+  buf->resize(std::min(slots, kChunkSlots) * slot_size);
+
+  *used = 0;
+  for (uint64_t first = 0; first < slots; first += kChunkSlots) {
+    uint64_t count = std::min(slots - first, kChunkSlots);
+    if (!scan_->ReadMemory(data + first * slot_size, buf->data(),
+                           count * slot_size)) {
+      return false;
+    }
+
+    const unsigned char* p = buf->data();
+    for (uint64_t i = 0; i < count; i++, p += slot_size) {
+      if (is_double) {
+        // Double stores mark holes with a NaN, not the hole object.
+        uint64_t bits;
+        memcpy(&bits, p, sizeof(bits));
+        if (swap_bytes_) bits = __builtin_bswap64(bits);
+        if (bits != kHoleNanBits) (*used)++;
+      } else if (!IsHole(DecodeWord(p))) {
+        (*used)++;
+      }
+    }
+  }
+  return true;
+}
+
+
+bool ElementsReader::Read(uint64_t address, Store* store,
+                          std::vector<unsigned char>* buf) {
+  unsigned char header[kMaxHeaderSize];
+  if (header_size_ > static_cast<int64_t>(sizeof(header))) return false;
+  if (!scan_->ReadMemory(address - tag_, header, header_size_)) return false;
+
+  store->map = DecodeWord(header + map_offset_);
+  auto it = shapes_.find(store->map);
+  if (it == shapes_.end()) return false;
+  const Shape& shape = it->second;
+  store->kind = shape.kind;
+
+  uint64_t elements = DecodeWord(header + elements_offset_);
+  if (IsSmi(elements)) return false;
+
+  // Arrays too long for a Smi length are in dictionary mode.
+  int64_t length = -1;
+  if (shape.is_array) {
+    uint64_t word = DecodeWord(header + array_length_offset_);
+    if (IsSmi(word)) length = SmiValue(word);
+  }
+
+  // Dictionaries keep their number of elements and capacity up front.
+  uint64_t start = elements - tag_;
+  int64_t store_header_size = data_offset_;
+  if (store->kind == kDictionary)
+    store_header_size += (capacity_index_ + 1) * pointer_size_;
+  if (store_header_size > static_cast<int64_t>(sizeof(header))) return false;
+  if (!scan_->ReadMemory(start, header, store_header_size)) return false;
+
+  uint64_t word = DecodeWord(header + length_offset_);
+  if (!IsSmi(word) || SmiValue(word) < 0) return false;
+  bool is_double = IsDouble(store->kind);
+  uint64_t slot_size = is_double ? sizeof(double) : pointer_size_;
+  store->capacity = SmiValue(word);
+  store->used = 0;
+  store->size = 0;
+  store->wasted = 0;
+  if (store->capacity == 0) return true;
+  store->size = data_offset_ + store->capacity * slot_size;
+
+  uint64_t logical = store->capacity;
+  if (length >= 0) logical = std::min<uint64_t>(length, store->capacity);
+
+  switch (store->kind) {
+    case kDictionary: {
+      uint64_t used = DecodeWord(header + data_offset_ +
+                                 number_of_elements_index_ * pointer_size_);
+      uint64_t capacity =
+          DecodeWord(header + data_offset_ + capacity_index_ * pointer_size_);
+      if (!IsSmi(used) || !IsSmi(capacity)) return false;
+      // Counted in entries of a key, a value and its details.
+      store->capacity = SmiValue(capacity);
+      store->used = SmiValue(used);
+      slot_size = entry_size_ * pointer_size_;
+      break;
+    }
+    case kHoleySmi:
+    case kHoley:
+    case kHoleyDouble:
+      // V8 fills the spare slots of arrays with the hole, look it up there
+      // before going through the elements.
+      if (!is_double && hole_ == 0 && logical < store->capacity) {
+        unsigned char spare[8];
+        if (scan_->ReadMemory(start + data_offset_ + logical * slot_size,
+                              spare, slot_size)) {
+          IsHole(DecodeWord(spare));
+        }
+      }
+      if (!CountUsed(start + data_offset_, logical, is_double, buf,
+                     &store->used)) {
+        return false;
+      }
+      break;
+    case kPackedSmi:
+    case kPacked:
+    case kPackedDouble:
+      store->used = logical;
+      break;
+    default:
+      // Frozen, typed array and arguments elements have no spare slots V8
+      // would fill.
+      store->used = store->capacity;
+      break;
+  }
+
+  if (store->used > store->capacity) store->used = store->capacity;
+  store->wasted = (store->capacity - store->used) * slot_size;
+  return true;
+}
+
+
+bool ElementsStatsCmd::DoExecute(SBDebugger d, char** cmd,
+                                 SBCommandReturnObject& result) {
+  OutputSink out(d, result);
+  if (!ParseOutputOptions(cmd, &out, result)) return false;
+
+  SBTarget target = d.GetSelectedTarget();
+  if (!target.IsValid()) {
+    result.SetError("No valid process, please start something\n");
+    return false;
+  }
+
+  ScanOptions scan_options;
+  scan_options.json = out.json();
+  char** start;
+  if (!ParseCountOptions(cmd, &scan_options, kDefaultCount, &count_, &start) ||
+      (start != nullptr && start[0] != nullptr)) {
+    result.SetError("USAGE: v8 elementsstats [flags]\n");
+    return false;
+  }
+
+  /* Ensure we have a map of objects. */
+  if (!llscan.ScanHeapForObjects(target, result, scan_options)) {
+    result.SetStatus(eReturnStatusFailed);
+    return false;
+  }
+
+  auto lock = llscan.LockResults();
+
+  if (scan_options.live_only &&
+      !llscan.MarkLiveObjects(target, result, scan_options)) {
+    result.SetStatus(eReturnStatusFailed);
+    return false;
+  }
+
+  // Load V8 constants from postmortem data
+  llv8.Load(target);
+
+  if (llv8.map()->kBitField2Offset == -1 ||
+      llv8.map()->kElementsKindMask == -1) {
+    result.SetError("No elements kinds in the postmortem data\n");
+    return false;
+  }
+
+  // The kind of every map is looked up once, before the objects are read.
+  ElementsReader reader(&llscan, &llv8, target);
+  MapUsageMap maps;
+  std::vector<uint64_t> addresses;
+  for (auto& entry : llscan.GetMapsToInstances()) {
+    TypeRecord* record = entry.second;
+    bool has_elements = false;
+    for (auto& map_entry : record->GetMaps()) {
+      v8::Error err;
+      v8::Map map(&llv8, map_entry.first);
+      int64_t type = map.GetType(err);
+      if (err.Fail()) continue;
+      bool is_array = type == llv8.types()->kJSArrayType;
+      if (!is_array && !v8::JSObject::IsObjectType(&llv8, type)) continue;
+      int64_t elements_kind = map.ElementsKind(err);
+      if (err.Fail()) continue;
+
+      MapUsage& usage = maps[map_entry.first];
+      usage.map = map_entry.first;
+      usage.kind = reader.GetKind(elements_kind);
+      usage.type = record;
+      reader.AddMap(map_entry.first, usage.kind, is_array);
+      has_elements = true;
+    }
+    if (!has_elements) continue;
+
+    for (uint64_t address : record->GetInstances()) {
+      if (scan_options.live_only && !llscan.IsLive(address)) continue;
+      addresses.push_back(address);
+    }
+  }
+
+  size_t workers = llscan.ParallelWorkers();
+  std::vector<std::unordered_map<uint64_t, Usage>> usages(workers);
+  std::vector<uint64_t> unreadable(workers, 0);
+  std::vector<std::vector<unsigned char>> bufs(workers);
+
+  ScanProgress progress(d, "Reading elements", addresses.size(), false,
+                        scan_options);
+  uint64_t done = llscan.ParallelFor(
+      addresses, progress, [&](size_t worker, uint64_t address) {
+        ElementsReader::Store store;
+        if (!reader.Read(address, &store, &bufs[worker])) {
+          unreadable[worker]++;
+          return;
+        }
+        usages[worker][store.map].Add(store);
+      });
+  bool complete = done == addresses.size();
+
+  // Add up the maps by kind and by constructor.
+  Usage total;
+  std::vector<Usage> kinds(ElementsReader::kNumKinds);
+  std::unordered_map<TypeRecord*, Usage> types;
+  for (size_t i = 0; i < workers; i++) {
+    for (auto& entry : usages[i]) maps[entry.first].usage.Add(entry.second);
+    usages[i].clear();
+    if (i != 0) unreadable[0] += unreadable[i];
+  }
+
+  std::vector<const MapUsage*> sorted_maps;
+  for (auto& entry : maps) {
+    const MapUsage& map = entry.second;
+    if (map.usage.objects == 0) continue;
+    total.Add(map.usage);
+    kinds[map.kind].Add(map.usage);
+    types[map.type].Add(map.usage);
+    sorted_maps.push_back(&map);
+  }
+
+  std::vector<std::pair<TypeRecord*, const Usage*>> sorted_types;
+  for (auto& entry : types)
+    sorted_types.push_back({entry.first, &entry.second});
+
+  // Most wasted first, the larger stores break ties.
+  auto more_wasted = [](const Usage& a, const Usage& b) {
+    return a.wasted != b.wasted ? a.wasted > b.wasted : a.size > b.size;
+  };
+  size_t shown_types = std::min<size_t>(sorted_types.size(), count_);
+  std::partial_sort(sorted_types.begin(), sorted_types.begin() + shown_types,
+                    sorted_types.end(),
+                    [&](const std::pair<TypeRecord*, const Usage*>& a,
+                        const std::pair<TypeRecord*, const Usage*>& b) {
+                      return more_wasted(*a.second, *b.second);
+                    });
+  size_t shown_maps = std::min<size_t>(sorted_maps.size(), count_);
+  std::partial_sort(sorted_maps.begin(), sorted_maps.begin() + shown_maps,
+                    sorted_maps.end(),
+                    [&](const MapUsage* a, const MapUsage* b) {
+                      return more_wasted(a->usage, b->usage);
+                    });
+
+  if (out.json()) {
+    JSONWriter& json = out.json_writer();
+    json.BeginObject();
+    json.Member("complete", complete);
+    json.Member("objects", total.objects);
+    json.Member("size", total.size);
+    json.Member("wasted", total.wasted);
+    json.Member("unreadable", unreadable[0]);
+    json.Key("kinds");
+    json.BeginArray();
+    for (size_t kind = 0; kind < kinds.size(); kind++) {
+      if (kinds[kind].objects == 0) continue;
+      json.BeginObject();
+      json.Member("kind", ElementsReader::KindName(
+                              static_cast<ElementsReader::Kind>(kind)));
+      json.Member("objects", kinds[kind].objects);
+      json.Member("size", kinds[kind].size);
+      json.Member("wasted", kinds[kind].wasted);
+      json.EndObject();
+    }
+    json.EndArray();
+    json.Key("types");
+    json.BeginArray();
+    for (size_t i = 0; i < shown_types; i++) {
+      json.BeginObject();
+      json.Member("type", sorted_types[i].first->GetTypeName());
+      json.Member("objects", sorted_types[i].second->objects);
+      json.Member("size", sorted_types[i].second->size);
+      json.Member("wasted", sorted_types[i].second->wasted);
+      json.EndObject();
+    }
+    json.EndArray();
+    json.Key("maps");
+    json.BeginArray();
+    for (size_t i = 0; i < shown_maps; i++) {
+      const MapUsage* map = sorted_maps[i];
+      json.BeginObject();
+      json.Key("map");
+      json.Address(map->map);
+      json.Member("type", map->type->GetTypeName());
+      json.Member("kind", ElementsReader::KindName(map->kind));
+      json.Member("objects", map->usage.objects);
+      json.Member("capacity", map->usage.capacity);
+      json.Member("used", map->usage.used);
+      json.Member("size", map->usage.size);
+      json.Member("wasted", map->usage.wasted);
+      json.EndObject();
+    }
+    json.EndArray();
+    json.EndObject();
+    result.SetStatus(eReturnStatusSuccessFinishResult);
+    return true;
+  }
+
+  if (!complete) {
+    out.Printf("PARTIAL RESULT: stopped after %" PRIu64 " of %" PRIu64
+               " objects.\n",
+               done,
+               static_cast<uint64_t>(addresses.size()));
+  }
+  double percent = total.size == 0 ? 0 : 100.0 * total.wasted / total.size;
+  out.Printf("%" PRIu64 " objects with elements, %" PRIu64
+             " bytes of backing stores, %" PRIu64 " bytes (%.1f%%) wasted.\n",
+             total.objects, total.size, total.wasted, percent);
+  if (unreadable[0] != 0) {
+    out.Printf("Unreadable: %" PRIu64 " objects left out.\n", unreadable[0]);
+  }
+  if (total.objects == 0) {
+    result.SetStatus(eReturnStatusSuccessFinishResult);
+    return true;
+  }
+
+  out.Printf("\nBy elements kind:\n");
+  out.Printf("          Kind    Objects      Bytes     Wasted\n");
+  out.Printf(" ------------- ---------- ---------- ----------\n");
+  for (size_t kind = 0; kind < kinds.size(); kind++) {
+    if (kinds[kind].objects == 0) continue;
+    const char* name =
+        ElementsReader::KindName(static_cast<ElementsReader::Kind>(kind));
+    out.Printf(" %13s %10" PRIu64 " %10" PRIu64 " %10" PRIu64 "\n", name,
+               kinds[kind].objects, kinds[kind].size, kinds[kind].wasted);
+  }
+
+  out.Printf("\nBy constructor, most wasted first:\n");
+  out.Printf("    Objects      Bytes     Wasted Name\n");
+  out.Printf(" ---------- ---------- ---------- ----\n");
+  for (size_t i = 0; i < shown_types; i++) {
+    const Usage* usage = sorted_types[i].second;
+    out.Printf(" %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %s\n",
+               usage->objects, usage->size, usage->wasted,
+               sorted_types[i].first->GetTypeName().c_str());
+  }
+
+  // Dictionaries count entries rather than slots.
+  out.Printf("\nBy map, most wasted first:\n");
+  out.Printf("    Objects          Kind   Capacity       Used     Wasted "
+             "Map                Name\n");
+  out.Printf(" ---------- ------------- ---------- ---------- ---------- "
+             "------------------ ----\n");
+  for (size_t i = 0; i < shown_maps; i++) {
+    const MapUsage* map = sorted_maps[i];
+    out.Printf(" %10" PRIu64 " %13s %10" PRIu64 " %10" PRIu64 " %10" PRIu64
+               " 0x%016" PRIx64 " %s\n",
+               map->usage.objects, ElementsReader::KindName(map->kind),
+               map->usage.capacity, map->usage.used, map->usage.wasted,
+               map->map, map->type->GetTypeName().c_str());
+  }
+
+  result.SetStatus(eReturnStatusSuccessFinishResult);
+  return true;
+}
+
+}  // namespace llnode
@@ -0,0 +1,156 @@
+#ifndef SRC_LLELEMENTS_H_
+#define SRC_LLELEMENTS_H_
+
+#include <lldb/API/LLDB.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "src/llnode.h"
+#include "src/llscan.h"
+
+namespace llnode {
+
+/* Reads how objects use their elements backing store. Every object takes two
+ * reads, one for its own header and one for the header of its store, stores
+ * that can have holes are also read in bulk to count them. The elements kind
+ * of each map is looked up through LLV8 once, with AddMap(), before reading.
+ * Safe to use from several threads when the scan can read in parallel.
+ */
+class ElementsReader : public WordReader {
+ public:
+  enum Kind {
+    kPackedSmi,
+    kHoleySmi,
+    kPacked,
+    kHoley,
+    kPackedDouble,
+    kHoleyDouble,
+    kDictionary,
+    kOther,
+    kNumKinds
+  };
+
+  // The backing store of one object.
+  class Store {
+   public:
+    uint64_t map = 0;
+    Kind kind = kOther;
+    // Slots, or entries of dictionaries, the store has room for.
+    uint64_t capacity = 0;
+    // Slots holding an element, entries for dictionaries.
+    uint64_t used = 0;
+    // 0 for the empty store all objects share.
+    uint64_t size = 0;
+    // Bytes of the store no element uses.
+    uint64_t wasted = 0;
+  };
+
+  ElementsReader(LLScan* scan, v8::LLV8* llv8, lldb::SBTarget target);
+
+  // The kind of V8's `ElementsKind` of a map.
+  Kind GetKind(int64_t elements_kind) const;
+  static const char* KindName(Kind kind);
+
+  // Only the objects of maps added here are read, AddMap isn't thread safe.
+  void AddMap(uint64_t map, Kind kind, bool is_array);
+
+  /* Read the backing store of the object at `address`, `buf` is scratch
+   * space. Returns false when it can't be read or its map wasn't added.
+   */
+  bool Read(uint64_t address, Store* store, std::vector<unsigned char>* buf);
+
+ private:
+  class Shape {
+   public:
+    Kind kind = kOther;
+    // JSArrays have a length, the elements of other objects are counted.
+    bool is_array = false;
+  };
+
+  // Bits of the NaN marking holes in double stores, kHoleNanInt64 in V8.
+  static const uint64_t kHoleNanBits = 0xfff7fffffff7ffffULL;
+  static const uint64_t kChunkSlots = 4096;
+  static const size_t kMaxHeaderSize = 16 * 8;
+
+  static inline bool IsDouble(Kind kind) {
+    return kind == kPackedDouble || kind == kHoleyDouble;
+  }
+
+  // Count the slots from `data` on that aren't the hole.
+  bool CountUsed(uint64_t data, uint64_t slots, bool is_double,
+                 std::vector<unsigned char>* buf, uint64_t* used);
+  bool IsHole(uint64_t word);
+
+  int64_t elements_offset_;
+  int64_t array_length_offset_;
+  int64_t header_size_;
+  int64_t length_offset_;
+  int64_t data_offset_;
+  int64_t dictionary_elements_;
+  int64_t number_of_elements_index_;
+  int64_t capacity_index_;
+  int64_t entry_size_;
+
+  std::unordered_map<uint64_t, Shape> shapes_;
+
+  // The address of the hole, 0 until one was found.
+  std::atomic<uint64_t> hole_;
+  // LLV8 is used from one thread at a time.
+  std::mutex mutex_;
+};
+
+class ElementsStatsCmd : public CommandBase {
+ public:
+  ElementsStatsCmd() : count_(kDefaultCount) {}
+  ~ElementsStatsCmd() override {}
+
+  bool DoExecute(lldb::SBDebugger d, char** cmd,
+                 lldb::SBCommandReturnObject& result) override;
+
+ private:
+  class Usage {
+   public:
+    uint64_t objects = 0;
+    uint64_t capacity = 0;
+    uint64_t used = 0;
+    uint64_t size = 0;
+    uint64_t wasted = 0;
+
+    inline void Add(const ElementsReader::Store& store) {
+      objects++;
+      capacity += store.capacity;
+      used += store.used;
+      size += store.size;
+      wasted += store.wasted;
+    }
+    inline void Add(const Usage& other) {
+      objects += other.objects;
+      capacity += other.capacity;
+      used += other.used;
+      size += other.size;
+      wasted += other.wasted;
+    }
+  };
+
+  // The usage of the objects with one map.
+  class MapUsage {
+   public:
+    uint64_t map = 0;
+    ElementsReader::Kind kind = ElementsReader::kOther;
+    TypeRecord* type = nullptr;
+    Usage usage;
+  };
+
+  typedef std::unordered_map<uint64_t, MapUsage> MapUsageMap;
+
+  static const uint64_t kDefaultCount = 10;
+
+  uint64_t count_;
+};
+
+}  // namespace llnode
+
+#endif  // SRC_LLELEMENTS_H_
@@ -0,0 +1,696 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <cinttypes>
+
+#include "src/llfields.h"
+#include "src/llutf8.h"
+#include "src/llv8-inl.h"
+#include "src/llv8.h"
+
+namespace llnode {
+
+using lldb::SBCommandReturnObject;
+using lldb::SBDebugger;
+using lldb::SBTarget;
+using lldb::eReturnStatusFailed;
+using lldb::eReturnStatusSuccessFinishResult;
+
+// Defined in llnode.cc
+extern v8::LLV8 llv8;
+// Defined in llscan.cc
+extern LLScan llscan;
+
+
+PropertyReader::PropertyReader(LLScan* scan, v8::LLV8* llv8, SBTarget target,
+                               const std::vector<std::string>& names)
+    : WordReader(scan, llv8, target),
+      names_(names),
+      strings_(scan, llv8, target),
+      flattener_(&strings_, llv8) {
+  properties_offset_ = llv8->js_object()->kPropertiesOffset;
+  fixed_array_data_offset_ = llv8->fixed_array()->kDataOffset;
+  heap_number_value_offset_ = llv8->heap_number()->kValueOffset;
+  oddball_kind_offset_ = llv8->oddball()->kKindOffset;
+  first_nonstring_ = llv8->types()->kFirstNonstringType;
+  heap_number_type_ = llv8->types()->kHeapNumberType;
+  oddball_type_ = llv8->types()->kOddballType;
+  function_type_ = llv8->types()->kJSFunctionType;
+  llv8->map();
+  llv8->descriptor_array();
+}
+
+
+const PropertyReader::Layout& PropertyReader::GetLayout(uint64_t map) {
+  std::lock_guard<std::recursive_mutex> lock(strings_.llv8_mutex());
+
+  auto it = layouts_.find(map);
+  if (it != layouts_.end()) return it->second;
+
+  Layout& layout = layouts_[map];
+  layout.slots.resize(names_.size());
+
+  v8::Error err;
+  v8::Map map_obj(llv8_, map);
+  layout.type = map_obj.GetType(err);
+  if (err.Fail()) {
+    layout.type = -1;
+    return layout;
+  }
+
+  int64_t type = layout.type;
+  bool has_properties = v8::JSObject::IsObjectType(llv8_, type) ||
+                        type == llv8_->types()->kJSArrayType ||
+                        type == llv8_->types()->kJSFunctionType ||
+                        type == llv8_->types()->kJSRegExpType ||
+                        type == llv8_->types()->kJSDateType ||
+                        type == llv8_->types()->kJSArrayBufferType ||
+                        type == llv8_->types()->kJSTypedArrayType;
+  if (!has_properties) return layout;
+
+  layout.instance_size = map_obj.InstanceSize(err);
+  if (err.Fail() || layout.instance_size > kMaxInstanceSize) return layout;
+
+  bool is_dict = map_obj.IsDictionary(err);
+  if (err.Fail()) return layout;
+
+  if (is_dict) {
+    for (Slot& slot : layout.slots) slot.where = Slot::kDictionary;
+  } else {
+    ResolveDescriptors(map_obj, &layout);
+  }
+  layout.valid = true;
+  return layout;
+}
+
+
+void PropertyReader::ResolveDescriptors(v8::Map& map, Layout* layout) {
+  v8::Error err;
+  v8::HeapObject descriptors_obj = map.InstanceDescriptors(err);
+  if (err.Fail()) return;
+  v8::DescriptorArray descriptors(descriptors_obj);
+
+  int64_t own_descriptors_count = map.NumberOfOwnDescriptors(err);
+  if (err.Fail()) return;
+  int64_t in_object_count = map.InObjectProperties(err);
+  if (err.Fail()) return;
+
+  for (int64_t i = 0; i < own_descriptors_count; i++) {
+    v8::Value key = descriptors.GetKey(i, err);
+    if (err.Fail()) return;
+    std::string key_name = key.ToString(err);
+    if (err.Fail()) continue;
+
+    for (size_t n = 0; n < names_.size(); n++) {
+      if (names_[n] != key_name) continue;
+
+      v8::Smi details = descriptors.GetDetails(i, err);
+      if (err.Fail()) return;
+
+      Slot& slot = layout->slots[n];
+      if (!descriptors.IsFieldDetails(details)) {
+        // Constants and accessors are kept in the descriptors.
+        v8::Value value = descriptors.GetValue(i, err);
+        if (err.Fail()) continue;
+        slot.where = Slot::kConstant;
+        slot.constant = value.raw();
+        continue;
+      }
+
+      slot.is_double = descriptors.IsDoubleField(details);
+      int64_t index = descriptors.FieldIndex(details) - in_object_count;
+      if (index < 0) {
+        slot.where = Slot::kInObject;
+        slot.offset = layout->instance_size + index * pointer_size_;
+      } else {
+        slot.where = Slot::kOutOfObject;
+        slot.offset = index;
+      }
+    }
+  }
+}
+
+
+bool PropertyReader::Read(uint64_t address, std::vector<Property>* properties,
+                          uint64_t* size) {
+  uint64_t start = address - tag_;
+  uint64_t map;
+  if (!ReadWord(start + map_offset_, &map)) return false;
+
+  const Layout& layout = GetLayout(map);
+  if (!layout.valid) return false;
+
+  unsigned char object[kMaxInstanceSize];
+  if (!scan_->ReadMemory(start, object, layout.instance_size)) return false;
+  if (size != nullptr) *size = layout.instance_size;
+  uint64_t extra = DecodeWord(object + properties_offset_) - tag_;
+
+  properties->assign(names_.size(), Property());
+  for (size_t n = 0; n < names_.size(); n++) {
+    const Slot& slot = layout.slots[n];
+    Property& property = (*properties)[n];
+
+    uint64_t word;
+    switch (slot.where) {
+      case Slot::kNone:
+        continue;
+      case Slot::kInObject:
+        word = DecodeWord(object + slot.offset);
+        break;
+      case Slot::kOutOfObject:
+        if (!ReadWord(extra + fixed_array_data_offset_ +
+                          slot.offset * pointer_size_,
+                      &word)) {
+          continue;
+        }
+        break;
+      case Slot::kConstant:
+        word = slot.constant;
+        break;
+      case Slot::kDictionary: {
+        // Every object has its own dictionary, look it up the slow way.
+        std::lock_guard<std::recursive_mutex> lock(strings_.llv8_mutex());
+        v8::Error err;
+        v8::JSObject js_obj(llv8_, address);
+        v8::Value value = js_obj.GetProperty(names_[n], err);
+        if (err.Fail() || value.v8() == nullptr) continue;
+        word = value.raw();
+        break;
+      }
+    }
+
+    if (slot.is_double) {
+      // Double fields hold the bits of the number rather than a value.
+      property.kind = Property::kDouble;
+      memcpy(&property.number, &word, sizeof(property.number));
+    } else {
+      property.kind = Property::kTagged;
+      property.value = word;
+    }
+  }
+
+  return true;
+}
+
+
+int64_t PropertyReader::GetType(uint64_t address) {
+  uint64_t map;
+  if (!ReadWord(address - tag_ + map_offset_, &map)) return -1;
+  return GetLayout(map).type;
+}
+
+
+bool PropertyReader::ReadNumber(uint64_t address, double* number) {
+  unsigned char buf[sizeof(double)];
+  if (!scan_->ReadMemory(address - tag_ + heap_number_value_offset_, buf,
+                         sizeof(buf))) {
+    return false;
+  }
+  uint64_t bits;
+  memcpy(&bits, buf, sizeof(bits));
+  if (swap_bytes_) bits = __builtin_bswap64(bits);
+  memcpy(number, &bits, sizeof(*number));
+  return true;
+}
+
+
+const char* PropertyReader::OddballName(uint64_t address) {
+  uint64_t kind;
+  if (!ReadWord(address - tag_ + oddball_kind_offset_, &kind) || !IsSmi(kind))
+    return nullptr;
+
+  int64_t value = SmiValue(kind);
+  if (value == llv8_->oddball()->kTrue) return "true";
+  if (value == llv8_->oddball()->kFalse) return "false";
+  if (value == llv8_->oddball()->kNull) return "null";
+  if (value == llv8_->oddball()->kUndefined) return "undefined";
+  return nullptr;
+}
+
+
+bool PropertyReader::ReadString(uint64_t address, std::string* utf8) {
+  std::string chars;
+  int64_t char_size;
+  if (!strings_.Read(address, &chars, &char_size)) {
+    // Ropes and slices are put together through LLV8.
+    std::lock_guard<std::recursive_mutex> lock(strings_.llv8_mutex());
+    if (!flattener_.Flatten(address, &chars, &char_size)) return false;
+  }
+
+  size_t length = chars.size() / char_size;
+  utf8->resize(Utf8Capacity(length));
+  if (char_size == 1) {
+    utf8->resize(Latin1ToUtf8(chars.data(), length, &(*utf8)[0]));
+  } else {
+    utf8->resize(Utf16ToUtf8(chars.data(), length, &(*utf8)[0]));
+  }
+  return true;
+}
+
+
+bool PropertyReader::HashString(uint64_t address, uint64_t* hash) {
+  uint64_t size;
+  if (strings_.Hash(address, hash, &size)) return true;
+
+  std::string chars;
+  int64_t char_size;
+  {
+    std::lock_guard<std::recursive_mutex> lock(strings_.llv8_mutex());
+    if (!flattener_.Flatten(address, &chars, &char_size)) return false;
+  }
+
+  ContentHash content(char_size);
+  content.Update(reinterpret_cast<const unsigned char*>(chars.data()),
+                 chars.size());
+  *hash = content.Finish();
+  return true;
+}
+
+
+std::string PropertyReader::TypeName(uint64_t address) {
+  uint64_t map;
+  if (!ReadWord(address - tag_ + map_offset_, &map)) return std::string();
+
+  std::lock_guard<std::recursive_mutex> lock(strings_.llv8_mutex());
+  auto it = type_names_.find(map);
+  if (it != type_names_.end()) return it->second;
+
+  // Objects sharing a map share a constructor.
+  v8::Error err;
+  std::string type_name = v8::HeapObject(llv8_, address).GetTypeName(err);
+  if (err.Fail()) type_name.clear();
+  type_names_[map] = type_name;
+  return type_name;
+}
+
+
+bool FieldTable::ParseFormat(const std::string& name, Format* format) {
+  if (name == "tsv") {
+    *format = kTSV;
+  } else if (name == "csv") {
+    *format = kCSV;
+  } else if (name == "jsonl") {
+    *format = kJSONLines;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+
+FieldTable::Format FieldTable::FormatForPath(const std::string& out_path) {
+  std::string path = OutputSink::StripCompression(out_path);
+  size_t dot = path.rfind('.');
+  if (dot == std::string::npos) return kTSV;
+
+  std::string ext = path.substr(dot + 1);
+  if (ext == "csv") return kCSV;
+  if (ext == "jsonl" || ext == "json") return kJSONLines;
+  return kTSV;
+}
+
+
+void FieldTable::WriteHeader() {
+  // JSON lines name every value, they need no header.
+  if (format_ == kJSONLines) return;
+
+  buf_ += "address";
+  for (const std::string& name : names_) {
+    buf_ += format_ == kTSV ? '\t' : ',';
+    WriteText(name);
+  }
+  buf_ += '\n';
+}
+
+
+bool FieldTable::WriteRow(uint64_t address) {
+  if (!reader_->Read(address, &properties_)) return false;
+
+  char buf[32];
+  snprintf(buf, sizeof(buf), "0x%016" PRIx64, address);
+  if (format_ == kJSONLines) {
+    buf_ += "{\"address\":\"";
+    buf_ += buf;
+    buf_ += '"';
+  } else {
+    buf_ += buf;
+  }
+
+  for (size_t n = 0; n < names_.size(); n++) {
+    if (format_ == kJSONLines) {
+      // Leave out missing properties rather than make them null.
+      if (properties_[n].kind == PropertyReader::Property::kMissing) continue;
+      buf_ += ',';
+      WriteText(names_[n]);
+      buf_ += ':';
+    } else {
+      buf_ += format_ == kTSV ? '\t' : ',';
+    }
+    WriteProperty(properties_[n]);
+  }
+
+  buf_ += format_ == kJSONLines ? "}\n" : "\n";
+  if (buf_.size() >= kFlushSize) Flush();
+  return true;
+}
+
+
+void FieldTable::Flush() {
+  if (buf_.empty()) return;
+  flush_(buf_);
+  buf_.clear();
+}
+
+
+void FieldTable::WriteProperty(const PropertyReader::Property& property) {
+  char buf[32];
+  if (property.kind == PropertyReader::Property::kMissing) return;
+  if (property.kind == PropertyReader::Property::kDouble) {
+    WriteNumber(property.number);
+    return;
+  }
+
+  uint64_t value = property.value;
+  if (reader_->IsSmi(value)) {
+    snprintf(buf, sizeof(buf), "%" PRId64, reader_->SmiValue(value));
+    buf_ += buf;
+    return;
+  }
+
+  int64_t type = reader_->GetType(value);
+  double number;
+  if (type == -1) {
+    // Not a value we can read, leave it empty.
+  } else if (reader_->IsString(type) && reader_->ReadString(value, &text_)) {
+    WriteText(text_);
+    return;
+  } else if (type == reader_->heap_number_type() &&
+             reader_->ReadNumber(value, &number)) {
+    WriteNumber(number);
+    return;
+  } else if (type == reader_->oddball_type()) {
+    const char* name = reader_->OddballName(value);
+    if (name != nullptr) {
+      // JSON has no undefined.
+      bool undefined = strcmp(name, "undefined") == 0;
+      buf_ += format_ == kJSONLines && undefined ? "null" : name;
+      return;
+    }
+  }
+
+  // Anything else is identified by its address, for `v8 inspect`.
+  snprintf(buf, sizeof(buf), "0x%016" PRIx64, value);
+  if (format_ == kJSONLines) {
+    buf_ += '"';
+    buf_ += buf;
+    buf_ += '"';
+  } else {
+    buf_ += buf;
+  }
+}
+
+
+void FieldTable::WriteNumber(double number) {
+  if (format_ == kJSONLines && !isfinite(number)) {
+    buf_ += "null";
+    return;
+  }
+
+  // The shortest of the two that reads back as the same number.
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%.15g", number);
+  if (strtod(buf, nullptr) != number)
+    snprintf(buf, sizeof(buf), "%.17g", number);
+  buf_ += buf;
+}
+
+
+void FieldTable::WriteText(const std::string& text) {
+  if (format_ == kTSV) {
+    // The escapes of PostgreSQL's text format, so rows stay on one line.
+    for (char c : text) {
+      switch (c) {
+        case '\t':
+          buf_ += "\\t";
+          break;
+        case '\n':
+          buf_ += "\\n";
+          break;
+        case '\r':
+          buf_ += "\\r";
+          break;
+        case '\\':
+          buf_ += "\\\\";
+          break;
+        default:
+          buf_ += c;
+      }
+    }
+    return;
+  }
+
+  if (format_ == kCSV) {
+    if (text.find_first_of(",\"\r\n") == std::string::npos) {
+      buf_ += text;
+      return;
+    }
+    buf_ += '"';
+    for (char c : text) {
+      if (c == '"') buf_ += '"';
+      buf_ += c;
+    }
+    buf_ += '"';
+    return;
+  }
+
+  JSONWriter::Escape(text.data(), text.size(), &buf_);
+}
+
+
+FieldHistCmd::Key FieldHistCmd::GetKey(
+    PropertyReader& reader, const PropertyReader::Property& property) {
+  Key key = {Key::kMissing, 0};
+  if (property.kind == PropertyReader::Property::kMissing) return key;
+
+  double number = property.number;
+  if (property.kind == PropertyReader::Property::kTagged) {
+    uint64_t value = property.value;
+    if (reader.IsSmi(value)) {
+      number = reader.SmiValue(value);
+    } else {
+      int64_t type = reader.GetType(value);
+      key.kind = Key::kObject;
+      key.id = value;
+      if (reader.IsString(type)) {
+        if (reader.HashString(value, &key.id)) key.kind = Key::kString;
+        return key;
+      }
+      if (type != reader.heap_number_type() ||
+          !reader.ReadNumber(value, &number))
+        return key;
+    }
+  }
+
+  // Numbers are the same whether they are Smis, boxed or unboxed.
+  key.kind = Key::kNumber;
+  memcpy(&key.id, &number, sizeof(key.id));
+  return key;
+}
+
+
+bool FieldHistCmd::DoExecute(SBDebugger d, char** cmd,
+                             SBCommandReturnObject& result) {
+  OutputSink out(d, result);
+  if (!ParseOutputOptions(cmd, &out, result)) return false;
+
+  SBTarget target = d.GetSelectedTarget();
+  if (!target.IsValid()) {
+    result.SetError("No valid process, please start something\n");
+    return false;
+  }
+
+  ScanOptions scan_options;
+  scan_options.json = out.json();
+  char** start;
+  if (!ParseCountOptions(cmd, &scan_options, kDefaultCount, &count_, &start) ||
+      start == nullptr || start[0] == nullptr || start[1] == nullptr ||
+      start[2] != nullptr) {
+    result.SetError("USAGE: v8 fieldhist [flags] type_name property\n");
+    return false;
+  }
+  std::string type_name = start[0];
+  std::string name = start[1];
+
+  /* Ensure we have a map of objects. */
+  if (!llscan.ScanHeapForObjects(target, result, scan_options)) {
+    result.SetStatus(eReturnStatusFailed);
+    return false;
+  }
+
+  auto lock = llscan.LockResults();
+
+  if (scan_options.live_only &&
+      !llscan.MarkLiveObjects(target, result, scan_options)) {
+    result.SetStatus(eReturnStatusFailed);
+    return false;
+  }
+
+  // Load V8 constants from postmortem data
+  llv8.Load(target);
+
+  TypeRecordMap& mapstoinstances = llscan.GetMapsToInstances();
+  auto it = mapstoinstances.find(type_name);
+  if (it == mapstoinstances.end() && out.json()) {
+    std::string message =
+        "No objects found with type name " + type_name + "\n";
+    result.SetError(message.c_str());
+    return false;
+  } else if (it == mapstoinstances.end()) {
+    out.Printf("No objects found with type name %s\n", type_name.c_str());
+    result.SetStatus(eReturnStatusFailed);
+    return false;
+  }
+
+  std::vector<uint64_t> addresses;
+  for (uint64_t address : it->second->GetInstances()) {
+    if (scan_options.live_only && !llscan.IsLive(address)) continue;
+    addresses.push_back(address);
+  }
+
+  // Most fields have far fewer values than there are instances.
+  static const size_t kMaxReserve = 1 << 20;
+  size_t workers = llscan.ParallelWorkers();
+  PropertyReader reader(&llscan, &llv8, target, {name});
+  std::vector<GroupMap> groups(workers);
+  std::vector<uint64_t> unreadable(workers, 0);
+  std::vector<std::vector<PropertyReader::Property>> properties(workers);
+  for (GroupMap& group : groups)
+    group.reserve(std::min(addresses.size() / workers + 1, kMaxReserve));
+
+  ScanProgress progress(d, "Reading fields", addresses.size(), false,
+                        scan_options);
+  uint64_t done = llscan.ParallelFor(
+      addresses, progress, [&](size_t worker, uint64_t address) {
+        std::vector<PropertyReader::Property>& mine = properties[worker];
+        uint64_t size;
+        if (!reader.Read(address, &mine, &size)) {
+          unreadable[worker]++;
+          return;
+        }
+        Group& group = groups[worker][GetKey(reader, mine[0])];
+        if (group.count++ == 0) group.example = mine[0];
+        group.size += size;
+      });
+  bool complete = done == addresses.size();
+
+  GroupMap& merged = groups[0];
+  for (size_t i = 1; i < workers; i++) {
+    for (auto& entry : groups[i]) {
+      Group& group = merged[entry.first];
+      if (group.count == 0) group.example = entry.second.example;
+      group.count += entry.second.count;
+      group.size += entry.second.size;
+    }
+    groups[i].clear();
+    unreadable[0] += unreadable[i];
+  }
+
+  std::vector<const Group*> sorted;
+  uint64_t instances = 0;
+  for (auto& entry : merged) {
+    sorted.push_back(&entry.second);
+    instances += entry.second.count;
+  }
+  auto larger = [](const Group* a, const Group* b) {
+    return a->count != b->count ? a->count > b->count : a->size > b->size;
+  };
+  size_t shown = std::min<size_t>(sorted.size(), count_);
+  std::partial_sort(sorted.begin(), sorted.begin() + shown, sorted.end(),
+                    larger);
+
+  v8::Value::InspectOptions inspect_options;
+  if (out.json()) {
+    JSONWriter& json = out.json_writer();
+    json.BeginObject();
+    json.Member("complete", complete);
+    json.Member("type", type_name);
+    json.Member("property", name);
+    json.Member("instances", instances);
+    json.Member("unreadable", unreadable[0]);
+    json.Member("distinct", static_cast<uint64_t>(merged.size()));
+    json.Key("values");
+    json.BeginArray();
+    for (size_t i = 0; i < shown; i++) {
+      const Group* group = sorted[i];
+      json.BeginObject();
+      json.Member("count", group->count);
+      json.Member("size", group->size);
+      // Missing properties have a null value, unboxed doubles a number.
+      json.Key("value");
+      if (group->example.kind == PropertyReader::Property::kMissing) {
+        json.Null();
+      } else if (group->example.kind == PropertyReader::Property::kDouble) {
+        json.Double(group->example.number);
+      } else {
+        v8::Error err;
+        v8::Value value(&llv8, group->example.value);
+        WriteValue(&json, value, value.Inspect(&inspect_options, err));
+      }
+      json.EndObject();
+    }
+    json.EndArray();
+    json.EndObject();
+    result.SetStatus(eReturnStatusSuccessFinishResult);
+    return true;
+  }
+
+  if (!complete) {
+    out.Printf("PARTIAL RESULT: stopped after %" PRIu64 " of %" PRIu64
+               " instances.\n",
+               done,
+               static_cast<uint64_t>(addresses.size()));
+  }
+  out.Printf("%" PRIu64 " values of %s in %" PRIu64 " %s instances\n",
+             static_cast<uint64_t>(merged.size()), name.c_str(), instances,
+             type_name.c_str());
+  if (unreadable[0] != 0) {
+    out.Printf("Unreadable: %" PRIu64 " instances left out.\n",
+               unreadable[0]);
+  }
+  if (shown == 0) {
+    result.SetStatus(eReturnStatusSuccessFinishResult);
+    return true;
+  }
+
+  out.Printf("      Count       Size Value\n");
+  out.Printf(" ---------- ---------- -----\n");
+  for (size_t i = 0; i < shown; i++) {
+    const Group* group = sorted[i];
+    std::string preview;
+    char buf[64];
+    if (group->example.kind == PropertyReader::Property::kMissing) {
+      preview = "(missing)";
+    } else if (group->example.kind == PropertyReader::Property::kDouble) {
+      snprintf(buf, sizeof(buf), "<Number: %f>", group->example.number);
+      preview = buf;
+    } else {
+      v8::Error err;
+      v8::Value value(&llv8, group->example.value);
+      preview = value.Inspect(&inspect_options, err);
+      if (err.Fail()) {
+        snprintf(buf, sizeof(buf), "0x%016" PRIx64, group->example.value);
+        preview = buf;
+      }
+    }
+    out.Printf(" %10" PRIu64 " %10" PRIu64 " %s\n", group->count,
+               group->size, preview.c_str());
+  }
+
+  result.SetStatus(eReturnStatusSuccessFinishResult);
+  return true;
+}
+
+}  // namespace llnode
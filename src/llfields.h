@@ -0,0 +1,202 @@
+#ifndef SRC_LLFIELDS_H_
+#define SRC_LLFIELDS_H_
+
+#include <lldb/API/LLDB.h>
+#include <stdio.h>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "src/llscan.h"
+#include "src/llstrings.h"
+
+namespace llnode {
+
+/* Reads a few named properties of many objects. Where each property lives is
+ * looked up through LLV8 once per map, the values are then read straight from
+ * the object with LLScan::ReadMemory. Safe to use from several threads when
+ * the scan can read in parallel, LLV8 is only used under a lock.
+ */
+class PropertyReader : public WordReader {
+ public:
+  class Property {
+   public:
+    enum Kind { kMissing, kTagged, kDouble };
+
+    Kind kind = kMissing;
+    // A tagged value for kTagged.
+    uint64_t value = 0;
+    // An unboxed double field for kDouble.
+    double number = 0;
+  };
+
+  PropertyReader(LLScan* scan, v8::LLV8* llv8, lldb::SBTarget target,
+                 const std::vector<std::string>& names);
+
+  /* Read the properties of the object at `address` into `properties`, one per
+   * name. `size`, when given, is set to the size of the object. Returns false
+   * when the object can't be read.
+   */
+  bool Read(uint64_t address, std::vector<Property>* properties,
+            uint64_t* size = nullptr);
+
+  // Instance type of a heap object, -1 when it can't be read.
+  int64_t GetType(uint64_t address);
+  inline bool IsString(int64_t type) const { return type < first_nonstring_; }
+  bool ReadNumber(uint64_t address, double* number);
+  // "true", "false", "null" or "undefined", nullptr for other oddballs.
+  const char* OddballName(uint64_t address);
+  // The characters of a string as UTF-8.
+  bool ReadString(uint64_t address, std::string* utf8);
+  /* Hash the characters of a string of any representation, the same way
+   * FlatStringReader::Hash does.
+   */
+  bool HashString(uint64_t address, uint64_t* hash);
+  // The type name findjsobjects groups the object under.
+  std::string TypeName(uint64_t address);
+
+  inline int64_t heap_number_type() const { return heap_number_type_; }
+  inline int64_t oddball_type() const { return oddball_type_; }
+  inline int64_t function_type() const { return function_type_; }
+
+ private:
+  class Slot {
+   public:
+    enum Where { kNone, kInObject, kOutOfObject, kConstant, kDictionary };
+
+    Where where = kNone;
+    bool is_double = false;
+    // Byte offset into the object, or index into its properties array.
+    int64_t offset = 0;
+    // The value of constant properties, kept in the descriptors.
+    uint64_t constant = 0;
+  };
+
+  class Layout {
+   public:
+    bool valid = false;
+    int64_t type = -1;
+    int64_t instance_size = 0;
+    std::vector<Slot> slots;
+  };
+
+  static const int64_t kMaxInstanceSize = 256 * 8;
+
+  const Layout& GetLayout(uint64_t map);
+  void ResolveDescriptors(v8::Map& map, Layout* layout);
+
+  std::vector<std::string> names_;
+  int64_t properties_offset_;
+  int64_t fixed_array_data_offset_;
+  int64_t heap_number_value_offset_;
+  int64_t oddball_kind_offset_;
+  int64_t first_nonstring_;
+  int64_t heap_number_type_;
+  int64_t oddball_type_;
+  int64_t function_type_;
+
+  FlatStringReader strings_;
+  StringFlattener flattener_;
+
+  // Guarded by strings_.llv8_mutex(), element references stay valid as more
+  // maps are added.
+  std::unordered_map<uint64_t, Layout> layouts_;
+  std::unordered_map<uint64_t, std::string> type_names_;
+};
+
+/* Writes the properties of objects as rows of tab or comma separated values,
+ * or as one JSON object per line, in chunks handed to `flush`.
+ */
+class FieldTable {
+ public:
+  enum Format { kTSV, kCSV, kJSONLines };
+
+  FieldTable(PropertyReader* reader, const std::vector<std::string>& names,
+             Format format, std::function<void(const std::string&)> flush)
+      : reader_(reader), names_(names), format_(format), flush_(flush) {}
+  ~FieldTable() { Flush(); }
+
+  // Parse "tsv", "csv" or "jsonl", returns false for anything else.
+  static bool ParseFormat(const std::string& name, Format* format);
+  /* The format a file name suggests, TSV unless it ends in .csv or .jsonl,
+   * before any .gz or .zst.
+   */
+  static Format FormatForPath(const std::string& path);
+
+  void WriteHeader();
+  // Returns false when the object can't be read, nothing is written then.
+  bool WriteRow(uint64_t address);
+  void Flush();
+
+ private:
+  static const size_t kFlushSize = 64 * 1024;
+
+  void WriteProperty(const PropertyReader::Property& property);
+  void WriteNumber(double number);
+  void WriteText(const std::string& text);
+
+  PropertyReader* reader_;
+  std::vector<std::string> names_;
+  Format format_;
+  std::function<void(const std::string&)> flush_;
+
+  std::string buf_;
+  std::vector<PropertyReader::Property> properties_;
+  std::string text_;
+};
+
+class FieldHistCmd : public CommandBase {
+ public:
+  FieldHistCmd() : count_(kDefaultCount) {}
+  ~FieldHistCmd() override {}
+
+  bool DoExecute(lldb::SBDebugger d, char** cmd,
+                 lldb::SBCommandReturnObject& result) override;
+
+ private:
+  /* What makes two values the same: the value of numbers, Smis included,
+   * the hash of the characters of strings, the address of anything else.
+   */
+  class Key {
+   public:
+    enum Kind { kMissing, kNumber, kString, kObject };
+
+    Kind kind;
+    uint64_t id;
+
+    inline bool operator==(const Key& other) const {
+      return kind == other.kind && id == other.id;
+    }
+  };
+
+  class KeyHash {
+   public:
+    inline size_t operator()(const Key& key) const {
+      return std::hash<uint64_t>()(key.id) ^ key.kind;
+    }
+  };
+
+  class Group {
+   public:
+    uint64_t count = 0;
+    // Total size of the instances with this value.
+    uint64_t size = 0;
+    // One of the values, to print.
+    PropertyReader::Property example;
+  };
+
+  typedef std::unordered_map<Key, Group, KeyHash> GroupMap;
+
+  static const uint64_t kDefaultCount = 10;
+
+  static Key GetKey(PropertyReader& reader,
+                    const PropertyReader::Property& property);
+
+  uint64_t count_;
+};
+
+}  // namespace llnode
+
+#endif  // SRC_LLFIELDS_H_
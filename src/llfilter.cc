@@ -0,0 +1,444 @@
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "src/llfilter.h"
+
+namespace llnode {
+
+
+/* Recursive descent over the expression, building the closures on the way
+ * back up:
+ *
+ *   or         := and ("||" and)*
+ *   and        := unary ("&&" unary)*
+ *   unary      := "!" unary | "(" or ")" | "has" "(" name ")" | comparison
+ *   comparison := operand (("==" | "!=" | "<" | "<=" | ">" | ">=") operand
+ *                 | "instanceof" identifier)?
+ *   operand    := "typeof" operand | literal | name
+ *   name       := identifier | "[" string "]"
+ */
+class ObjectFilter::Parser {
+ public:
+  Parser(ObjectFilter* filter, const std::string& text)
+      : filter_(filter), text_(text), pos_(0) {}
+
+  bool Parse(Predicate* predicate, std::string* error) {
+    *predicate = ParseOr();
+    SkipSpace();
+    if (error_.empty() && pos_ != text_.size()) Fail("unexpected input");
+    if (!error_.empty()) {
+      *error = error_ + " at offset " + std::to_string(pos_);
+      return false;
+    }
+    return true;
+  }
+
+ private:
+  void Fail(const std::string& message) {
+    if (error_.empty()) error_ = message;
+  }
+
+  void SkipSpace() {
+    while (pos_ < text_.size() && isspace(text_[pos_])) pos_++;
+  }
+
+  // Consume `token` if it is next.
+  bool Take(const char* token) {
+    SkipSpace();
+    size_t length = strlen(token);
+    if (text_.compare(pos_, length, token) != 0) return false;
+
+    // Keywords have to end where identifiers do.
+    if (isalpha(token[0]) && pos_ + length < text_.size() &&
+        IsIdentifierChar(text_[pos_ + length])) {
+      return false;
+    }
+    pos_ += length;
+    return true;
+  }
+
+  static bool IsIdentifierChar(char c) {
+    return isalnum(c) || c == '_' || c == '$';
+  }
+
+  std::string TakeIdentifier() {
+    SkipSpace();
+    size_t start = pos_;
+    if (pos_ < text_.size() && !isdigit(text_[pos_])) {
+      while (pos_ < text_.size() && IsIdentifierChar(text_[pos_])) pos_++;
+    }
+    if (pos_ == start) Fail("expected a name");
+    return text_.substr(start, pos_ - start);
+  }
+
+  std::string TakeString() {
+    SkipSpace();
+    std::string value;
+    if (pos_ >= text_.size() || (text_[pos_] != '"' && text_[pos_] != '\'')) {
+      Fail("expected a string");
+      return value;
+    }
+
+    char quote = text_[pos_++];
+    while (pos_ < text_.size() && text_[pos_] != quote) {
+      char c = text_[pos_++];
+      if (c == '\\' && pos_ < text_.size()) {
+        c = text_[pos_++];
+        if (c == 'n') c = '\n';
+        if (c == 't') c = '\t';
+      }
+      value += c;
+    }
+    if (pos_ >= text_.size()) {
+      Fail("unterminated string");
+      return value;
+    }
+    pos_++;
+    return value;
+  }
+
+  // Index of the property `name` in the names the reader is created with.
+  size_t PropertyIndex(const std::string& name) {
+    std::vector<std::string>& names = filter_->names_;
+    auto it = std::find(names.begin(), names.end(), name);
+    if (it != names.end()) return it - names.begin();
+    names.push_back(name);
+    return names.size() - 1;
+  }
+
+  bool PeekName() {
+    SkipSpace();
+    if (pos_ >= text_.size()) return false;
+    char c = text_[pos_];
+    return c == '[' || isalpha(c) || c == '_' || c == '$';
+  }
+
+  size_t ParseName() {
+    if (Take("[")) {
+      std::string name = TakeString();
+      if (!Take("]")) Fail("expected ]");
+      return PropertyIndex(name);
+    }
+    return PropertyIndex(TakeIdentifier());
+  }
+
+  Predicate ParseOr() {
+    Predicate left = ParseAnd();
+    while (error_.empty() && Take("||")) {
+      Predicate right = ParseAnd();
+      left = [left, right](Subject& s) { return left(s) || right(s); };
+    }
+    return left;
+  }
+
+  Predicate ParseAnd() {
+    Predicate left = ParseUnary();
+    while (error_.empty() && Take("&&")) {
+      Predicate right = ParseUnary();
+      left = [left, right](Subject& s) { return left(s) && right(s); };
+    }
+    return left;
+  }
+
+  Predicate ParseUnary() {
+    if (Take("!")) {
+      Predicate inner = ParseUnary();
+      return [inner](Subject& s) { return !inner(s); };
+    }
+
+    if (Take("(")) {
+      Predicate inner = ParseOr();
+      if (!Take(")")) Fail("expected )");
+      return inner;
+    }
+
+    // `has` is only a keyword when it is called.
+    ObjectFilter* filter = filter_;
+    SkipSpace();
+    size_t start = pos_;
+    if (Take("has") && !Take("(")) pos_ = start;
+    if (pos_ != start) {
+      size_t index = ParseName();
+      if (!Take(")")) Fail("expected )");
+      return [filter, index](Subject& s) {
+        const PropertyReader::Property* property =
+            filter->GetProperty(s, index);
+        return property != nullptr &&
+               property->kind != PropertyReader::Property::kMissing;
+      };
+    }
+
+    return ParseComparison();
+  }
+
+  Predicate ParseComparison() {
+    ObjectFilter* filter = filter_;
+    Operand left = ParseOperand();
+    if (!error_.empty()) return Predicate();
+
+    if (Take("instanceof")) {
+      std::string type_name = TakeIdentifier();
+      return [filter, left, type_name](Subject& s) {
+        Datum datum = left(s);
+        return datum.kind == Datum::kObject &&
+               filter->reader_->TypeName(datum.address) == type_name;
+      };
+    }
+
+    // Longer operators first, so "<=" isn't read as "<".
+    static const char* kOperators[] = {"===", "!==", "==", "!=",
+                                       "<=",  ">=",  "<",  ">"};
+    const char* op = nullptr;
+    for (const char* candidate : kOperators) {
+      if (Take(candidate)) {
+        op = candidate;
+        break;
+      }
+    }
+    if (op == nullptr) {
+      return [filter, left](Subject& s) {
+        Datum datum = left(s);
+        return filter->Truthy(datum);
+      };
+    }
+
+    Operand right = ParseOperand();
+    if (op[0] == '=' || op[0] == '!') {
+      bool negate = op[0] == '!';
+      return [filter, left, right, negate](Subject& s) {
+        Datum a = left(s);
+        Datum b = right(s);
+        return filter->Equals(a, b) != negate;
+      };
+    }
+
+    bool less = op[0] == '<';
+    bool equal = op[1] == '=';
+    return [filter, left, right, less, equal](Subject& s) {
+      Datum a = left(s);
+      Datum b = right(s);
+      bool ordered;
+      int order = filter->Compare(a, b, &ordered);
+      if (!ordered) return false;
+      if (order == 0) return equal;
+      return (order < 0) == less;
+    };
+  }
+
+  Operand ParseOperand() {
+    ObjectFilter* filter = filter_;
+    if (Take("typeof")) {
+      Operand inner = ParseOperand();
+      return [filter, inner](Subject& s) {
+        Datum datum = inner(s);
+        Datum result;
+        result.kind = Datum::kString;
+        result.has_text = true;
+        result.text = filter->TypeOf(datum);
+        return result;
+      };
+    }
+
+    Datum literal;
+    SkipSpace();
+    char c = pos_ < text_.size() ? text_[pos_] : '\0';
+    if (c == '"' || c == '\'') {
+      literal.kind = Datum::kString;
+      literal.has_text = true;
+      literal.text = TakeString();
+    } else if (isdigit(c) || c == '-' || c == '.') {
+      const char* start = text_.c_str() + pos_;
+      char* end;
+      literal.kind = Datum::kNumber;
+      literal.number = strtod(start, &end);
+      if (end == start) Fail("expected a number");
+      pos_ += end - start;
+    } else if (Take("true")) {
+      literal.kind = Datum::kBoolean;
+      literal.boolean = true;
+    } else if (Take("false")) {
+      literal.kind = Datum::kBoolean;
+    } else if (Take("null")) {
+      literal.kind = Datum::kNull;
+    } else if (Take("undefined")) {
+      literal.kind = Datum::kUndefined;
+    } else if (PeekName()) {
+      size_t index = ParseName();
+      return [filter, index](Subject& s) {
+        const PropertyReader::Property* property =
+            filter->GetProperty(s, index);
+        if (property == nullptr) return Datum();
+        return filter->ToDatum(*property);
+      };
+    } else {
+      Fail("expected a property or a literal");
+    }
+
+    return [literal](Subject& s) { return literal; };
+  }
+
+  ObjectFilter* filter_;
+  const std::string& text_;
+  size_t pos_;
+  std::string error_;
+};
+
+
+bool ObjectFilter::Compile(const std::string& expression, std::string* error) {
+  names_.clear();
+  Parser parser(this, expression);
+  if (!parser.Parse(&predicate_, error)) return false;
+
+  reader_.reset(new PropertyReader(scan_, llv8_, target_, names_));
+  return true;
+}
+
+
+bool ObjectFilter::Matches(uint64_t address) {
+  Subject subject;
+  subject.address = address;
+  return predicate_(subject);
+}
+
+
+const PropertyReader::Property* ObjectFilter::GetProperty(Subject& subject,
+                                                          size_t index) {
+  if (!subject.read) {
+    subject.read = true;
+    subject.readable = reader_->Read(subject.address, &subject.properties);
+  }
+  return subject.readable ? &subject.properties[index] : nullptr;
+}
+
+
+ObjectFilter::Datum ObjectFilter::ToDatum(
+    const PropertyReader::Property& property) {
+  Datum datum;
+  if (property.kind == PropertyReader::Property::kMissing) return datum;
+  if (property.kind == PropertyReader::Property::kDouble) {
+    datum.kind = Datum::kNumber;
+    datum.number = property.number;
+    return datum;
+  }
+
+  uint64_t value = property.value;
+  if (reader_->IsSmi(value)) {
+    datum.kind = Datum::kNumber;
+    datum.number = reader_->SmiValue(value);
+    return datum;
+  }
+
+  int64_t type = reader_->GetType(value);
+  datum.address = value;
+  if (reader_->IsString(type)) {
+    datum.kind = Datum::kString;
+  } else if (type == reader_->heap_number_type() &&
+             reader_->ReadNumber(value, &datum.number)) {
+    datum.kind = Datum::kNumber;
+  } else if (type == reader_->oddball_type()) {
+    const char* name = reader_->OddballName(value);
+    if (name == nullptr || strcmp(name, "undefined") == 0) {
+      datum.kind = Datum::kUndefined;
+    } else if (strcmp(name, "null") == 0) {
+      datum.kind = Datum::kNull;
+    } else {
+      datum.kind = Datum::kBoolean;
+      datum.boolean = strcmp(name, "true") == 0;
+    }
+  } else {
+    datum.kind = Datum::kObject;
+  }
+  return datum;
+}
+
+
+const std::string& ObjectFilter::Text(Datum& datum) {
+  if (!datum.has_text) {
+    datum.has_text = true;
+    if (!reader_->ReadString(datum.address, &datum.text)) datum.text.clear();
+  }
+  return datum.text;
+}
+
+
+bool ObjectFilter::Truthy(Datum& datum) {
+  switch (datum.kind) {
+    case Datum::kUndefined:
+    case Datum::kNull:
+      return false;
+    case Datum::kBoolean:
+      return datum.boolean;
+    case Datum::kNumber:
+      return datum.number != 0 && datum.number == datum.number;
+    case Datum::kString:
+      return !Text(datum).empty();
+    case Datum::kObject:
+      return true;
+  }
+  return false;
+}
+
+
+bool ObjectFilter::Equals(Datum& a, Datum& b) {
+  bool a_nullish = a.kind == Datum::kUndefined || a.kind == Datum::kNull;
+  bool b_nullish = b.kind == Datum::kUndefined || b.kind == Datum::kNull;
+  if (a_nullish || b_nullish) return a_nullish && b_nullish;
+  if (a.kind != b.kind) return false;
+
+  switch (a.kind) {
+    case Datum::kBoolean:
+      return a.boolean == b.boolean;
+    case Datum::kNumber:
+      return a.number == b.number;
+    case Datum::kString:
+      // Internalized strings are often the same object.
+      if (!a.has_text && !b.has_text && a.address == b.address) return true;
+      return Text(a) == Text(b);
+    case Datum::kObject:
+      return a.address == b.address;
+    default:
+      return false;
+  }
+}
+
+
+int ObjectFilter::Compare(Datum& a, Datum& b, bool* ordered) {
+  *ordered = a.kind == b.kind &&
+             (a.kind == Datum::kNumber || a.kind == Datum::kString);
+  if (!*ordered) return 0;
+
+  if (a.kind == Datum::kNumber) {
+    // NaN isn't ordered with anything.
+    if (a.number != a.number || b.number != b.number) *ordered = false;
+    return a.number < b.number ? -1 : a.number > b.number ? 1 : 0;
+  }
+
+  int order = Text(a).compare(Text(b));
+  return order < 0 ? -1 : order > 0 ? 1 : 0;
+}
+
+
+const char* ObjectFilter::TypeOf(Datum& datum) {
+  switch (datum.kind) {
+    case Datum::kUndefined:
+      return "undefined";
+    case Datum::kBoolean:
+      return "boolean";
+    case Datum::kNumber:
+      return "number";
+    case Datum::kString:
+      return "string";
+    case Datum::kNull:
+      return "object";
+    case Datum::kObject:
+      return reader_->GetType(datum.address) == reader_->function_type()
+                 ? "function"
+                 : "object";
+  }
+  return "undefined";
+}
+
+}  // namespace llnode
@@ -0,0 +1,90 @@
+#ifndef SRC_LLFILTER_H_
+#define SRC_LLFILTER_H_
+
+#include <lldb/API/LLDB.h>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "src/llfields.h"
+
+namespace llnode {
+
+/* A predicate on objects, for the --where option of findjsinstances and
+ * findrefs, for example:
+ *
+ *   state == "open" && bytes > 1048576
+ *   has(timer) || typeof callback == "function" || parent instanceof Socket
+ *
+ * Operands are properties of the object, `["odd-name"]` for names that
+ * aren't identifiers, and number, string, true, false, null and undefined
+ * literals. Values of different types are never equal, except for null and
+ * undefined, and only numbers and strings can be ordered. A property on its
+ * own is true when it is truthy in JavaScript.
+ *
+ * The expression is compiled once into a tree of closures. Properties are
+ * read through a PropertyReader with the per map layouts, and strings are
+ * only read when a comparison needs their characters, so objects failing a
+ * cheap test on the left of && are never decoded further.
+ */
+class ObjectFilter {
+ public:
+  ObjectFilter(LLScan* scan, v8::LLV8* llv8, lldb::SBTarget target)
+      : scan_(scan), llv8_(llv8), target_(target) {}
+
+  // Returns false and sets `error` when `expression` doesn't parse.
+  bool Compile(const std::string& expression, std::string* error);
+
+  bool Matches(uint64_t address);
+
+ private:
+  // The value of an operand for one object.
+  class Datum {
+   public:
+    enum Kind { kUndefined, kNull, kBoolean, kNumber, kString, kObject };
+
+    Kind kind = kUndefined;
+    bool boolean = false;
+    double number = 0;
+    // Strings and objects, strings are read on demand.
+    uint64_t address = 0;
+    bool has_text = false;
+    std::string text;
+  };
+
+  // The object being tested, its properties are read on first use.
+  class Subject {
+   public:
+    uint64_t address;
+    bool read = false;
+    bool readable = false;
+    std::vector<PropertyReader::Property> properties;
+  };
+
+  typedef std::function<bool(Subject&)> Predicate;
+  typedef std::function<Datum(Subject&)> Operand;
+
+  class Parser;
+
+  const PropertyReader::Property* GetProperty(Subject& subject, size_t index);
+  Datum ToDatum(const PropertyReader::Property& property);
+  const std::string& Text(Datum& datum);
+  bool Truthy(Datum& datum);
+  bool Equals(Datum& a, Datum& b);
+  // -1, 0 or 1, `ordered` is false when `a` and `b` can't be ordered.
+  int Compare(Datum& a, Datum& b, bool* ordered);
+  const char* TypeOf(Datum& datum);
+
+  LLScan* scan_;
+  v8::LLV8* llv8_;
+  lldb::SBTarget target_;
+
+  std::vector<std::string> names_;
+  std::unique_ptr<PropertyReader> reader_;
+  Predicate predicate_;
+};
+
+}  // namespace llnode
+
+#endif  // SRC_LLFILTER_H_
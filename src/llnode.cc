@@ -7,8 +7,11 @@
 
 #include <lldb/API/SBExpressionOptions.h>
 
+#include "src/llelements.h"
+#include "src/llfields.h"
 #include "src/llnode.h"
 #include "src/llscan.h"
+#include "src/llstrings.h"
 #include "src/llv8.h"
 
 namespace llnode {
@@ -29,6 +32,10 @@ using lldb::eReturnStatusSuccessFinishResult;
 
 v8::LLV8 llv8;
 
+// Defined in llscan.cc
+extern LLScan llscan;
+
+
 char** CommandBase::ParseInspectOptions(char** cmd,
                                         v8::Value::InspectOptions* options) {
   static struct option opts[] = {
@@ -85,8 +92,168 @@ char** CommandBase::ParseInspectOptions(char** cmd,
 }
 
 
+bool CommandBase::ParseOutputOptions(char** cmd, OutputSink* out,
+                                     SBCommandReturnObject& result) {
+  out->set_json(TakeFlag(cmd, "--json"));
+
+  std::string path;
+  if (!TakeOption(cmd, "--out", &path)) return true;
+
+  std::string error;
+  if (!out->Open(path, &error)) {
+    error += "\n";
+    result.SetError(error.c_str());
+    return false;
+  }
+  return true;
+}
+
+
+bool CommandBase::ParseCountOptions(char** cmd, ScanOptions* options,
+                                    uint64_t default_count, uint64_t* count,
+                                    char*** start) {
+  static struct option opts[] = {{"count", required_argument, nullptr, 'n'},
+                                 {"timeout", required_argument, nullptr, 't'},
+                                 {"live-only", no_argument, nullptr, 'L'},
+                                 {nullptr, 0, nullptr, 0}};
+
+  int argc = 1;
+  for (char** p = cmd; p != nullptr && *p != nullptr; p++) argc++;
+
+  char* args[argc];
+
+  // Make this look like a command line, we need a valid element at index 0
+  // for getopt_long to use in its error messages.
+  char name[] = "llscan";
+  args[0] = name;
+  for (int i = 0; i < argc - 1; i++) args[i + 1] = cmd[i];
+
+  *count = default_count;
+  bool valid = true;
+
+  // Reset getopts.
+  optind = 0;
+  opterr = 1;
+  do {
+    int arg = getopt_long(argc, args, "n:t:L", opts, nullptr);
+    if (arg == -1) break;
+
+    switch (arg) {
+      case 'n':
+        if (!ParseCount(optarg, count) || *count == 0) valid = false;
+        break;
+      case 't':
+        if (!ParseCount(optarg, &options->timeout)) valid = false;
+        break;
+      case 'L':
+        options->live_only = true;
+        break;
+      default:
+        continue;
+    }
+  } while (true);
+
+  if (start != nullptr) *start = nullptr;
+  if (cmd == nullptr) return valid;
+
+  // getopt_long moves the arguments after the options, keep that order.
+  for (int i = 1; i < argc; i++) cmd[i - 1] = args[i];
+  if (start != nullptr) *start = &cmd[optind - 1];
+  return valid;
+}
+
+
+bool CommandBase::ParseCount(const std::string& text, uint64_t* count) {
+  char* end;
+  errno = 0;
+  *count = strtoull(text.c_str(), &end, 10);
+  return !text.empty() && text[0] != '-' && *end == '\0' && errno == 0;
+}
+
+
+bool CommandBase::TakeFlag(char** cmd, const char* flag) {
+  if (cmd == nullptr) return false;
+
+  bool found = false;
+  char** out = cmd;
+  for (char** p = cmd; *p != nullptr; p++) {
+    if (strcmp(*p, flag) == 0) {
+      found = true;
+      continue;
+    }
+    *out++ = *p;
+  }
+  *out = nullptr;
+  return found;
+}
+
+
+bool CommandBase::TakeOption(char** cmd, const char* option,
+                             std::string* value) {
+  if (cmd == nullptr) return false;
+
+  bool found = false;
+  size_t length = strlen(option);
+  char** out = cmd;
+  for (char** p = cmd; *p != nullptr; p++) {
+    if (strcmp(*p, option) == 0 && p[1] != nullptr) {
+      found = true;
+      *value = *++p;
+      continue;
+    }
+    if (strncmp(*p, option, length) == 0 && (*p)[length] == '=') {
+      found = true;
+      *value = *p + length + 1;
+      continue;
+    }
+    *out++ = *p;
+  }
+  *out = nullptr;
+  return found;
+}
+
+
+void CommandBase::WriteValue(JSONWriter* json, v8::Value& value,
+                             const std::string& inspect) {
+  v8::Error err;
+  std::string type = value.GetTypeName(err);
+
+  json->BeginObject();
+  json->Key("address");
+  json->Address(value.raw());
+  if (err.Success()) json->Member("type", type);
+  json->Member("inspect", inspect);
+  json->EndObject();
+}
+
+
+// `text` without the line break lldb descriptions end with.
+static std::string TrimNewline(const char* text) {
+  std::string trimmed = text == nullptr ? "" : text;
+  while (!trimmed.empty() && trimmed.back() == '\n') trimmed.pop_back();
+  return trimmed;
+}
+
+
+static void WriteFrame(JSONWriter* json, uint32_t index, bool selected,
+                       uint64_t pc, const char* kind,
+                       const std::string& description) {
+  json->BeginObject();
+  json->Member("index", static_cast<uint64_t>(index));
+  json->Member("selected", selected);
+  json->Key("pc");
+  json->Address(pc);
+  json->Member("kind", kind);
+  json->Member("description", description);
+  json->EndObject();
+}
+
+
 bool BacktraceCmd::DoExecute(SBDebugger d, char** cmd,
                              SBCommandReturnObject& result) {
+  OutputSink out(d, result);
+  if (!ParseOutputOptions(cmd, &out, result)) return false;
+
   SBTarget target = d.GetSelectedTarget();
   SBThread thread = target.GetProcess().GetSelectedThread();
   if (!thread.IsValid()) {
@@ -102,13 +269,24 @@ bool BacktraceCmd::DoExecute(SBDebugger d, char** cmd,
     return false;
   }
 
+  // Get the heap scan going while the stacks are being read.
+  llscan.MaybeStartBackgroundScan(target);
+
   // Load V8 constants from postmortem data
   llv8.Load(target);
 
+  JSONWriter& json = out.json_writer();
   {
     SBStream desc;
     if (!thread.GetDescription(desc)) return false;
-    result.Printf(" * %s", desc.GetData());
+    if (out.json()) {
+      json.BeginObject();
+      json.Member("thread", TrimNewline(desc.GetData()));
+      json.Key("frames");
+      json.BeginArray();
+    } else {
+      out.Printf(" * %s", desc.GetData());
+    }
   }
 
   SBFrame selected_frame = thread.GetSelectedFrame();
@@ -125,8 +303,11 @@ bool BacktraceCmd::DoExecute(SBDebugger d, char** cmd,
       v8::JSFrame v8_frame(&llv8, static_cast<int64_t>(frame.GetFP()));
       std::string res = v8_frame.Inspect(true, err);
       if (err.Success()) {
-        result.Printf("  %c frame #%u: 0x%016" PRIx64 " %s\n", star, i, pc,
-                      res.c_str());
+        if (out.json())
+          WriteFrame(&json, i, star == '*', pc, "js", res);
+        else
+          out.Printf("  %c frame #%u: 0x%016" PRIx64 " %s\n", star, i, pc,
+                     res.c_str());
         continue;
       }
     }
@@ -138,8 +319,11 @@ bool BacktraceCmd::DoExecute(SBDebugger d, char** cmd,
       lldb::SBMemoryRegionInfo info;
       if (target.GetProcess().GetMemoryRegionInfo(pc, info).Success() &&
           info.IsExecutable() && info.IsWritable()) {
-        result.Printf("  %c frame #%u: 0x%016" PRIx64 " <builtin>\n", star, i,
-                      pc);
+        if (out.json())
+          WriteFrame(&json, i, star == '*', pc, "builtin", "<builtin>");
+        else
+          out.Printf("  %c frame #%u: 0x%016" PRIx64 " <builtin>\n", star, i,
+                     pc);
         continue;
       }
     }
@@ -147,8 +331,17 @@ bool BacktraceCmd::DoExecute(SBDebugger d, char** cmd,
 
     // C++ stack frame.
     SBStream desc;
-    if (frame.GetDescription(desc))
-      result.Printf("  %c %s", star, desc.GetData());
+    if (!frame.GetDescription(desc)) continue;
+    if (out.json())
+      WriteFrame(&json, i, star == '*', pc, "native",
+                 TrimNewline(desc.GetData()));
+    else
+      out.Printf("  %c %s", star, desc.GetData());
+  }
+
+  if (out.json()) {
+    json.EndArray();
+    json.EndObject();
   }
 
   result.SetStatus(eReturnStatusSuccessFinishResult);
@@ -158,6 +351,9 @@ bool BacktraceCmd::DoExecute(SBDebugger d, char** cmd,
 
 bool PrintCmd::DoExecute(SBDebugger d, char** cmd,
                          SBCommandReturnObject& result) {
+  OutputSink out(d, result);
+  if (!ParseOutputOptions(cmd, &out, result)) return false;
+
   if (cmd == nullptr || *cmd == nullptr) {
     if (detailed_) {
       result.SetError("USAGE: v8 inspect [flags] expr\n");
@@ -193,6 +389,8 @@ bool PrintCmd::DoExecute(SBDebugger d, char** cmd,
     return false;
   }
 
+  llscan.MaybeStartBackgroundScan(target);
+
   // Load V8 constants from postmortem data
   llv8.Load(target);
 
@@ -204,7 +402,13 @@ bool PrintCmd::DoExecute(SBDebugger d, char** cmd,
     return false;
   }
 
-  result.Printf("%s\n", res.c_str());
+  if (out.json()) {
+    JSONWriter& json = out.json_writer();
+    WriteValue(&json, v8_value, res);
+  } else {
+    out.Write(res);
+    out.Write("\n", 1);
+  }
   result.SetStatus(eReturnStatusSuccessFinishResult);
   return true;
 }
@@ -212,6 +416,9 @@ bool PrintCmd::DoExecute(SBDebugger d, char** cmd,
 
 bool ListCmd::DoExecute(SBDebugger d, char** cmd,
                         SBCommandReturnObject& result) {
+  OutputSink out(d, result);
+  if (!ParseOutputOptions(cmd, &out, result)) return false;
+
   if (cmd == nullptr || *cmd == nullptr) {
     result.SetError("USAGE: v8 source list\n");
     return false;
@@ -268,6 +475,10 @@ bool ListCmd::DoExecute(SBDebugger d, char** cmd,
   last_frame = frame;
   // C++ symbol
   if (symbol.IsValid()) {
+    if (out.json()) {
+      result.SetError("--json only works in JavaScript frames\n");
+      return false;
+    }
     SBCommandInterpreter interpreter = d.GetCommandInterpreter();
     std::string cmd = "source list ";
     cmd += full_cmd;
@@ -291,9 +502,26 @@ bool ListCmd::DoExecute(SBDebugger d, char** cmd,
   }
   last_line = line_cursor;
 
+  JSONWriter& json = out.json_writer();
+  if (out.json()) {
+    json.BeginObject();
+    json.Key("lines");
+    json.BeginArray();
+  }
   for (uint32_t i = 0; i < lines_found; i++) {
-    result.Printf("  %d %s\n", line_cursor - lines_found + i + 1,
-                  lines[i].c_str());
+    uint64_t line = line_cursor - lines_found + i + 1;
+    if (out.json()) {
+      json.BeginObject();
+      json.Member("line", line);
+      json.Member("text", lines[i]);
+      json.EndObject();
+    } else {
+      out.Printf("  %" PRIu64 " %s\n", line, lines[i].c_str());
+    }
+  }
+  if (out.json()) {
+    json.EndArray();
+    json.EndObject();
   }
   result.SetStatus(eReturnStatusSuccessFinishResult);
   return true;
@@ -306,7 +534,11 @@ namespace lldb {
 bool PluginInitialize(SBDebugger d) {
   SBCommandInterpreter interpreter = d.GetCommandInterpreter();
 
-  SBCommand v8 = interpreter.AddMultiwordCommand("v8", "Node.js helpers");
+  SBCommand v8 = interpreter.AddMultiwordCommand(
+      "v8",
+      "Node.js helpers. Every command takes --out path to write its output "
+      "to a file instead, through gzip or zstd when the path ends in .gz or "
+      ".zst, and --json to write one JSON document instead of text.");
 
   v8.AddCommand(
       "bt", new llnode::BacktraceCmd(),
@@ -347,30 +579,188 @@ bool PluginInitialize(SBDebugger d) {
   v8.AddCommand("findjsobjects", new llnode::FindObjectsCmd(),
                 "List all object types and instance counts grouped by type"
                 "name and sorted by instance count.\n"
+                "Use -t or --timeout seconds to stop the heap scan early with "
+                "a partial result, running the command again resumes it. "
+                "Ctrl-C interrupts the scan the same way.\n"
+                "Use -p or --sample percent to estimate the counts and sizes "
+                "from a random sample of the heap instead, with 95% "
+                "confidence intervals. Estimates also count objects nothing "
+                "refers to, an exact scan replaces them once it has run.\n"
+                "Use -O or --owned to add the size of the elements and "
+                "out-of-object properties only the instances refer to. "
+                "Copy-on-write elements shared between array literals are "
+                "counted once per array.\n"
+                "Use -s or --space name to count only the instances in one "
+                "heap space: new, old, code, large or unknown. Use -S or "
+                "--spaces to show the size of each type in every space. The "
+                "space comes from the header of the page holding the object, "
+                "map space pages can't be told apart from old space ones.\n"
+                "Use -L or --live-only to count only the instances reachable "
+                "from outside the V8 heap (stacks, handles, the isolate's "
+                "roots) and report the unreachable ones as a total. Marking "
+                "errs towards live, stale pointers outside the heap keep "
+                "objects alive.\n"
+                "Use -M or --by-map to count the instances of each map (hidden "
+                "class) rather than of each type name, to find constructors "
+                "whose instances have many shapes.\n"
+                "Use -D or --dictionaries to list the types with instances in "
+                "dictionary mode, how many, the average capacity and number "
+                "of used entries of their property dictionaries, and the bytes "
+                "the dictionaries take.\n"
 #ifndef LLDB_SBMemoryRegionInfoList_h_
-                "Requires `LLNODE_RANGESFILE` environment variable to be set "
-                "to a file containing memory ranges for the core file being "
-                "debugged.\n"
-                "There are scripts for generating this file on Linux and Mac "
-                "in the scripts directory of the llnode repository."
+                "Memory ranges of ELF core files are read from the core file "
+                "itself, for other core files `LLNODE_RANGESFILE` environment "
+                "variable must be set to a file containing memory ranges for "
+                "the core file being debugged.\n"
+                "There is a script for generating this file on Mac in the "
+                "scripts directory of the llnode repository."
 #endif  // LLDB_SBMemoryRegionInfoList_h_
   );
 
   interpreter.AddCommand("findjsobjects", new llnode::FindObjectsCmd(),
                          "Alias for `v8 findjsobjects`");
 
+  v8.AddCommand(
+      "scan", new llnode::ScanCmd(),
+      "Scan the heap for objects ahead of the commands that need it.\n\n"
+      "Flags:\n\n"
+      " * -b, --background     - scan on a worker thread and return at once, "
+      "later scan commands wait for it or, when cut short with Ctrl-C or "
+      "--timeout, answer from its partial results. Only for core files llnode "
+      "can read itself\n"
+      " * -t, --timeout secs   - stop scanning after `secs` seconds\n\n"
+      "Set the `LLNODE_AUTOSCAN` environment variable to start a background "
+      "scan of core files on the first `v8 bt` or `v8 inspect`.\n\n"
+      "Syntax: v8 scan [flags]\n"
+      "        v8 scan status\n"
+      "        v8 scan stop\n");
+
   v8.AddCommand("findjsinstances", new llnode::FindInstancesCmd(),
                 "List every object with the specified type name.\n"
                 "Use -v or --verbose to display detailed `v8 inspect` output "
                 "for each object.\n"
+                "Use --live-only to leave out instances that aren't reachable "
+                "from outside the V8 heap.\n"
+                "Use --fields a,b,c to write just those properties of every "
+                "instance, one row per instance, as tab separated values. "
+                "--format csv or --format jsonl write comma separated values "
+                "or JSON lines instead, --out path writes the rows to a file, "
+                "picking the format from its extension unless --format is "
+                "given.\n"
+                "Use --where expr to list only the instances matching `expr`, "
+                "for example 'state == \"open\" && bytes > 1048576'. Compare "
+                "properties with numbers, strings, true, false, null and "
+                "undefined using == != < <= > >=, combine tests with && || ! "
+                "and parentheses, test for properties with has(name) and "
+                "types with typeof name == \"string\" or name instanceof Type. "
+                "Use [\"odd-name\"] for names that aren't identifiers.\n"
+                "Use --limit N to list N instances at most and --offset M to "
+                "skip the first M, --next lists the next page of the last "
+                "paged listing. Instances are listed as they are found.\n"
+                "Use --sample N to inspect N instances picked at random, the "
+                "same ones every run, after the count and size of them all.\n"
                 "Accepts the same options as `v8 inspect`");
 
   interpreter.AddCommand("findjsinstances", new llnode::FindInstancesCmd(),
                          "List all objects which share the specified map.\n");
 
+  v8.AddCommand(
+      "findlargest", new llnode::FindLargestCmd(),
+      "List the largest objects found by the heap scan, largest first. The "
+      "size includes the elements and out-of-object properties only the "
+      "object refers to.\n\n"
+      "Flags:\n\n"
+      " * -n, --count num      - list `num` objects, 10 by default\n"
+      " * -T, --type name      - only objects with this type name\n"
+      " * -t, --timeout secs   - stop scanning after `secs` seconds\n"
+      " * -L, --live-only      - only objects reachable from outside the V8 "
+      "heap\n\n"
+      "Syntax: v8 findlargest [flags]\n");
+
+  v8.AddCommand(
+      "fieldhist", new llnode::FieldHistCmd(),
+      "Count the values of a property across every instance of a type, most "
+      "common first, with the total size of the instances holding each "
+      "value. Smis and numbers are grouped by value, strings by their "
+      "characters and other objects by address.\n\n"
+      "Flags:\n\n"
+      " * -n, --count num      - list `num` values, 10 by default\n"
+      " * -t, --timeout secs   - stop scanning after `secs` seconds\n"
+      " * -L, --live-only      - only instances reachable from outside the V8 "
+      "heap\n\n"
+      "Syntax: v8 fieldhist [flags] type_name property\n");
+
+  v8.AddCommand(
+      "dupstrings", new llnode::DupStringsCmd(),
+      "List the string values found more than once by the heap scan, by the "
+      "bytes the extra copies take up. Strings are compared by their "
+      "characters, one and two byte strings never match. Only sequential "
+      "and external strings are compared, cons and sliced strings share the "
+      "characters of other strings. The characters of external strings, "
+      "outside of the V8 heap, count towards the waste.\n\n"
+      "Flags:\n\n"
+      " * -n, --count num      - list `num` values, 20 by default\n"
+      " * -t, --timeout secs   - stop scanning after `secs` seconds\n"
+      " * -L, --live-only      - only strings reachable from outside the V8 "
+      "heap\n\n"
+      "Syntax: v8 dupstrings [flags]\n");
+
+  v8.AddCommand(
+      "stringstats", new llnode::StringStatsCmd(),
+      "Show the number and size of the strings found by the heap scan by "
+      "representation and encoding, the depth of cons string ropes, and the "
+      "sliced string parents keeping the most bytes alive that no slice "
+      "uses. The characters of external strings are shown as off-heap "
+      "bytes.\n\n"
+      "Flags:\n\n"
+      " * -n, --count num      - list `num` sliced string parents, 10 by "
+      "default\n"
+      " * -t, --timeout secs   - stop scanning after `secs` seconds\n"
+      " * -L, --live-only      - only strings reachable from outside the V8 "
+      "heap\n\n"
+      "Syntax: v8 stringstats [flags]\n");
+
+  v8.AddCommand(
+      "elementsstats", new llnode::ElementsStatsCmd(),
+      "Show how the arrays and other objects found by the heap scan use the "
+      "backing stores of their elements: the bytes of the stores and the "
+      "bytes no element uses, by elements kind, by constructor and by map, "
+      "most wasted first. Spare slots past the length of arrays and holes "
+      "count as wasted, and so do unused entries of dictionary elements. "
+      "Copy-on-write elements shared between array literals are counted "
+      "once per array.\n\n"
+      "Flags:\n\n"
+      " * -n, --count num      - list `num` constructors and maps, 10 by "
+      "default\n"
+      " * -t, --timeout secs   - stop scanning after `secs` seconds\n"
+      " * -L, --live-only      - only objects reachable from outside the V8 "
+      "heap\n\n"
+      "Syntax: v8 elementsstats [flags]\n");
+
+  v8.AddCommand(
+      "grepstrings", new llnode::GrepStringsCmd(),
+      "List the strings found by the heap scan that contain `pattern`, with "
+      "the objects referring to them. Ropes are searched as a whole, two "
+      "byte strings are searched as `v8 inspect` prints them.\n\n"
+      "Flags:\n\n"
+      " * -r, --regex          - `pattern` is an ECMAScript regular "
+      "expression\n"
+      " * -t, --timeout secs   - stop scanning after `secs` seconds\n"
+      " * -L, --live-only      - only strings reachable from outside the V8 "
+      "heap\n\n"
+      "Syntax: v8 grepstrings [flags] pattern\n");
+
   v8.AddCommand("nodeinfo", new llnode::NodeInfoCmd(),
                 "Print information about Node.js\n");
 
+  v8.AddCommand(
+      "shapes", new llnode::ShapesCmd(),
+      "List the maps (hidden classes) the instances of a type have, most "
+      "common first, with the number and size of their instances, how many "
+      "properties are kept in the object and in its properties backing "
+      "store, whether they are in dictionary mode, and the property names.\n\n"
+      "Syntax: v8 shapes type_name\n");
+
   v8.AddCommand(
       "findrefs", new llnode::FindReferencesCmd(),
       "Finds all the object properties which meet the search criteria.\n"
@@ -382,6 +772,15 @@ bool PluginInitialize(SBDebugger d) {
       " * -n, --name  name     - all properties with the specified name\n"
       " * -s, --string string  - all properties that refer to the specified "
       "JavaScript string value\n"
+      " * -t, --timeout secs   - stop scanning after `secs` seconds with a "
+      "partial result\n"
+      " * -L, --live-only      - leave out referring objects that aren't "
+      "reachable from outside the V8 heap\n"
+      " * -w, --where expr     - only referring objects matching `expr`, see "
+      "`v8 findjsinstances`\n"
+      " * --limit N            - list the references of N objects at most\n"
+      " * --offset M           - skip the first M referring objects\n"
+      " * --next               - list the next page of the last paged search\n"
       "\n");
 
   return true;
@@ -5,13 +5,53 @@
 
 #include <lldb/API/LLDB.h>
 
+#include "src/lloutput.h"
 #include "src/llv8.h"
 
 namespace llnode {
 
+class ScanOptions;
+
 class CommandBase : public lldb::SBCommandPluginInterface {
  public:
   char** ParseInspectOptions(char** cmd, v8::Value::InspectOptions* options);
+
+  /* Take `--json` and `--out path` off `cmd`, switch `out` to JSON and point
+   * it at that file. Returns false with an error in `result` when the file
+   * can't be opened.
+   */
+  bool ParseOutputOptions(char** cmd, OutputSink* out,
+                          lldb::SBCommandReturnObject& result);
+
+  /* Parse `-n count`, `-t timeout` and `-L` of the commands printing the top
+   * `count` entries of a heap scan, `count` is `default_count` without -n.
+   * The rest of the arguments keep their order, `start` is set to the first
+   * one when given. Returns false when -n isn't a positive count or -t a
+   * number of seconds.
+   */
+  bool ParseCountOptions(char** cmd, ScanOptions* options,
+                         uint64_t default_count, uint64_t* count,
+                         char*** start);
+
+  // Parse a whole decimal number, returns false for anything else.
+  static bool ParseCount(const std::string& text, uint64_t* count);
+
+  /* Remove every `flag` from the null terminated `cmd`, for flags of commands
+   * that hand the rest of their arguments to ParseInspectOptions.
+   */
+  static bool TakeFlag(char** cmd, const char* flag);
+
+  /* Remove every `option` and the value following it, or given as
+   * `option=value`, from the null terminated `cmd`. `value` is set to the
+   * last one, returns false when the option isn't there.
+   */
+  static bool TakeOption(char** cmd, const char* option, std::string* value);
+
+  /* Write `value` for --json as an object with its address, type name and
+   * `inspect`, the `v8 inspect` text of it.
+   */
+  static void WriteValue(JSONWriter* json, v8::Value& value,
+                         const std::string& inspect);
 };
 
 class BacktraceCmd : public CommandBase {
@@ -0,0 +1,380 @@
+#include <errno.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cinttypes>
+#include <cmath>
+#include <vector>
+
+#include "src/lloutput.h"
+
+namespace llnode {
+
+using lldb::SBCommandReturnObject;
+using lldb::SBDebugger;
+
+
+static bool EndsWith(const std::string& text, const char* suffix) {
+  size_t length = strlen(suffix);
+  return text.size() > length &&
+         text.compare(text.size() - length, length, suffix) == 0;
+}
+
+
+// Quote `text` for the shell that popen() runs.
+static std::string ShellQuote(const std::string& text) {
+  std::string quoted = "'";
+  for (char c : text) {
+    if (c == '\'')
+      quoted += "'\\''";
+    else
+      quoted += c;
+  }
+  return quoted + "'";
+}
+
+
+OutputSink::OutputSink(SBDebugger debugger, SBCommandReturnObject& result)
+    : result_(result),
+      file_(nullptr),
+      error_(0),
+      written_(0),
+      stream_(debugger.GetOutputFileHandle()),
+      json_(false),
+      json_writer_(this) {
+  buf_.reserve(kChunkSize);
+}
+
+
+std::string OutputSink::StripCompression(const std::string& path) {
+  if (EndsWith(path, ".gz")) return path.substr(0, path.size() - 3);
+  if (EndsWith(path, ".zst")) return path.substr(0, path.size() - 4);
+  return path;
+}
+
+
+bool OutputSink::Open(const std::string& path, std::string* error) {
+  // Whatever was written so far belongs to the result.
+  Flush();
+
+  // Create the file here even when it's compressed, a bad path is reported
+  // better than by the shell.
+  FILE* file = fopen(path.c_str(), "w");
+  if (file == nullptr) {
+    *error = "Can't open " + path + ": " + strerror(errno);
+    return false;
+  }
+
+  std::string compressor;
+  if (EndsWith(path, ".gz"))
+    compressor = "gzip -c";
+  else if (EndsWith(path, ".zst"))
+    compressor = "zstd -q -c";
+
+  if (!compressor.empty()) {
+    fclose(file);
+    std::string command = compressor + " > " + ShellQuote(path);
+    file = popen(command.c_str(), "w");
+    if (file == nullptr) {
+      *error = "Can't run " + compressor + ": " + strerror(errno);
+      return false;
+    }
+  }
+
+  path_ = path;
+  file_ = file;
+  compressor_ = compressor;
+  error_ = 0;
+  written_ = 0;
+  return true;
+}
+
+
+bool OutputSink::Close() {
+  Flush();
+  if (file_ == nullptr) return true;
+
+  int status = compressor_.empty() ? fclose(file_) : pclose(file_);
+  if (status != 0 && error_ == 0 && compressor_.empty()) error_ = errno;
+  file_ = nullptr;
+
+  std::string message;
+  if (error_ != 0) {
+    message = "Failed writing " + path_ + ": " + strerror(error_) + "\n";
+  } else if (status != 0) {
+    message = "Failed writing " + path_ + ": `" + compressor_ +
+              "` exited with status " + std::to_string(status >> 8) + "\n";
+  } else {
+    // Commands that failed have already said why.
+    if (result_.Succeeded())
+      result_.Printf("Wrote %" PRIu64 " bytes to %s\n", written_,
+                     path_.c_str());
+    return true;
+  }
+
+  result_.SetError(message.c_str());
+  return false;
+}
+
+
+void OutputSink::Write(const char* data, size_t size) {
+  // Big pieces skip the copy into the buffer.
+  if (buf_.empty() && size >= kChunkSize) {
+    Emit(data, size);
+    return;
+  }
+
+  buf_.append(data, size);
+  if (buf_.size() >= kChunkSize) Flush();
+}
+
+
+void OutputSink::Printf(const char* format, ...) {
+  char text[1024];
+  va_list args;
+  va_start(args, format);
+  va_list copy;
+  va_copy(copy, args);
+  int size = vsnprintf(text, sizeof(text), format, copy);
+  va_end(copy);
+
+  if (size < 0) {
+    // Nothing sensible to write.
+  } else if (static_cast<size_t>(size) < sizeof(text)) {
+    Write(text, size);
+  } else {
+    std::vector<char> large(size + 1);
+    vsnprintf(large.data(), large.size(), format, args);
+    Write(large.data(), size);
+  }
+  va_end(args);
+}
+
+
+void OutputSink::Flush() {
+  if (buf_.empty()) return;
+  Emit(buf_.data(), buf_.size());
+  buf_.clear();
+}
+
+
+void OutputSink::Poll() {
+  if (stream_ == nullptr || file_ != nullptr || buf_.empty()) return;
+
+  auto now = std::chrono::steady_clock::now();
+  if (now - last_emit_ >= std::chrono::milliseconds(kStreamIntervalMs))
+    Flush();
+}
+
+
+void OutputSink::Emit(const char* data, size_t size) {
+  if (file_ == nullptr && stream_ != nullptr) {
+    fwrite(data, 1, size, stream_);
+    fflush(stream_);
+    last_emit_ = std::chrono::steady_clock::now();
+    return;
+  }
+  if (file_ == nullptr) {
+    result_.Printf("%.*s", static_cast<int>(size), data);
+    return;
+  }
+
+  written_ += size;
+  if (error_ == 0 && fwrite(data, 1, size, file_) != size) error_ = errno;
+}
+
+
+void JSONWriter::BeginObject() {
+  Separate();
+  Raw("{", 1);
+  empty_.push_back(true);
+}
+
+
+void JSONWriter::EndObject() {
+  empty_.pop_back();
+  Raw("}", 1);
+  // One document per line.
+  if (empty_.empty()) Raw("\n", 1);
+}
+
+
+void JSONWriter::BeginArray() {
+  Separate();
+  Raw("[", 1);
+  empty_.push_back(true);
+}
+
+
+void JSONWriter::EndArray() {
+  empty_.pop_back();
+  Raw("]", 1);
+  if (empty_.empty()) Raw("\n", 1);
+}
+
+
+void JSONWriter::Key(const char* key) {
+  Separate();
+  Escape(key, strlen(key), out_->chunk());
+  Raw(":", 1);
+  after_key_ = true;
+}
+
+
+void JSONWriter::String(const char* data, size_t size) {
+  Separate();
+  Escape(data, size, out_->chunk());
+  out_->Commit();
+}
+
+
+void JSONWriter::Int(int64_t value) {
+  char text[32];
+  Separate();
+  Raw(text, snprintf(text, sizeof(text), "%" PRId64, value));
+}
+
+
+void JSONWriter::Uint(uint64_t value) {
+  char text[32];
+  Separate();
+  Raw(text, snprintf(text, sizeof(text), "%" PRIu64, value));
+}
+
+
+void JSONWriter::Double(double value) {
+  if (!std::isfinite(value)) return Null();
+
+  // The shortest of the two that reads back the same.
+  char text[32];
+  int size = snprintf(text, sizeof(text), "%.15g", value);
+  if (strtod(text, nullptr) != value)
+    size = snprintf(text, sizeof(text), "%.17g", value);
+  Separate();
+  Raw(text, size);
+}
+
+
+void JSONWriter::Bool(bool value) {
+  Separate();
+  if (value)
+    Raw("true", 4);
+  else
+    Raw("false", 5);
+}
+
+
+void JSONWriter::Null() {
+  Separate();
+  Raw("null", 4);
+}
+
+
+void JSONWriter::Address(uint64_t address) {
+  char text[32];
+  Separate();
+  Raw(text, snprintf(text, sizeof(text), "\"0x%016" PRIx64 "\"", address));
+}
+
+
+void JSONWriter::Separate() {
+  if (after_key_) {
+    after_key_ = false;
+    return;
+  }
+  if (empty_.empty()) return;
+  if (!empty_.back()) Raw(",", 1);
+  empty_.back() = false;
+}
+
+
+void JSONWriter::Raw(const char* text, size_t size) {
+  out_->chunk()->append(text, size);
+  out_->Commit();
+}
+
+
+// The length of the UTF-8 sequence at `p`, 0 when it isn't valid.
+static size_t SequenceLength(const unsigned char* p, size_t available) {
+  size_t length;
+  unsigned char low = 0x80;
+  unsigned char high = 0xbf;
+  if (p[0] >= 0xc2 && p[0] <= 0xdf) {
+    length = 2;
+  } else if (p[0] >= 0xe0 && p[0] <= 0xef) {
+    length = 3;
+    // No overlong forms and no surrogates.
+    if (p[0] == 0xe0) low = 0xa0;
+    if (p[0] == 0xed) high = 0x9f;
+  } else if (p[0] >= 0xf0 && p[0] <= 0xf4) {
+    length = 4;
+    // No overlong forms and nothing past U+10FFFF.
+    if (p[0] == 0xf0) low = 0x90;
+    if (p[0] == 0xf4) high = 0x8f;
+  } else {
+    return 0;
+  }
+
+  if (available < length || p[1] < low || p[1] > high) return 0;
+  for (size_t i = 2; i < length; i++)
+    if ((p[i] & 0xc0) != 0x80) return 0;
+  return length;
+}
+
+
+void JSONWriter::Escape(const char* data, size_t size, std::string* buf) {
+  static const char kHex[] = "0123456789abcdef";
+
+  const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+  const unsigned char* end = p + size;
+  buf->push_back('"');
+  while (p < end) {
+    // Copy runs of printable ASCII in one go.
+    const unsigned char* run = p;
+    while (p < end && *p >= 0x20 && *p < 0x80 && *p != '"' && *p != '\\') p++;
+    buf->append(reinterpret_cast<const char*>(run), p - run);
+    if (p == end) break;
+
+    unsigned char c = *p;
+    if (c >= 0x80) {
+      size_t length = SequenceLength(p, end - p);
+      if (length != 0) {
+        buf->append(reinterpret_cast<const char*>(p), length);
+        p += length;
+      } else {
+        // A Latin-1 character.
+        buf->push_back(static_cast<char>(0xc0 | (c >> 6)));
+        buf->push_back(static_cast<char>(0x80 | (c & 0x3f)));
+        p++;
+      }
+      continue;
+    }
+
+    p++;
+    switch (c) {
+      case '"':
+        buf->append("\\\"");
+        break;
+      case '\\':
+        buf->append("\\\\");
+        break;
+      case '\n':
+        buf->append("\\n");
+        break;
+      case '\r':
+        buf->append("\\r");
+        break;
+      case '\t':
+        buf->append("\\t");
+        break;
+      default:
+        buf->append("\\u00");
+        buf->push_back(kHex[c >> 4]);
+        buf->push_back(kHex[c & 0xf]);
+    }
+  }
+  buf->push_back('"');
+}
+
+}  // namespace llnode
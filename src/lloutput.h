@@ -0,0 +1,179 @@
+#ifndef SRC_LLOUTPUT_H_
+#define SRC_LLOUTPUT_H_
+
+#include <lldb/API/LLDB.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+namespace llnode {
+
+class OutputSink;
+
+/* Writes one JSON document into an OutputSink as it goes, with nothing kept
+ * but the nesting, so arrays of any length can be streamed. Commas are put
+ * in as needed, for example:
+ *
+ *   JSONWriter& json = out.json_writer();
+ *   json.BeginObject();
+ *   json.Key("types");
+ *   json.BeginArray();
+ *   ...
+ *   json.EndArray();
+ *   json.EndObject();
+ *
+ * Strings are escaped straight into the chunk being filled. Bytes that aren't
+ * valid UTF-8 are taken as Latin-1, the encoding of V8's one byte strings, so
+ * the document always parses. Addresses are written as "0x..." strings, JSON
+ * numbers can't hold 64 bits exactly.
+ */
+class JSONWriter {
+ public:
+  explicit JSONWriter(OutputSink* out) : out_(out), after_key_(false) {}
+
+  void BeginObject();
+  void EndObject();
+  void BeginArray();
+  void EndArray();
+  // The name of the next member of an object, its value follows.
+  void Key(const char* key);
+
+  void String(const char* data, size_t size);
+  inline void String(const std::string& text) {
+    String(text.data(), text.size());
+  }
+  inline void String(const char* text) { String(text, strlen(text)); }
+  void Int(int64_t value);
+  void Uint(uint64_t value);
+  // Infinities and NaN are written as null.
+  void Double(double value);
+  void Bool(bool value);
+  void Null();
+  void Address(uint64_t address);
+
+  // A member of an object in one go.
+  inline void Member(const char* key, const char* value) {
+    Key(key);
+    String(value);
+  }
+  inline void Member(const char* key, const std::string& value) {
+    Key(key);
+    String(value);
+  }
+  inline void Member(const char* key, int64_t value) {
+    Key(key);
+    Int(value);
+  }
+  inline void Member(const char* key, uint64_t value) {
+    Key(key);
+    Uint(value);
+  }
+  inline void Member(const char* key, double value) {
+    Key(key);
+    Double(value);
+  }
+  inline void Member(const char* key, bool value) {
+    Key(key);
+    Bool(value);
+  }
+
+  // Append `data` to `buf` as a quoted JSON string.
+  static void Escape(const char* data, size_t size, std::string* buf);
+
+ private:
+  void Separate();
+  void Raw(const char* text, size_t size);
+
+  OutputSink* out_;
+  // One entry per open object or array, true until it has a value.
+  std::vector<bool> empty_;
+  bool after_key_;
+};
+
+/* Where a command writes its output. Text is collected in chunks of
+ * kChunkSize bytes and handed on as each chunk fills, to the debugger's
+ * output or, after Open(), to a file, so the start of a long listing shows at
+ * once and lldb keeps no copy of it. Files ending in .gz or .zst are written
+ * through gzip or zstd. When the debugger has no output file, as when it's
+ * driven through the SB API, the chunks go to the command result, which
+ * holds all of them until the command returns.
+ *
+ * The text of a single value, as `v8 inspect` prints it, is still put
+ * together whole before it's written.
+ *
+ * Once a command has a sink all of its output must go through it, text
+ * printed straight to the result would overtake the buffered chunk.
+ */
+class OutputSink {
+ public:
+  OutputSink(lldb::SBDebugger debugger, lldb::SBCommandReturnObject& result);
+  ~OutputSink() { Close(); }
+
+  // Returns false and sets `error` when `path` can't be written.
+  bool Open(const std::string& path, std::string* error);
+
+  /* Flush the last chunk. When writing to a file, close it and report the
+   * number of bytes written, or the error, in the result. Runs from the
+   * destructor, after the command has set its status.
+   */
+  bool Close();
+
+  void Write(const char* data, size_t size);
+  inline void Write(const std::string& text) {
+    Write(text.data(), text.size());
+  }
+  void Printf(const char* format, ...) __attribute__((format(printf, 2, 3)));
+  void Flush();
+
+  /* Pass on what was written so far when streaming and nothing was for a
+   * while, called after each result of a long listing.
+   */
+  void Poll();
+
+  /* The chunk being filled, for writers that format straight into it. Call
+   * Commit() after appending.
+   */
+  inline std::string* chunk() { return &buf_; }
+  inline void Commit() {
+    if (buf_.size() >= kChunkSize) Flush();
+  }
+
+  inline bool to_file() const { return file_ != nullptr; }
+  inline const std::string& path() const { return path_; }
+  // Set by --json, the command writes a JSON document instead of text.
+  inline bool json() const { return json_; }
+  inline void set_json(bool json) { json_ = json; }
+  inline JSONWriter& json_writer() { return json_writer_; }
+
+  // `path` without a .gz or .zst suffix.
+  static std::string StripCompression(const std::string& path);
+
+ private:
+  static const size_t kChunkSize = 64 * 1024;
+  static const int kStreamIntervalMs = 100;
+
+  void Emit(const char* data, size_t size);
+
+  lldb::SBCommandReturnObject& result_;
+  std::string buf_;
+
+  std::string path_;
+  FILE* file_;
+  // The command compressing the file, empty when it's written as is.
+  std::string compressor_;
+  // errno of the first failed write, 0 when there was none.
+  int error_;
+  uint64_t written_;
+  // The debugger's output, nullptr when it has none.
+  FILE* stream_;
+  std::chrono::steady_clock::time_point last_emit_;
+  bool json_;
+  JSONWriter json_writer_;
+};
+
+}  // namespace llnode
+
+#endif  // SRC_LLOUTPUT_H_
@@ -1,15 +1,25 @@
 #include <errno.h>
 #include <getopt.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include <algorithm>
 #include <cinttypes>
+#include <cmath>
 #include <fstream>
+#include <limits>
+#include <functional>
+#include <queue>
+#include <random>
 #include <vector>
 
 #include <lldb/API/SBExpressionOptions.h>
 
+#include "src/llfields.h"
+#include "src/llfilter.h"
 #include "src/llnode.h"
 #include "src/llscan.h"
 #include "src/llv8-inl.h"
@@ -33,17 +43,276 @@ extern v8::LLV8 llv8;
 
 LLScan llscan;
 
+volatile sig_atomic_t ScanProgress::interrupted_ = 0;
+struct sigaction ScanProgress::previous_action_;
+int ScanProgress::depth_ = 0;
+Pager::Cursor FindInstancesCmd::cursor_;
+Pager::Cursor FindReferencesCmd::cursor_;
+
+
+ScanProgress::ScanProgress(SBDebugger debugger, const char* what,
+                           uint64_t total, bool bytes,
+                           const ScanOptions& options)
+    : cancel_(nullptr),
+      err_(debugger.GetErrorFileHandle()),
+      what_(what),
+      total_(total),
+      bytes_(bytes),
+      timed_out_(false),
+      start_(std::chrono::steady_clock::now()),
+      deadline_(options.start + std::chrono::seconds(options.timeout)),
+      last_report_(start_) {
+  if (options.timeout == 0)
+    deadline_ = std::chrono::steady_clock::time_point::max();
+
+  /* The lldb we build against has no way to ask whether the user pressed
+   * Ctrl-C, catch SIGINT ourselves and pass it on to lldb's handler. Scans
+   * run inside others share the handler of the outermost one, and see the
+   * Ctrl-C it saw.
+   */
+  if (depth_++ != 0) return;
+  interrupted_ = 0;
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_sigaction = OnInterrupt;
+  action.sa_flags = SA_SIGINFO | SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGINT, &action, &previous_action_);
+}
+
+
+ScanProgress::ScanProgress(const std::atomic<bool>& cancel)
+    : cancel_(&cancel),
+      err_(nullptr),
+      what_(nullptr),
+      total_(0),
+      bytes_(false),
+      timed_out_(false) {}
+
+
+ScanProgress::~ScanProgress() {
+  if (cancel_ == nullptr && --depth_ == 0)
+    sigaction(SIGINT, &previous_action_, nullptr);
+}
+
+
+void ScanProgress::OnInterrupt(int sig, siginfo_t* info, void* context) {
+  interrupted_ = 1;
+
+  if (previous_action_.sa_flags & SA_SIGINFO) {
+    if (previous_action_.sa_sigaction != nullptr)
+      previous_action_.sa_sigaction(sig, info, context);
+  } else if (previous_action_.sa_handler != SIG_DFL &&
+             previous_action_.sa_handler != SIG_IGN) {
+    previous_action_.sa_handler(sig);
+  }
+}
+
+
+bool ScanProgress::Update(uint64_t done, uint64_t found) {
+  if (cancel_ != nullptr) return !*cancel_;
+  if (interrupted_) return false;
+
+  auto now = std::chrono::steady_clock::now();
+  if (now >= deadline_) {
+    timed_out_ = true;
+    return false;
+  }
+
+  // Report at a fixed interval, short scans stay quiet.
+  if (now - last_report_ < std::chrono::seconds(5) || err_ == nullptr)
+    return true;
+  last_report_ = now;
+
+  uint64_t elapsed =
+      std::chrono::duration_cast<std::chrono::seconds>(now - start_).count();
+  uint64_t percent = total_ == 0 ? 100 : done * 100 / total_;
+  uint64_t eta = done == 0 ? 0 : elapsed * (total_ - done) / done;
+
+  if (bytes_) {
+    fprintf(err_, "%s: %" PRIu64 " of %" PRIu64 " MB (%" PRIu64
+                  "%%), %" PRIu64 " objects found, ETA %" PRIu64 "s\n",
+            what_, done >> 20, total_ >> 20, percent, found, eta);
+  } else if (total_ == 0) {
+    fprintf(err_, "%s: %" PRIu64 " objects visited, %" PRIu64 " found\n",
+            what_, done, found);
+  } else {
+    fprintf(err_, "%s: %" PRIu64 " of %" PRIu64 " objects (%" PRIu64
+                  "%%), %" PRIu64 " found, ETA %" PRIu64 "s\n",
+            what_, done, total_, percent, found, eta);
+  }
+  fflush(err_);
+
+  return true;
+}
+
+
+bool ScanCmd::DoExecute(SBDebugger d, char** cmd,
+                        SBCommandReturnObject& result) {
+  OutputSink out(d, result);
+  if (!ParseOutputOptions(cmd, &out, result)) return false;
+
+  SBTarget target = d.GetSelectedTarget();
+  if (!target.IsValid()) {
+    result.SetError("No valid process, please start something\n");
+    return false;
+  }
+
+  if (cmd != nullptr && *cmd != nullptr && strcmp(*cmd, "status") == 0) {
+    llscan.PrintScanStatus(out);
+    result.SetStatus(eReturnStatusSuccessFinishResult);
+    return true;
+  }
+
+  if (cmd != nullptr && *cmd != nullptr && strcmp(*cmd, "stop") == 0) {
+    llscan.StopBackgroundScan();
+    llscan.PrintScanStatus(out);
+    result.SetStatus(eReturnStatusSuccessFinishResult);
+    return true;
+  }
+
+  ScanOptions scan_options;
+  scan_options.json = out.json();
+  bool background = false;
+  if (!ParseScanOptions(cmd, &scan_options, &background)) {
+    result.SetError("USAGE: v8 scan [flags]\n");
+    return false;
+  }
+
+  if (background) {
+    if (!llscan.StartBackgroundScan(target, result, scan_options)) {
+      result.SetStatus(eReturnStatusFailed);
+      return false;
+    }
+    // The notes went to the error stream, answer with the status.
+    if (out.json()) llscan.PrintScanStatus(out);
+  } else {
+    if (!llscan.ScanHeapForObjects(target, result, scan_options)) {
+      result.SetStatus(eReturnStatusFailed);
+      return false;
+    }
+    llscan.PrintScanStatus(out);
+  }
+
+  result.SetStatus(eReturnStatusSuccessFinishResult);
+  return true;
+}
+
+
+bool ScanCmd::ParseScanOptions(char** cmd, ScanOptions* options,
+                               bool* background) {
+  static struct option opts[] = {{"background", no_argument, nullptr, 'b'},
+                                 {"timeout", required_argument, nullptr, 't'},
+                                 {nullptr, 0, nullptr, 0}};
+
+  int argc = 1;
+  for (char** p = cmd; p != nullptr && *p != nullptr; p++) argc++;
+
+  char* args[argc];
+
+  // Make this look like a command line, we need a valid element at index 0
+  // for getopt_long to use in its error messages.
+  char name[] = "llscan";
+  args[0] = name;
+  for (int i = 0; i < argc - 1; i++) args[i + 1] = cmd[i];
+
+  bool valid = true;
+
+  // Reset getopts.
+  optind = 0;
+  opterr = 1;
+  do {
+    int arg = getopt_long(argc, args, "bt:", opts, nullptr);
+    if (arg == -1) break;
+
+    switch (arg) {
+      case 'b':
+        *background = true;
+        break;
+      case 't':
+        if (!ParseCount(optarg, &options->timeout)) valid = false;
+        break;
+      default:
+        continue;
+    }
+  } while (true);
+
+  return valid;
+}
+
 
 bool FindObjectsCmd::DoExecute(SBDebugger d, char** cmd,
                                SBCommandReturnObject& result) {
+  OutputSink out(d, result);
+  if (!ParseOutputOptions(cmd, &out, result)) return false;
+
   SBTarget target = d.GetSelectedTarget();
   if (!target.IsValid()) {
     result.SetError("No valid process, please start something\n");
     return false;
   }
 
+  ScanOptions scan_options;
+  scan_options.json = out.json();
+  if (!ParseScanOptions(cmd, &scan_options)) {
+    result.SetError("USAGE: v8 findjsobjects [flags]\n");
+    return false;
+  }
+
+  bool filter_space = !space_name_.empty();
+  v8::MemoryChunk::Space space = v8::MemoryChunk::kUnknownSpace;
+  if (filter_space &&
+      !v8::MemoryChunk::ParseSpaceName(space_name_.c_str(), &space)) {
+    result.SetError(
+        "Unknown space, use one of new, old, code, large or unknown\n");
+    return false;
+  }
+  if (filter_space && owned_) {
+    result.SetError("--owned can't be combined with --space\n");
+    return false;
+  }
+  bool live_only = scan_options.live_only;
+  if (live_only && (filter_space || spaces_ || owned_)) {
+    result.SetError(
+        "--live-only can't be combined with --space, --spaces or --owned\n");
+    return false;
+  }
+  if ((by_map_ || dictionaries_) &&
+      (filter_space || spaces_ || owned_ || live_only ||
+       scan_options.sample > 0)) {
+    result.SetError(
+        "--by-map and --dictionaries can't be combined with --space, "
+        "--spaces, --owned, --live-only or --sample\n");
+    return false;
+  }
+
+  // Estimate unless an exact scan has already been done.
+  if (!live_only && scan_options.sample > 0 && scan_options.sample < 100) {
+    bool exact;
+    {
+      auto lock = llscan.LockResults();
+      exact = llscan.IsScanComplete();
+    }
+    if (!exact) return PrintEstimate(target, result, out, scan_options);
+  }
+
   /* Ensure we have a map of objects. */
-  if (!llscan.ScanHeapForObjects(target, result)) {
+  if (!llscan.ScanHeapForObjects(target, result, scan_options)) {
+    result.SetStatus(eReturnStatusFailed);
+    return false;
+  }
+
+  auto lock = llscan.LockResults();
+
+  // Load V8 constants from postmortem data
+  llv8.Load(target);
+
+  if (owned_ && !ComputeOwnedSizes(d, result, scan_options)) {
+    result.SetStatus(eReturnStatusFailed);
+    return false;
+  }
+
+  if (live_only && !llscan.MarkLiveObjects(target, result, scan_options)) {
     result.SetStatus(eReturnStatusFailed);
     return false;
   }
@@ -61,17 +330,123 @@ bool FindObjectsCmd::DoExecute(SBDebugger d, char** cmd,
   std::sort(sorted_by_count.begin(), sorted_by_count.end(),
             TypeRecord::CompareInstanceCounts);
 
-  uint64_t total_objects = 0;
+  if (spaces_) {
+    PrintSpaces(out, sorted_by_count);
+    result.SetStatus(eReturnStatusSuccessFinishResult);
+    return true;
+  }
+
+  if (by_map_) {
+    PrintMaps(out, sorted_by_count);
+    result.SetStatus(eReturnStatusSuccessFinishResult);
+    return true;
+  }
+
+  if (dictionaries_) {
+    PrintDictionaries(out, sorted_by_count);
+    result.SetStatus(eReturnStatusSuccessFinishResult);
+    return true;
+  }
+
+  if (filter_space) {
+    std::stable_sort(sorted_by_count.begin(), sorted_by_count.end(),
+                     [space](TypeRecord* a, TypeRecord* b) {
+                       return a->GetSpaceInstanceCount(space) <
+                              b->GetSpaceInstanceCount(space);
+                     });
+  } else if (live_only) {
+    std::stable_sort(sorted_by_count.begin(), sorted_by_count.end(),
+                     [](TypeRecord* a, TypeRecord* b) {
+                       return a->GetLiveInstanceCount() <
+                              b->GetLiveInstanceCount();
+                     });
+  }
+
+  uint64_t garbage_count = 0;
+  uint64_t garbage_size = 0;
 
-  result.Printf(" Instances  Total Size Name\n");
-  result.Printf(" ---------- ---------- ----\n");
+  uint64_t total_objects = 0;
+  uint64_t dictionary_count = 0;
+  uint64_t dictionary_size = 0;
+
+  JSONWriter& json = out.json_writer();
+  if (out.json()) {
+    json.BeginObject();
+    json.Key("types");
+    json.BeginArray();
+  } else if (owned_) {
+    out.Printf(" Instances  Total Size Owned Size Name\n");
+    out.Printf(" ---------- ---------- ---------- ----\n");
+  } else {
+    out.Printf(" Instances  Total Size Name\n");
+    out.Printf(" ---------- ---------- ----\n");
+  }
 
   for (std::vector<TypeRecord*>::iterator it = sorted_by_count.begin();
        it != sorted_by_count.end(); ++it) {
     TypeRecord* t = *it;
-    result.Printf(" %10" PRId64 " %10" PRId64 " %s\n", t->GetInstanceCount(),
-                  t->GetTotalInstanceSize(), t->GetTypeName().c_str());
+    uint64_t count = t->GetInstanceCount();
+    uint64_t size = t->GetTotalInstanceSize();
+    if (filter_space) {
+      count = t->GetSpaceInstanceCount(space);
+      size = t->GetSpaceInstanceSize(space);
+      if (count == 0) continue;
+    } else if (live_only) {
+      garbage_count += t->GetInstanceCount() - t->GetLiveInstanceCount();
+      garbage_size += t->GetTotalInstanceSize() - t->GetLiveInstanceSize();
+      count = t->GetLiveInstanceCount();
+      size = t->GetLiveInstanceSize();
+      if (count == 0) continue;
+    }
+
+    if (out.json()) {
+      json.BeginObject();
+      json.Member("name", t->GetTypeName());
+      json.Member("instances", count);
+      json.Member("size", size);
+      if (owned_) json.Member("owned_size", t->GetTotalOwnedSize());
+      json.EndObject();
+    } else if (owned_) {
+      out.Printf(" %10" PRId64 " %10" PRId64 " %10" PRId64 " %s\n", count,
+                 size, t->GetTotalOwnedSize(), t->GetTypeName().c_str());
+    } else {
+      out.Printf(" %10" PRId64 " %10" PRId64 " %s\n", count, size,
+                 t->GetTypeName().c_str());
+    }
     total_objects += t->GetInstanceCount();
+    dictionary_count += t->GetDictionaryCount();
+    dictionary_size += t->GetDictionarySize();
+  }
+
+  // Counted for every instance, so left out when only some are listed.
+  bool show_dictionaries = !filter_space && !live_only;
+
+  if (out.json()) {
+    json.EndArray();
+    if (live_only) {
+      json.Key("unreachable");
+      json.BeginObject();
+      json.Member("instances", garbage_count);
+      json.Member("size", garbage_size);
+      json.EndObject();
+    }
+    if (show_dictionaries) {
+      json.Key("dictionary_mode");
+      json.BeginObject();
+      json.Member("instances", dictionary_count);
+      json.Member("size", dictionary_size);
+      json.EndObject();
+    }
+    json.EndObject();
+  } else if (live_only) {
+    out.Printf("Unreachable: %" PRId64 " objects, %" PRId64
+               " bytes left out above.\n",
+               garbage_count, garbage_size);
+  } else if (show_dictionaries && dictionary_count != 0) {
+    out.Printf("Dictionary mode: %" PRIu64 " objects, %" PRIu64
+               " bytes in property dictionaries, see `v8 findjsobjects "
+               "--dictionaries`.\n",
+               dictionary_count, dictionary_size);
   }
 
   result.SetStatus(eReturnStatusSuccessFinishResult);
@@ -79,238 +454,674 @@ bool FindObjectsCmd::DoExecute(SBDebugger d, char** cmd,
 }
 
 
-bool FindInstancesCmd::DoExecute(SBDebugger d, char** cmd,
-                                 SBCommandReturnObject& result) {
-  if (cmd == nullptr || *cmd == nullptr) {
-    result.SetError("USAGE: v8 findjsinstances [flags] instance_name\n");
+bool FindObjectsCmd::PrintEstimate(SBTarget target,
+                                   SBCommandReturnObject& result,
+                                   OutputSink& out,
+                                   const ScanOptions& options) {
+  if (!llscan.SampleHeapForObjects(target, result, options)) {
+    result.SetStatus(eReturnStatusFailed);
     return false;
   }
 
-  SBTarget target = d.GetSelectedTarget();
-  if (!target.IsValid()) {
-    result.SetError("No valid process, please start something\n");
-    return false;
+  uint64_t sampled = llscan.GetSampledBlocks();
+  uint64_t total = llscan.GetTotalBlocks();
+  uint64_t stride = llscan.GetSampleStride();
+
+  struct Estimate {
+    const std::string* name;
+    double count;
+    double count_interval;
+    double size;
+    double size_interval;
+  };
+
+  std::vector<Estimate> estimates;
+  for (auto const& entry : llscan.GetSampleRecords()) {
+    Estimate e;
+    e.name = &entry.first;
+    e.count =
+        entry.second.EstimateCount(sampled, total, stride, &e.count_interval);
+    e.size =
+        entry.second.EstimateSize(sampled, total, stride, &e.size_interval);
+    estimates.push_back(e);
   }
 
-  /* Ensure we have a map of objects. */
-  if (!llscan.ScanHeapForObjects(target, result)) {
-    result.SetStatus(eReturnStatusFailed);
-    return false;
+  std::sort(estimates.begin(), estimates.end(),
+            [](const Estimate& a, const Estimate& b) {
+              if (a.count == b.count) return *a.name < *b.name;
+              return a.count < b.count;
+            });
+
+  if (out.json()) {
+    JSONWriter& json = out.json_writer();
+    json.BeginObject();
+    json.Member("sampled_blocks", sampled);
+    json.Member("total_blocks", total);
+    json.Member("sample_percent", 100.0 / stride);
+    json.Key("types");
+    json.BeginArray();
+    for (const Estimate& e : estimates) {
+      json.BeginObject();
+      json.Member("name", *e.name);
+      json.Member("instances", e.count);
+      json.Member("instances_interval", e.count_interval);
+      json.Member("size", e.size);
+      json.Member("size_interval", e.size_interval);
+      json.EndObject();
+    }
+    json.EndArray();
+    json.EndObject();
+    result.SetStatus(eReturnStatusSuccessFinishResult);
+    return true;
   }
 
-  v8::Value::InspectOptions inspect_options;
-
-  inspect_options.detailed = detailed_;
-
-  char** start = ParseInspectOptions(cmd, &inspect_options);
-
-  std::string full_cmd;
-  for (; start != nullptr && *start != nullptr; start++) full_cmd += *start;
+  // --sample is rounded to one block out of a whole number of blocks.
+  out.Printf("Estimated from %" PRIu64 " of %" PRIu64
+             " blocks (1 in %" PRIu64
+             ", %.3g%% of the heap), with 95%% confidence intervals.\n",
+             sampled, total, stride, 100.0 / stride);
+  out.Printf(" Instances     +/-95%% Total Size     +/-95%% Name\n");
+  out.Printf(" ---------- ---------- ---------- ---------- ----\n");
+
+  for (const Estimate& e : estimates) {
+    out.Printf(" %10.0f %10.0f %10.0f %10.0f %s\n", e.count,
+               e.count_interval, e.size, e.size_interval, e.name->c_str());
+  }
 
-  std::string type_name = full_cmd;
+  result.SetStatus(eReturnStatusSuccessFinishResult);
+  return true;
+}
 
-  // Load V8 constants from postmortem data
-  llv8.Load(target);
 
-  TypeRecordMap::iterator instance_it =
-      llscan.GetMapsToInstances().find(type_name);
-  if (instance_it != llscan.GetMapsToInstances().end()) {
-    TypeRecord* t = instance_it->second;
-    for (std::set<uint64_t>::iterator it = t->GetInstances().begin();
-         it != t->GetInstances().end(); ++it) {
-      v8::Error err;
-      v8::Value v8_value(&llv8, *it);
-      std::string res = v8_value.Inspect(&inspect_options, err);
-      result.Printf("%s\n", res.c_str());
+void FindObjectsCmd::PrintSpaces(OutputSink& out,
+                                 std::vector<TypeRecord*>& records) {
+  const int kNumSpaces = v8::MemoryChunk::kNumSpaces;
+  uint64_t totals[kNumSpaces] = {};
+  uint64_t total_count = 0;
+
+  if (out.json()) {
+    JSONWriter& json = out.json_writer();
+    json.BeginObject();
+    json.Key("types");
+    json.BeginArray();
+    for (TypeRecord* t : records) {
+      json.BeginObject();
+      json.Member("name", t->GetTypeName());
+      json.Member("instances", t->GetInstanceCount());
+      json.Key("spaces");
+      json.BeginObject();
+      for (int i = 0; i < kNumSpaces; i++) {
+        auto space = static_cast<v8::MemoryChunk::Space>(i);
+        json.Member(v8::MemoryChunk::SpaceName(space),
+                    t->GetSpaceInstanceSize(space));
+      }
+      json.EndObject();
+      json.EndObject();
     }
+    json.EndArray();
+    json.EndObject();
+    return;
+  }
 
-  } else {
-    result.Printf("No objects found with type name %s\n", type_name.c_str());
-    result.SetStatus(eReturnStatusFailed);
-    return false;
+  out.Printf("Total size of the instances in each space:\n");
+  out.Printf(" Instances ");
+  for (int i = 0; i < kNumSpaces; i++) {
+    auto space = static_cast<v8::MemoryChunk::Space>(i);
+    out.Printf(" %10s", v8::MemoryChunk::SpaceName(space));
+  }
+  out.Printf(" Name\n");
+  out.Printf(" ----------");
+  for (int i = 0; i < kNumSpaces; i++) out.Printf(" ----------");
+  out.Printf(" ----\n");
+
+  for (TypeRecord* t : records) {
+    out.Printf(" %10" PRId64, t->GetInstanceCount());
+    for (int i = 0; i < kNumSpaces; i++) {
+      auto space = static_cast<v8::MemoryChunk::Space>(i);
+      out.Printf(" %10" PRId64, t->GetSpaceInstanceSize(space));
+      totals[i] += t->GetSpaceInstanceSize(space);
+    }
+    out.Printf(" %s\n", t->GetTypeName().c_str());
+    total_count += t->GetInstanceCount();
   }
 
-  result.SetStatus(eReturnStatusSuccessFinishResult);
-  return true;
+  out.Printf(" ----------");
+  for (int i = 0; i < kNumSpaces; i++) out.Printf(" ----------");
+  out.Printf(" ----\n");
+  out.Printf(" %10" PRId64, total_count);
+  for (int i = 0; i < kNumSpaces; i++) out.Printf(" %10" PRId64, totals[i]);
+  out.Printf(" (total)\n");
 }
 
 
-bool NodeInfoCmd::DoExecute(SBDebugger d, char** cmd,
-                            SBCommandReturnObject& result) {
-  SBTarget target = d.GetSelectedTarget();
-  if (!target.IsValid()) {
-    result.SetError("No valid process, please start something\n");
-    return false;
+void FindObjectsCmd::PrintDictionaries(OutputSink& out,
+                                       std::vector<TypeRecord*>& records) {
+  std::vector<TypeRecord*> sorted;
+  for (TypeRecord* t : records)
+    if (t->GetDictionaryCount() != 0) sorted.push_back(t);
+  // The most bytes in dictionaries come last, like the largest types.
+  std::stable_sort(sorted.begin(), sorted.end(),
+                   [](TypeRecord* a, TypeRecord* b) {
+                     return a->GetDictionarySize() < b->GetDictionarySize();
+                   });
+
+  JSONWriter& json = out.json_writer();
+  if (out.json()) {
+    json.BeginObject();
+    json.Key("types");
+    json.BeginArray();
+  } else {
+    out.Printf(
+        " Instances  Dictionary Avg Capacity   Avg Used Dict Bytes Name\n");
+    out.Printf(
+        " ---------- ---------- ------------ ---------- ---------- ----\n");
   }
 
-  /* Ensure we have a map of objects. */
-  if (!llscan.ScanHeapForObjects(target, result)) {
-    return false;
+  uint64_t total_count = 0;
+  uint64_t total_size = 0;
+  for (TypeRecord* t : sorted) {
+    uint64_t count = t->GetDictionaryCount();
+    double capacity = static_cast<double>(t->GetDictionaryCapacity()) / count;
+    double used = static_cast<double>(t->GetDictionaryUsed()) / count;
+    total_count += count;
+    total_size += t->GetDictionarySize();
+
+    if (out.json()) {
+      json.BeginObject();
+      json.Member("name", t->GetTypeName());
+      json.Member("instances", t->GetInstanceCount());
+      json.Member("dictionary_instances", count);
+      json.Member("average_capacity", capacity);
+      json.Member("average_used", used);
+      json.Member("dictionary_size", t->GetDictionarySize());
+      json.EndObject();
+      continue;
+    }
+    out.Printf(" %10" PRIu64 " %10" PRIu64 " %12.1f %10.1f %10" PRIu64
+               " %s\n",
+               t->GetInstanceCount(), count, capacity, used,
+               t->GetDictionarySize(), t->GetTypeName().c_str());
   }
 
-  std::string process_type_name("process");
+  if (out.json()) {
+    json.EndArray();
+    json.EndObject();
+  } else {
+    out.Printf(
+        " ---------- ---------- ------------ ---------- ---------- ----\n");
+    out.Printf("            %10" PRIu64 "                         %10" PRIu64
+               " (total)\n",
+               total_count, total_size);
+  }
+}
 
-  TypeRecordMap::iterator instance_it =
-      llscan.GetMapsToInstances().find(process_type_name);
 
-  if (instance_it != llscan.GetMapsToInstances().end()) {
-    TypeRecord* t = instance_it->second;
-    for (std::set<uint64_t>::iterator it = t->GetInstances().begin();
-         it != t->GetInstances().end(); ++it) {
-      v8::Error err;
+// What findjsobjects --by-map and v8 shapes show of a Map.
+class ShapeInfo {
+ public:
+  bool dictionary = false;
+  // Fields kept in the object and in its properties backing store.
+  int64_t in_object = 0;
+  int64_t out_of_object = 0;
+  /* Own property names in the order they were added, from the descriptors.
+   * Objects in dictionary mode keep their names to themselves.
+   */
+  std::vector<std::string> keys;
+};
 
-      // The properties object should be a JSObject
-      v8::JSObject process_obj(&llv8, *it);
 
+static bool ReadShape(uint64_t address, bool with_keys, ShapeInfo* shape) {
+  v8::Error err;
+  v8::Map map(&llv8, address);
+  shape->dictionary = map.IsDictionary(err);
+  if (err.Fail()) return false;
+  if (shape->dictionary) return true;
 
-      v8::Value pid_val = process_obj.GetProperty("pid", err);
+  v8::HeapObject descriptors_obj = map.InstanceDescriptors(err);
+  if (err.Fail()) return false;
+  v8::DescriptorArray descriptors(descriptors_obj);
+  int64_t own_descriptors_count = map.NumberOfOwnDescriptors(err);
+  if (err.Fail()) return false;
+  int64_t in_object_count = map.InObjectProperties(err);
+  if (err.Fail()) return false;
 
-      if (pid_val.v8() != nullptr) {
-        v8::Smi pid_smi(pid_val);
-        result.Printf("Information for process id %" PRId64
-                      " (process=0x%" PRIx64 ")\n",
-                      pid_smi.GetValue(), process_obj.raw());
-      } else {
-        // This isn't the process object we are looking for.
-        continue;
-      }
+  for (int64_t i = 0; i < own_descriptors_count; i++) {
+    v8::Smi details = descriptors.GetDetails(i, err);
+    if (err.Fail()) return false;
 
-      v8::Value platform_val = process_obj.GetProperty("platform", err);
+    // Constants and accessors live in the descriptors, not in the object.
+    if (descriptors.IsFieldDetails(details)) {
+      if (descriptors.FieldIndex(details) < in_object_count)
+        shape->in_object++;
+      else
+        shape->out_of_object++;
+    }
+    if (!with_keys) continue;
 
-      if (platform_val.v8() != nullptr) {
-        v8::String platform_str(platform_val);
-        result.Printf("Platform = %s, ", platform_str.ToString(err).c_str());
-      }
+    v8::Value key = descriptors.GetKey(i, err);
+    if (err.Fail()) return false;
+    std::string name = key.ToString(err);
+    shape->keys.push_back(err.Success() ? name : "???");
+  }
+  return true;
+}
 
-      v8::Value arch_val = process_obj.GetProperty("arch", err);
 
-      if (arch_val.v8() != nullptr) {
-        v8::String arch_str(arch_val);
-        result.Printf("Architecture = %s, ", arch_str.ToString(err).c_str());
-      }
+static void WriteShape(JSONWriter& json, uint64_t map,
+                       const TypeRecord::MapRecord& record,
+                       const ShapeInfo& shape, bool readable) {
+  json.Key("map");
+  json.Address(map);
+  json.Member("instances", record.count);
+  json.Member("size", record.size);
+  if (!readable) return;
+  json.Member("dictionary", shape.dictionary);
+  json.Member("in_object", shape.in_object);
+  json.Member("out_of_object", shape.out_of_object);
+}
 
-      v8::Value ver_val = process_obj.GetProperty("version", err);
 
-      if (ver_val.v8() != nullptr) {
-        v8::String ver_str(ver_val);
-        result.Printf("Node Version = %s\n", ver_str.ToString(err).c_str());
-      }
+static const char* ShapeMode(const ShapeInfo& shape, bool readable) {
+  if (!readable) return "?";
+  return shape.dictionary ? "dict" : "fast";
+}
 
-      // Note the extra s on versions!
-      v8::Value versions_val = process_obj.GetProperty("versions", err);
-      if (versions_val.v8() != nullptr) {
-        v8::JSObject versions_obj(versions_val);
 
-        std::vector<std::string> version_keys;
+void FindObjectsCmd::PrintMaps(OutputSink& out,
+                               std::vector<TypeRecord*>& records) {
+  class Row {
+   public:
+    TypeRecord* type;
+    uint64_t map;
+    const TypeRecord::MapRecord* record;
+  };
+
+  std::vector<Row> rows;
+  uint64_t polymorphic = 0;
+  for (TypeRecord* t : records) {
+    for (auto& entry : t->GetMaps()) {
+      Row row = {t, entry.first, &entry.second};
+      rows.push_back(row);
+    }
+    if (t->GetMaps().size() > 1) polymorphic++;
+  }
+  // Like the types, the most common maps come last.
+  std::sort(rows.begin(), rows.end(), [](const Row& a, const Row& b) {
+    if (a.record->count != b.record->count)
+      return a.record->count < b.record->count;
+    return a.map < b.map;
+  });
+
+  JSONWriter& json = out.json_writer();
+  if (out.json()) {
+    json.BeginObject();
+    json.Key("maps");
+    json.BeginArray();
+  } else {
+    out.Printf(
+        " Instances  Total Size In-object Out-object Mode Map"
+        "                Name\n");
+    out.Printf(
+        " ---------- ---------- --------- ---------- ---- ------------------"
+        " ----\n");
+  }
 
-        // Get the list of keys on an object as strings.
-        versions_obj.Keys(version_keys, err);
+  for (const Row& row : rows) {
+    ShapeInfo shape;
+    bool readable = ReadShape(row.map, false, &shape);
+    if (out.json()) {
+      json.BeginObject();
+      json.Member("name", row.type->GetTypeName());
+      WriteShape(json, row.map, *row.record, shape, readable);
+      json.EndObject();
+      continue;
+    }
+    out.Printf(" %10" PRIu64 " %10" PRIu64 " %9" PRId64 " %10" PRId64
+               " %-4s 0x%016" PRIx64 " %s\n",
+               row.record->count, row.record->size, shape.in_object,
+               shape.out_of_object, ShapeMode(shape, readable), row.map,
+               row.type->GetTypeName().c_str());
+  }
 
-        std::sort(version_keys.begin(), version_keys.end());
+  if (out.json()) {
+    json.EndArray();
+    json.Member("polymorphic_types", polymorphic);
+    json.EndObject();
+  } else {
+    out.Printf(" %" PRIu64 " maps, %" PRIu64
+               " types have more than one. Use `v8 shapes <type>` to list "
+               "the properties of each.\n",
+               static_cast<uint64_t>(rows.size()), polymorphic);
+  }
+}
 
-        result.Printf("Component versions (process.versions=0x%" PRIx64 "):\n",
-                      versions_val.raw());
 
-        for (std::vector<std::string>::iterator key = version_keys.begin();
-             key != version_keys.end(); ++key) {
-          v8::Value ver_val = versions_obj.GetProperty(*key, err);
-          if (ver_val.v8() != nullptr) {
-            v8::String ver_str(ver_val);
-            result.Printf("    %s = %s\n", key->c_str(),
-                          ver_str.ToString(err).c_str());
-          }
-        }
+bool FindObjectsCmd::ComputeOwnedSizes(SBDebugger d,
+                                       SBCommandReturnObject& result,
+                                       const ScanOptions& options) {
+  uint64_t total = 0;
+  for (auto const& entry : llscan.GetMapsToInstances()) {
+    if (!entry.second->HasOwnedSize())
+      total += entry.second->GetInstanceCount();
+  }
+  if (total == 0) return true;
+
+  ScanProgress progress(d, "Owned sizes", total, false, options);
+  ObjectSizer sizer;
+  uint64_t done = 0;
+  for (auto const& entry : llscan.GetMapsToInstances()) {
+    TypeRecord* t = entry.second;
+    if (t->HasOwnedSize()) continue;
+
+    uint64_t size = 0;
+    for (uint64_t address : t->GetInstances()) {
+      if ((++done & 0x3ff) == 0 && !progress.Update(done, 0)) {
+        result.SetError("Owned size computation stopped early\n");
+        return false;
       }
 
-      v8::Value release_val = process_obj.GetProperty("release", err);
-      if (release_val.v8() != nullptr) {
-        v8::JSObject release_obj(release_val);
+      v8::Error err;
+      v8::HeapObject object(&llv8, address);
+      int64_t owned = sizer.OwnedSize(object, err);
+      if (err.Success()) size += owned;
+    }
+    t->SetTotalOwnedSize(size);
+  }
 
-        std::vector<std::string> release_keys;
+  return true;
+}
 
-        // Get the list of keys on an object as strings.
-        release_obj.Keys(release_keys, err);
 
-        result.Printf("Release Info (process.release=0x%" PRIx64 "):\n",
-                      release_val.raw());
+bool FindObjectsCmd::ParseScanOptions(char** cmd, ScanOptions* options) {
+  static struct option opts[] = {{"timeout", required_argument, nullptr, 't'},
+                                 {"sample", required_argument, nullptr, 'p'},
+                                 {"owned", no_argument, nullptr, 'O'},
+                                 {"space", required_argument, nullptr, 's'},
+                                 {"spaces", no_argument, nullptr, 'S'},
+                                 {"live-only", no_argument, nullptr, 'L'},
+                                 {"by-map", no_argument, nullptr, 'M'},
+                                 {"dictionaries", no_argument, nullptr, 'D'},
+                                 {nullptr, 0, nullptr, 0}};
 
-        for (std::vector<std::string>::iterator key = release_keys.begin();
-             key != release_keys.end(); ++key) {
-          v8::Value ver_val = release_obj.GetProperty(*key, err);
-          if (ver_val.v8() != nullptr) {
-            v8::String ver_str(ver_val);
-            result.Printf("    %s = %s\n", key->c_str(),
-                          ver_str.ToString(err).c_str());
-          }
-        }
-      }
+  int argc = 1;
+  for (char** p = cmd; p != nullptr && *p != nullptr; p++) argc++;
 
-      v8::Value execPath_val = process_obj.GetProperty("execPath", err);
+  char* args[argc];
 
-      if (execPath_val.v8() != nullptr) {
-        v8::String execPath_str(execPath_val);
-        result.Printf("Executable Path = %s\n",
-                      execPath_str.ToString(err).c_str());
-      }
+  // Make this look like a command line, we need a valid element at index 0
+  // for getopt_long to use in its error messages.
+  char name[] = "llscan";
+  args[0] = name;
+  for (int i = 0; i < argc - 1; i++) args[i + 1] = cmd[i];
 
-      v8::Value argv_val = process_obj.GetProperty("argv", err);
+  owned_ = false;
+  spaces_ = false;
+  by_map_ = false;
+  dictionaries_ = false;
+  space_name_.clear();
 
-      if (argv_val.v8() != nullptr) {
-        v8::JSArray argv_arr(argv_val);
-        result.Printf("Command line arguments (process.argv=0x%" PRIx64 "):\n",
-                      argv_val.raw());
-        // argv is an array, which we can treat as a subtype of object.
-        int64_t length = argv_arr.GetArrayLength(err);
-        for (int64_t i = 0; i < length; ++i) {
-          v8::Value element_val = argv_arr.GetArrayElement(i, err);
-          if (element_val.v8() != nullptr) {
-            v8::String element_str(element_val);
-            result.Printf("    [%" PRId64 "] = '%s'\n", i,
-                          element_str.ToString(err).c_str());
-          }
-        }
-      }
+  bool valid = true;
 
-      /* The docs for process.execArgv say "These options are useful in order
-       * to spawn child processes with the same execution environment
-       * as the parent." so being able to check these have been passed in
-       * seems like a good idea.
-       */
-      v8::Value execArgv_val = process_obj.GetProperty("execArgv", err);
+  // Reset getopts.
+  optind = 0;
+  opterr = 1;
+  do {
+    int arg = getopt_long(argc, args, "t:p:Os:SLMD", opts, nullptr);
+    if (arg == -1) break;
 
-      if (argv_val.v8() != nullptr) {
-        // Should possibly just treat this as an object in case anyone has
-        // attached a property.
-        v8::JSArray execArgv_arr(execArgv_val);
-        result.Printf(
-            "Node.js Comamnd line arguments (process.execArgv=0x%" PRIx64
-            "):\n",
-            execArgv_val.raw());
-        // execArgv is an array, which we can treat as a subtype of object.
-        int64_t length = execArgv_arr.GetArrayLength(err);
-        for (int64_t i = 0; i < length; ++i) {
-          v8::Value element_val = execArgv_arr.GetArrayElement(i, err);
-          if (element_val.v8() != nullptr) {
-            v8::String element_str(element_val);
-            result.Printf("    [%" PRId64 "] = '%s'\n", i,
-                          element_str.ToString(err).c_str());
-          }
-        }
+    switch (arg) {
+      case 't':
+        if (!ParseCount(optarg, &options->timeout)) valid = false;
+        break;
+      case 'p':
+        options->sample = strtod(optarg, nullptr);
+        break;
+      case 'O':
+        owned_ = true;
+        break;
+      case 's':
+        space_name_ = optarg;
+        break;
+      case 'S':
+        spaces_ = true;
+        break;
+      case 'L':
+        options->live_only = true;
+        break;
+      case 'M':
+        by_map_ = true;
+        break;
+      case 'D':
+        dictionaries_ = true;
+        break;
+      default:
+        continue;
+    }
+  } while (true);
+
+  return valid;
+}
+
+
+/* Write the `names` properties of every instance of `t` matching `filter`,
+ * for `findjsinstances --fields`. The rows go to `out`, the totals to
+ * `result` so that they stay out of files.
+ */
+static bool WriteFields(SBDebugger d, TypeRecord* t,
+                        const std::vector<std::string>& names,
+                        FieldTable::Format format, ObjectFilter* filter,
+                        const ScanOptions& scan_options,
+                        SBCommandReturnObject& result, OutputSink& out) {
+  auto flush = [&](const std::string& chunk) { out.Write(chunk); };
+
+  PropertyReader reader(&llscan, &llv8, d.GetSelectedTarget(), names);
+  uint64_t rows = 0;
+  uint64_t unreadable = 0;
+  uint64_t unreachable = 0;
+  uint64_t done = 0;
+  bool complete = true;
+  {
+    FieldTable table(&reader, names, format, flush);
+    table.WriteHeader();
+
+    ScanProgress progress(d, "Reading fields", t->GetInstances().size(),
+                          false, scan_options);
+    for (uint64_t address : t->GetInstances()) {
+      if (!progress.Update(done, rows)) {
+        complete = false;
+        break;
+      }
+      done++;
+
+      if (scan_options.live_only && !llscan.IsLive(address)) {
+        unreachable++;
+      } else if (filter != nullptr && !filter->Matches(address)) {
+        // Left out on purpose.
+      } else if (table.WriteRow(address)) {
+        rows++;
+      } else {
+        unreadable++;
       }
     }
+  }
 
-  } else {
-    result.Printf("No process objects found.\n");
+  // The totals follow the rows when both go to the result.
+  out.Flush();
+  if (!complete) {
+    result.Printf("PARTIAL RESULT: stopped after %" PRIu64 " of %" PRIu64
+                  " instances.\n",
+                  done, static_cast<uint64_t>(t->GetInstances().size()));
+  }
+  if (unreadable != 0) {
+    result.Printf("Unreadable: %" PRIu64 " instances left out.\n", unreadable);
+  }
+  if (unreachable != 0) {
+    result.Printf("Unreachable: %" PRIu64 " instances left out.\n",
+                  unreachable);
   }
 
+  result.SetStatus(eReturnStatusSuccessFinishResult);
   return true;
 }
 
 
-bool FindReferencesCmd::DoExecute(SBDebugger d, char** cmd,
-                                  SBCommandReturnObject& result) {
+bool Pager::Parse(char*** cmd, std::string* error) {
+  std::string limit;
+  std::string offset;
+  bool has_limit = CommandBase::TakeOption(*cmd, "--limit", &limit);
+  bool has_offset = CommandBase::TakeOption(*cmd, "--offset", &offset);
+  next_ = CommandBase::TakeFlag(*cmd, "--next");
+  paged_ = has_limit || has_offset || next_;
+
+  if (has_limit && (!CommandBase::ParseCount(limit, &limit_) || limit_ == 0)) {
+    *error = "--limit takes a number of results\n";
+    return false;
+  }
+  if (has_offset && !CommandBase::ParseCount(offset, &offset_)) {
+    *error = "--offset takes a number of results\n";
+    return false;
+  }
+
+  if (next_) {
+    if (has_offset || (*cmd != nullptr && **cmd != nullptr)) {
+      *error = "--next only takes --limit, it repeats the last paged command\n";
+      return false;
+    }
+    if (!cursor_->more) {
+      *error = "No more results, page through a listing with --limit first\n";
+      return false;
+    }
+    if (!has_limit) limit_ = cursor_->limit;
+    offset_ = position_ = cursor_->position;
+
+    // The command takes its arguments apart, it gets copies of them.
+    args_ = cursor_->args;
+    for (std::string& arg : args_) argv_.push_back(&arg[0]);
+    argv_.push_back(nullptr);
+    *cmd = argv_.data();
+  } else if (paged_) {
+    for (char** p = *cmd; p != nullptr && *p != nullptr; p++)
+      args_.push_back(*p);
+  }
+  return true;
+}
+
+
+void Pager::Save(uint64_t resume, bool more) {
+  if (!paged_) return;
+
+  // `args_` holds the arguments as they were before the command parsed them.
+  cursor_->args = args_;
+  cursor_->position = position_;
+  cursor_->resume = resume;
+  cursor_->limit = limit_;
+  cursor_->more = more;
+}
+
+
+void Pager::PrintFooter(OutputSink& out, const char* command) {
+  if (!paged_) return;
+
+  uint64_t first = std::min(offset_, position_);
+  if (out.json()) {
+    JSONWriter& json = out.json_writer();
+    json.Member("offset", first);
+    json.Member("more", cursor_->more);
+    return;
+  }
+
+  if (shown_ != 0) {
+    out.Printf("Listed results %" PRIu64 " to %" PRIu64 ".", first + 1,
+               first + shown_);
+  } else {
+    out.Printf("No results after the first %" PRIu64 ".", first);
+  }
+  if (cursor_->more)
+    out.Printf(" Run `v8 %s --next` for more.\n", command);
+  else
+    out.Printf("\n");
+}
+
+
+void FindInstancesCmd::WriteSample(OutputSink& out, TypeRecord* t,
+                                   uint64_t count, ObjectFilter* filter,
+                                   const ScanOptions& scan_options,
+                                   v8::Value::InspectOptions* inspect_options) {
+  /* Algorithm R, the n-th instance replaces a random pick with probability
+   * count / n, so every instance is as likely to end up in the sample.
+   */
+  std::mt19937_64 random(kSampleSeed);
+  std::vector<uint64_t> picks;
+  uint64_t matched = 0;
+  for (uint64_t address : t->GetInstances()) {
+    if (scan_options.live_only && !llscan.IsLive(address)) continue;
+    if (filter != nullptr && !filter->Matches(address)) continue;
+
+    if (++matched <= count) {
+      picks.push_back(address);
+      continue;
+    }
+    uint64_t slot = random() % matched;
+    if (slot < count) picks[slot] = address;
+  }
+  std::sort(picks.begin(), picks.end());
+
+  uint64_t instances = t->GetInstanceCount();
+  uint64_t size = t->GetTotalInstanceSize();
+  if (scan_options.live_only) {
+    instances = t->GetLiveInstanceCount();
+    size = t->GetLiveInstanceSize();
+  }
+
+  JSONWriter& json = out.json_writer();
+  if (out.json()) {
+    json.BeginObject();
+    json.Member("type", t->GetTypeName());
+    json.Member("count", instances);
+    json.Member("size", size);
+    json.Member("matched", matched);
+    json.Key("sample");
+    json.BeginArray();
+  } else {
+    out.Printf("%" PRIu64 " instances of %s, %" PRIu64 " bytes", instances,
+               t->GetTypeName().c_str(), size);
+    if (filter != nullptr) out.Printf(", %" PRIu64 " matching", matched);
+    out.Printf(". A sample of %" PRIu64 ":\n",
+               static_cast<uint64_t>(picks.size()));
+  }
+
+  for (uint64_t address : picks) {
+    v8::Error err;
+    v8::Value v8_value(&llv8, address);
+    if (out.json()) {
+      WriteValue(&json, v8_value, v8_value.Inspect(inspect_options, err));
+    } else {
+      out.Write(v8_value.Inspect(inspect_options, err));
+      out.Write("\n", 1);
+    }
+  }
+
+  if (out.json()) {
+    json.EndArray();
+    json.EndObject();
+  }
+}
+
+
+bool FindInstancesCmd::DoExecute(SBDebugger d, char** cmd,
+                                 SBCommandReturnObject& result) {
+  OutputSink out(d, result);
+  if (!ParseOutputOptions(cmd, &out, result)) return false;
+
+  Pager pager(&cursor_);
+  std::string pager_error;
+  if (!pager.Parse(&cmd, &pager_error)) {
+    result.SetError(pager_error.c_str());
+    return false;
+  }
+
   if (cmd == nullptr || *cmd == nullptr) {
-    result.SetError("USAGE: v8 findrefs expr\n");
+    result.SetError("USAGE: v8 findjsinstances [flags] instance_name\n");
     return false;
   }
 
@@ -320,989 +1131,2994 @@ bool FindReferencesCmd::DoExecute(SBDebugger d, char** cmd,
     return false;
   }
 
-  // Default scan type.
-  ScanType type = ScanType::kFieldValue;
+  ScanOptions scan_options;
+  scan_options.json = out.json();
+  scan_options.live_only = TakeFlag(cmd, "--live-only");
+
+  std::string fields;
+  std::string format_name;
+  std::string where;
+  std::string sample_text;
+  bool project = TakeOption(cmd, "--fields", &fields);
+  bool has_where = TakeOption(cmd, "--where", &where);
+  bool has_format = TakeOption(cmd, "--format", &format_name);
+  bool has_sample = TakeOption(cmd, "--sample", &sample_text);
+
+  uint64_t sample = 0;
+  if (has_sample &&
+      (!CommandBase::ParseCount(sample_text, &sample) || sample == 0)) {
+    result.SetError("--sample takes a number of instances\n");
+    return false;
+  }
+  if (has_sample && (project || pager.paged())) {
+    result.SetError("--sample can't be used with --fields or paging\n");
+    return false;
+  }
 
-  char** start = ParseScanOptions(cmd, &type);
+  FieldTable::Format format = out.json()
+                                  ? FieldTable::kJSONLines
+                                  : FieldTable::FormatForPath(out.path());
+  if (has_format && !FieldTable::ParseFormat(format_name, &format)) {
+    result.SetError("Unknown format, use tsv, csv or jsonl\n");
+    return false;
+  }
 
-  if (*start == nullptr) {
-    result.SetError("Missing search parameter");
-    result.SetStatus(eReturnStatusFailed);
+  std::vector<std::string> names;
+  for (size_t start = 0; project && start <= fields.size();) {
+    size_t end = fields.find(',', start);
+    if (end == std::string::npos) end = fields.size();
+    if (end > start) names.push_back(fields.substr(start, end - start));
+    start = end + 1;
+  }
+  if (project && names.empty()) {
+    result.SetError("USAGE: v8 findjsinstances --fields a,b,c instance_name\n");
+    return false;
+  }
+  if (project && pager.paged()) {
+    result.SetError("--fields can't be paged, it writes every instance\n");
     return false;
   }
 
   // Load V8 constants from postmortem data
   llv8.Load(target);
 
-  ObjectScanner* scanner;
+  ObjectFilter filter(&llscan, &llv8, target);
+  std::string filter_error;
+  if (has_where && !filter.Compile(where, &filter_error)) {
+    filter_error = "Invalid --where expression: " + filter_error + "\n";
+    result.SetError(filter_error.c_str());
+    return false;
+  }
 
-  switch (type) {
-    case ScanType::kFieldValue: {
-      std::string full_cmd;
-      for (; start != nullptr && *start != nullptr; start++) full_cmd += *start;
+  /* Ensure we have a map of objects. */
+  if (!llscan.ScanHeapForObjects(target, result, scan_options)) {
+    result.SetStatus(eReturnStatusFailed);
+    return false;
+  }
 
-      SBExpressionOptions options;
-      SBValue value = target.EvaluateExpression(full_cmd.c_str(), options);
-      if (value.GetError().Fail()) {
-        SBStream desc;
-        if (value.GetError().GetDescription(desc)) {
-          result.SetError(desc.GetData());
-        }
-        result.SetStatus(eReturnStatusFailed);
-        return false;
+  auto lock = llscan.LockResults();
+
+  if (scan_options.live_only &&
+      !llscan.MarkLiveObjects(target, result, scan_options)) {
+    result.SetStatus(eReturnStatusFailed);
+    return false;
+  }
+
+  v8::Value::InspectOptions inspect_options;
+
+  inspect_options.detailed = detailed_;
+
+  char** start = ParseInspectOptions(cmd, &inspect_options);
+
+  std::string full_cmd;
+  for (; start != nullptr && *start != nullptr; start++) full_cmd += *start;
+
+  std::string type_name = full_cmd;
+
+  TypeRecordMap::iterator instance_it =
+      llscan.GetMapsToInstances().find(type_name);
+  if (instance_it != llscan.GetMapsToInstances().end() && project) {
+    return WriteFields(d, instance_it->second, names, format,
+                       has_where ? &filter : nullptr, scan_options, result,
+                       out);
+  } else if (instance_it != llscan.GetMapsToInstances().end() && has_sample) {
+    WriteSample(out, instance_it->second, sample,
+                has_where ? &filter : nullptr, scan_options, &inspect_options);
+  } else if (instance_it != llscan.GetMapsToInstances().end()) {
+    std::set<uint64_t>& instances = instance_it->second->GetInstances();
+    uint64_t unreachable = 0;
+    JSONWriter& json = out.json_writer();
+    if (out.json()) {
+      json.BeginObject();
+      json.Member("type", type_name);
+      json.Key("instances");
+      json.BeginArray();
+    }
+    // The set is sorted by address, pages go on from the first one left out.
+    std::set<uint64_t>::iterator it =
+        pager.resuming() ? instances.lower_bound(pager.resume())
+                         : instances.begin();
+    // Only an instance that would be listed makes for another page.
+    bool more = false;
+    for (; it != instances.end(); ++it) {
+      if (scan_options.live_only && !llscan.IsLive(*it)) {
+        unreachable++;
+        continue;
       }
-      // Check the address we've been given at least looks like a valid object.
-      v8::Value search_value(&llv8, value.GetValueAsSigned());
-      v8::Smi smi(search_value);
-      if (smi.Check()) {
-        result.SetError("Search value is an SMI.");
-        result.SetStatus(eReturnStatusFailed);
-        return false;
+      if (has_where && !filter.Matches(*it)) continue;
+      if (pager.full()) {
+        more = true;
+        break;
       }
-      scanner = new ReferenceScanner(search_value);
-      break;
-    }
-    case ScanType::kPropertyName: {
-      // Check for extra parameters or parameters that needed quoting.
-      if (start[1] != nullptr) {
-        result.SetError("Extra search parameter or unquoted string specified.");
-        result.SetStatus(eReturnStatusFailed);
-        return false;
+      if (!pager.Take()) continue;
+
+      v8::Error err;
+      v8::Value v8_value(&llv8, *it);
+      if (out.json()) {
+        WriteValue(&json, v8_value, v8_value.Inspect(&inspect_options, err));
+      } else {
+        out.Write(v8_value.Inspect(&inspect_options, err));
+        out.Write("\n", 1);
       }
-      std::string property_name = start[0];
-      scanner = new PropertyScanner(property_name);
-      break;
+      out.Poll();
     }
-    case ScanType::kStringValue: {
-      // Check for extra parameters or parameters that needed quoting.
-      if (start[1] != nullptr) {
-        result.SetError("Extra search parameter or unquoted string specified.");
-        result.SetStatus(eReturnStatusFailed);
-        return false;
+    pager.Save(more ? *it : 0, more);
+
+    if (out.json()) {
+      json.EndArray();
+      if (scan_options.live_only) json.Member("unreachable", unreachable);
+      pager.PrintFooter(out, "findjsinstances");
+      json.EndObject();
+    } else {
+      if (unreachable != 0) {
+        out.Printf("Unreachable: %" PRId64 " instances left out.\n",
+                   unreachable);
       }
-      std::string string_value = start[0];
-      scanner = new StringScanner(string_value);
-      break;
-    }
-    /* We can add options to the command and further sub-classes of
-     * object scanner to do other searches, e.g.:
-     * - Objects that refer to a particular string literal.
-     *   (lldb) findreferences -s "Hello World!"
-     */
-    case ScanType::kBadOption: {
-      result.SetError("Invalid search type");
-      result.SetStatus(eReturnStatusFailed);
-      return false;
+      pager.PrintFooter(out, "findjsinstances");
     }
+
+  } else if (out.json()) {
+    std::string message =
+        "No objects found with type name " + type_name + "\n";
+    result.SetError(message.c_str());
+    return false;
+  } else {
+    out.Printf("No objects found with type name %s\n", type_name.c_str());
+    result.SetStatus(eReturnStatusFailed);
+    return false;
   }
 
-  /* Ensure we have a map of objects.
-   * (Do this after we've checked the options to avoid
-   * a long pause before reporting an error.)
-   */
-  if (!llscan.ScanHeapForObjects(target, result)) {
-    delete scanner;
+  result.SetStatus(eReturnStatusSuccessFinishResult);
+  return true;
+}
+
+
+bool FindLargestCmd::DoExecute(SBDebugger d, char** cmd,
+                               SBCommandReturnObject& result) {
+  OutputSink out(d, result);
+  if (!ParseOutputOptions(cmd, &out, result)) return false;
+
+  SBTarget target = d.GetSelectedTarget();
+  if (!target.IsValid()) {
+    result.SetError("No valid process, please start something\n");
+    return false;
+  }
+
+  ScanOptions scan_options;
+  scan_options.json = out.json();
+  if (!ParseScanOptions(cmd, &scan_options) || count_ == 0) {
+    result.SetError("USAGE: v8 findlargest [-n count] [--type name]\n");
+    return false;
+  }
+
+  /* Ensure we have a map of objects. */
+  if (!llscan.ScanHeapForObjects(target, result, scan_options)) {
     result.SetStatus(eReturnStatusFailed);
     return false;
   }
 
-  if (!scanner->AreReferencesLoaded()) {
-    ScanForReferences(scanner);
+  auto lock = llscan.LockResults();
+
+  if (scan_options.live_only &&
+      !llscan.MarkLiveObjects(target, result, scan_options)) {
+    result.SetStatus(eReturnStatusFailed);
+    return false;
   }
-  ReferencesVector* references = scanner->GetReferences();
-  PrintReferences(result, references, scanner);
 
-  delete scanner;
+  // Load V8 constants from postmortem data
+  llv8.Load(target);
+
+  std::vector<TypeRecord*> records;
+  uint64_t total = 0;
+  for (auto const& entry : llscan.GetMapsToInstances()) {
+    if (!type_name_.empty() && entry.first != type_name_) continue;
+    records.push_back(entry.second);
+    total += entry.second->GetInstanceCount();
+  }
+  if (records.empty() && out.json()) {
+    std::string message =
+        "No objects found with type name " + type_name_ + "\n";
+    result.SetError(message.c_str());
+    return false;
+  } else if (records.empty()) {
+    out.Printf("No objects found with type name %s\n", type_name_.c_str());
+    result.SetStatus(eReturnStatusFailed);
+    return false;
+  }
+
+  struct Entry {
+    uint64_t size;
+    uint64_t address;
+    TypeRecord* record;
+
+    bool operator>(const Entry& other) const { return size > other.size; }
+  };
+
+  // The smallest of the largest objects so far is on top.
+  std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> largest;
+
+  ScanProgress progress(d, "Sizing objects", total, false, scan_options);
+  ObjectSizer sizer;
+  uint64_t done = 0;
+  bool complete = true;
+  for (TypeRecord* t : records) {
+    for (uint64_t address : t->GetInstances()) {
+      if ((++done & 0x3ff) == 0 && !progress.Update(done, largest.size())) {
+        complete = false;
+        break;
+      }
+      if (scan_options.live_only && !llscan.IsLive(address)) continue;
+
+      v8::Error err;
+      int64_t size = sizer.OwnedSize(v8::HeapObject(&llv8, address), err);
+      if (err.Fail()) continue;
+
+      Entry entry = {static_cast<uint64_t>(size), address, t};
+      if (largest.size() < count_) {
+        largest.push(entry);
+      } else if (entry.size > largest.top().size) {
+        largest.pop();
+        largest.push(entry);
+      }
+    }
+    if (!complete) break;
+  }
+
+  std::vector<Entry> sorted;
+  for (; !largest.empty(); largest.pop()) sorted.push_back(largest.top());
+
+  v8::Value::InspectOptions inspect_options;
+  if (out.json()) {
+    JSONWriter& json = out.json_writer();
+    json.BeginObject();
+    json.Member("complete", complete);
+    json.Key("objects");
+    json.BeginArray();
+    for (auto it = sorted.rbegin(); it != sorted.rend(); ++it) {
+      v8::Error err;
+      v8::Value value(&llv8, it->address);
+      json.BeginObject();
+      json.Key("address");
+      json.Address(it->address);
+      json.Member("size", it->size);
+      json.Member("type", it->record->GetTypeName());
+      json.Member("inspect", value.Inspect(&inspect_options, err));
+      json.EndObject();
+    }
+    json.EndArray();
+    json.EndObject();
+    result.SetStatus(eReturnStatusSuccessFinishResult);
+    return true;
+  }
+
+  if (!complete) {
+    out.Printf("PARTIAL RESULT: stopped after %" PRIu64 " of %" PRIu64
+               " objects.\n",
+               done, total);
+  }
+
+  out.Printf("       Size Name                 Object\n");
+  out.Printf(" ---------- -------------------- ------\n");
+  for (auto it = sorted.rbegin(); it != sorted.rend(); ++it) {
+    v8::Error err;
+    v8::Value value(&llv8, it->address);
+    std::string preview = value.Inspect(&inspect_options, err);
+    out.Printf(" %10" PRIu64 " %-20s %s\n", it->size,
+               it->record->GetTypeName().c_str(), preview.c_str());
+  }
+
+  result.SetStatus(eReturnStatusSuccessFinishResult);
+  return true;
+}
+
+
+bool FindLargestCmd::ParseScanOptions(char** cmd, ScanOptions* options) {
+  static struct option opts[] = {{"count", required_argument, nullptr, 'n'},
+                                 {"type", required_argument, nullptr, 'T'},
+                                 {"timeout", required_argument, nullptr, 't'},
+                                 {"live-only", no_argument, nullptr, 'L'},
+                                 {nullptr, 0, nullptr, 0}};
+
+  int argc = 1;
+  for (char** p = cmd; p != nullptr && *p != nullptr; p++) argc++;
+
+  char* args[argc];
+
+  // Make this look like a command line, we need a valid element at index 0
+  // for getopt_long to use in its error messages.
+  char name[] = "llscan";
+  args[0] = name;
+  for (int i = 0; i < argc - 1; i++) args[i + 1] = cmd[i];
+
+  count_ = kDefaultCount;
+  type_name_.clear();
+
+  bool valid = true;
+
+  // Reset getopts.
+  optind = 0;
+  opterr = 1;
+  do {
+    int arg = getopt_long(argc, args, "n:T:t:L", opts, nullptr);
+    if (arg == -1) break;
+
+    switch (arg) {
+      case 'n':
+        count_ = strtoull(optarg, nullptr, 10);
+        break;
+      case 'T':
+        type_name_ = optarg;
+        break;
+      case 't':
+        if (!ParseCount(optarg, &options->timeout)) valid = false;
+        break;
+      case 'L':
+        options->live_only = true;
+        break;
+      default:
+        continue;
+    }
+  } while (true);
+
+  return valid;
+}
+
+
+// A string property of `obj` as a member of the same name, for --json.
+static void WriteStringProperty(JSONWriter* json, v8::JSObject& obj,
+                                const std::string& name) {
+  v8::Error err;
+  v8::Value value = obj.GetProperty(name, err);
+  if (value.v8() == nullptr) return;
+
+  v8::String str(value);
+  std::string text = str.ToString(err);
+  if (err.Success()) json->Member(name.c_str(), text);
+}
+
+
+// The strings in the array property `name` of `obj`, for --json.
+static void WriteStringArray(JSONWriter* json, v8::JSObject& obj,
+                             const char* name) {
+  v8::Error err;
+  v8::Value value = obj.GetProperty(name, err);
+  if (value.v8() == nullptr) return;
+
+  v8::JSArray array(value);
+  json->Key(name);
+  json->BeginArray();
+  int64_t length = array.GetArrayLength(err);
+  for (int64_t i = 0; i < length; ++i) {
+    v8::Value element = array.GetArrayElement(i, err);
+    if (element.v8() == nullptr) continue;
+    v8::String str(element);
+    json->String(str.ToString(err));
+  }
+  json->EndArray();
+}
+
+
+// The string properties of the object property `name` of `obj`, for --json.
+static void WriteStringObject(JSONWriter* json, v8::JSObject& obj,
+                              const char* name) {
+  v8::Error err;
+  v8::Value value = obj.GetProperty(name, err);
+  if (value.v8() == nullptr) return;
+
+  v8::JSObject inner(value);
+  std::vector<std::string> keys;
+  inner.Keys(keys, err);
+  json->Key(name);
+  json->BeginObject();
+  for (const std::string& key : keys) WriteStringProperty(json, inner, key);
+  json->EndObject();
+}
+
+
+/* What `v8 nodeinfo` prints about a process object, for --json. Returns
+ * false, writing nothing, when it has no pid.
+ */
+static bool WriteProcess(JSONWriter* json, v8::JSObject& process_obj) {
+  v8::Error err;
+  v8::Value pid_val = process_obj.GetProperty("pid", err);
+  if (pid_val.v8() == nullptr) return false;
+
+  json->BeginObject();
+  json->Key("address");
+  json->Address(process_obj.raw());
+  json->Member("pid", v8::Smi(pid_val).GetValue());
+  WriteStringProperty(json, process_obj, "platform");
+  WriteStringProperty(json, process_obj, "arch");
+  WriteStringProperty(json, process_obj, "version");
+  WriteStringObject(json, process_obj, "versions");
+  WriteStringObject(json, process_obj, "release");
+  WriteStringProperty(json, process_obj, "execPath");
+  WriteStringArray(json, process_obj, "argv");
+  WriteStringArray(json, process_obj, "execArgv");
+  json->EndObject();
+  return true;
+}
+
+
+bool NodeInfoCmd::DoExecute(SBDebugger d, char** cmd,
+                            SBCommandReturnObject& result) {
+  OutputSink out(d, result);
+  if (!ParseOutputOptions(cmd, &out, result)) return false;
+
+  SBTarget target = d.GetSelectedTarget();
+  if (!target.IsValid()) {
+    result.SetError("No valid process, please start something\n");
+    return false;
+  }
+
+  ScanOptions scan_options;
+  scan_options.json = out.json();
+
+  /* Ensure we have a map of objects. */
+  if (!llscan.ScanHeapForObjects(target, result, scan_options)) {
+    return false;
+  }
+
+  auto lock = llscan.LockResults();
+
+  std::string process_type_name("process");
+
+  TypeRecordMap::iterator instance_it =
+      llscan.GetMapsToInstances().find(process_type_name);
+
+  JSONWriter& json = out.json_writer();
+  if (out.json()) {
+    json.BeginObject();
+    json.Key("processes");
+    json.BeginArray();
+  }
+
+  if (instance_it != llscan.GetMapsToInstances().end()) {
+    TypeRecord* t = instance_it->second;
+    for (std::set<uint64_t>::iterator it = t->GetInstances().begin();
+         it != t->GetInstances().end(); ++it) {
+      v8::Error err;
+
+      // The properties object should be a JSObject
+      v8::JSObject process_obj(&llv8, *it);
+
+      if (out.json()) {
+        WriteProcess(&json, process_obj);
+        continue;
+      }
+
+      v8::Value pid_val = process_obj.GetProperty("pid", err);
+
+      if (pid_val.v8() != nullptr) {
+        v8::Smi pid_smi(pid_val);
+        out.Printf("Information for process id %" PRId64
+                   " (process=0x%" PRIx64 ")\n",
+                   pid_smi.GetValue(), process_obj.raw());
+      } else {
+        // This isn't the process object we are looking for.
+        continue;
+      }
+
+      v8::Value platform_val = process_obj.GetProperty("platform", err);
+
+      if (platform_val.v8() != nullptr) {
+        v8::String platform_str(platform_val);
+        out.Printf("Platform = %s, ", platform_str.ToString(err).c_str());
+      }
+
+      v8::Value arch_val = process_obj.GetProperty("arch", err);
+
+      if (arch_val.v8() != nullptr) {
+        v8::String arch_str(arch_val);
+        out.Printf("Architecture = %s, ", arch_str.ToString(err).c_str());
+      }
+
+      v8::Value ver_val = process_obj.GetProperty("version", err);
+
+      if (ver_val.v8() != nullptr) {
+        v8::String ver_str(ver_val);
+        out.Printf("Node Version = %s\n", ver_str.ToString(err).c_str());
+      }
+
+      // Note the extra s on versions!
+      v8::Value versions_val = process_obj.GetProperty("versions", err);
+      if (versions_val.v8() != nullptr) {
+        v8::JSObject versions_obj(versions_val);
+
+        std::vector<std::string> version_keys;
+
+        // Get the list of keys on an object as strings.
+        versions_obj.Keys(version_keys, err);
+
+        std::sort(version_keys.begin(), version_keys.end());
+
+        out.Printf("Component versions (process.versions=0x%" PRIx64 "):\n",
+                   versions_val.raw());
+
+        for (std::vector<std::string>::iterator key = version_keys.begin();
+             key != version_keys.end(); ++key) {
+          v8::Value ver_val = versions_obj.GetProperty(*key, err);
+          if (ver_val.v8() != nullptr) {
+            v8::String ver_str(ver_val);
+            out.Printf("    %s = %s\n", key->c_str(),
+                       ver_str.ToString(err).c_str());
+          }
+        }
+      }
+
+      v8::Value release_val = process_obj.GetProperty("release", err);
+      if (release_val.v8() != nullptr) {
+        v8::JSObject release_obj(release_val);
+
+        std::vector<std::string> release_keys;
+
+        // Get the list of keys on an object as strings.
+        release_obj.Keys(release_keys, err);
+
+        out.Printf("Release Info (process.release=0x%" PRIx64 "):\n",
+                   release_val.raw());
+
+        for (std::vector<std::string>::iterator key = release_keys.begin();
+             key != release_keys.end(); ++key) {
+          v8::Value ver_val = release_obj.GetProperty(*key, err);
+          if (ver_val.v8() != nullptr) {
+            v8::String ver_str(ver_val);
+            out.Printf("    %s = %s\n", key->c_str(),
+                       ver_str.ToString(err).c_str());
+          }
+        }
+      }
+
+      v8::Value execPath_val = process_obj.GetProperty("execPath", err);
+
+      if (execPath_val.v8() != nullptr) {
+        v8::String execPath_str(execPath_val);
+        out.Printf("Executable Path = %s\n",
+                   execPath_str.ToString(err).c_str());
+      }
+
+      v8::Value argv_val = process_obj.GetProperty("argv", err);
+
+      if (argv_val.v8() != nullptr) {
+        v8::JSArray argv_arr(argv_val);
+        out.Printf("Command line arguments (process.argv=0x%" PRIx64 "):\n",
+                   argv_val.raw());
+        // argv is an array, which we can treat as a subtype of object.
+        int64_t length = argv_arr.GetArrayLength(err);
+        for (int64_t i = 0; i < length; ++i) {
+          v8::Value element_val = argv_arr.GetArrayElement(i, err);
+          if (element_val.v8() != nullptr) {
+            v8::String element_str(element_val);
+            out.Printf("    [%" PRId64 "] = '%s'\n", i,
+                       element_str.ToString(err).c_str());
+          }
+        }
+      }
+
+      /* The docs for process.execArgv say "These options are useful in order
+       * to spawn child processes with the same execution environment
+       * as the parent." so being able to check these have been passed in
+       * seems like a good idea.
+       */
+      v8::Value execArgv_val = process_obj.GetProperty("execArgv", err);
+
+      if (argv_val.v8() != nullptr) {
+        // Should possibly just treat this as an object in case anyone has
+        // attached a property.
+        v8::JSArray execArgv_arr(execArgv_val);
+        out.Printf(
+            "Node.js Comamnd line arguments (process.execArgv=0x%" PRIx64
+            "):\n",
+            execArgv_val.raw());
+        // execArgv is an array, which we can treat as a subtype of object.
+        int64_t length = execArgv_arr.GetArrayLength(err);
+        for (int64_t i = 0; i < length; ++i) {
+          v8::Value element_val = execArgv_arr.GetArrayElement(i, err);
+          if (element_val.v8() != nullptr) {
+            v8::String element_str(element_val);
+            out.Printf("    [%" PRId64 "] = '%s'\n", i,
+                       element_str.ToString(err).c_str());
+          }
+        }
+      }
+    }
+
+  } else if (!out.json()) {
+    out.Printf("No process objects found.\n");
+  }
+
+  if (out.json()) {
+    json.EndArray();
+    json.EndObject();
+  }
+
+  return true;
+}
+
+
+bool ShapesCmd::DoExecute(SBDebugger d, char** cmd,
+                          SBCommandReturnObject& result) {
+  OutputSink out(d, result);
+  if (!ParseOutputOptions(cmd, &out, result)) return false;
+
+  if (cmd == nullptr || *cmd == nullptr) {
+    result.SetError("USAGE: v8 shapes type_name\n");
+    return false;
+  }
+
+  SBTarget target = d.GetSelectedTarget();
+  if (!target.IsValid()) {
+    result.SetError("No valid process, please start something\n");
+    return false;
+  }
+
+  ScanOptions scan_options;
+  scan_options.json = out.json();
+
+  std::string type_name;
+  for (char** start = cmd; *start != nullptr; start++) type_name += *start;
+
+  /* Ensure we have a map of objects. */
+  if (!llscan.ScanHeapForObjects(target, result, scan_options)) {
+    result.SetStatus(eReturnStatusFailed);
+    return false;
+  }
+
+  auto lock = llscan.LockResults();
+
+  // Load V8 constants from postmortem data
+  llv8.Load(target);
+
+  TypeRecordMap::iterator it = llscan.GetMapsToInstances().find(type_name);
+  if (it == llscan.GetMapsToInstances().end()) {
+    std::string message =
+        "No objects found with type name " + type_name + "\n";
+    result.SetError(message.c_str());
+    return false;
+  }
+
+  // The most common shapes first.
+  typedef std::pair<uint64_t, const TypeRecord::MapRecord*> Shape;
+  std::vector<Shape> shapes;
+  for (auto& entry : it->second->GetMaps())
+    shapes.push_back(std::make_pair(entry.first, &entry.second));
+  std::sort(shapes.begin(), shapes.end(), [](const Shape& a, const Shape& b) {
+    if (a.second->count != b.second->count)
+      return a.second->count > b.second->count;
+    return a.first < b.first;
+  });
+
+  JSONWriter& json = out.json_writer();
+  if (out.json()) {
+    json.BeginObject();
+    json.Member("type", type_name);
+    json.Key("maps");
+    json.BeginArray();
+  } else {
+    out.Printf("%s has %" PRIu64 " maps:\n", type_name.c_str(),
+               static_cast<uint64_t>(shapes.size()));
+    out.Printf(" Instances  Total Size In-object Out-object Mode Map\n");
+    out.Printf(
+        " ---------- ---------- --------- ---------- ---- "
+        "------------------\n");
+  }
+
+  for (const Shape& entry : shapes) {
+    ShapeInfo shape;
+    bool readable = ReadShape(entry.first, true, &shape);
+    if (out.json()) {
+      json.BeginObject();
+      WriteShape(json, entry.first, *entry.second, shape, readable);
+      json.Key("keys");
+      json.BeginArray();
+      for (const std::string& key : shape.keys) json.String(key);
+      json.EndArray();
+      json.EndObject();
+      continue;
+    }
+
+    out.Printf(" %10" PRIu64 " %10" PRIu64 " %9" PRId64 " %10" PRId64
+               " %-4s 0x%016" PRIx64 "\n",
+               entry.second->count, entry.second->size, shape.in_object,
+               shape.out_of_object, ShapeMode(shape, readable), entry.first);
+    if (shape.keys.empty()) continue;
+    std::string keys;
+    for (const std::string& key : shape.keys)
+      keys += (keys.empty() ? "" : ", ") + key;
+    out.Printf("            Properties: %s\n", keys.c_str());
+  }
+
+  if (out.json()) {
+    json.EndArray();
+    json.EndObject();
+  }
+
+  result.SetStatus(eReturnStatusSuccessFinishResult);
+  return true;
+}
+
+
+bool FindReferencesCmd::DoExecute(SBDebugger d, char** cmd,
+                                  SBCommandReturnObject& result) {
+  OutputSink out(d, result);
+  if (!ParseOutputOptions(cmd, &out, result)) return false;
+
+  Pager pager(&cursor_);
+  std::string pager_error;
+  if (!pager.Parse(&cmd, &pager_error)) {
+    result.SetError(pager_error.c_str());
+    return false;
+  }
+
+  if (cmd == nullptr || *cmd == nullptr) {
+    result.SetError("USAGE: v8 findrefs expr\n");
+    return false;
+  }
+
+  SBTarget target = d.GetSelectedTarget();
+  if (!target.IsValid()) {
+    result.SetError("No valid process, please start something\n");
+    return false;
+  }
+
+  // Default scan type.
+  ScanType type = ScanType::kFieldValue;
+  ScanOptions scan_options;
+  scan_options.json = out.json();
+
+  char** start = ParseScanOptions(cmd, &type, &scan_options);
+  if (start == nullptr) {
+    result.SetError("USAGE: v8 findrefs expr\n");
+    return false;
+  }
+
+  if (*start == nullptr) {
+    result.SetError("Missing search parameter");
+    result.SetStatus(eReturnStatusFailed);
+    return false;
+  }
+
+  // Load V8 constants from postmortem data
+  llv8.Load(target);
+
+  ObjectFilter filter(&llscan, &llv8, target);
+  std::string filter_error;
+  if (!where_.empty() && !filter.Compile(where_, &filter_error)) {
+    filter_error = "Invalid --where expression: " + filter_error + "\n";
+    result.SetError(filter_error.c_str());
+    result.SetStatus(eReturnStatusFailed);
+    return false;
+  }
+
+  ObjectScanner* scanner;
+
+  switch (type) {
+    case ScanType::kFieldValue: {
+      std::string full_cmd;
+      for (; start != nullptr && *start != nullptr; start++) full_cmd += *start;
+
+      SBExpressionOptions options;
+      SBValue value = target.EvaluateExpression(full_cmd.c_str(), options);
+      if (value.GetError().Fail()) {
+        SBStream desc;
+        if (value.GetError().GetDescription(desc)) {
+          result.SetError(desc.GetData());
+        }
+        result.SetStatus(eReturnStatusFailed);
+        return false;
+      }
+      // Check the address we've been given at least looks like a valid object.
+      v8::Value search_value(&llv8, value.GetValueAsSigned());
+      v8::Smi smi(search_value);
+      if (smi.Check()) {
+        result.SetError("Search value is an SMI.");
+        result.SetStatus(eReturnStatusFailed);
+        return false;
+      }
+      scanner = new ReferenceScanner(search_value);
+      break;
+    }
+    case ScanType::kPropertyName: {
+      // Check for extra parameters or parameters that needed quoting.
+      if (start[1] != nullptr) {
+        result.SetError("Extra search parameter or unquoted string specified.");
+        result.SetStatus(eReturnStatusFailed);
+        return false;
+      }
+      std::string property_name = start[0];
+      scanner = new PropertyScanner(property_name);
+      break;
+    }
+    case ScanType::kStringValue: {
+      // Check for extra parameters or parameters that needed quoting.
+      if (start[1] != nullptr) {
+        result.SetError("Extra search parameter or unquoted string specified.");
+        result.SetStatus(eReturnStatusFailed);
+        return false;
+      }
+      std::string string_value = start[0];
+      scanner = new StringScanner(string_value);
+      break;
+    }
+    /* We can add options to the command and further sub-classes of
+     * object scanner to do other searches, e.g.:
+     * - Objects that refer to a particular string literal.
+     *   (lldb) findreferences -s "Hello World!"
+     */
+    case ScanType::kBadOption: {
+      result.SetError("Invalid search type");
+      result.SetStatus(eReturnStatusFailed);
+      return false;
+    }
+  }
+
+  /* Ensure we have a map of objects.
+   * (Do this after we've checked the options to avoid
+   * a long pause before reporting an error.)
+   */
+  if (!llscan.ScanHeapForObjects(target, result, scan_options)) {
+    delete scanner;
+    result.SetStatus(eReturnStatusFailed);
+    return false;
+  }
+
+  auto lock = llscan.LockResults();
+
+  if (scan_options.live_only &&
+      !llscan.MarkLiveObjects(target, result, scan_options)) {
+    delete scanner;
+    result.SetStatus(eReturnStatusFailed);
+    return false;
+  }
+
+  bool complete = llscan.IsScanComplete();
+
+  bool references_complete = scanner->AreReferencesLoaded() ||
+                             ScanForReferences(scanner, d, scan_options);
+  if (!references_complete) {
+    complete = false;
+    if (!out.json())
+      out.Printf(
+          "PARTIAL RESULT: reference scan stopped early, run the command "
+          "again to scan for all references.\n");
+  }
+  JSONWriter& json = out.json_writer();
+  if (out.json()) {
+    json.BeginObject();
+    json.Member("complete", complete);
+  }
+  ReferencesVector* references = scanner->GetReferences();
+  PrintReferences(out, references, scanner, scan_options.live_only,
+                  where_.empty() ? nullptr : &filter, &pager);
+  pager.PrintFooter(out, "findrefs");
+  if (out.json()) json.EndObject();
+
+  // Don't keep partial references around, the next search starts over.
+  if (!complete) llscan.ClearReferences();
+
+  delete scanner;
+
+  result.SetStatus(eReturnStatusSuccessFinishResult);
+  return true;
+}
+
+
+bool FindReferencesCmd::ScanForReferences(ObjectScanner* scanner,
+                                          SBDebugger d,
+                                          const ScanOptions& options) {
+  // Walk all the object instances and handle them according to their type.
+  // The caller holds the results lock, the map can't change under us.
+  TypeRecordMap& mapstoinstances = llscan.GetMapsToInstances();
+
+  uint64_t total = 0;
+  for (auto const& entry : mapstoinstances)
+    total += entry.second->GetInstanceCount();
+
+  ScanProgress progress(d, "Scanning for references", total, false, options);
+  uint64_t done = 0;
+
+  for (auto const& entry : mapstoinstances) {
+    TypeRecord* typerecord = entry.second;
+    for (uint64_t addr : typerecord->GetInstances()) {
+      ReferencesVector* references = scanner->GetReferences();
+      if (!progress.Update(done++,
+                           references == nullptr ? 0 : references->size()))
+        return false;
+
+      v8::Error err;
+      v8::Value obj_value(&llv8, addr);
+      v8::HeapObject heap_object(obj_value);
+      int64_t type = heap_object.GetType(err);
+      v8::LLV8* v8 = heap_object.v8();
+
+      // We only need to handle the types that are in
+      // FindJSObjectsVisitor::IsAHistogramType
+      // as those are the only objects that end up in GetMapsToInstances
+      if (v8::JSObject::IsObjectType(v8, type) ||
+          type == v8->types()->kJSArrayType) {
+        // Objects can have elements and arrays can have named properties.
+        // Basically we need to access objects and arrays as both objects and
+        // arrays.
+        v8::JSObject js_obj(heap_object);
+        scanner->ScanRefs(js_obj, err);
+
+      } else if (type < v8->types()->kFirstNonstringType) {
+        v8::String str(heap_object);
+        scanner->ScanRefs(str, err);
+
+      } else if (type == v8->types()->kJSTypedArrayType) {
+        // These should only point to off heap memory,
+        // this case should be a no-op.
+      } else {
+        // result.Printf("Unhandled type: %" PRId64 " for addr %" PRIx64
+        //    "\n", type, addr);
+      }
+    }
+  }
+
+  return true;
+}
+
+
+/* Print that `holder`, of type `type_name`, refers to `value` through the
+ * property `name`, or the element `index` when `name` is null. `text` is the
+ * string `value` refers to, for `findrefs -s`.
+ */
+static void PrintReference(OutputSink& out, uint64_t holder,
+                           const std::string& type_name, const char* name,
+                           int64_t index, uint64_t value,
+                           const std::string* text = nullptr) {
+  if (out.json()) {
+    JSONWriter& json = out.json_writer();
+    json.BeginObject();
+    json.Key("holder");
+    json.Address(holder);
+    json.Member("type", type_name);
+    if (name != nullptr)
+      json.Member("property", name);
+    else
+      json.Member("index", index);
+    json.Key("value");
+    json.Address(value);
+    if (text != nullptr) json.Member("string", *text);
+    json.EndObject();
+    return;
+  }
+
+  if (name != nullptr)
+    out.Printf("0x%" PRIx64 ": %s.%s=0x%" PRIx64, holder, type_name.c_str(),
+               name, value);
+  else
+    out.Printf("0x%" PRIx64 ": %s[%" PRId64 "]=0x%" PRIx64, holder,
+               type_name.c_str(), index, value);
+  if (text != nullptr)
+    out.Printf(" '%s'\n", text->c_str());
+  else
+    out.Write("\n", 1);
+}
+
+
+void FindReferencesCmd::PrintReferences(OutputSink& out,
+                                        ReferencesVector* references,
+                                        ObjectScanner* scanner,
+                                        bool live_only, ObjectFilter* filter,
+                                        Pager* pager) {
+  JSONWriter& json = out.json_writer();
+  if (out.json()) {
+    json.Key("references");
+    json.BeginArray();
+  }
+
+  // Walk all the object instances and handle them according to their type.
+  uint64_t unreachable = 0;
+  bool more = false;
+  size_t i = pager != nullptr && pager->resuming() ? pager->resume() : 0;
+  for (; i < references->size(); i++) {
+    uint64_t addr = (*references)[i];
+    if (live_only && !llscan.IsLive(addr)) {
+      unreachable++;
+      continue;
+    }
+    if (filter != nullptr && !filter->Matches(addr)) continue;
+    if (pager != nullptr && pager->full()) {
+      more = true;
+      break;
+    }
+    if (pager != nullptr && !pager->Take()) continue;
+
+    v8::Error err;
+    v8::Value obj_value(&llv8, addr);
+    v8::HeapObject heap_object(obj_value);
+    int64_t type = heap_object.GetType(err);
+    v8::LLV8* v8 = heap_object.v8();
+
+    // We only need to handle the types that are in
+    // FindJSObjectsVisitor::IsAHistogramType
+    // as those are the only objects that end up in GetMapsToInstances
+    if (v8::JSObject::IsObjectType(v8, type) ||
+        type == v8->types()->kJSArrayType) {
+      // Objects can have elements and arrays can have named properties.
+      // Basically we need to access objects and arrays as both objects and
+      // arrays.
+      v8::JSObject js_obj(heap_object);
+      scanner->PrintRefs(out, js_obj, err);
+
+    } else if (type < v8->types()->kFirstNonstringType) {
+      v8::String str(heap_object);
+      scanner->PrintRefs(out, str, err);
+
+    } else if (type == v8->types()->kJSTypedArrayType) {
+      // These should only point to off heap memory,
+      // this case should be a no-op.
+    } else {
+      // out.Printf("Unhandled type: %" PRId64 " for addr %" PRIx64
+      //    "\n", type, addr);
+    }
+    out.Poll();
+  }
+  if (pager != nullptr) pager->Save(i, more);
+
+  if (out.json()) {
+    json.EndArray();
+    if (live_only) json.Member("unreachable", unreachable);
+  } else if (unreachable != 0) {
+    out.Printf("Unreachable: %" PRId64 " referring objects left out.\n",
+               unreachable);
+  }
+}
+
+
+char** FindReferencesCmd::ParseScanOptions(char** cmd, ScanType* type,
+                                           ScanOptions* options) {
+  static struct option opts[] = {{"value", no_argument, nullptr, 'v'},
+                                 {"name", no_argument, nullptr, 'n'},
+                                 {"string", no_argument, nullptr, 's'},
+                                 {"timeout", required_argument, nullptr, 't'},
+                                 {"live-only", no_argument, nullptr, 'L'},
+                                 {"where", required_argument, nullptr, 'w'},
+                                 {nullptr, 0, nullptr, 0}};
+
+  int argc = 1;
+  for (char** p = cmd; p != nullptr && *p != nullptr; p++) argc++;
+
+  char* args[argc];
+
+  // Make this look like a command line, we need a valid element at index 0
+  // for getopt_long to use in its error messages.
+  char name[] = "llscan";
+  args[0] = name;
+  for (int i = 0; i < argc - 1; i++) args[i + 1] = cmd[i];
+
+  bool found_scan_type = false;
+  where_.clear();
+
+  bool valid = true;
+
+  // Reset getopts.
+  optind = 0;
+  opterr = 1;
+  do {
+    int arg = getopt_long(argc, args, "vnst:Lw:", opts, nullptr);
+    if (arg == -1) break;
+
+    if (arg == 't') {
+      if (!ParseCount(optarg, &options->timeout)) valid = false;
+      continue;
+    }
+    if (arg == 'w') {
+      where_ = optarg;
+      continue;
+    }
+    if (arg == 'L') {
+      options->live_only = true;
+      continue;
+    }
+
+    if (found_scan_type) {
+      *type = ScanType::kBadOption;
+      break;
+    }
+
+    switch (arg) {
+      case 'v':
+        *type = ScanType::kFieldValue;
+        found_scan_type = true;
+        break;
+      case 'n':
+        *type = ScanType::kPropertyName;
+        found_scan_type = true;
+        break;
+      case 's':
+        *type = ScanType::kStringValue;
+        found_scan_type = true;
+        break;
+      default:
+        *type = ScanType::kBadOption;
+        break;
+    }
+  } while (true);
+
+  if (!valid) return nullptr;
+  return &cmd[optind - 1];
+}
+
+
+void FindReferencesCmd::ReferenceScanner::PrintRefs(
+    OutputSink& out, v8::JSObject& js_obj, v8::Error& err) {
+  int64_t length = js_obj.GetArrayLength(err);
+  for (int64_t i = 0; i < length; ++i) {
+    v8::Value v = js_obj.GetArrayElement(i, err);
+
+    // Array is borked, or not array at all - skip it
+    if (!err.Success()) break;
+
+    if (v.raw() != search_value_.raw()) continue;
+
+    std::string type_name = js_obj.GetTypeName(err);
+    PrintReference(out, js_obj.raw(), type_name, nullptr, i,
+                   search_value_.raw());
+  }
+
+  // Walk all the properties in this object.
+  // We only create strings for the field names that match the search
+  // value.
+  std::vector<std::pair<v8::Value, v8::Value>> entries = js_obj.Entries(err);
+  if (err.Fail()) {
+    return;
+  }
+  for (auto entry : entries) {
+    v8::Value v = entry.second;
+    if (v.raw() == search_value_.raw()) {
+      std::string key = entry.first.ToString(err);
+      std::string type_name = js_obj.GetTypeName(err);
+      PrintReference(out, js_obj.raw(), type_name, key.c_str(), 0,
+                     search_value_.raw());
+    }
+  }
+}
+
+
+void FindReferencesCmd::ReferenceScanner::PrintRefs(
+    OutputSink& out, v8::String& str, v8::Error& err) {
+  v8::LLV8* v8 = str.v8();
+
+  int64_t repr = str.Representation(err);
+
+  // Concatenated and sliced strings refer to other strings so
+  // we need to check their references.
+
+  if (repr == v8->string()->kSlicedStringTag) {
+    v8::SlicedString sliced_str(str);
+    v8::String parent = sliced_str.Parent(err);
+    if (err.Success() && parent.raw() == search_value_.raw()) {
+      std::string type_name = sliced_str.GetTypeName(err);
+      PrintReference(out, str.raw(), type_name, "<Parent>", 0,
+                     search_value_.raw());
+    }
+  } else if (repr == v8->string()->kConsStringTag) {
+    v8::ConsString cons_str(str);
+
+    v8::String first = cons_str.First(err);
+    if (err.Success() && first.raw() == search_value_.raw()) {
+      std::string type_name = cons_str.GetTypeName(err);
+      PrintReference(out, str.raw(), type_name, "<First>", 0,
+                     search_value_.raw());
+    }
+
+    v8::String second = cons_str.Second(err);
+    if (err.Success() && second.raw() == search_value_.raw()) {
+      std::string type_name = cons_str.GetTypeName(err);
+      PrintReference(out, str.raw(), type_name, "<Second>", 0,
+                     search_value_.raw());
+    }
+  } else if (repr == v8->string()->kThinStringTag) {
+    v8::ThinString thin_str(str);
+    v8::String actual = thin_str.Actual(err);
+    if (err.Success() && actual.raw() == search_value_.raw()) {
+      std::string type_name = thin_str.GetTypeName(err);
+      PrintReference(out, str.raw(), type_name, "<Actual>", 0,
+                     search_value_.raw());
+    }
+  }
+  // Nothing to do for other kinds of string.
+}
+
+
+void FindReferencesCmd::ReferenceScanner::ScanRefs(v8::JSObject& js_obj,
+                                                   v8::Error& err) {
+  ReferencesVector* references;
+  std::set<uint64_t> already_saved;
+
+  int64_t length = js_obj.GetArrayLength(err);
+  for (int64_t i = 0; i < length; ++i) {
+    v8::Value v = js_obj.GetArrayElement(i, err);
+
+    // Array is borked, or not array at all - skip it
+    if (!err.Success()) break;
+    if (already_saved.count(v.raw())) continue;
+
+    references = llscan.GetReferencesByValue(v.raw());
+    references->push_back(js_obj.raw());
+    already_saved.insert(v.raw());
+  }
+
+  // Walk all the properties in this object.
+  // We only create strings for the field names that match the search
+  // value.
+  std::vector<std::pair<v8::Value, v8::Value>> entries = js_obj.Entries(err);
+  if (err.Fail()) {
+    return;
+  }
+  for (auto entry : entries) {
+    v8::Value v = entry.second;
+
+    if (already_saved.count(v.raw())) continue;
+
+    references = llscan.GetReferencesByValue(v.raw());
+    references->push_back(js_obj.raw());
+    already_saved.insert(v.raw());
+  }
+}
+
+
+void FindReferencesCmd::ReferenceScanner::ScanRefs(v8::String& str,
+                                                   v8::Error& err) {
+  ReferencesVector* references;
+  std::set<uint64_t> already_saved;
+
+  v8::LLV8* v8 = str.v8();
+
+  int64_t repr = str.Representation(err);
+
+  // Concatenated and sliced strings refer to other strings so
+  // we need to check their references.
+
+  if (repr == v8->string()->kSlicedStringTag) {
+    v8::SlicedString sliced_str(str);
+    v8::String parent = sliced_str.Parent(err);
+
+    if (err.Success()) {
+      references = llscan.GetReferencesByValue(parent.raw());
+      references->push_back(str.raw());
+    }
+
+  } else if (repr == v8->string()->kConsStringTag) {
+    v8::ConsString cons_str(str);
+
+    v8::String first = cons_str.First(err);
+    if (err.Success()) {
+      references = llscan.GetReferencesByValue(first.raw());
+      references->push_back(str.raw());
+    }
+
+    v8::String second = cons_str.Second(err);
+    if (err.Success() && first.raw() != second.raw()) {
+      references = llscan.GetReferencesByValue(second.raw());
+      references->push_back(str.raw());
+    }
+  } else if (repr == v8->string()->kThinStringTag) {
+    v8::ThinString thin_str(str);
+    v8::String actual = thin_str.Actual(err);
+
+    if (err.Success()) {
+      references = llscan.GetReferencesByValue(actual.raw());
+      references->push_back(str.raw());
+    }
+  }
+  // Nothing to do for other kinds of string.
+}
+
+
+bool FindReferencesCmd::ReferenceScanner::AreReferencesLoaded() {
+  return llscan.AreReferencesByValueLoaded();
+}
+
+
+ReferencesVector* FindReferencesCmd::ReferenceScanner::GetReferences() {
+  return llscan.GetReferencesByValue(search_value_.raw());
+}
+
+
+void FindReferencesCmd::PropertyScanner::PrintRefs(
+    OutputSink& out, v8::JSObject& js_obj, v8::Error& err) {
+  // (Note: We skip array elements as they don't have names.)
+
+  // Walk all the properties in this object.
+  // We only create strings for the field names that match the search
+  // value.
+  std::vector<std::pair<v8::Value, v8::Value>> entries = js_obj.Entries(err);
+  if (err.Fail()) {
+    return;
+  }
+  for (auto entry : entries) {
+    v8::HeapObject nameObj(entry.first);
+    std::string key = entry.first.ToString(err);
+    if (err.Fail()) {
+      continue;
+    }
+    if (key == search_value_) {
+      std::string type_name = js_obj.GetTypeName(err);
+      PrintReference(out, js_obj.raw(), type_name, key.c_str(), 0,
+                     entry.second.raw());
+    }
+  }
+}
+
+
+void FindReferencesCmd::PropertyScanner::ScanRefs(v8::JSObject& js_obj,
+                                                  v8::Error& err) {
+  // (Note: We skip array elements as they don't have names.)
+
+  // Walk all the properties in this object.
+  // We only create strings for the field names that match the search
+  // value.
+  ReferencesVector* references;
+  std::vector<std::pair<v8::Value, v8::Value>> entries = js_obj.Entries(err);
+  if (err.Fail()) {
+    return;
+  }
+  for (auto entry : entries) {
+    v8::HeapObject nameObj(entry.first);
+    std::string key = entry.first.ToString(err);
+    if (err.Fail()) {
+      continue;
+    }
+    references = llscan.GetReferencesByProperty(key);
+    references->push_back(js_obj.raw());
+  }
+}
+
+
+bool FindReferencesCmd::PropertyScanner::AreReferencesLoaded() {
+  return llscan.AreReferencesByPropertyLoaded();
+}
+
+
+ReferencesVector* FindReferencesCmd::PropertyScanner::GetReferences() {
+  return llscan.GetReferencesByProperty(search_value_);
+}
+
+
+void FindReferencesCmd::StringScanner::PrintRefs(OutputSink& out,
+                                                 v8::JSObject& js_obj,
+                                                 v8::Error& err) {
+  v8::LLV8* v8 = js_obj.v8();
+
+  int64_t length = js_obj.GetArrayLength(err);
+  for (int64_t i = 0; i < length; ++i) {
+    v8::Value v = js_obj.GetArrayElement(i, err);
+    if (err.Fail()) {
+      continue;
+    }
+    v8::HeapObject valueObj(v);
+
+    int64_t type = valueObj.GetType(err);
+    if (err.Fail()) {
+      continue;
+    }
+    if (type < v8->types()->kFirstNonstringType) {
+      v8::String valueString(valueObj);
+      std::string value = valueString.ToString(err);
+      if (err.Fail()) {
+        continue;
+      }
+      if (err.Success() && search_value_ == value) {
+        std::string type_name = js_obj.GetTypeName(err);
+
+        PrintReference(out, js_obj.raw(), type_name, nullptr, i, v.raw(),
+                       &value);
+      }
+    }
+  }
+
+  // Walk all the properties in this object.
+  // We only create strings for the field names that match the search
+  // value.
+  std::vector<std::pair<v8::Value, v8::Value>> entries = js_obj.Entries(err);
+  if (err.Success()) {
+    for (auto entry : entries) {
+      v8::HeapObject valueObj(entry.second);
+      int64_t type = valueObj.GetType(err);
+      if (err.Fail()) {
+        continue;
+      }
+      if (type < v8->types()->kFirstNonstringType) {
+        v8::String valueString(valueObj);
+        std::string value = valueString.ToString(err);
+        if (err.Fail()) {
+          continue;
+        }
+        if (search_value_ == value) {
+          std::string key = entry.first.ToString(err);
+          if (err.Fail()) {
+            continue;
+          }
+          std::string type_name = js_obj.GetTypeName(err);
+          PrintReference(out, js_obj.raw(), type_name, key.c_str(), 0,
+                         entry.second.raw(), &value);
+        }
+      }
+    }
+  }
+}
+
+
+void FindReferencesCmd::StringScanner::PrintRefs(OutputSink& out,
+                                                 v8::String& str,
+                                                 v8::Error& err) {
+  v8::LLV8* v8 = str.v8();
+
+  // Concatenated and sliced strings refer to other strings so
+  // we need to check their references.
+
+  int64_t repr = str.Representation(err);
+  if (err.Fail()) return;
+
+  if (repr == v8->string()->kSlicedStringTag) {
+    v8::SlicedString sliced_str(str);
+    v8::String parent_str = sliced_str.Parent(err);
+    if (err.Fail()) return;
+    std::string parent = parent_str.ToString(err);
+    if (err.Success() && search_value_ == parent) {
+      std::string type_name = sliced_str.GetTypeName(err);
+      PrintReference(out, str.raw(), type_name, "<Parent>", 0, parent_str.raw(),
+                     &parent);
+    }
+  } else if (repr == v8->string()->kConsStringTag) {
+    v8::ConsString cons_str(str);
+
+    v8::String first_str = cons_str.First(err);
+    if (err.Fail()) return;
+
+    // It looks like sometimes one of the strings can be <null> or another
+    // value,
+    // verify that they are a JavaScript String before calling ToString.
+    int64_t first_type = first_str.GetType(err);
+    if (err.Fail()) return;
+
+    if (first_type < v8->types()->kFirstNonstringType) {
+      std::string first = first_str.ToString(err);
+
+      if (err.Success() && search_value_ == first) {
+        std::string type_name = cons_str.GetTypeName(err);
+        PrintReference(out, str.raw(), type_name, "<First>", 0, first_str.raw(),
+                       &first);
+      }
+    }
+
+    v8::String second_str = cons_str.Second(err);
+    if (err.Fail()) return;
+
+    // It looks like sometimes one of the strings can be <null> or another
+    // value,
+    // verify that they are a JavaScript String before calling ToString.
+    int64_t second_type = second_str.GetType(err);
+    if (err.Fail()) return;
+
+    if (second_type < v8->types()->kFirstNonstringType) {
+      std::string second = second_str.ToString(err);
+
+      if (err.Success() && search_value_ == second) {
+        std::string type_name = cons_str.GetTypeName(err);
+        PrintReference(out, str.raw(), type_name, "<Second>", 0,
+                       second_str.raw(), &second);
+      }
+    }
+  }
+  // Nothing to do for other kinds of string.
+  // They are strings so we will find references to them.
+}
+
+
+void FindReferencesCmd::StringScanner::ScanRefs(v8::JSObject& js_obj,
+                                                v8::Error& err) {
+  v8::LLV8* v8 = js_obj.v8();
+  ReferencesVector* references;
+  std::set<std::string> already_saved;
+
+  int64_t length = js_obj.GetArrayLength(err);
+  for (int64_t i = 0; i < length; ++i) {
+    v8::Value v = js_obj.GetArrayElement(i, err);
+    if (err.Fail()) {
+      continue;
+    }
+    v8::HeapObject valueObj(v);
+
+    int64_t type = valueObj.GetType(err);
+    if (err.Fail()) {
+      continue;
+    }
+    if (type < v8->types()->kFirstNonstringType) {
+      v8::String valueString(valueObj);
+      std::string value = valueString.ToString(err);
+      if (err.Fail()) {
+        continue;
+      }
+
+      if (already_saved.count(value)) continue;
+
+      references = llscan.GetReferencesByString(value);
+      references->push_back(js_obj.raw());
+      already_saved.insert(value);
+    }
+  }
+
+  // Walk all the properties in this object.
+  // We only create strings for the field names that match the search
+  // value.
+  std::vector<std::pair<v8::Value, v8::Value>> entries = js_obj.Entries(err);
+  if (err.Success()) {
+    for (auto entry : entries) {
+      v8::HeapObject valueObj(entry.second);
+      int64_t type = valueObj.GetType(err);
+      if (err.Fail()) {
+        continue;
+      }
+      if (type < v8->types()->kFirstNonstringType) {
+        v8::String valueString(valueObj);
+        std::string value = valueString.ToString(err);
+        if (err.Fail()) {
+          continue;
+        }
+        if (already_saved.count(value)) continue;
+
+        references = llscan.GetReferencesByString(value);
+        references->push_back(js_obj.raw());
+        already_saved.insert(value);
+      }
+    }
+  }
+}
+
+
+void FindReferencesCmd::StringScanner::ScanRefs(v8::String& str,
+                                                v8::Error& err) {
+  v8::LLV8* v8 = str.v8();
+  ReferencesVector* references;
+
+  // Concatenated and sliced strings refer to other strings so
+  // we need to check their references.
+
+  int64_t repr = str.Representation(err);
+  if (err.Fail()) return;
+
+  if (repr == v8->string()->kSlicedStringTag) {
+    v8::SlicedString sliced_str(str);
+    v8::String parent_str = sliced_str.Parent(err);
+    if (err.Fail()) return;
+    std::string parent = parent_str.ToString(err);
+    if (err.Success()) {
+      references = llscan.GetReferencesByString(parent);
+      references->push_back(str.raw());
+    }
+  } else if (repr == v8->string()->kConsStringTag) {
+    v8::ConsString cons_str(str);
+
+    v8::String first_str = cons_str.First(err);
+    if (err.Fail()) return;
+
+    // It looks like sometimes one of the strings can be <null> or another
+    // value,
+    // verify that they are a JavaScript String before calling ToString.
+    int64_t first_type = first_str.GetType(err);
+    if (err.Fail()) return;
+
+    if (first_type < v8->types()->kFirstNonstringType) {
+      std::string first = first_str.ToString(err);
+
+      if (err.Success()) {
+        references = llscan.GetReferencesByString(first);
+        references->push_back(str.raw());
+      }
+    }
+
+    v8::String second_str = cons_str.Second(err);
+    if (err.Fail()) return;
+
+    // It looks like sometimes one of the strings can be <null> or another
+    // value,
+    // verify that they are a JavaScript String before calling ToString.
+    int64_t second_type = second_str.GetType(err);
+    if (err.Fail()) return;
+
+    if (second_type < v8->types()->kFirstNonstringType) {
+      std::string second = second_str.ToString(err);
+
+      if (err.Success()) {
+        references = llscan.GetReferencesByString(second);
+        references->push_back(str.raw());
+      }
+    }
+  }
+  // Nothing to do for other kinds of string.
+  // They are strings so we will find references to them.
+}
+
+
+bool FindReferencesCmd::StringScanner::AreReferencesLoaded() {
+  return llscan.AreReferencesByStringLoaded();
+}
+
+
+ReferencesVector* FindReferencesCmd::StringScanner::GetReferences() {
+  return llscan.GetReferencesByString(search_value_);
+}
+
+
+FindJSObjectsVisitor::FindJSObjectsVisitor(SBTarget& target,
+                                           TypeRecordMap& mapstoinstances,
+                                           std::vector<uint64_t>& roots,
+                                           v8::LLV8* llv8)
+    : target_(target),
+      llv8_(llv8),
+      mapstoinstances_(mapstoinstances),
+      roots_(roots) {
+  found_count_ = 0;
+  address_byte_size_ = target_.GetProcess().GetAddressByteSize();
+  // Load V8 constants from postmortem data
+  llv8_->Load(target);
+}
+
+
+/* Visit every address, a bit brute force but it works. */
+uint64_t FindJSObjectsVisitor::Visit(uint64_t location, uint64_t word) {
+  v8::Value v8_value(llv8_, word);
+
+  v8::Error err;
+  // Test if this is SMI
+  // Skip inspecting things that look like Smi's, they aren't objects.
+  v8::Smi smi(v8_value);
+  if (smi.Check()) return address_byte_size_;
+
+  v8::HeapObject heap_object(v8_value);
+  if (!heap_object.Check()) return address_byte_size_;
+
+  v8::HeapObject map_object = heap_object.GetMap(err);
+  if (err.Fail() || !map_object.Check()) return address_byte_size_;
+
+  v8::Map map(map_object);
+
+  MapCacheEntry map_info;
+  if (map_cache_.count(map.raw()) == 0) {
+    map_info.is_map = IsAMap(map);
+    map_info.is_dictionary = false;
+
+    // Check type first
+    map_info.is_histogram = IsAHistogramType(map, err);
+
+    // On success load type name and how to size the instances
+    if (map_info.is_histogram) {
+      map_info.type_name = heap_object.GetTypeName(err);
+      if (err.Success()) map_info.size = v8::SizeFormula::ForMap(map, err);
+      if (err.Success()) {
+        v8::Error dict_err;
+        map_info.is_dictionary =
+            v8::JSObject::IsObjectType(llv8_, map.GetType(dict_err)) &&
+            map.IsDictionary(dict_err) && dict_err.Success();
+      }
+    }
+
+    // Cache result
+    map_cache_.emplace(map.raw(), map_info);
+
+    if (err.Fail()) return address_byte_size_;
+  } else {
+    map_info = map_cache_.at(map.raw());
+  }
+
+  // Pointers from outside the V8 heap are the roots for marking.
+  if (map_info.is_map &&
+      GetSpace(location) == v8::MemoryChunk::kUnknownSpace &&
+      (roots_.empty() || roots_.back() != word))
+    roots_.push_back(word);
+
+  if (!map_info.is_histogram) return address_byte_size_;
+
+  /* No entry in the map, create a new one. */
+  if (mapstoinstances_.count(map_info.type_name) == 0) {
+    int64_t size = map_info.size.Size(heap_object, err);
+    if (err.Fail()) return address_byte_size_;
+
+    TypeRecord* t = new TypeRecord(map_info.type_name);
+
+    AddInstance(t, heap_object, size, map_info, map.raw());
+    mapstoinstances_.emplace(map_info.type_name, t);
+
+  } else {
+    /* Update an existing instance, if we haven't seen this instance before. */
+    TypeRecord* t = mapstoinstances_.at(map_info.type_name);
+    /* Determine if this is a new instance.
+     * (We are scanning pointers to objects, we may have seen this location
+     * before.)
+     */
+    if (t->GetInstances().count(word) == 0) {
+      int64_t size = map_info.size.Size(heap_object, err);
+      if (err.Fail()) return address_byte_size_;
+
+      AddInstance(t, heap_object, size, map_info, map.raw());
+    }
+  }
+
+  if (err.Fail()) {
+    return address_byte_size_;
+  }
+
+  found_count_++;
+
+  /* Just advance one word.
+   * (Should advance by object size, assuming objects can't overlap!)
+   */
+  return address_byte_size_;
+}
+
+
+void FindJSObjectsVisitor::AddInstance(TypeRecord* t, v8::HeapObject& object,
+                                       int64_t size,
+                                       const MapCacheEntry& map_info,
+                                       uint64_t map) {
+  t->AddInstance(object.raw(), size, GetSpace(object.raw()), map);
+  if (!map_info.is_dictionary) return;
+
+  // Only objects in dictionary mode pay for the extra reads.
+  v8::Error err;
+  v8::JSObject js_object(object);
+  v8::HeapObject properties = js_object.Properties(err);
+  if (err.Fail()) return;
+  v8::NameDictionary dictionary(properties);
+  int64_t capacity = dictionary.Capacity(err);
+  if (err.Fail()) return;
+  int64_t used = dictionary.NumberOfElements(err);
+  if (err.Fail()) return;
+  v8::Smi length = dictionary.FixedArray::Length(err);
+  if (err.Fail()) return;
+
+  int64_t dictionary_size = llv8_->fixed_array()->kDataOffset +
+                            length.GetValue() * llv8_->common()->kPointerSize;
+  t->AddDictionary(capacity, used, dictionary_size);
+}
+
+
+v8::MemoryChunk::Space FindJSObjectsVisitor::GetSpace(uint64_t address) {
+  auto it = chunks_.upper_bound(address);
+  if (it != chunks_.begin() && address < std::prev(it)->second.end)
+    return std::prev(it)->second.space;
+
+  /* Large object chunks span many pages and only the first one has a header,
+   * walk back over the chunk boundaries to the one holding `address`. Every
+   * boundary is read once, one seen before means no chunk holds `address`.
+   */
+  uint64_t alignment = llv8_->memory_chunk()->kAlignment;
+  uint64_t limit = llv8_->memory_chunk()->kMaxChunkSize / alignment;
+  uint64_t start = address & ~(alignment - 1);
+  for (uint64_t i = 0; i < limit && start != 0; i++, start -= alignment) {
+    if (!probed_.insert(start).second) break;
+
+    v8::Error err;
+    v8::MemoryChunk chunk(llv8_, start);
+    int64_t size = chunk.Size(err);
+    if (err.Fail() || size == 0) continue;
+
+    ChunkEntry entry;
+    entry.end = start + size;
+    entry.space = chunk.GetSpace(err);
+    chunks_.emplace(start, entry);
+
+    // Chunks don't overlap, the nearest one below `address` is the only one
+    // that can hold it.
+    if (address < entry.end) return entry.space;
+    break;
+  }
+  return v8::MemoryChunk::kUnknownSpace;
+}
+
+
+/* A Map's map is the meta map, which is its own map. */
+bool FindJSObjectsVisitor::IsAMap(v8::HeapObject& object) {
+  v8::Error err;
+  v8::HeapObject meta_map = object.GetMap(err);
+  if (err.Fail() || !meta_map.Check()) return false;
+
+  v8::HeapObject meta_map_map = meta_map.GetMap(err);
+  return err.Success() && meta_map_map.raw() == meta_map.raw();
+}
+
+
+bool FindJSObjectsVisitor::IsAHistogramType(v8::Map& map, v8::Error& err) {
+  int64_t type = map.GetType(err);
+  if (err.Fail()) return false;
+
+  v8::LLV8* v8 = map.v8();
+  if (v8::JSObject::IsObjectType(v8, type)) return true;
+  if (type == v8->types()->kJSArrayType) return true;
+  if (type == v8->types()->kJSTypedArrayType) return true;
+  if (type < v8->types()->kFirstNonstringType) return true;
+  return false;
+}
+
+
+int64_t ObjectSizer::ShallowSize(v8::HeapObject object, v8::Error& err) {
+  v8::HeapObject map_object = object.GetMap(err);
+  if (err.Fail()) return 0;
+
+  auto it = formulas_.find(map_object.raw());
+  if (it == formulas_.end()) {
+    v8::SizeFormula formula =
+        v8::SizeFormula::ForMap(v8::Map(map_object), err);
+    if (err.Fail()) return 0;
+    it = formulas_.emplace(map_object.raw(), formula).first;
+  }
+
+  return it->second.Size(object, err);
+}
+
+
+int64_t ObjectSizer::OwnedSize(v8::HeapObject object, v8::Error& err) {
+  int64_t size = ShallowSize(object, err);
+  if (err.Fail()) return 0;
+
+  int64_t type = object.GetType(err);
+  if (err.Fail()) return 0;
+
+  v8::LLV8* v8 = object.v8();
+  if (!v8::JSObject::IsObjectType(v8, type) &&
+      type != v8->types()->kJSArrayType &&
+      type != v8->types()->kJSTypedArrayType)
+    return size;
+
+  v8::JSObject js_obj(object);
+  v8::HeapObject properties = js_obj.Properties(err);
+  if (err.Fail()) return 0;
+  size += BackingStoreSize(properties, err);
+  if (err.Fail()) return 0;
+
+  v8::HeapObject elements = js_obj.Elements(err);
+  if (err.Fail()) return 0;
+  size += BackingStoreSize(elements, err);
+  if (err.Fail()) return 0;
+
+  return size;
+}
+
+
+int64_t ObjectSizer::BackingStoreSize(v8::HeapObject store, v8::Error& err) {
+  if (!store.Check()) return 0;
+
+  v8::FixedArrayBase array(store);
+  v8::Smi length = array.Length(err);
+  if (err.Fail()) return 0;
+  if (length.GetValue() == 0) return 0;
+
+  return ShallowSize(store, err);
+}
+
+
+double SampleRecord::Estimate(double sum, double squares, uint64_t sampled,
+                              uint64_t total, uint64_t stride,
+                              double* interval) {
+  *interval = 0;
+  if (sampled == 0) return 0;
+
+  // Every block had a one in `stride` chance to be sampled.
+  double n = sampled;
+  if (sampled > 1) {
+    // Treat the blocks as a simple random sample, which errs on the wide side
+    // for a stratified one.
+    double variance = (squares - sum * sum / n) / (n - 1);
+    double fraction = n / total;
+    *interval = 1.96 * total * std::sqrt((1 - fraction) * variance / n);
+  }
+  return sum * stride;
+}
+
+
+SampleVisitor::SampleVisitor(SBTarget& target, SampleRecordMap& records,
+                             v8::LLV8* llv8)
+    : llv8_(llv8), found_count_(0), meta_map_(0), records_(records) {
+  address_byte_size_ = target.GetProcess().GetAddressByteSize();
+  // Load V8 constants from postmortem data
+  llv8_->Load(target);
+}
+
+
+uint64_t SampleVisitor::Visit(uint64_t location, uint64_t word) {
+  v8::Value v8_value(llv8_, word);
+
+  v8::Smi smi(v8_value);
+  if (smi.Check()) return address_byte_size_;
+
+  v8::HeapObject heap_object(v8_value);
+  if (!heap_object.Check()) return address_byte_size_;
+
+  auto it = map_cache_.find(word);
+  if (it == map_cache_.end()) {
+    MapCacheEntry entry;
+    entry.is_map = false;
+    entry.is_histogram = false;
+    entry.has_size = false;
+
+    /* A Map's map is the meta map, which is its own map. Find it from the
+     * first Map seen, after that one comparison is enough.
+     */
+    v8::Error err;
+    v8::HeapObject map_object = heap_object.GetMap(err);
+    if (err.Success()) {
+      if (meta_map_ == 0) {
+        v8::HeapObject meta_map = map_object.GetMap(err);
+        if (err.Success() && meta_map.raw() == map_object.raw() &&
+            v8::Map(map_object).GetType(err) == llv8_->types()->kMapType)
+          meta_map_ = map_object.raw();
+      }
+      entry.is_map = meta_map_ != 0 && map_object.raw() == meta_map_;
+    }
 
-  result.SetStatus(eReturnStatusSuccessFinishResult);
-  return true;
-}
+    if (entry.is_map) {
+      v8::Map map(heap_object);
+      v8::Error size_err;
+      entry.size = v8::SizeFormula::ForMap(map, size_err);
+      entry.has_size = size_err.Success();
 
+      entry.is_histogram = FindJSObjectsVisitor::IsAHistogramType(map, err);
 
-void FindReferencesCmd::ScanForReferences(ObjectScanner* scanner) {
-  // Walk all the object instances and handle them according to their type.
-  TypeRecordMap mapstoinstances = llscan.GetMapsToInstances();
-  for (auto const entry : mapstoinstances) {
-    TypeRecord* typerecord = entry.second;
-    for (uint64_t addr : typerecord->GetInstances()) {
-      v8::Error err;
-      v8::Value obj_value(&llv8, addr);
-      v8::HeapObject heap_object(obj_value);
-      int64_t type = heap_object.GetType(err);
-      v8::LLV8* v8 = heap_object.v8();
+      // The object starts at `location`.
+      v8::HeapObject object(llv8_, location + llv8_->heap_obj()->kTag);
+      if (entry.is_histogram) entry.type_name = object.GetTypeName(err);
+      if (err.Fail() || !entry.has_size) entry.is_histogram = false;
+    }
 
-      // We only need to handle the types that are in
-      // FindJSObjectsVisitor::IsAHistogramType
-      // as those are the only objects that end up in GetMapsToInstances
-      if (v8::JSObject::IsObjectType(v8, type) ||
-          type == v8->types()->kJSArrayType) {
-        // Objects can have elements and arrays can have named properties.
-        // Basically we need to access objects and arrays as both objects and
-        // arrays.
-        v8::JSObject js_obj(heap_object);
-        scanner->ScanRefs(js_obj, err);
+    // Objects that aren't Maps can be pointed to from anywhere, only cache
+    // what is cheap to keep.
+    if (!entry.is_map && map_cache_.size() > kMaxCacheSize) map_cache_.clear();
+    it = map_cache_.emplace(word, entry).first;
+  }
 
-      } else if (type < v8->types()->kFirstNonstringType) {
-        v8::String str(heap_object);
-        scanner->ScanRefs(str, err);
+  const MapCacheEntry& entry = it->second;
+  if (!entry.has_size) return address_byte_size_;
 
-      } else if (type == v8->types()->kJSTypedArrayType) {
-        // These should only point to off heap memory,
-        // this case should be a no-op.
-      } else {
-        // result.Printf("Unhandled type: %" PRId64 " for addr %" PRIx64
-        //    "\n", type, addr);
-      }
-    }
+  v8::Error err;
+  v8::HeapObject object(llv8_, location + llv8_->heap_obj()->kTag);
+  int64_t size = entry.size.Size(object, err);
+  if (err.Fail() || size < address_byte_size_) return address_byte_size_;
+
+  if (entry.is_histogram) {
+    std::pair<uint64_t, uint64_t>& counts = block_counts_[entry.type_name];
+    counts.first++;
+    counts.second += size;
+    found_count_++;
   }
+
+  // The fields of the object can hold Maps too, carry on after it.
+  return (size + address_byte_size_ - 1) & ~(address_byte_size_ - 1);
 }
 
 
-void FindReferencesCmd::PrintReferences(SBCommandReturnObject& result,
-                                        ReferencesVector* references,
-                                        ObjectScanner* scanner) {
-  // Walk all the object instances and handle them according to their type.
-  TypeRecordMap mapstoinstances = llscan.GetMapsToInstances();
-  for (uint64_t addr : *references) {
-    v8::Error err;
-    v8::Value obj_value(&llv8, addr);
-    v8::HeapObject heap_object(obj_value);
-    int64_t type = heap_object.GetType(err);
-    v8::LLV8* v8 = heap_object.v8();
+void SampleVisitor::EndBlock() {
+  // Blocks without any instances of a type add nothing to its sums.
+  for (auto& entry : block_counts_)
+    records_[entry.first].AddBlock(entry.second.first, entry.second.second);
+  block_counts_.clear();
+}
 
-    // We only need to handle the types that are in
-    // FindJSObjectsVisitor::IsAHistogramType
-    // as those are the only objects that end up in GetMapsToInstances
-    if (v8::JSObject::IsObjectType(v8, type) ||
-        type == v8->types()->kJSArrayType) {
-      // Objects can have elements and arrays can have named properties.
-      // Basically we need to access objects and arrays as both objects and
-      // arrays.
-      v8::JSObject js_obj(heap_object);
-      scanner->PrintRefs(result, js_obj, err);
 
-    } else if (type < v8->types()->kFirstNonstringType) {
-      v8::String str(heap_object);
-      scanner->PrintRefs(result, str, err);
+bool HeapMarker::Mark(LLScan* scan, v8::LLV8* llv8,
+                      const std::vector<uint64_t>& roots,
+                      ScanProgress& progress) {
+  Clear();
+  scan_ = scan;
+  llv8_ = llv8;
+  page_size_ = llv8_->memory_chunk()->kPageSize;
+  addr_size_ = llv8_->common()->kPointerSize;
+  swap_bytes_ = scan_->process_.GetByteOrder() != GetHostByteOrder();
+  buffer_.resize(kReadSize);
+
+  for (LLScan::MemoryRange* range = scan_->ranges_; range != nullptr;
+       range = range->next_)
+    ranges_.push_back({range->start_, range->start_ + range->length_});
+  std::sort(ranges_.begin(), ranges_.end());
+
+  // The heap scan has already checked the roots point to objects.
+  for (uint64_t root : roots) {
+    if (SetMark(root)) worklist_.push_back(root);
+  }
 
-    } else if (type == v8->types()->kJSTypedArrayType) {
-      // These should only point to off heap memory,
-      // this case should be a no-op.
-    } else {
-      // result.Printf("Unhandled type: %" PRId64 " for addr %" PRIx64
-      //    "\n", type, addr);
+  uint64_t visited = 0;
+  while (!worklist_.empty()) {
+    uint64_t address = worklist_.back();
+    worklist_.pop_back();
+    VisitObject(address);
+
+    if ((++visited & 0xfff) == 0 && !progress.Update(visited, marked_count_)) {
+      Clear();
+      return false;
     }
   }
+
+  std::vector<unsigned char>().swap(buffer_);
+  std::vector<uint64_t>().swap(worklist_);
+  ranges_.clear();
+  map_cache_.clear();
+  return true;
 }
 
 
-char** FindReferencesCmd::ParseScanOptions(char** cmd, ScanType* type) {
-  static struct option opts[] = {{"value", no_argument, nullptr, 'v'},
-                                 {"name", no_argument, nullptr, 'n'},
-                                 {"string", no_argument, nullptr, 's'},
-                                 {nullptr, 0, nullptr, 0}};
+bool HeapMarker::IsMarked(uint64_t address) const {
+  if (bitmap_.empty()) return false;
 
-  int argc = 1;
-  for (char** p = cmd; p != nullptr && *p != nullptr; p++) argc++;
+  uint64_t page = address & ~(page_size_ - 1);
+  auto it = bitmap_.find(page);
+  if (it == bitmap_.end()) return false;
 
-  char* args[argc];
+  uint64_t index = (address - page) / addr_size_;
+  return (it->second[index / 64] & (1ULL << (index % 64))) != 0;
+}
 
-  // Make this look like a command line, we need a valid element at index 0
-  // for getopt_long to use in its error messages.
-  char name[] = "llscan";
-  args[0] = name;
-  for (int i = 0; i < argc - 1; i++) args[i + 1] = cmd[i];
 
-  bool found_scan_type = false;
+void HeapMarker::Clear() {
+  bitmap_.clear();
+  worklist_.clear();
+  ranges_.clear();
+  map_cache_.clear();
+  marked_count_ = 0;
+  meta_map_ = 0;
+}
 
-  // Reset getopts.
-  optind = 0;
-  opterr = 1;
-  do {
-    int arg = getopt_long(argc, args, "vns", opts, nullptr);
-    if (arg == -1) break;
 
-    if (found_scan_type) {
-      *type = ScanType::kBadOption;
-      break;
-    }
+bool HeapMarker::SetMark(uint64_t address) {
+  uint64_t page = address & ~(page_size_ - 1);
+  uint64_t index = (address - page) / addr_size_;
 
-    switch (arg) {
-      case 'v':
-        *type = ScanType::kFieldValue;
-        found_scan_type = true;
-        break;
-      case 'n':
-        *type = ScanType::kPropertyName;
-        found_scan_type = true;
-        break;
-      case 's':
-        *type = ScanType::kStringValue;
-        found_scan_type = true;
-        break;
-      default:
-        *type = ScanType::kBadOption;
-        break;
-    }
-  } while (true);
+  std::vector<uint64_t>& bits = bitmap_[page];
+  if (bits.empty()) bits.resize(page_size_ / addr_size_ / 64);
 
-  return &cmd[optind - 1];
+  uint64_t mask = 1ULL << (index % 64);
+  if (bits[index / 64] & mask) return false;
+
+  bits[index / 64] |= mask;
+  marked_count_++;
+  return true;
 }
 
 
-void FindReferencesCmd::ReferenceScanner::PrintRefs(
-    SBCommandReturnObject& result, v8::JSObject& js_obj, v8::Error& err) {
-  int64_t length = js_obj.GetArrayLength(err);
-  for (int64_t i = 0; i < length; ++i) {
-    v8::Value v = js_obj.GetArrayElement(i, err);
+bool HeapMarker::InRanges(uint64_t address) const {
+  auto it = std::upper_bound(
+      ranges_.begin(), ranges_.end(),
+      std::make_pair(address, std::numeric_limits<uint64_t>::max()));
+  return it != ranges_.begin() && address < std::prev(it)->second;
+}
 
-    // Array is borked, or not array at all - skip it
-    if (!err.Success()) break;
 
-    if (v.raw() != search_value_.raw()) continue;
+bool HeapMarker::IsObject(uint64_t address) {
+  // Most words aren't pointers into the scanned memory, rule them out
+  // before reading anything.
+  if (!v8::HeapObject(llv8_, address).Check() || !InRanges(address))
+    return false;
 
-    std::string type_name = js_obj.GetTypeName(err);
-    result.Printf("0x%" PRIx64 ": %s[%" PRId64 "]=0x%" PRIx64 "\n",
-                  js_obj.raw(), type_name.c_str(), i, search_value_.raw());
-  }
+  unsigned char buf[8];
+  uint64_t map_address =
+      address - llv8_->heap_obj()->kTag + llv8_->heap_obj()->kMapOffset;
+  if (!scan_->ReadMemory(map_address, buf, addr_size_)) return false;
 
-  // Walk all the properties in this object.
-  // We only create strings for the field names that match the search
-  // value.
-  std::vector<std::pair<v8::Value, v8::Value>> entries = js_obj.Entries(err);
-  if (err.Fail()) {
-    return;
-  }
-  for (auto entry : entries) {
-    v8::Value v = entry.second;
-    if (v.raw() == search_value_.raw()) {
-      std::string key = entry.first.ToString(err);
-      std::string type_name = js_obj.GetTypeName(err);
-      result.Printf("0x%" PRIx64 ": %s.%s=0x%" PRIx64 "\n", js_obj.raw(),
-                    type_name.c_str(), key.c_str(), search_value_.raw());
-    }
-  }
+  uint64_t map = DecodeWord(buf);
+  if (!v8::HeapObject(llv8_, map).Check() || !InRanges(map)) return false;
+  return GetMapInfo(map).is_map;
 }
 
 
-void FindReferencesCmd::ReferenceScanner::PrintRefs(
-    SBCommandReturnObject& result, v8::String& str, v8::Error& err) {
-  v8::LLV8* v8 = str.v8();
-
-  int64_t repr = str.Representation(err);
+uint64_t HeapMarker::DecodeWord(const unsigned char* p) const {
+  if (addr_size_ == 4) {
+    uint32_t word;
+    memcpy(&word, p, sizeof(word));
+    return swap_bytes_ ? __builtin_bswap32(word) : word;
+  }
+  uint64_t word;
+  memcpy(&word, p, sizeof(word));
+  return swap_bytes_ ? __builtin_bswap64(word) : word;
+}
 
-  // Concatenated and sliced strings refer to other strings so
-  // we need to check their references.
 
-  if (repr == v8->string()->kSlicedStringTag) {
-    v8::SlicedString sliced_str(str);
-    v8::String parent = sliced_str.Parent(err);
-    if (err.Success() && parent.raw() == search_value_.raw()) {
-      std::string type_name = sliced_str.GetTypeName(err);
-      result.Printf("0x%" PRIx64 ": %s.%s=0x%" PRIx64 "\n", str.raw(),
-                    type_name.c_str(), "<Parent>", search_value_.raw());
-    }
-  } else if (repr == v8->string()->kConsStringTag) {
-    v8::ConsString cons_str(str);
+HeapMarker::MapInfo HeapMarker::GetMapInfo(uint64_t address) {
+  auto it = map_cache_.find(address);
+  if (it != map_cache_.end()) return it->second;
 
-    v8::String first = cons_str.First(err);
-    if (err.Success() && first.raw() == search_value_.raw()) {
-      std::string type_name = cons_str.GetTypeName(err);
-      result.Printf("0x%" PRIx64 ": %s.%s=0x%" PRIx64 "\n", str.raw(),
-                    type_name.c_str(), "<First>", search_value_.raw());
-    }
+  MapInfo info;
+  info.is_map = false;
+  info.body = kTagged;
 
-    v8::String second = cons_str.Second(err);
-    if (err.Success() && second.raw() == search_value_.raw()) {
-      std::string type_name = cons_str.GetTypeName(err);
-      result.Printf("0x%" PRIx64 ": %s.%s=0x%" PRIx64 "\n", str.raw(),
-                    type_name.c_str(), "<Second>", search_value_.raw());
-    }
-  } else if (repr == v8->string()->kThinStringTag) {
-    v8::ThinString thin_str(str);
-    v8::String actual = thin_str.Actual(err);
-    if (err.Success() && actual.raw() == search_value_.raw()) {
-      std::string type_name = thin_str.GetTypeName(err);
-      result.Printf("0x%" PRIx64 ": %s.%s=0x%" PRIx64 "\n", str.raw(),
-                    type_name.c_str(), "<Actual>", search_value_.raw());
+  v8::Error err;
+  v8::Map map(llv8_, address);
+  v8::HeapObject meta_map = map.GetMap(err);
+
+  // The meta map is its own map, find it once and compare after that.
+  if (err.Success() && meta_map_ == 0) {
+    v8::HeapObject meta_map_map = meta_map.GetMap(err);
+    if (err.Success() && meta_map_map.raw() == meta_map.raw())
+      meta_map_ = meta_map.raw();
+  }
+  info.is_map = err.Success() && meta_map_ != 0 && meta_map.raw() == meta_map_;
+
+  if (info.is_map) {
+    int64_t type = map.GetType(err);
+    if (type < llv8_->types()->kFirstNonstringType) {
+      int64_t repr = type & llv8_->string()->kRepresentationMask;
+      if (repr == llv8_->string()->kSeqStringTag) info.body = kRawData;
+    } else if (type == llv8_->types()->kHeapNumberType ||
+               type == llv8_->types()->kFixedDoubleArrayType ||
+               type == llv8_->types()->kByteArrayType) {
+      info.body = kRawData;
+    } else if (type == llv8_->types()->kCodeType) {
+      info.body = kCode;
     }
+    info.size = v8::SizeFormula::ForMap(map, err);
+    if (err.Fail()) info.is_map = false;
   }
-  // Nothing to do for other kinds of string.
+
+  // Anything that looks like a pointer ends up here, only cache what is
+  // cheap to keep.
+  if (info.is_map || map_cache_.size() < kMaxCacheSize)
+    map_cache_.emplace(address, info);
+  return info;
 }
 
 
-void FindReferencesCmd::ReferenceScanner::ScanRefs(v8::JSObject& js_obj,
-                                                   v8::Error& err) {
-  ReferencesVector* references;
-  std::set<uint64_t> already_saved;
+void HeapMarker::VisitObject(uint64_t address) {
+  v8::Error err;
+  v8::HeapObject object(llv8_, address);
+  v8::HeapObject map = object.GetMap(err);
+  if (err.Fail()) return;
 
-  int64_t length = js_obj.GetArrayLength(err);
-  for (int64_t i = 0; i < length; ++i) {
-    v8::Value v = js_obj.GetArrayElement(i, err);
+  // The map keeps the prototype alive, and through it the constructor.
+  if (SetMark(map.raw())) worklist_.push_back(map.raw());
 
-    // Array is borked, or not array at all - skip it
-    if (!err.Success()) break;
-    if (already_saved.count(v.raw())) continue;
+  MapInfo info = GetMapInfo(map.raw());
+  if (!info.is_map || info.body == kRawData) return;
 
-    references = llscan.GetReferencesByValue(v.raw());
-    references->push_back(js_obj.raw());
-    already_saved.insert(v.raw());
-  }
+  int64_t size = info.size.Size(object, err);
+  if (err.Fail()) return;
 
-  // Walk all the properties in this object.
-  // We only create strings for the field names that match the search
-  // value.
-  std::vector<std::pair<v8::Value, v8::Value>> entries = js_obj.Entries(err);
-  if (err.Fail()) {
-    return;
+  /* Variable sized objects without a SizeFormula, hash tables, contexts,
+   * scope infos and the like, are laid out as FixedArrays.
+   */
+  if (size == 0) {
+    v8::FixedArrayBase array(object);
+    v8::Smi length = array.Length(err);
+    if (err.Fail() || !length.Check() || length.GetValue() < 0) return;
+    size = llv8_->fixed_array()->kDataOffset + length.GetValue() * addr_size_;
   }
-  for (auto entry : entries) {
-    v8::Value v = entry.second;
 
-    if (already_saved.count(v.raw())) continue;
+  // Only the header of Code objects holds pointers.
+  if (info.body == kCode)
+    size = std::min(size, llv8_->code()->kStartOffset);
 
-    references = llscan.GetReferencesByValue(v.raw());
-    references->push_back(js_obj.raw());
-    already_saved.insert(v.raw());
-  }
+  VisitPointers(address - llv8_->heap_obj()->kTag, size);
 }
 
 
-void FindReferencesCmd::ReferenceScanner::ScanRefs(v8::String& str,
-                                                   v8::Error& err) {
-  ReferencesVector* references;
-  std::set<uint64_t> already_saved;
+void HeapMarker::VisitPointers(uint64_t start, uint64_t size) {
+  // The map word has been visited already.
+  for (uint64_t offset = addr_size_; offset < size; offset += kReadSize) {
+    uint64_t length = size - offset;
+    if (length > kReadSize) length = kReadSize;
+    if (!scan_->ReadMemory(start + offset, buffer_.data(), length)) continue;
 
-  v8::LLV8* v8 = str.v8();
+    for (uint64_t i = 0; i + addr_size_ <= length; i += addr_size_) {
+      uint64_t value = DecodeWord(&buffer_[i]);
+      if (IsMarked(value) || !IsObject(value)) continue;
+      SetMark(value);
+      worklist_.push_back(value);
+    }
+  }
+}
 
-  int64_t repr = str.Representation(err);
 
-  // Concatenated and sliced strings refer to other strings so
-  // we need to check their references.
+bool LLScan::MarkLiveObjects(lldb::SBTarget target,
+                             lldb::SBCommandReturnObject& result,
+                             const ScanOptions& options) {
+  if (!scan_complete_) {
+    result.SetError(
+        "--live-only needs a complete heap scan, run the command again "
+        "without --timeout\n");
+    return false;
+  }
+  if (marked_) return true;
 
-  if (repr == v8->string()->kSlicedStringTag) {
-    v8::SlicedString sliced_str(str);
-    v8::String parent = sliced_str.Parent(err);
+  // Load V8 constants from postmortem data
+  llv8.Load(target);
 
-    if (err.Success()) {
-      references = llscan.GetReferencesByValue(parent.raw());
-      references->push_back(str.raw());
-    }
+  ScanProgress progress(target.GetDebugger(), "Marking live objects", 0, false,
+                        options);
+  if (!marker_.Mark(this, &llv8, roots_, progress)) {
+    result.SetError("Marking was stopped before it could finish.\n");
+    return false;
+  }
 
-  } else if (repr == v8->string()->kConsStringTag) {
-    v8::ConsString cons_str(str);
+  ObjectSizer sizer;
+  for (auto const& entry : mapstoinstances_) {
+    TypeRecord* t = entry.second;
+    uint64_t count = 0;
+    uint64_t size = 0;
+    for (uint64_t address : t->GetInstances()) {
+      if (!marker_.IsMarked(address)) continue;
 
-    v8::String first = cons_str.First(err);
-    if (err.Success()) {
-      references = llscan.GetReferencesByValue(first.raw());
-      references->push_back(str.raw());
+      v8::Error err;
+      int64_t object_size =
+          sizer.ShallowSize(v8::HeapObject(&llv8, address), err);
+      count++;
+      if (err.Success()) size += object_size;
     }
+    t->SetLive(count, size);
+  }
 
-    v8::String second = cons_str.Second(err);
-    if (err.Success() && first.raw() != second.raw()) {
-      references = llscan.GetReferencesByValue(second.raw());
-      references->push_back(str.raw());
+  marked_ = true;
+  return true;
+}
+
+
+bool LLScan::ScanHeapForObjects(lldb::SBTarget target,
+                                lldb::SBCommandReturnObject& result,
+                                const ScanOptions& options) {
+  if (background_thread_.joinable()) {
+    if (target_ != target) {
+      StopBackgroundScan();
+    } else if (!WaitForBackgroundScan(result, options)) {
+      // Answer from what the background scan has found so far.
+      return true;
     }
-  } else if (repr == v8->string()->kThinStringTag) {
-    v8::ThinString thin_str(str);
-    v8::String actual = thin_str.Actual(err);
+  }
 
-    if (err.Success()) {
-      references = llscan.GetReferencesByValue(actual.raw());
-      references->push_back(str.raw());
+  if (!PrepareScan(target, result)) return false;
+
+  /* If we've reached here we have access to information about the valid memory
+   * ranges in the process and can scan for objects.
+   */
+
+  /* Populate the map of objects. */
+  if (!scan_complete_) {
+    // References found in a partial heap are incomplete too.
+    if (scan_cursor_ != 0) ClearReferences();
+
+    FindJSObjectsVisitor v(target, GetMapsToInstances(), roots_, &scan_v8_);
+    scan_v8_.ReadFromCore(nullptr);
+    uint64_t total = GetTotalRangeSize();
+    ScanProgress progress(target.GetDebugger(), "Scanning heap", total, true,
+                          options);
+
+    scan_complete_ = ScanMemoryRanges(v, progress);
+    if (scan_complete_) {
+      PrintScanSummary(result, options);
+    } else {
+      Note(result, options,
+           "PARTIAL RESULT: heap scan %s after %" PRIu64 " of %" PRIu64
+           " bytes (%" PRIu64
+           "%%), run the command again to resume the scan.\n",
+           progress.timed_out() ? "timed out" : "was interrupted",
+           scanned_bytes_, total,
+           total == 0 ? 100 : scanned_bytes_ * 100 / total);
     }
   }
-  // Nothing to do for other kinds of string.
-}
 
+  // The exact results replace any estimate.
+  if (scan_complete_) ClearSampleRecords();
 
-bool FindReferencesCmd::ReferenceScanner::AreReferencesLoaded() {
-  return llscan.AreReferencesByValueLoaded();
+  return true;
 }
 
 
-ReferencesVector* FindReferencesCmd::ReferenceScanner::GetReferences() {
-  return llscan.GetReferencesByValue(search_value_.raw());
-}
-
+bool LLScan::PrepareScan(lldb::SBTarget target,
+                         lldb::SBCommandReturnObject& result) {
+  /* Check the last scan is still valid - the process hasn't moved
+   * and we haven't changed target.
+   */
 
-void FindReferencesCmd::PropertyScanner::PrintRefs(
-    SBCommandReturnObject& result, v8::JSObject& js_obj, v8::Error& err) {
-  // (Note: We skip array elements as they don't have names.)
+  // Reload process anyway
+  process_ = target.GetProcess();
+  address_byte_size_ = process_.GetAddressByteSize();
+  swap_bytes_ = process_.GetByteOrder() != GetHostByteOrder();
 
-  // Walk all the properties in this object.
-  // We only create strings for the field names that match the search
-  // value.
-  std::vector<std::pair<v8::Value, v8::Value>> entries = js_obj.Entries(err);
-  if (err.Fail()) {
-    return;
+  // Need to reload memory ranges (when they come from LLNODE_RANGESFILE this
+  // does assume the user has also updated it with data for the new dump or
+  // things won't match up).
+  if (target_ != target) {
+    ClearMemoryRanges();
+    ClearMapsToInstances();
+    ClearReferences();
+    ClearSampleRecords();
+    target_ = target;
   }
-  for (auto entry : entries) {
-    v8::HeapObject nameObj(entry.first);
-    std::string key = entry.first.ToString(err);
-    if (err.Fail()) {
-      continue;
+
+  if (nullptr == ranges_ && !GenerateMemoryRangesFromCore(target)) {
+#ifdef LLDB_SBMemoryRegionInfoList_h_
+    if (!GenerateMemoryRangesFromRegions(target)) {
+      result.SetError(
+          "No memory range information available for this process. Cannot scan "
+          "for objects.\n");
+      return false;
     }
-    if (key == search_value_) {
-      std::string type_name = js_obj.GetTypeName(err);
-      result.Printf("0x%" PRIx64 ": %s.%s=0x%" PRIx64 "\n", js_obj.raw(),
-                    type_name.c_str(), key.c_str(), entry.second.raw());
+#else   // !LLDB_SBMemoryRegionInfoList_h_
+    /* Fall back to environment variable containing pre-parsed list of memory
+     * ranges. */
+    const char* segmentsfilename = getenv("LLNODE_RANGESFILE");
+
+    if (segmentsfilename == nullptr) {
+      result.SetError(
+          "No memory range information available for this process. Cannot scan "
+          "for objects.\n"
+          "Please set `LLNODE_RANGESFILE` environment variable\n");
+      return false;
+    }
+
+    if (!GenerateMemoryRanges(target, segmentsfilename)) {
+      result.SetError(
+          "No memory range information available for this process. Cannot scan "
+          "for objects.\n");
+      return false;
     }
+#endif  // LLDB_SBMemoryRegionInfoList_h_
   }
+
+  return true;
 }
 
 
-void FindReferencesCmd::PropertyScanner::ScanRefs(v8::JSObject& js_obj,
-                                                  v8::Error& err) {
-  // (Note: We skip array elements as they don't have names.)
+/* Returns false if the wait was cut short, the background scan carries on
+ * and the caller answers from its partial results.
+ */
+bool LLScan::WaitForBackgroundScan(lldb::SBCommandReturnObject& result,
+                                   const ScanOptions& options) {
+  uint64_t total = GetTotalRangeSize();
+  ScanProgress progress(target_.GetDebugger(), "Waiting for heap scan", total,
+                        true, options);
+
+  while (background_running_) {
+    uint64_t scanned;
+    uint64_t found;
+    {
+      std::lock_guard<std::mutex> lock(results_mutex_);
+      scanned = scanned_bytes_;
+      found = GetFoundCount();
+    }
 
-  // Walk all the properties in this object.
-  // We only create strings for the field names that match the search
-  // value.
-  ReferencesVector* references;
-  std::vector<std::pair<v8::Value, v8::Value>> entries = js_obj.Entries(err);
-  if (err.Fail()) {
-    return;
-  }
-  for (auto entry : entries) {
-    v8::HeapObject nameObj(entry.first);
-    std::string key = entry.first.ToString(err);
-    if (err.Fail()) {
-      continue;
+    if (!progress.Update(scanned, found)) {
+      Note(result, options,
+           "PARTIAL RESULT: background heap scan is at %" PRIu64 " of %" PRIu64
+           " bytes (%" PRIu64 "%%), see `v8 scan status` for its progress.\n",
+           scanned, total, total == 0 ? 100 : scanned * 100 / total);
+      return false;
     }
-    references = llscan.GetReferencesByProperty(key);
-    references->push_back(js_obj.raw());
-  }
-}
 
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
 
-bool FindReferencesCmd::PropertyScanner::AreReferencesLoaded() {
-  return llscan.AreReferencesByPropertyLoaded();
+  background_thread_.join();
+  background_visitor_.reset();
+  return true;
 }
 
 
-ReferencesVector* FindReferencesCmd::PropertyScanner::GetReferences() {
-  return llscan.GetReferencesByProperty(search_value_);
-}
+bool LLScan::SampleHeapForObjects(lldb::SBTarget target,
+                                  lldb::SBCommandReturnObject& result,
+                                  const ScanOptions& options) {
+  if (background_thread_.joinable() && target_ != target) StopBackgroundScan();
+
+  // A running background scan has the memory ranges ready and owns process_.
+  if (!background_running_ && !PrepareScan(target, result)) return false;
+
+  // Reuse the last estimate if it came from the same sample.
+  if (total_blocks_ != 0 && sample_percent_ == options.sample) return true;
+  ClearSampleRecords();
+
+  uint64_t stride = std::max<int64_t>(1, std::llround(100 / options.sample));
+  sample_stride_ = stride;
+  const uint64_t addr_size = target.GetProcess().GetAddressByteSize();
+  bool swap_bytes = target.GetProcess().GetByteOrder() != GetHostByteOrder();
+
+  uint64_t total_blocks = 0;
+  for (MemoryRange* range = ranges_; range != nullptr; range = range->next_)
+    total_blocks += (range->length_ + kSampleBlockSize - 1) / kSampleBlockSize;
+
+  SampleVisitor v(target, sample_records_, &llv8);
+  ScanProgress progress(target.GetDebugger(), "Sampling heap",
+                        total_blocks / stride * kSampleBlockSize, true,
+                        options);
+  BlockReader reader(this, kSampleBlockSize, 0, stride);
+
+  uint64_t sampled_blocks = 0;
+  uint64_t sampled_bytes = 0;
+  BlockReader::Block* block;
+  while ((block = reader.Next()) != nullptr) {
+    VisitBlock(v, block, addr_size, swap_bytes);
+    v.EndBlock();
+    sampled_blocks++;
+    sampled_bytes += block->size_;
+    reader.Release();
+
+    // A sample cut short only covers the low addresses, don't keep it.
+    if (!progress.Update(sampled_bytes, v.FoundCount())) {
+      ClearSampleRecords();
+      result.SetError("Sampling was stopped before it could finish.\n");
+      return false;
+    }
+  }
 
+  sample_percent_ = options.sample;
+  sampled_blocks_ = sampled_blocks;
+  total_blocks_ = total_blocks;
+  return true;
+}
 
-void FindReferencesCmd::StringScanner::PrintRefs(SBCommandReturnObject& result,
-                                                 v8::JSObject& js_obj,
-                                                 v8::Error& err) {
-  v8::LLV8* v8 = js_obj.v8();
 
-  int64_t length = js_obj.GetArrayLength(err);
-  for (int64_t i = 0; i < length; ++i) {
-    v8::Value v = js_obj.GetArrayElement(i, err);
-    if (err.Fail()) {
-      continue;
-    }
-    v8::HeapObject valueObj(v);
+bool LLScan::StartBackgroundScan(lldb::SBTarget target,
+                                 lldb::SBCommandReturnObject& result,
+                                 const ScanOptions& options) {
+  if (background_running_ && target_ == target) {
+    Note(result, options,
+         "Heap scan is already running in the background.\n");
+    return true;
+  }
+  StopBackgroundScan();
 
-    int64_t type = valueObj.GetType(err);
-    if (err.Fail()) {
-      continue;
-    }
-    if (type < v8->types()->kFirstNonstringType) {
-      v8::String valueString(valueObj);
-      std::string value = valueString.ToString(err);
-      if (err.Fail()) {
-        continue;
-      }
-      if (err.Success() && search_value_ == value) {
-        std::string type_name = js_obj.GetTypeName(err);
+  if (!PrepareScan(target, result)) return false;
 
-        result.Printf("0x%" PRIx64 ": %s[%" PRId64 "]=0x%" PRIx64 " '%s'\n",
-                      js_obj.raw(), type_name.c_str(), i, v.raw(),
-                      value.c_str());
-      }
-    }
+  if (scan_complete_) {
+    Note(result, options, "Heap scan is already complete.\n");
+    return true;
   }
 
-  // Walk all the properties in this object.
-  // We only create strings for the field names that match the search
-  // value.
-  std::vector<std::pair<v8::Value, v8::Value>> entries = js_obj.Entries(err);
-  if (err.Success()) {
-    for (auto entry : entries) {
-      v8::HeapObject valueObj(entry.second);
-      int64_t type = valueObj.GetType(err);
-      if (err.Fail()) {
-        continue;
-      }
-      if (type < v8->types()->kFirstNonstringType) {
-        v8::String valueString(valueObj);
-        std::string value = valueString.ToString(err);
-        if (err.Fail()) {
-          continue;
-        }
-        if (search_value_ == value) {
-          std::string key = entry.first.ToString(err);
-          if (err.Fail()) {
-            continue;
-          }
-          std::string type_name = js_obj.GetTypeName(err);
-          result.Printf("0x%" PRIx64 ": %s.%s=0x%" PRIx64 " '%s'\n",
-                        js_obj.raw(), type_name.c_str(), key.c_str(),
-                        entry.second.raw(), value.c_str());
-        }
-      }
-    }
+  // The worker thread must not use lldb, the commands run meanwhile do.
+  if (!CanReadInParallel()) {
+    result.SetError(
+        "Background scans need the core file to be read without lldb, scan "
+        "in the foreground instead.\n");
+    return false;
   }
-}
 
+  // References found in a partial heap are incomplete too.
+  if (scan_cursor_ != 0) ClearReferences();
 
-void FindReferencesCmd::StringScanner::PrintRefs(SBCommandReturnObject& result,
-                                                 v8::String& str,
-                                                 v8::Error& err) {
-  v8::LLV8* v8 = str.v8();
+  // Everything that needs lldb is loaded here, before the thread starts.
+  background_visitor_.reset(
+      new FindJSObjectsVisitor(target_, GetMapsToInstances(), roots_,
+                               &scan_v8_));
+  scan_v8_.ReadFromCore(&core_);
 
-  // Concatenated and sliced strings refer to other strings so
-  // we need to check their references.
+  background_stop_ = false;
+  background_running_ = true;
+  background_start_ = std::chrono::steady_clock::now();
+  background_thread_ = std::thread(&LLScan::RunBackgroundScan, this);
 
-  int64_t repr = str.Representation(err);
-  if (err.Fail()) return;
+  Note(result, options,
+       "Scanning the heap in the background, see `v8 scan status` for its "
+       "progress.\n");
+  return true;
+}
 
-  if (repr == v8->string()->kSlicedStringTag) {
-    v8::SlicedString sliced_str(str);
-    v8::String parent_str = sliced_str.Parent(err);
-    if (err.Fail()) return;
-    std::string parent = parent_str.ToString(err);
-    if (err.Success() && search_value_ == parent) {
-      std::string type_name = sliced_str.GetTypeName(err);
-      result.Printf("0x%" PRIx64 ": %s.%s=0x%" PRIx64 " '%s'\n", str.raw(),
-                    type_name.c_str(), "<Parent>", parent_str.raw(),
-                    parent.c_str());
-    }
-  } else if (repr == v8->string()->kConsStringTag) {
-    v8::ConsString cons_str(str);
 
-    v8::String first_str = cons_str.First(err);
-    if (err.Fail()) return;
+void LLScan::RunBackgroundScan() {
+  ScanProgress progress(background_stop_);
 
-    // It looks like sometimes one of the strings can be <null> or another
-    // value,
-    // verify that they are a JavaScript String before calling ToString.
-    int64_t first_type = first_str.GetType(err);
-    if (err.Fail()) return;
+  bool complete = ScanMemoryRanges(*background_visitor_, progress);
+  {
+    std::lock_guard<std::mutex> lock(results_mutex_);
+    scan_complete_ = complete;
+  }
+  background_running_ = false;
+}
 
-    if (first_type < v8->types()->kFirstNonstringType) {
-      std::string first = first_str.ToString(err);
 
-      if (err.Success() && search_value_ == first) {
-        std::string type_name = cons_str.GetTypeName(err);
-        result.Printf("0x%" PRIx64 ": %s.%s=0x%" PRIx64 " '%s'\n", str.raw(),
-                      type_name.c_str(), "<First>", first_str.raw(),
-                      first.c_str());
-      }
-    }
+void LLScan::StopBackgroundScan() {
+  if (!background_thread_.joinable()) return;
 
-    v8::String second_str = cons_str.Second(err);
-    if (err.Fail()) return;
+  background_stop_ = true;
+  background_thread_.join();
+  background_visitor_.reset();
+}
 
-    // It looks like sometimes one of the strings can be <null> or another
-    // value,
-    // verify that they are a JavaScript String before calling ToString.
-    int64_t second_type = second_str.GetType(err);
-    if (err.Fail()) return;
 
-    if (second_type < v8->types()->kFirstNonstringType) {
-      std::string second = second_str.ToString(err);
+void LLScan::MaybeStartBackgroundScan(lldb::SBTarget target) {
+  if (getenv("LLNODE_AUTOSCAN") == nullptr) return;
 
-      if (err.Success() && search_value_ == second) {
-        std::string type_name = cons_str.GetTypeName(err);
-        result.Printf("0x%" PRIx64 ": %s.%s=0x%" PRIx64 " '%s'\n", str.raw(),
-                      type_name.c_str(), "<Second>", second_str.raw(),
-                      second.c_str());
-      }
-    }
-  }
-  // Nothing to do for other kinds of string.
-  // They are strings so we will find references to them.
-}
+  // Only once per target.
+  if (target_ == target) return;
 
+  const char* plugin = target.GetProcess().GetPluginName();
+  if (plugin == nullptr || strstr(plugin, "core") == nullptr) return;
 
-void FindReferencesCmd::StringScanner::ScanRefs(v8::JSObject& js_obj,
-                                                v8::Error& err) {
-  v8::LLV8* v8 = js_obj.v8();
-  ReferencesVector* references;
-  std::set<std::string> already_saved;
+  SBCommandReturnObject result;
+  StartBackgroundScan(target, result);
+}
 
-  int64_t length = js_obj.GetArrayLength(err);
-  for (int64_t i = 0; i < length; ++i) {
-    v8::Value v = js_obj.GetArrayElement(i, err);
-    if (err.Fail()) {
-      continue;
-    }
-    v8::HeapObject valueObj(v);
 
-    int64_t type = valueObj.GetType(err);
-    if (err.Fail()) {
-      continue;
+void LLScan::PrintScanStatus(OutputSink& out) {
+  std::lock_guard<std::mutex> lock(results_mutex_);
+
+  JSONWriter& json = out.json_writer();
+  if (ranges_ == nullptr) {
+    if (out.json()) {
+      json.BeginObject();
+      json.Member("state", "not started");
+      json.EndObject();
+    } else {
+      out.Printf("Heap scan: not started\n");
     }
-    if (type < v8->types()->kFirstNonstringType) {
-      v8::String valueString(valueObj);
-      std::string value = valueString.ToString(err);
-      if (err.Fail()) {
-        continue;
-      }
+    return;
+  }
 
-      if (already_saved.count(value)) continue;
+  const char* state;
+  if (background_running_)
+    state = "running in the background";
+  else if (scan_complete_)
+    state = "complete";
+  else if (scan_cursor_ == 0)
+    state = "not started";
+  else
+    state = "stopped";
+
+  uint64_t total = GetTotalRangeSize();
+  uint64_t elapsed = 0;
+  uint64_t eta = 0;
+  if (background_running_ && scanned_bytes_ != 0) {
+    elapsed = std::chrono::duration_cast<std::chrono::seconds>(
+                  std::chrono::steady_clock::now() - background_start_)
+                  .count();
+    eta = elapsed * (total - scanned_bytes_) / scanned_bytes_;
+  }
 
-      references = llscan.GetReferencesByString(value);
-      references->push_back(js_obj.raw());
-      already_saved.insert(value);
+  if (out.json()) {
+    json.BeginObject();
+    json.Member("state", background_running_ ? "running" : state);
+    json.Member("scanned_bytes", scanned_bytes_);
+    json.Member("total_bytes", total);
+    json.Member("objects", GetFoundCount());
+    if (background_running_ && scanned_bytes_ != 0) {
+      json.Member("elapsed", elapsed);
+      json.Member("eta", eta);
     }
+    json.EndObject();
+    return;
   }
 
-  // Walk all the properties in this object.
-  // We only create strings for the field names that match the search
-  // value.
-  std::vector<std::pair<v8::Value, v8::Value>> entries = js_obj.Entries(err);
-  if (err.Success()) {
-    for (auto entry : entries) {
-      v8::HeapObject valueObj(entry.second);
-      int64_t type = valueObj.GetType(err);
-      if (err.Fail()) {
-        continue;
-      }
-      if (type < v8->types()->kFirstNonstringType) {
-        v8::String valueString(valueObj);
-        std::string value = valueString.ToString(err);
-        if (err.Fail()) {
-          continue;
-        }
-        if (already_saved.count(value)) continue;
+  out.Printf("Heap scan: %s, %" PRIu64 " of %" PRIu64 " MB (%" PRIu64
+             "%%), %" PRIu64 " objects found\n",
+             state, scanned_bytes_ >> 20, total >> 20,
+             total == 0 ? 100 : scanned_bytes_ * 100 / total,
+             GetFoundCount());
+
+  if (background_running_ && scanned_bytes_ != 0)
+    out.Printf("Elapsed %" PRIu64 "s, ETA %" PRIu64 "s\n", elapsed, eta);
+}
+
+
+LLScan::BlockReader::BlockReader(LLScan* scan, uint64_t block_size,
+                                 uint64_t start, uint64_t stride)
+    : scan_(scan),
+      block_size_(block_size),
+      start_(start),
+      stride_(stride),
+      read_ahead_(scan->CanReadInParallel()),
+      blocks_(read_ahead_ ? kReadAheadBlocks : 1),
+      range_(scan->ranges_),
+      random_(kSampleSeed) {
+  for (Block& block : blocks_) block.data_ = new unsigned char[block_size];
+  if (read_ahead_) thread_ = std::thread(&BlockReader::Run, this);
+}
 
-        references = llscan.GetReferencesByString(value);
-        references->push_back(js_obj.raw());
-        already_saved.insert(value);
-      }
+
+LLScan::BlockReader::~BlockReader() {
+  if (read_ahead_) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
     }
+    cond_.notify_all();
+    thread_.join();
   }
+
+  for (Block& block : blocks_) delete[] block.data_;
 }
 
 
-void FindReferencesCmd::StringScanner::ScanRefs(v8::String& str,
-                                                v8::Error& err) {
-  v8::LLV8* v8 = str.v8();
-  ReferencesVector* references;
+bool LLScan::BlockReader::Read(Block* block) {
+  for (; range_ != nullptr; range_ = range_->next_, address_ = 0) {
+    uint64_t address_end = range_->start_ + range_->length_;
+    if (address_end <= start_) continue;
 
-  // Concatenated and sliced strings refer to other strings so
-  // we need to check their references.
+    address_ = std::max(address_, std::max(range_->start_, start_));
+    while (address_ < address_end) {
+      uint64_t address = address_;
+      address_ += block_size_;
 
-  int64_t repr = str.Representation(err);
-  if (err.Fail()) return;
+      // Stratified sampling, one block out of every `stride_` blocks.
+      if (stride_ > 1) {
+        if (index_ % stride_ == 0) pick_ = index_ + random_() % stride_;
+        if (index_++ != pick_) continue;
+      }
 
-  if (repr == v8->string()->kSlicedStringTag) {
-    v8::SlicedString sliced_str(str);
-    v8::String parent_str = sliced_str.Parent(err);
-    if (err.Fail()) return;
-    std::string parent = parent_str.ToString(err);
-    if (err.Success()) {
-      references = llscan.GetReferencesByString(parent);
-      references->push_back(str.raw());
+      uint64_t size = std::min(address_end - address, block_size_);
+      block->range_ = range_;
+      block->address_ = address;
+      block->size_ = size;
+      block->chunks_.clear();
+      block->unreadable_ = scan_->ReadMemoryChunks(address, block->data_, size,
+                                                   0, block->chunks_);
+
+      if (scan_->core_.IsOpen())
+        scan_->core_.Prefetch(address + size, block_size_);
+      return true;
     }
-  } else if (repr == v8->string()->kConsStringTag) {
-    v8::ConsString cons_str(str);
-
-    v8::String first_str = cons_str.First(err);
-    if (err.Fail()) return;
+  }
+  return false;
+}
 
-    // It looks like sometimes one of the strings can be <null> or another
-    // value,
-    // verify that they are a JavaScript String before calling ToString.
-    int64_t first_type = first_str.GetType(err);
-    if (err.Fail()) return;
 
-    if (first_type < v8->types()->kFirstNonstringType) {
-      std::string first = first_str.ToString(err);
+void LLScan::BlockReader::Run() {
+  size_t tail = 0;
 
-      if (err.Success()) {
-        references = llscan.GetReferencesByString(first);
-        references->push_back(str.raw());
-      }
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cond_.wait(lock, [this] { return stop_ || count_ < blocks_.size(); });
+      if (stop_) return;
     }
 
-    v8::String second_str = cons_str.Second(err);
-    if (err.Fail()) return;
+    // The slot is ours until it is published below.
+    if (!Read(&blocks_[tail])) break;
 
-    // It looks like sometimes one of the strings can be <null> or another
-    // value,
-    // verify that they are a JavaScript String before calling ToString.
-    int64_t second_type = second_str.GetType(err);
-    if (err.Fail()) return;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      count_++;
+    }
+    cond_.notify_all();
+    tail = (tail + 1) % blocks_.size();
+  }
 
-    if (second_type < v8->types()->kFirstNonstringType) {
-      std::string second = second_str.ToString(err);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    finished_ = true;
+  }
+  cond_.notify_all();
+}
 
-      if (err.Success()) {
-        references = llscan.GetReferencesByString(second);
-        references->push_back(str.raw());
+
+LLScan::BlockReader::Block* LLScan::BlockReader::Next() {
+  // lldb can only be used from one thread at a time, read on this one.
+  if (!read_ahead_) {
+    if (count_ == 0) {
+      if (finished_ || !Read(&blocks_[0])) {
+        finished_ = true;
+        return nullptr;
       }
+      count_ = 1;
     }
+    return &blocks_[0];
   }
-  // Nothing to do for other kinds of string.
-  // They are strings so we will find references to them.
-}
 
-
-bool FindReferencesCmd::StringScanner::AreReferencesLoaded() {
-  return llscan.AreReferencesByStringLoaded();
+  std::unique_lock<std::mutex> lock(mutex_);
+  cond_.wait(lock, [this] { return count_ > 0 || finished_; });
+  if (count_ == 0) return nullptr;
+  return &blocks_[head_];
 }
 
 
-ReferencesVector* FindReferencesCmd::StringScanner::GetReferences() {
-  return llscan.GetReferencesByString(search_value_);
-}
-
+void LLScan::BlockReader::Release() {
+  if (!read_ahead_) {
+    count_ = 0;
+    return;
+  }
 
-FindJSObjectsVisitor::FindJSObjectsVisitor(SBTarget& target,
-                                           TypeRecordMap& mapstoinstances)
-    : target_(target), mapstoinstances_(mapstoinstances) {
-  found_count_ = 0;
-  address_byte_size_ = target_.GetProcess().GetAddressByteSize();
-  // Load V8 constants from postmortem data
-  llv8.Load(target);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    head_ = (head_ + 1) % blocks_.size();
+    count_--;
+  }
+  cond_.notify_all();
 }
 
 
-/* Visit every address, a bit brute force but it works. */
-uint64_t FindJSObjectsVisitor::Visit(uint64_t location, uint64_t word) {
-  v8::Value v8_value(&llv8, word);
-
-  v8::Error err;
-  // Test if this is SMI
-  // Skip inspecting things that look like Smi's, they aren't objects.
-  v8::Smi smi(v8_value);
-  if (smi.Check()) return address_byte_size_;
+/* Returns false when the scan was stopped before reaching the end of the
+ * memory ranges, scan_cursor_ records where to pick up again.
+ */
+bool LLScan::ScanMemoryRanges(FindJSObjectsVisitor& v, ScanProgress& progress) {
+  bool done = false;
 
-  v8::HeapObject heap_object(v8_value);
-  if (!heap_object.Check()) return address_byte_size_;
+  const uint64_t addr_size = address_byte_size_;
+  bool swap_bytes = swap_bytes_;
 
-  v8::HeapObject map_object = heap_object.GetMap(err);
-  if (err.Fail() || !map_object.Check()) return address_byte_size_;
+  if (scan_cursor_ == 0) {
+    scanned_bytes_ = 0;
+    for (MemoryRange* range = ranges_; range != nullptr; range = range->next_)
+      range->unreadable_ = 0;
+  }
 
-  v8::Map map(map_object);
+  // Pages are usually around 1mb, so this should more than enough
+  const uint64_t block_size = 1024 * 1024 * addr_size;
+  BlockReader reader(this, block_size, scan_cursor_);
 
-  MapCacheEntry map_info;
-  if (map_cache_.count(map.raw()) == 0) {
-    // Check type first
-    map_info.is_histogram = IsAHistogramType(map, err);
+  /* Brute force search - query every address - but allow the visitor code to
+   * say how far to move on so we don't read every byte.
+   */
+  BlockReader::Block* block;
+  while (!done && (block = reader.Next()) != nullptr) {
+    std::unique_lock<std::mutex> lock(results_mutex_);
+    block->range_->unreadable_ += block->unreadable_;
 
-    // On success load type name
-    if (map_info.is_histogram)
-      map_info.type_name = heap_object.GetTypeName(err);
+    done = !VisitBlock(v, block, addr_size, swap_bytes);
 
-    // Cache result
-    map_cache_.emplace(map.raw(), map_info);
+    scan_cursor_ = block->address_ + block->size_;
+    scanned_bytes_ += block->size_;
+    lock.unlock();
+    reader.Release();
 
-    if (err.Fail()) return address_byte_size_;
-  } else {
-    map_info = map_cache_.at(map.raw());
+    if (!done && !progress.Update(scanned_bytes_, v.FoundCount())) return false;
   }
 
-  if (!map_info.is_histogram) return address_byte_size_;
+  return true;
+}
 
-  /* No entry in the map, create a new one. */
-  if (mapstoinstances_.count(map_info.type_name) == 0) {
-    TypeRecord* t = new TypeRecord(map_info.type_name);
 
-    t->AddInstance(word, map.InstanceSize(err));
-    mapstoinstances_.emplace(map_info.type_name, t);
+/* Visit every word of the readable parts of `block`. Returns false when the
+ * visitor asks to stop.
+ */
+template <class Visitor>
+bool LLScan::VisitBlock(Visitor& v, BlockReader::Block* block,
+                        uint64_t addr_size, bool swap_bytes) {
+  for (const MemoryChunk& chunk : block->chunks_) {
+    uint64_t increment = 1;
+    size_t chunk_end = chunk.offset_ + chunk.length_;
+    for (size_t j = chunk.offset_; j + addr_size <= chunk_end;) {
+      uint64_t value;
+
+      if (addr_size == 4) {
+        value = *reinterpret_cast<uint32_t*>(&block->data_[j]);
+        if (swap_bytes) {
+          value = __builtin_bswap32(value);
+        }
+      } else if (addr_size == 8) {
+        value = *reinterpret_cast<uint64_t*>(&block->data_[j]);
+        if (swap_bytes) {
+          value = __builtin_bswap64(value);
+        }
+      } else {
+        break;
+      }
 
-  } else {
-    /* Update an existing instance, if we haven't seen this instance before. */
-    TypeRecord* t = mapstoinstances_.at(map_info.type_name);
-    /* Determine if this is a new instance.
-     * (We are scanning pointers to objects, we may have seen this location
-     * before.)
-     */
-    if (t->GetInstances().count(word) == 0) {
-      t->AddInstance(word, map.InstanceSize(err));
-    }
-  }
+      increment = v.Visit(j + block->address_, value);
+      if (increment == 0) return false;
 
-  if (err.Fail()) {
-    return address_byte_size_;
+      j += static_cast<size_t>(increment);
+    }
   }
 
-  found_count_++;
-
-  /* Just advance one word.
-   * (Should advance by object size, assuming objects can't overlap!)
-   */
-  return address_byte_size_;
+  return true;
 }
 
 
-bool FindJSObjectsVisitor::IsAHistogramType(v8::Map& map, v8::Error& err) {
-  int64_t type = map.GetType(err);
-  if (err.Fail()) return false;
+/* Prefer reading from the core file directly when we have it, lldb
+ * serializes memory reads behind a lock.
+ */
+bool LLScan::ReadMemory(uint64_t address, unsigned char* buf, uint64_t size) {
+  if (core_.IsOpen()) return core_.ReadMemory(address, buf, size);
 
-  v8::LLV8* v8 = map.v8();
-  if (v8::JSObject::IsObjectType(v8, type)) return true;
-  if (type == v8->types()->kJSArrayType) return true;
-  if (type == v8->types()->kJSTypedArrayType) return true;
-  if (type < v8->types()->kFirstNonstringType) return true;
-  return false;
+  SBError sberr;
+  size_t read = process_.ReadMemory(address, buf, size, sberr);
+  return sberr.Success() && read == size;
 }
 
 
-bool LLScan::ScanHeapForObjects(lldb::SBTarget target,
-                                lldb::SBCommandReturnObject& result) {
-  /* Check the last scan is still valid - the process hasn't moved
-   * and we haven't changed target.
+size_t LLScan::ParallelWorkers() {
+  /* lldb can only be used from one thread at a time, core files from many.
+   * The readers fall back to LLV8 under a lock while the calling thread only
+   * reports progress, and a background scan reads through the core file.
    */
+  if (!CanReadInParallel()) return 1;
+  return std::max(1U, std::min(std::thread::hardware_concurrency(), 8U));
+}
 
-  // Reload process anyway
-  process_ = target.GetProcess();
 
-  // Need to reload memory ranges (though this does assume the user has also
-  // updated
-  // LLNODE_RANGESFILE with data for the new dump or things won't match up).
-  if (target_ != target) {
-    ClearMemoryRanges();
-    ClearMapsToInstances();
-    ClearReferences();
-    target_ = target;
-  }
+uint64_t LLScan::ParallelFor(const std::vector<uint64_t>& addresses,
+                             ScanProgress& progress,
+                             const std::function<void(size_t, uint64_t)>& fn) {
+  static const uint64_t kBatchSize = 1024;
 
-#ifndef LLDB_SBMemoryRegionInfoList_h_
-  /* Fall back to environment variable containing pre-parsed list of memory
-   * ranges. */
-  if (nullptr == ranges_) {
-    const char* segmentsfilename = getenv("LLNODE_RANGESFILE");
+  size_t workers = ParallelWorkers();
+  std::atomic<uint64_t> next{0};
+  std::atomic<uint64_t> done{0};
+  std::atomic<size_t> running{workers};
+  std::atomic<bool> stop{false};
 
-    if (segmentsfilename == nullptr) {
-      result.SetError(
-          "No memory range information available for this process. Cannot scan "
-          "for objects.\n"
-          "Please set `LLNODE_RANGESFILE` environment variable\n");
-      return false;
-    }
+  // Progress is only reported from the thread running the command.
+  auto work = [&](size_t worker, bool report) {
+    while (!stop) {
+      uint64_t first = next.fetch_add(kBatchSize);
+      if (first >= addresses.size()) break;
+      uint64_t last = std::min<uint64_t>(first + kBatchSize, addresses.size());
 
-    if (!GenerateMemoryRanges(target, segmentsfilename)) {
-      result.SetError(
-          "No memory range information available for this process. Cannot scan "
-          "for objects.\n");
-      return false;
+      for (uint64_t i = first; i < last; i++) fn(worker, addresses[i]);
+      done += last - first;
+
+      if (report && !progress.Update(done, 0)) stop = true;
     }
+    running--;
+  };
+
+  if (workers == 1) {
+    work(0, true);
+    return done;
   }
-#endif  // LLDB_SBMemoryRegionInfoList_h_
 
-  /* If we've reached here we have access to information about the valid memory
-   * ranges in the process and can scan for objects.
-   */
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < workers; i++) {
+    threads.push_back(std::thread(work, i, false));
+  }
+  while (running > 0) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    if (!progress.Update(done, 0)) stop = true;
+  }
+  for (std::thread& thread : threads) thread.join();
+  return done;
+}
 
-  /* Populate the map of objects. */
-  if (mapstoinstances_.empty()) {
-    FindJSObjectsVisitor v(target, GetMapsToInstances());
 
-    ScanMemoryRanges(v);
+WordReader::WordReader(LLScan* scan, v8::LLV8* llv8, SBTarget target)
+    : scan_(scan), llv8_(llv8) {
+  swap_bytes_ = target.GetProcess().GetByteOrder() != GetHostByteOrder();
+
+  // Load the constants here, the worker threads only read them.
+  tag_ = llv8->heap_obj()->kTag;
+  pointer_size_ = llv8->common()->kPointerSize;
+  map_offset_ = llv8->heap_obj()->kMapOffset;
+  llv8->smi();
+}
+
+
+uint64_t WordReader::DecodeWord(const unsigned char* p) const {
+  if (pointer_size_ == 4) {
+    uint32_t word;
+    memcpy(&word, p, sizeof(word));
+    return swap_bytes_ ? __builtin_bswap32(word) : word;
   }
+  uint64_t word;
+  memcpy(&word, p, sizeof(word));
+  return swap_bytes_ ? __builtin_bswap64(word) : word;
+}
+
 
+bool WordReader::ReadWord(uint64_t address, uint64_t* word) {
+  unsigned char buf[8];
+  if (!scan_->ReadMemory(address, buf, pointer_size_)) return false;
+  *word = DecodeWord(buf);
   return true;
 }
 
-inline static ByteOrder GetHostByteOrder() {
-  union {
-    uint8_t a[2];
-    uint16_t b;
-  } u = {{0, 1}};
-  return u.b == 1 ? ByteOrder::eByteOrderBig : ByteOrder::eByteOrderLittle;
+
+bool WordReader::IsSmi(uint64_t value) const {
+  return v8::Smi(llv8_, value).Check();
 }
 
-void LLScan::ScanMemoryRanges(FindJSObjectsVisitor& v) {
-  bool done = false;
 
-  const uint64_t addr_size = process_.GetAddressByteSize();
-  bool swap_bytes = process_.GetByteOrder() != GetHostByteOrder();
+int64_t WordReader::SmiValue(uint64_t value) const {
+  return v8::Smi(llv8_, value).GetValue();
+}
 
-  // Pages are usually around 1mb, so this should more than enough
-  const uint64_t block_size = 1024 * 1024 * addr_size;
-  unsigned char* block = new unsigned char[block_size];
 
-#ifndef LLDB_SBMemoryRegionInfoList_h_
-  MemoryRange* head = ranges_;
+/* Read `size` bytes at `address` into `block + offset`. Truncated cores
+ * are missing pages so when a read fails the block is split in half until
+ * the unreadable pages are found, only those are skipped. The readable parts
+ * are appended to `chunks`, the number of unreadable bytes is returned.
+ */
+uint64_t LLScan::ReadMemoryChunks(uint64_t address, unsigned char* block,
+                                  uint64_t size, uint64_t offset,
+                                  std::vector<MemoryChunk>& chunks) {
+  if (ReadMemory(address, block + offset, size)) {
+    // Merge with the previous chunk when they are contiguous.
+    if (!chunks.empty() &&
+        chunks.back().offset_ + chunks.back().length_ == offset) {
+      chunks.back().length_ += size;
+    } else {
+      chunks.push_back(MemoryChunk(offset, size));
+    }
+    return 0;
+  }
 
-  while (head != nullptr && !done) {
-    uint64_t address = head->start_;
-    uint64_t len = head->length_;
-    head = head->next_;
+  if (size <= kReadPageSize) return size;
 
-#else  // LLDB_SBMemoryRegionInfoList_h_
-  lldb::SBMemoryRegionInfoList memory_regions = process_.GetMemoryRegions();
-  lldb::SBMemoryRegionInfo region_info;
+  // Split on a page boundary so each half starts page aligned.
+  uint64_t half = size / 2;
+  half += (kReadPageSize - (address + half) % kReadPageSize) % kReadPageSize;
+  if (half >= size) half = size - kReadPageSize;
 
-  for (uint32_t i = 0; i < memory_regions.GetSize(); ++i) {
-    memory_regions.GetMemoryRegionAtIndex(i, region_info);
+  return ReadMemoryChunks(address, block, half, offset, chunks) +
+         ReadMemoryChunks(address + half, block, size - half, offset + half,
+                          chunks);
+}
 
-    if (!region_info.IsWritable()) {
-      continue;
-    }
 
-    uint64_t address = region_info.GetRegionBase();
-    uint64_t len = region_info.GetRegionEnd() - region_info.GetRegionBase();
+uint64_t LLScan::GetTotalRangeSize() {
+  uint64_t total = 0;
+  for (MemoryRange* range = ranges_; range != nullptr; range = range->next_)
+    total += range->length_;
+  return total;
+}
 
-#endif  // LLDB_SBMemoryRegionInfoList_h_
-    /* Brute force search - query every address - but allow the visitor code to
-     * say how far to move on so we don't read every byte.
-     */
 
-    SBError sberr;
-    uint64_t address_end = address + len;
+// Callers must hold results_mutex_ if a background scan may be running.
+uint64_t LLScan::GetFoundCount() {
+  uint64_t found = 0;
+  for (auto const& entry : mapstoinstances_)
+    found += entry.second->GetInstanceCount();
+  return found;
+}
 
-    // Load data in blocks to speed up whole process
-    for (auto searchAddress = address; searchAddress < address_end;
-         searchAddress += block_size) {
-      size_t loaded = std::min(address_end - searchAddress, block_size);
-      process_.ReadMemory(searchAddress, block, loaded, sberr);
-      if (sberr.Fail()) {
-        // TODO(indutny): add error information
-        break;
-      }
 
-      uint32_t increment = 1;
-      for (size_t j = 0; j + addr_size <= loaded;) {
-        uint64_t value;
+void LLScan::Note(SBCommandReturnObject& result, const ScanOptions& options,
+                  const char* format, ...) {
+  char text[1024];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(text, sizeof(text), format, args);
+  va_end(args);
 
-        if (addr_size == 4) {
-          value = *reinterpret_cast<uint32_t*>(&block[j]);
-          if (swap_bytes) {
-            value = __builtin_bswap32(value);
-          }
-        } else if (addr_size == 8) {
-          value = *reinterpret_cast<uint64_t*>(&block[j]);
-          if (swap_bytes) {
-            value = __builtin_bswap64(value);
-          }
-        } else {
-          break;
-        }
+  if (options.json)
+    result.AppendWarning(text);
+  else
+    result.Printf("%s", text);
+}
 
-        increment = v.Visit(j + searchAddress, value);
-        if (increment == 0) break;
 
-        j += static_cast<size_t>(increment);
-      }
+void LLScan::PrintScanSummary(SBCommandReturnObject& result,
+                              const ScanOptions& options) {
+  uint64_t total = 0;
+  uint64_t unreadable = 0;
+  uint32_t range_count = 0;
+  uint32_t unreadable_count = 0;
 
-      if (increment == 0) {
-        done = true;
-        break;
-      }
-    }
+  for (MemoryRange* range = ranges_; range != nullptr; range = range->next_) {
+    total += range->length_;
+    unreadable += range->unreadable_;
+    range_count++;
+    if (range->unreadable_ != 0) unreadable_count++;
   }
 
-  delete[] block;
+  if (unreadable == 0) return;
+
+  Note(result, options,
+       "Scanned %" PRIu64 " bytes in %" PRIu32 " memory ranges, %" PRIu64
+       " bytes in %" PRIu32 " ranges could not be read:\n",
+       total - unreadable, range_count, unreadable, unreadable_count);
+  for (MemoryRange* range = ranges_; range != nullptr; range = range->next_) {
+    if (range->unreadable_ == 0) continue;
+    Note(result, options,
+         "  0x%016" PRIx64 "-0x%016" PRIx64 ": %" PRIu64 " of %" PRIu64
+         " bytes unreadable\n",
+         range->start_, range->start_ + range->length_, range->unreadable_,
+         range->length_);
+  }
 }
 
 
 /* Read a file of memory ranges parsed from the core dump.
  * This is a work around for the lack of an API to get the memory ranges
  * within lldb.
- * There are scripts for generating this file on Mac and Linux stored in
- * the scripts directory of the llnode repository.
+ * Only needed for cores that aren't ELF files, there is a script for
+ * generating this file on Mac stored in the scripts directory of the llnode
+ * repository.
  * Export the name or full path to the ranges file in the LLNODE_RANGESFILE
  * env var before starting lldb and loading the llnode plugin.
  */
@@ -1317,39 +4133,82 @@ bool LLScan::GenerateMemoryRanges(lldb::SBTarget target,
   uint64_t address = 0;
   uint64_t len = 0;
 
-  MemoryRange** tailptr = &ranges_;
+  // Missing or truncated ranges are fine, the scan skips unreadable pages.
+  while (input >> std::hex >> address >> std::hex >> len) {
+    AddMemoryRange(address, len);
+  }
+  return true;
+}
+
 
-  lldb::addr_t address_byte_size = target.GetProcess().GetAddressByteSize();
+/* Build the list of memory ranges from the program headers of an ELF core
+ * file. Segments that can't hold V8 objects (read only and file backed
+ * mappings) are left out and the sizes come from what is actually present in
+ * the core so, unlike with a ranges file, there is no need to probe them.
+ */
+bool LLScan::GenerateMemoryRangesFromCore(lldb::SBTarget target) {
+  lldb::SBProcess process = target.GetProcess();
+  if (!core_.OpenForProcess(process)) return false;
+
+  std::vector<uint64_t> stack_pointers;
+  for (uint32_t i = 0; i < process.GetNumThreads(); i++) {
+    lldb::SBFrame frame = process.GetThreadAtIndex(i).GetFrameAtIndex(0);
+    if (frame.IsValid()) stack_pointers.push_back(frame.GetSP());
+  }
+  core_.ClassifySegments(stack_pointers);
 
-  while (input >> std::hex >> address >> std::hex >> len) {
-    /* Check if the range is accessible.
-     * The structure of a core file means if you check the start and the end of
-     * a range then the middle will be there, ranges are contiguous in the file,
-     * but cores often get truncated due to file size limits so ranges can be
-     * missing or truncated. Sometimes shared memory segments are omitted so
-     * it's also possible an entire section could be missing from the middle.
-     */
-    lldb::SBError error;
+  uint64_t start = 0;
+  uint64_t end = 0;
+  CoreSegment::Kind kind = CoreSegment::kAnonymous;
+  for (const CoreSegment& segment : core_.segments()) {
+    if (!segment.IsScannable()) continue;
 
-    target.GetProcess().ReadPointerFromMemory(address, error);
-    if (!error.Success()) {
-      /* Could not access first word, skip. */
+    uint64_t segment_end = segment.start_ + segment.file_length_;
+
+    // Merge adjacent segments of the same kind into a single range.
+    if (end != start && segment.start_ == end && segment.kind_ == kind) {
+      end = segment_end;
       continue;
     }
 
-    target.GetProcess().ReadPointerFromMemory(
-        (address + len) - address_byte_size, error);
-    if (!error.Success()) {
-      /* Could not access last word, skip. */
+    if (end != start) AddMemoryRange(start, end - start);
+    start = segment.start_;
+    end = segment_end;
+    kind = segment.kind_;
+  }
+  if (end != start) AddMemoryRange(start, end - start);
+
+  return ranges_ != nullptr;
+}
+
+
+#ifdef LLDB_SBMemoryRegionInfoList_h_
+bool LLScan::GenerateMemoryRangesFromRegions(lldb::SBTarget target) {
+  lldb::SBMemoryRegionInfoList memory_regions =
+      target.GetProcess().GetMemoryRegions();
+  lldb::SBMemoryRegionInfo region_info;
+
+  for (uint32_t i = 0; i < memory_regions.GetSize(); ++i) {
+    memory_regions.GetMemoryRegionAtIndex(i, region_info);
+
+    if (!region_info.IsWritable()) {
       continue;
     }
 
-    MemoryRange* newRange = new MemoryRange(address, len);
-
-    *tailptr = newRange;
-    tailptr = &(newRange->next_);
+    AddMemoryRange(region_info.GetRegionBase(),
+                   region_info.GetRegionEnd() - region_info.GetRegionBase());
   }
-  return true;
+
+  return ranges_ != nullptr;
+}
+#endif  // LLDB_SBMemoryRegionInfoList_h_
+
+
+void LLScan::AddMemoryRange(uint64_t start, uint64_t length) {
+  MemoryRange* range = new MemoryRange(start, length);
+
+  *ranges_tail_ = range;
+  ranges_tail_ = &(range->next_);
 }
 
 
@@ -1361,6 +4220,8 @@ void LLScan::ClearMemoryRanges() {
     delete range;
   }
   ranges_ = nullptr;
+  ranges_tail_ = &ranges_;
+  core_.Close();
 }
 
 
@@ -1371,8 +4232,23 @@ void LLScan::ClearMapsToInstances() {
     delete t;
   }
   mapstoinstances_.clear();
+  roots_.clear();
+  marker_.Clear();
+  marked_ = false;
+  scan_complete_ = false;
+  scan_cursor_ = 0;
+  scanned_bytes_ = 0;
 }
 
+void LLScan::ClearSampleRecords() {
+  sample_records_.clear();
+  sample_percent_ = 0;
+  sampled_blocks_ = 0;
+  total_blocks_ = 0;
+  sample_stride_ = 0;
+}
+
+
 void LLScan::ClearReferences() {
   ReferencesVector* references;
 
@@ -1393,5 +4269,7 @@ void LLScan::ClearReferences() {
     delete references;
   }
   references_by_string_.clear();
+
+  FindReferencesCmd::ClearCursor();
 }
 }  // namespace llnode
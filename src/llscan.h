@@ -2,12 +2,36 @@
 #define SRC_LLSCAN_H_
 
 #include <lldb/API/LLDB.h>
+#include <signal.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <random>
 #include <set>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include "src/llcore.h"
 #include "src/llnode.h"
 
 namespace llnode {
 
+class LLScan;
+class ObjectFilter;
+class TypeRecord;
+
+inline lldb::ByteOrder GetHostByteOrder() {
+  union {
+    uint8_t a[2];
+    uint16_t b;
+  } u = {{0, 1}};
+  return u.b == 1 ? lldb::eByteOrderBig : lldb::eByteOrderLittle;
+}
+
 typedef std::vector<uint64_t> ReferencesVector;
 
 typedef std::map<uint64_t, ReferencesVector*> ReferencesByValueMap;
@@ -15,12 +39,181 @@ typedef std::map<std::string, ReferencesVector*> ReferencesByPropertyMap;
 typedef std::map<std::string, ReferencesVector*> ReferencesByStringMap;
 
 
+class ScanOptions {
+ public:
+  ScanOptions()
+      : timeout(0),
+        sample(0),
+        live_only(false),
+        json(false),
+        start(std::chrono::steady_clock::now()) {}
+
+  // Stop scanning after this many seconds, 0 for no limit.
+  uint64_t timeout;
+  // Scan this percentage of the heap and extrapolate, 0 for an exact scan.
+  double sample;
+  // Leave out objects that aren't reachable from outside the V8 heap.
+  bool live_only;
+  /* The command writes a --json document, notes about the scan are given as
+   * warnings so they stay out of it.
+   */
+  bool json;
+  std::chrono::steady_clock::time_point start;
+};
+
+/* Reports the progress of long running scans on stderr and tells them when
+ * to stop early, either because Ctrl-C was pressed or because the time
+ * budget of the command ran out.
+ */
+class ScanProgress {
+ public:
+  ScanProgress(lldb::SBDebugger debugger, const char* what, uint64_t total,
+               bool bytes, const ScanOptions& options);
+  // Background scans only stop when `cancel` is set and stay quiet.
+  explicit ScanProgress(const std::atomic<bool>& cancel);
+  ~ScanProgress();
+
+  /* Returns false when the scan should stop. `done` is out of the total
+   * passed to the constructor, 0 when it isn't known up front, `found` is the
+   * number of objects found.
+   */
+  bool Update(uint64_t done, uint64_t found);
+
+  inline bool interrupted() const { return interrupted_ != 0; }
+  inline bool timed_out() const { return timed_out_; }
+
+ private:
+  static void OnInterrupt(int sig, siginfo_t* info, void* context);
+
+  static volatile sig_atomic_t interrupted_;
+  static struct sigaction previous_action_;
+  /* Number of foreground scans alive, all on the thread running commands.
+   * Only the outermost installs and restores the SIGINT handler.
+   */
+  static int depth_;
+
+  const std::atomic<bool>* cancel_;
+  FILE* err_;
+  const char* what_;
+  uint64_t total_;
+  bool bytes_;
+  bool timed_out_;
+  std::chrono::steady_clock::time_point start_;
+  std::chrono::steady_clock::time_point deadline_;
+  std::chrono::steady_clock::time_point last_report_;
+};
+
+class ScanCmd : public CommandBase {
+ public:
+  ~ScanCmd() override {}
+
+  bool DoExecute(lldb::SBDebugger d, char** cmd,
+                 lldb::SBCommandReturnObject& result) override;
+
+  // Returns false when --timeout isn't a number of seconds.
+  bool ParseScanOptions(char** cmd, ScanOptions* options, bool* background);
+};
+
 class FindObjectsCmd : public CommandBase {
  public:
+  FindObjectsCmd()
+      : owned_(false), spaces_(false), by_map_(false), dictionaries_(false) {}
   ~FindObjectsCmd() override {}
 
   bool DoExecute(lldb::SBDebugger d, char** cmd,
                  lldb::SBCommandReturnObject& result) override;
+
+  // Returns false when --timeout isn't a number of seconds.
+  bool ParseScanOptions(char** cmd, ScanOptions* options);
+
+ private:
+  bool PrintEstimate(lldb::SBTarget target,
+                     lldb::SBCommandReturnObject& result, OutputSink& out,
+                     const ScanOptions& options);
+  bool ComputeOwnedSizes(lldb::SBDebugger d,
+                         lldb::SBCommandReturnObject& result,
+                         const ScanOptions& options);
+  void PrintSpaces(OutputSink& out, std::vector<TypeRecord*>& records);
+  void PrintMaps(OutputSink& out, std::vector<TypeRecord*>& records);
+  void PrintDictionaries(OutputSink& out, std::vector<TypeRecord*>& records);
+
+  bool owned_;
+  bool spaces_;
+  bool by_map_;
+  bool dictionaries_;
+  std::string space_name_;
+};
+
+/* Pages through a long listing. --limit N lists at most N results, --offset M
+ * leaves out the first M and --next lists the page after the last one, with
+ * the arguments the last paged command was given. Where that page stopped is
+ * kept in a Cursor that outlives the command.
+ */
+class Pager {
+ public:
+  class Cursor {
+   public:
+    Cursor() : position(0), resume(0), limit(0), more(false) {}
+
+    // The arguments of the paged command, without the paging options.
+    std::vector<std::string> args;
+    // The number of results before the next page.
+    uint64_t position;
+    // Where the listing goes on, an address or an index into it.
+    uint64_t resume;
+    uint64_t limit;
+    // False once the last page was listed.
+    bool more;
+  };
+
+  explicit Pager(Cursor* cursor)
+      : cursor_(cursor),
+        limit_(0),
+        offset_(0),
+        position_(0),
+        shown_(0),
+        paged_(false),
+        next_(false) {}
+
+  /* Take the paging options off `*cmd`, for --next point it at the saved
+   * arguments instead. Returns false and sets `error` when an option is
+   * invalid or there is no page to go on with.
+   */
+  bool Parse(char*** cmd, std::string* error);
+
+  // True when --next goes on from `resume()` rather than from the start.
+  inline bool resuming() const { return next_; }
+  inline uint64_t resume() const { return cursor_->resume; }
+  inline bool paged() const { return paged_; }
+
+  /* Called for each result in order, returns true when it's on the page.
+   * Results before the offset are only counted.
+   */
+  inline bool Take() {
+    if (position_++ < offset_) return false;
+    shown_++;
+    return true;
+  }
+  inline bool full() const { return limit_ != 0 && shown_ >= limit_; }
+
+  /* Remember where the listing stopped for --next, `resume` is where the
+   * first result left off the page is. Does nothing unless paging.
+   */
+  void Save(uint64_t resume, bool more);
+
+  // Tell what was listed and how to get the next page, `command` is its name.
+  void PrintFooter(OutputSink& out, const char* command);
+
+ private:
+  Cursor* cursor_;
+  std::vector<std::string> args_;
+  std::vector<char*> argv_;
+  uint64_t limit_;
+  uint64_t offset_;
+  uint64_t position_;
+  uint64_t shown_;
+  bool paged_;
+  bool next_;
 };
 
 class FindInstancesCmd : public CommandBase {
@@ -31,9 +224,40 @@ class FindInstancesCmd : public CommandBase {
                  lldb::SBCommandReturnObject& result) override;
 
  private:
+  // A fixed seed picks the same sample every time.
+  static const uint64_t kSampleSeed = 0x66696e646a73;
+
+  /* Inspect `count` instances of `t` picked at random by reservoir sampling,
+   * after the totals of the type.
+   */
+  void WriteSample(OutputSink& out, TypeRecord* t, uint64_t count,
+                   ObjectFilter* filter, const ScanOptions& scan_options,
+                   v8::Value::InspectOptions* inspect_options);
+
+  // Shared by both names of the command.
+  static Pager::Cursor cursor_;
+
   bool detailed_;
 };
 
+class FindLargestCmd : public CommandBase {
+ public:
+  FindLargestCmd() : count_(kDefaultCount) {}
+  ~FindLargestCmd() override {}
+
+  bool DoExecute(lldb::SBDebugger d, char** cmd,
+                 lldb::SBCommandReturnObject& result) override;
+
+  // Returns false when --timeout isn't a number of seconds.
+  bool ParseScanOptions(char** cmd, ScanOptions* options);
+
+ private:
+  static const uint64_t kDefaultCount = 10;
+
+  uint64_t count_;
+  std::string type_name_;
+};
+
 class NodeInfoCmd : public CommandBase {
  public:
   ~NodeInfoCmd() override {}
@@ -42,6 +266,14 @@ class NodeInfoCmd : public CommandBase {
                  lldb::SBCommandReturnObject& result) override;
 };
 
+class ShapesCmd : public CommandBase {
+ public:
+  ~ShapesCmd() override {}
+
+  bool DoExecute(lldb::SBDebugger d, char** cmd,
+                 lldb::SBCommandReturnObject& result) override;
+};
+
 class FindReferencesCmd : public CommandBase {
  public:
   ~FindReferencesCmd() override {}
@@ -51,7 +283,8 @@ class FindReferencesCmd : public CommandBase {
 
   enum ScanType { kFieldValue, kPropertyName, kStringValue, kBadOption };
 
-  char** ParseScanOptions(char** cmd, ScanType* type);
+  // Returns null when --timeout isn't a number of seconds.
+  char** ParseScanOptions(char** cmd, ScanType* type, ScanOptions* options);
 
   class ObjectScanner {
    public:
@@ -64,16 +297,20 @@ class FindReferencesCmd : public CommandBase {
     virtual void ScanRefs(v8::JSObject& js_obj, v8::Error& err){};
     virtual void ScanRefs(v8::String& str, v8::Error& err){};
 
-    virtual void PrintRefs(lldb::SBCommandReturnObject& result,
-                           v8::JSObject& js_obj, v8::Error& err) {}
-    virtual void PrintRefs(lldb::SBCommandReturnObject& result, v8::String& str,
+    virtual void PrintRefs(OutputSink& out, v8::JSObject& js_obj,
                            v8::Error& err) {}
+    virtual void PrintRefs(OutputSink& out, v8::String& str, v8::Error& err) {}
   };
 
-  void PrintReferences(lldb::SBCommandReturnObject& result,
-                       ReferencesVector* references, ObjectScanner* scanner);
+  /* Objects `filter` doesn't match are left out, when there is one. With a
+   * `pager` only its page of the holders is printed.
+   */
+  void PrintReferences(OutputSink& out, ReferencesVector* references,
+                       ObjectScanner* scanner, bool live_only,
+                       ObjectFilter* filter = nullptr, Pager* pager = nullptr);
 
-  void ScanForReferences(ObjectScanner* scanner);
+  bool ScanForReferences(ObjectScanner* scanner, lldb::SBDebugger d,
+                         const ScanOptions& options);
 
   class ReferenceScanner : public ObjectScanner {
    public:
@@ -86,10 +323,9 @@ class FindReferencesCmd : public CommandBase {
     void ScanRefs(v8::JSObject& js_obj, v8::Error& err) override;
     void ScanRefs(v8::String& str, v8::Error& err) override;
 
-    void PrintRefs(lldb::SBCommandReturnObject& result, v8::JSObject& js_obj,
-                   v8::Error& err) override;
-    void PrintRefs(lldb::SBCommandReturnObject& result, v8::String& str,
+    void PrintRefs(OutputSink& out, v8::JSObject& js_obj,
                    v8::Error& err) override;
+    void PrintRefs(OutputSink& out, v8::String& str, v8::Error& err) override;
 
    private:
     v8::Value search_value_;
@@ -107,7 +343,7 @@ class FindReferencesCmd : public CommandBase {
 
     // We only scan properties on objects not Strings, use default no-op impl
     // of PrintRefs for Strings.
-    void PrintRefs(lldb::SBCommandReturnObject& result, v8::JSObject& js_obj,
+    void PrintRefs(OutputSink& out, v8::JSObject& js_obj,
                    v8::Error& err) override;
 
    private:
@@ -126,14 +362,24 @@ class FindReferencesCmd : public CommandBase {
     void ScanRefs(v8::JSObject& js_obj, v8::Error& err) override;
     void ScanRefs(v8::String& str, v8::Error& err) override;
 
-    void PrintRefs(lldb::SBCommandReturnObject& result, v8::JSObject& js_obj,
-                   v8::Error& err) override;
-    void PrintRefs(lldb::SBCommandReturnObject& result, v8::String& str,
+    void PrintRefs(OutputSink& out, v8::JSObject& js_obj,
                    v8::Error& err) override;
+    void PrintRefs(OutputSink& out, v8::String& str, v8::Error& err) override;
 
    private:
     std::string search_value_;
   };
+
+  /* Forget the page `--next` goes on from, it is an index into references
+   * that are being thrown away.
+   */
+  static void ClearCursor() { cursor_ = Pager::Cursor(); }
+
+ private:
+  static Pager::Cursor cursor_;
+
+  // The --where expression, empty when there isn't one.
+  std::string where_;
 };
 
 class MemoryVisitor {
@@ -145,18 +391,84 @@ class MemoryVisitor {
 
 class TypeRecord {
  public:
+  // The instances of the type that have one Map.
+  class MapRecord {
+   public:
+    uint64_t count = 0;
+    uint64_t size = 0;
+  };
+  typedef std::unordered_map<uint64_t, MapRecord> MapRecordMap;
+
   TypeRecord(std::string& type_name)
-      : type_name_(type_name), instance_count_(0), total_instance_size_(0) {}
+      : type_name_(type_name),
+        instance_count_(0),
+        total_instance_size_(0),
+        total_owned_size_(0),
+        owned_count_(0),
+        space_counts_(),
+        space_sizes_(),
+        live_count_(0),
+        live_size_(0),
+        dictionary_count_(0),
+        dictionary_capacity_(0),
+        dictionary_used_(0),
+        dictionary_size_(0) {}
 
   inline std::string& GetTypeName() { return type_name_; };
   inline uint64_t GetInstanceCount() { return instance_count_; };
   inline uint64_t GetTotalInstanceSize() { return total_instance_size_; };
   inline std::set<uint64_t>& GetInstances() { return instances_; };
 
-  inline void AddInstance(uint64_t address, uint64_t size) {
+  /* The owned size is worked out on demand, it is stale once more instances
+   * have been added.
+   */
+  inline bool HasOwnedSize() { return owned_count_ == instance_count_; };
+  inline uint64_t GetTotalOwnedSize() { return total_owned_size_; };
+  inline void SetTotalOwnedSize(uint64_t size) {
+    total_owned_size_ = size;
+    owned_count_ = instance_count_;
+  };
+
+  inline uint64_t GetSpaceInstanceCount(v8::MemoryChunk::Space space) {
+    return space_counts_[space];
+  };
+  inline uint64_t GetSpaceInstanceSize(v8::MemoryChunk::Space space) {
+    return space_sizes_[space];
+  };
+
+  // Only valid once the heap has been marked.
+  inline uint64_t GetLiveInstanceCount() { return live_count_; };
+  inline uint64_t GetLiveInstanceSize() { return live_size_; };
+  inline void SetLive(uint64_t count, uint64_t size) {
+    live_count_ = count;
+    live_size_ = size;
+  };
+
+  // By the address of the Map.
+  inline MapRecordMap& GetMaps() { return maps_; };
+
+  // Instances in dictionary mode and the NameDictionary of their properties.
+  inline uint64_t GetDictionaryCount() { return dictionary_count_; };
+  inline uint64_t GetDictionaryCapacity() { return dictionary_capacity_; };
+  inline uint64_t GetDictionaryUsed() { return dictionary_used_; };
+  inline uint64_t GetDictionarySize() { return dictionary_size_; };
+  inline void AddDictionary(uint64_t capacity, uint64_t used, uint64_t size) {
+    dictionary_count_++;
+    dictionary_capacity_ += capacity;
+    dictionary_used_ += used;
+    dictionary_size_ += size;
+  };
+
+  inline void AddInstance(uint64_t address, uint64_t size,
+                          v8::MemoryChunk::Space space, uint64_t map) {
     instances_.insert(address);
     instance_count_++;
     total_instance_size_ += size;
+    space_counts_[space]++;
+    space_sizes_[space] += size;
+    MapRecord& record = maps_[map];
+    record.count++;
+    record.size += size;
   };
 
   /* Sort records by instance count, use the other fields as tie breakers
@@ -177,48 +489,318 @@ class TypeRecord {
   std::string type_name_;
   uint64_t instance_count_;
   uint64_t total_instance_size_;
+  uint64_t total_owned_size_;
+  uint64_t owned_count_;
+  uint64_t space_counts_[v8::MemoryChunk::kNumSpaces];
+  uint64_t space_sizes_[v8::MemoryChunk::kNumSpaces];
+  uint64_t live_count_;
+  uint64_t live_size_;
+  uint64_t dictionary_count_;
+  uint64_t dictionary_capacity_;
+  uint64_t dictionary_used_;
+  uint64_t dictionary_size_;
   std::set<uint64_t> instances_;
+  MapRecordMap maps_;
 };
 
 typedef std::map<std::string, TypeRecord*> TypeRecordMap;
 
+/* Shallow and owned sizes of heap objects, with the SizeFormula of every Map
+ * seen cached.
+ */
+class ObjectSizer {
+ public:
+  int64_t ShallowSize(v8::HeapObject object, v8::Error& err);
+
+  /* The object plus the backing stores only it refers to: its elements and
+   * out-of-object properties. Empty backing stores are shared by every
+   * object without any and aren't counted.
+   */
+  int64_t OwnedSize(v8::HeapObject object, v8::Error& err);
+
+ private:
+  int64_t BackingStoreSize(v8::HeapObject store, v8::Error& err);
+
+  std::map<int64_t, v8::SizeFormula> formulas_;
+};
+
+/* Instance counts and sizes of one type in the sampled blocks of the heap,
+ * summed along with their squares so they can be extrapolated to the whole
+ * heap with a confidence interval.
+ */
+class SampleRecord {
+ public:
+  SampleRecord()
+      : count_(0), count_squares_(0), size_(0), size_squares_(0) {}
+
+  inline void AddBlock(uint64_t count, uint64_t size) {
+    count_ += count;
+    count_squares_ += static_cast<double>(count) * count;
+    size_ += size;
+    size_squares_ += static_cast<double>(size) * size;
+  }
+
+  /* Estimates for a sample of `sampled` out of `total` blocks, one out of
+   * every `stride`. `interval` is set to the half width of the 95%
+   * confidence interval.
+   */
+  inline double EstimateCount(uint64_t sampled, uint64_t total,
+                              uint64_t stride, double* interval) const {
+    return Estimate(count_, count_squares_, sampled, total, stride, interval);
+  }
+  inline double EstimateSize(uint64_t sampled, uint64_t total,
+                             uint64_t stride, double* interval) const {
+    return Estimate(size_, size_squares_, sampled, total, stride, interval);
+  }
+
+ private:
+  static double Estimate(double sum, double squares, uint64_t sampled,
+                         uint64_t total, uint64_t stride, double* interval);
+
+  double count_;
+  double count_squares_;
+  double size_;
+  double size_squares_;
+};
+
+typedef std::map<std::string, SampleRecord> SampleRecordMap;
+
 class FindJSObjectsVisitor : MemoryVisitor {
  public:
-  FindJSObjectsVisitor(lldb::SBTarget& target, TypeRecordMap& mapstoinstances);
+  FindJSObjectsVisitor(lldb::SBTarget& target, TypeRecordMap& mapstoinstances,
+                       std::vector<uint64_t>& roots, v8::LLV8* llv8);
   ~FindJSObjectsVisitor() {}
 
   uint64_t Visit(uint64_t location, uint64_t word);
 
   uint32_t FoundCount() { return found_count_; }
 
+  static bool IsAHistogramType(v8::Map& map, v8::Error& err);
+
  private:
   struct MapCacheEntry {
     std::string type_name;
+    bool is_map;
     bool is_histogram;
+    // Instances keep their properties in a NameDictionary.
+    bool is_dictionary;
+    v8::SizeFormula size;
   };
 
-  bool IsAHistogramType(v8::Map& map, v8::Error& err);
+  v8::MemoryChunk::Space GetSpace(uint64_t address);
+  void AddInstance(TypeRecord* t, v8::HeapObject& object, int64_t size,
+                   const MapCacheEntry& map_info, uint64_t map);
+  static bool IsAMap(v8::HeapObject& object);
 
   lldb::SBTarget& target_;
+  v8::LLV8* llv8_;
   uint32_t address_byte_size_;
   uint32_t found_count_;
 
   TypeRecordMap& mapstoinstances_;
+  // Pointers to heap objects found outside the V8 heap.
+  std::vector<uint64_t>& roots_;
   std::map<int64_t, MapCacheEntry> map_cache_;
+
+  struct ChunkEntry {
+    uint64_t end;
+    v8::MemoryChunk::Space space;
+  };
+  // The chunks found so far by their start, and every address looked at.
+  std::map<uint64_t, ChunkEntry> chunks_;
+  std::unordered_set<uint64_t> probed_;
+};
+
+
+/* Finds objects by location rather than by the pointers to them: the first
+ * word of every object points to its Map. Once an object is found the rest
+ * of it is skipped, so Maps held in its fields aren't taken for objects of
+ * their own and each object is seen once. Extrapolating from a sample of the
+ * heap relies on that. Unlike FindJSObjectsVisitor this also counts objects
+ * nothing refers to anymore.
+ */
+class SampleVisitor : MemoryVisitor {
+ public:
+  SampleVisitor(lldb::SBTarget& target, SampleRecordMap& records,
+                v8::LLV8* llv8);
+  ~SampleVisitor() {}
+
+  uint64_t Visit(uint64_t location, uint64_t word);
+
+  // Called at the end of every sampled block.
+  void EndBlock();
+
+  uint64_t FoundCount() { return found_count_; }
+
+ private:
+  struct MapCacheEntry {
+    bool is_map;
+    bool is_histogram;
+    // Instances can be sized and skipped.
+    bool has_size;
+    std::string type_name;
+    v8::SizeFormula size;
+  };
+
+  static const size_t kMaxCacheSize = 1 << 20;
+
+  v8::LLV8* llv8_;
+  uint32_t address_byte_size_;
+  uint64_t found_count_;
+  int64_t meta_map_;
+
+  SampleRecordMap& records_;
+  // Keyed by the first word of the candidate object, maps or not.
+  std::map<int64_t, MapCacheEntry> map_cache_;
+  std::map<std::string, std::pair<uint64_t, uint64_t>> block_counts_;
+};
+
+
+/* Marks every object reachable from the roots the heap scan found, pointers
+ * to heap objects from memory outside the V8 heap: stacks, handle scopes,
+ * global handles and the isolate's root list all live there. Like V8's own
+ * collector it uses a work-list rather than recursion and keeps one mark bit
+ * per word of every heap page.
+ *
+ * It errs towards live: stale pointers outside the heap, weak references
+ * and raw data that looks like a pointer all keep objects alive.
+ */
+class HeapMarker {
+ public:
+  HeapMarker()
+      : scan_(nullptr),
+        llv8_(nullptr),
+        page_size_(0),
+        addr_size_(0),
+        swap_bytes_(false),
+        meta_map_(0),
+        marked_count_(0) {}
+
+  // Returns false when marking was stopped early, the marks are cleared.
+  bool Mark(LLScan* scan, v8::LLV8* llv8, const std::vector<uint64_t>& roots,
+            ScanProgress& progress);
+  bool IsMarked(uint64_t address) const;
+  inline uint64_t MarkedCount() const { return marked_count_; }
+  void Clear();
+
+ private:
+  enum BodyKind { kTagged, kRawData, kCode };
+
+  struct MapInfo {
+    bool is_map;
+    BodyKind body;
+    v8::SizeFormula size;
+  };
+
+  // Sets the mark bit of `address`, returns false if it was already set.
+  bool SetMark(uint64_t address);
+  // Whether `address` is in one of the memory ranges of the scan.
+  bool InRanges(uint64_t address) const;
+  bool IsObject(uint64_t address);
+  uint64_t DecodeWord(const unsigned char* p) const;
+  MapInfo GetMapInfo(uint64_t map);
+  void VisitObject(uint64_t address);
+  void VisitPointers(uint64_t start, uint64_t size);
+
+  static const uint64_t kReadSize = 64 * 1024;
+  static const size_t kMaxCacheSize = 1 << 20;
+
+  LLScan* scan_;
+  v8::LLV8* llv8_;
+  uint64_t page_size_;
+  uint64_t addr_size_;
+  bool swap_bytes_;
+  int64_t meta_map_;
+
+  // The memory ranges of the scan, sorted by start address.
+  std::vector<std::pair<uint64_t, uint64_t>> ranges_;
+  std::unordered_map<uint64_t, std::vector<uint64_t>> bitmap_;
+  std::vector<uint64_t> worklist_;
+  std::unordered_map<uint64_t, MapInfo> map_cache_;
+  std::vector<unsigned char> buffer_;
+  uint64_t marked_count_;
 };
 
 
 class LLScan {
  public:
   LLScan() {}
+  ~LLScan() { StopBackgroundScan(); }
 
   bool ScanHeapForObjects(lldb::SBTarget target,
-                          lldb::SBCommandReturnObject& result);
+                          lldb::SBCommandReturnObject& result,
+                          const ScanOptions& options = ScanOptions());
+
+  /* Estimate the histogram from a stratified random sample of the heap, the
+   * percentage to scan comes from `options.sample`.
+   */
+  bool SampleHeapForObjects(lldb::SBTarget target,
+                            lldb::SBCommandReturnObject& result,
+                            const ScanOptions& options);
+  inline SampleRecordMap& GetSampleRecords() { return sample_records_; };
+  inline uint64_t GetSampledBlocks() { return sampled_blocks_; };
+  inline uint64_t GetTotalBlocks() { return total_blocks_; };
+  inline uint64_t GetSampleStride() { return sample_stride_; };
+
+  /* Scan the heap on a worker thread. Scan commands issued later wait for it
+   * to finish, or answer from its partial results when the wait is cut short
+   * by Ctrl-C or --timeout.
+   */
+  bool StartBackgroundScan(lldb::SBTarget target,
+                           lldb::SBCommandReturnObject& result,
+                           const ScanOptions& options = ScanOptions());
+  void StopBackgroundScan();
+  // Start a background scan of core files when LLNODE_AUTOSCAN is set.
+  void MaybeStartBackgroundScan(lldb::SBTarget target);
+  void PrintScanStatus(OutputSink& out);
+
+  /* Hold while using the results, a background scan may still be adding to
+   * them.
+   */
+  inline std::unique_lock<std::mutex> LockResults() {
+    return std::unique_lock<std::mutex>(results_mutex_);
+  }
   bool GenerateMemoryRanges(lldb::SBTarget target,
                             const char* segmentsfilename);
+  bool GenerateMemoryRangesFromCore(lldb::SBTarget target);
+#ifdef LLDB_SBMemoryRegionInfoList_h_
+  bool GenerateMemoryRangesFromRegions(lldb::SBTarget target);
+#endif  // LLDB_SBMemoryRegionInfoList_h_
 
   inline TypeRecordMap& GetMapsToInstances() { return mapstoinstances_; };
 
+  /* Mark the objects reachable from outside the V8 heap, once per complete
+   * scan, and count the live instances of every type.
+   */
+  bool MarkLiveObjects(lldb::SBTarget target,
+                       lldb::SBCommandReturnObject& result,
+                       const ScanOptions& options);
+  inline bool IsLive(uint64_t address) { return marker_.IsMarked(address); }
+
+  // False when the last scan was stopped early and the results are partial.
+  inline bool IsScanComplete() { return scan_complete_; };
+
+  /* Read target memory, straight from the core file when there is one. Only
+   * safe to call from several threads at once when CanReadInParallel().
+   */
+  bool ReadMemory(uint64_t address, unsigned char* buf, uint64_t size);
+  inline bool CanReadInParallel() { return core_.IsOpen(); }
+
+  /* The number of threads ParallelFor runs `fn` on, up to 8 when reading a
+   * core file, 1 when lldb does the reading. Size per worker state with it.
+   */
+  size_t ParallelWorkers();
+  /* Call `fn(worker, address)` for every address, handed out in batches to
+   * ParallelWorkers() threads numbered from 0. `progress` is updated from the
+   * calling thread only. Returns the number of addresses done, less than all
+   * of them when `progress` said to stop.
+   */
+  uint64_t ParallelFor(const std::vector<uint64_t>& addresses,
+                       ScanProgress& progress,
+                       const std::function<void(size_t, uint64_t)>& fn);
+
+  void ClearReferences();
+
   // References By Value
   inline bool AreReferencesByValueLoaded() {
     return references_by_value_.size() > 0;
@@ -251,31 +833,189 @@ class LLScan {
   };
 
  private:
-  void ScanMemoryRanges(FindJSObjectsVisitor& v);
+  // Smallest unit a failed read is split into.
+  static const uint64_t kReadPageSize = 4096;
+
+  class MemoryChunk {
+   public:
+    MemoryChunk(uint64_t offset, uint64_t length)
+        : offset_(offset), length_(length) {}
+
+    uint64_t offset_;
+    uint64_t length_;
+  };
+
+  class MemoryRange;
+  friend class HeapMarker;
+
+  /* Reads the memory ranges on a separate thread, ahead of the scan, so that
+   * paging in the core overlaps with visiting the objects. At most
+   * kReadAheadBlocks blocks are held in memory at any time. Without a core
+   * file lldb does the reading, one block at a time on the thread calling
+   * Next().
+   */
+  class BlockReader {
+   public:
+    class Block {
+     public:
+      MemoryRange* range_ = nullptr;
+      uint64_t address_ = 0;
+      uint64_t size_ = 0;
+      uint64_t unreadable_ = 0;
+      unsigned char* data_ = nullptr;
+      std::vector<MemoryChunk> chunks_;
+    };
+
+    /* With a `stride` above 1 only one randomly picked block out of every
+     * `stride` blocks is read.
+     */
+    BlockReader(LLScan* scan, uint64_t block_size, uint64_t start,
+                uint64_t stride = 1);
+    ~BlockReader();
+
+    // Wait for the next block in address order, nullptr after the last one.
+    Block* Next();
+    // Hand the block returned by Next() back so it can be refilled.
+    void Release();
+
+   private:
+    // Fill `block` with the next block to visit, false after the last one.
+    bool Read(Block* block);
+    void Run();
+
+    LLScan* scan_;
+    uint64_t block_size_;
+    uint64_t start_;
+    uint64_t stride_;
+    bool read_ahead_;
+    std::vector<Block> blocks_;
+
+    // Where Read() is, and the state of the stratified sampling.
+    MemoryRange* range_;
+    uint64_t address_ = 0;
+    std::mt19937_64 random_;
+    uint64_t index_ = 0;
+    uint64_t pick_ = 0;
+
+    size_t head_ = 0;
+    size_t count_ = 0;
+    bool finished_ = false;
+    bool stop_ = false;
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::thread thread_;
+  };
+
+  static const size_t kReadAheadBlocks = 4;
+  // Sampling picks from small blocks to get enough of them.
+  static const uint64_t kSampleBlockSize = 64 * 1024;
+  // A fixed seed keeps estimates reproducible.
+  static const uint64_t kSampleSeed = 0x6c6c6e6f6465;
+
+  bool PrepareScan(lldb::SBTarget target, lldb::SBCommandReturnObject& result);
+  bool WaitForBackgroundScan(lldb::SBCommandReturnObject& result,
+                             const ScanOptions& options);
+  void RunBackgroundScan();
+  bool ScanMemoryRanges(FindJSObjectsVisitor& v, ScanProgress& progress);
+  template <class Visitor>
+  bool VisitBlock(Visitor& v, BlockReader::Block* block, uint64_t addr_size,
+                  bool swap_bytes);
+  uint64_t GetTotalRangeSize();
+  uint64_t GetFoundCount();
+  uint64_t ReadMemoryChunks(uint64_t address, unsigned char* block,
+                            uint64_t size, uint64_t offset,
+                            std::vector<MemoryChunk>& chunks);
+  void PrintScanSummary(lldb::SBCommandReturnObject& result,
+                        const ScanOptions& options);
+  // Print a note about the scan, see ScanOptions::json.
+  void Note(lldb::SBCommandReturnObject& result, const ScanOptions& options,
+            const char* format, ...) __attribute__((format(printf, 4, 5)));
+  void AddMemoryRange(uint64_t start, uint64_t length);
   void ClearMemoryRanges();
   void ClearMapsToInstances();
-  void ClearReferences();
+  void ClearSampleRecords();
 
   class MemoryRange {
    public:
     MemoryRange(uint64_t start, uint64_t length)
-        : start_(start), length_(length), next_(nullptr) {}
+        : start_(start), length_(length), unreadable_(0), next_(nullptr) {}
 
     uint64_t start_;
     uint64_t length_;
+    // Bytes that couldn't be read during the last scan.
+    uint64_t unreadable_;
     MemoryRange* next_;
   };
 
   lldb::SBTarget target_;
   lldb::SBProcess process_;
+  CoreFile core_;
   MemoryRange* ranges_ = nullptr;
+  MemoryRange** ranges_tail_ = &ranges_;
   TypeRecordMap mapstoinstances_;
+  std::vector<uint64_t> roots_;
+  HeapMarker marker_;
+  bool marked_ = false;
+
+  /* A scan that was stopped early resumes from scan_cursor_ the next time
+   * one of the scan commands runs.
+   */
+  bool scan_complete_ = false;
+  uint64_t scan_cursor_ = 0;
+  uint64_t scanned_bytes_ = 0;
+
+  SampleRecordMap sample_records_;
+  double sample_percent_ = 0;
+  // One block out of every sample_stride_ was sampled.
+  uint64_t sample_stride_ = 0;
+  uint64_t sampled_blocks_ = 0;
+  uint64_t total_blocks_ = 0;
+
+  // Set by PrepareScan, the background scan can't ask lldb for them.
+  uint64_t address_byte_size_ = 8;
+  bool swap_bytes_ = false;
+
+  /* The scan has its own LLV8 so it can run off the main thread. A background
+   * scan points it at the core file and never uses lldb.
+   */
+  v8::LLV8 scan_v8_;
+  std::unique_ptr<FindJSObjectsVisitor> background_visitor_;
+  std::thread background_thread_;
+  std::atomic<bool> background_running_{false};
+  std::atomic<bool> background_stop_{false};
+  std::chrono::steady_clock::time_point background_start_;
+  // Guards the results and the scan position while a background scan runs.
+  std::mutex results_mutex_;
 
   ReferencesByValueMap references_by_value_;
   ReferencesByPropertyMap references_by_property_;
   ReferencesByStringMap references_by_string_;
 };
 
+/* Decodes words read with LLScan::ReadMemory in the byte order of the
+ * target, for the readers that go through many objects without LLV8. The
+ * constants are loaded up front, so the readers can be used from the
+ * threads of LLScan::ParallelFor.
+ */
+class WordReader {
+ public:
+  WordReader(LLScan* scan, v8::LLV8* llv8, lldb::SBTarget target);
+
+  uint64_t DecodeWord(const unsigned char* p) const;
+  bool ReadWord(uint64_t address, uint64_t* word);
+  bool IsSmi(uint64_t value) const;
+  int64_t SmiValue(uint64_t value) const;
+
+ protected:
+  LLScan* scan_;
+  v8::LLV8* llv8_;
+  bool swap_bytes_;
+  int64_t tag_;
+  int64_t pointer_size_;
+  int64_t map_offset_;
+};
+
 }  // namespace llnode
 
 
@@ -0,0 +1,1353 @@
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <cinttypes>
+#include <functional>
+#include <queue>
+#include <regex>
+#include <unordered_set>
+#include <vector>
+
+#include "src/llnode.h"
+#include "src/llscan.h"
+#include "src/llstrings.h"
+#include "src/llutf8.h"
+#include "src/llv8-inl.h"
+#include "src/llv8.h"
+
+namespace llnode {
+
+using lldb::SBCommandReturnObject;
+using lldb::SBDebugger;
+using lldb::SBTarget;
+using lldb::eReturnStatusFailed;
+using lldb::eReturnStatusSuccessFinishResult;
+
+// Defined in llnode.cc
+extern v8::LLV8 llv8;
+// Defined in llscan.cc
+extern LLScan llscan;
+
+
+inline static uint64_t RotateLeft(uint64_t value, int bits) {
+  return (value << bits) | (value >> (64 - bits));
+}
+
+
+inline void ContentHash::Mix(uint64_t word) {
+  word *= 0x87c37b91114253d5ULL;
+  word = RotateLeft(word, 31);
+  word *= 0x4cf5ad432745937fULL;
+  hash_ ^= word;
+  hash_ = RotateLeft(hash_, 27) * 5 + 0x52dce729;
+}
+
+
+void ContentHash::Update(const unsigned char* data, uint64_t size) {
+  length_ += size;
+
+  uint64_t word;
+  for (; size >= sizeof(word); data += sizeof(word), size -= sizeof(word)) {
+    memcpy(&word, data, sizeof(word));
+    Mix(word);
+  }
+
+  // Only the last call has a partial word, pad it with zeroes.
+  if (size > 0) {
+    word = 0;
+    memcpy(&word, data, size);
+    Mix(word);
+  }
+}
+
+
+uint64_t ContentHash::Finish() const {
+  uint64_t hash = hash_ ^ length_;
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ULL;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+
+FlatStringReader::FlatStringReader(LLScan* scan, v8::LLV8* llv8,
+                                   SBTarget target)
+    : WordReader(scan, llv8, target) {
+  length_offset_ = llv8->string()->kLengthOffset;
+  one_byte_chars_offset_ = llv8->one_byte_string()->kCharsOffset;
+  two_byte_chars_offset_ = llv8->two_byte_string()->kCharsOffset;
+  resource_data_offset_ = llv8->external_string()->kResourceDataOffset;
+  llv8->types();
+  llv8->map();
+}
+
+
+FlatStringReader::StringMap FlatStringReader::GetStringMap(uint64_t map) {
+  std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+  auto it = string_maps_.find(map);
+  if (it != string_maps_.end()) return it->second;
+
+  StringMap string_map = {0, false, -1, 0};
+  v8::Error err;
+  int64_t type = v8::Map(llv8_, map).GetType(err);
+  if (!err.Fail() && type < llv8_->types()->kFirstNonstringType) {
+    int64_t repr = type & llv8_->string()->kRepresentationMask;
+    string_map.representation = repr;
+    string_map.external = repr == llv8_->string()->kExternalStringTag;
+
+    // Short external strings don't cache the address of their characters.
+    bool flat = repr == llv8_->string()->kSeqStringTag ||
+                (string_map.external && resource_data_offset_ != -1 &&
+                 (type & llv8_->external_string()->kShortExternalStringMask) !=
+                     llv8_->external_string()->kShortExternalStringTag);
+
+    int64_t encoding = type & llv8_->string()->kEncodingMask;
+    string_map.width = encoding == llv8_->string()->kTwoByteStringTag ? 2 : 1;
+    if (!flat) {
+      string_map.char_size = 0;
+    } else if (encoding == llv8_->string()->kOneByteStringTag) {
+      string_map.char_size = 1;
+    } else if (encoding == llv8_->string()->kTwoByteStringTag) {
+      string_map.char_size = 2;
+    }
+  }
+
+  string_maps_[map] = string_map;
+  return string_map;
+}
+
+
+bool FlatStringReader::ReadHeader(uint64_t address, Header* header) {
+  uint64_t start = address - tag_;
+  unsigned char buf[64];
+  uint64_t header_size = length_offset_ + pointer_size_;
+  if (header_size > sizeof(buf) ||
+      !scan_->ReadMemory(start, buf, header_size)) {
+    return false;
+  }
+
+  StringMap string_map = GetStringMap(DecodeWord(buf + map_offset_));
+  header->char_size = string_map.char_size;
+  if (header->char_size == 0) return false;
+
+  v8::Smi length(llv8_, DecodeWord(buf + length_offset_));
+  if (!length.Check()) return false;
+  header->length = length.GetValue();
+  if (header->length < 0 || header->length > kMaxLength) return false;
+
+  uint64_t bytes = header->length * header->char_size;
+  if (string_map.external) {
+    unsigned char data[8];
+    if (!scan_->ReadMemory(start + resource_data_offset_, data,
+                           pointer_size_)) {
+      return false;
+    }
+    header->chars = DecodeWord(data);
+    header->size = resource_data_offset_ + pointer_size_;
+    header->off_heap = bytes;
+    return true;
+  }
+
+  int64_t chars_offset = header->char_size == 1 ? one_byte_chars_offset_
+                                                : two_byte_chars_offset_;
+  header->chars = start + chars_offset;
+  header->size = chars_offset + bytes;
+  header->size = (header->size + pointer_size_ - 1) & ~(pointer_size_ - 1);
+  header->off_heap = 0;
+  return true;
+}
+
+
+bool FlatStringReader::Hash(uint64_t address, uint64_t* hash, uint64_t* size) {
+  Header header;
+  if (!ReadHeader(address, &header)) return false;
+
+  ContentHash content(header.char_size);
+  unsigned char buf[kReadSize];
+  uint64_t bytes = header.length * header.char_size;
+  for (uint64_t offset = 0; offset < bytes; offset += kReadSize) {
+    uint64_t n = bytes - offset < kReadSize ? bytes - offset : kReadSize;
+    if (!scan_->ReadMemory(header.chars + offset, buf, n)) return false;
+    content.Update(buf, n);
+  }
+
+  *hash = content.Finish();
+  *size = header.size + header.off_heap;
+  return true;
+}
+
+
+bool FlatStringReader::Read(uint64_t address, std::string* chars,
+                            int64_t* char_size) {
+  Header header;
+  if (!ReadHeader(address, &header)) return false;
+
+  chars->resize(header.length * header.char_size);
+  *char_size = header.char_size;
+  if (chars->empty()) return true;
+  return scan_->ReadMemory(header.chars,
+                           reinterpret_cast<unsigned char*>(&(*chars)[0]),
+                           chars->size());
+}
+
+
+bool FlatStringReader::Representation(uint64_t address,
+                                      int64_t* representation,
+                                      int64_t* char_size) {
+  uint64_t map;
+  if (!ReadWord(address - tag_ + map_offset_, &map)) return false;
+
+  StringMap string_map = GetStringMap(map);
+  if (string_map.representation == -1) return false;
+  *representation = string_map.representation;
+  *char_size = string_map.width;
+  return true;
+}
+
+
+/* Convert `from`, `from_size` bytes per character, to `to_size` bytes per
+ * character and append it to `to`. Only one byte characters are widened,
+ * two byte characters only end up in one byte ropes in a corrupt heap and
+ * keep their low byte.
+ */
+static void AppendChars(const char* from, size_t length, int64_t from_size,
+                        int64_t to_size, std::string* to) {
+  if (from_size == to_size) {
+    to->append(from, length * from_size);
+  } else if (from_size == 1) {
+    for (size_t i = 0; i < length; i++) {
+      to->push_back(from[i]);
+      to->push_back('\0');
+    }
+  } else {
+    for (size_t i = 0; i < length; i++) to->push_back(from[i * 2]);
+  }
+}
+
+
+bool StringFlattener::Flatten(uint64_t address, std::string* chars,
+                              int64_t* char_size,
+                              std::unordered_set<uint64_t>* sub_ropes) {
+  // Most strings are flat and don't need LLV8 at all.
+  if (reader_->Read(address, chars, char_size)) return true;
+
+  int64_t repr;
+  if (!reader_->Representation(address, &repr, char_size)) return false;
+  chars->clear();
+  return Append(address, *char_size, chars, sub_ropes);
+}
+
+
+bool StringFlattener::Append(uint64_t address, int64_t char_size,
+                             std::string* chars,
+                             std::unordered_set<uint64_t>* sub_ropes) {
+  // Ropes can be too deep to recurse into, walk their leaves left to right.
+  std::vector<uint64_t> pending(1, address);
+  std::string leaf;
+  int64_t leaf_size;
+
+  while (!pending.empty()) {
+    uint64_t next = pending.back();
+    pending.pop_back();
+
+    if (reader_->Read(next, &leaf, &leaf_size)) {
+      AppendChars(leaf.data(), leaf.size() / leaf_size, leaf_size, char_size,
+                  chars);
+      continue;
+    }
+
+    int64_t repr;
+    if (!reader_->Representation(next, &repr, &leaf_size)) return false;
+
+    v8::Error err;
+    v8::String str(llv8_, next);
+    if (repr == llv8_->string()->kConsStringTag) {
+      if (sub_ropes != nullptr && next != address) sub_ropes->insert(next);
+
+      v8::ConsString rope(str);
+      v8::String first = rope.First(err);
+      if (err.Fail()) return false;
+      v8::String second = rope.Second(err);
+      if (err.Fail()) return false;
+      pending.push_back(second.raw());
+      pending.push_back(first.raw());
+    } else if (repr == llv8_->string()->kThinStringTag) {
+      v8::ThinString thin(str);
+      v8::String actual = thin.Actual(err);
+      if (err.Fail()) return false;
+      pending.push_back(actual.raw());
+    } else if (repr == llv8_->string()->kSlicedStringTag) {
+      v8::SlicedString slice(str);
+      v8::String parent = slice.Parent(err);
+      if (err.Fail()) return false;
+      int64_t offset = slice.Offset(err).GetValue();
+      if (err.Fail()) return false;
+      int64_t length = slice.Length(err).GetValue();
+      if (err.Fail()) return false;
+
+      // Parents are always flat.
+      if (!reader_->Read(parent.raw(), &leaf, &leaf_size)) return false;
+      if (offset < 0 || length < 0 ||
+          static_cast<uint64_t>((offset + length) * leaf_size) > leaf.size()) {
+        return false;
+      }
+      AppendChars(leaf.data() + offset * leaf_size, length, leaf_size,
+                  char_size, chars);
+    } else {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+
+DupRecordRuns::~DupRecordRuns() {
+  for (Run& run : runs_) {
+    if (run.file_ != nullptr) fclose(run.file_);
+  }
+}
+
+
+void DupRecordRuns::Add(std::vector<DupRecord>& records) {
+  if (records.empty()) return;
+  std::sort(records.begin(), records.end());
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  runs_.push_back(Run());
+  Run& run = runs_.back();
+
+  if (in_memory_ + records.size() > kMemoryRecords) {
+    run.file_ = tmpfile();
+    if (run.file_ != nullptr &&
+        fwrite(records.data(), sizeof(DupRecord), records.size(),
+               run.file_) == records.size() &&
+        fseek(run.file_, 0, SEEK_SET) == 0) {
+      records.clear();
+      return;
+    }
+
+    // Hold on to the run when it can't be spilled.
+    if (run.file_ != nullptr) fclose(run.file_);
+    run.file_ = nullptr;
+  }
+
+  in_memory_ += records.size();
+  run.records_.swap(records);
+  records.clear();
+}
+
+
+bool DupRecordRuns::Next(Run& run, DupRecord* record) {
+  if (run.next_ == run.records_.size()) {
+    if (run.file_ == nullptr) return false;
+
+    run.records_.resize(kReadRecords);
+    size_t n = fread(run.records_.data(), sizeof(DupRecord), kReadRecords,
+                     run.file_);
+    run.records_.resize(n);
+    run.next_ = 0;
+    if (n == 0) return false;
+  }
+
+  *record = run.records_[run.next_++];
+  return true;
+}
+
+
+bool DupRecordRuns::Merge(
+    std::function<bool(const std::vector<DupRecord>&)> group) {
+  typedef std::pair<DupRecord, size_t> Head;
+  auto later = [](const Head& a, const Head& b) { return b.first < a.first; };
+  std::priority_queue<Head, std::vector<Head>, decltype(later)> heads(later);
+
+  for (size_t i = 0; i < runs_.size(); i++) {
+    DupRecord record;
+    if (Next(runs_[i], &record)) heads.push(Head(record, i));
+  }
+
+  std::vector<DupRecord> records;
+  while (!heads.empty()) {
+    Head head = heads.top();
+    heads.pop();
+
+    if (!records.empty() && records.back().hash != head.first.hash) {
+      if (records.size() > 1 && !group(records)) return false;
+      records.clear();
+    }
+    records.push_back(head.first);
+
+    DupRecord record;
+    if (Next(runs_[head.second], &record)) {
+      heads.push(Head(record, head.second));
+    }
+  }
+  if (records.size() > 1) return group(records);
+  return true;
+}
+
+
+bool DupStringsCmd::DoExecute(SBDebugger d, char** cmd,
+                              SBCommandReturnObject& result) {
+  OutputSink out(d, result);
+  if (!ParseOutputOptions(cmd, &out, result)) return false;
+
+  SBTarget target = d.GetSelectedTarget();
+  if (!target.IsValid()) {
+    result.SetError("No valid process, please start something\n");
+    return false;
+  }
+
+  ScanOptions scan_options;
+  scan_options.json = out.json();
+  if (!ParseCountOptions(cmd, &scan_options, kDefaultCount, &count_,
+                         nullptr)) {
+    result.SetError("USAGE: v8 dupstrings [-n count]\n");
+    return false;
+  }
+
+  /* Ensure we have a map of objects. */
+  if (!llscan.ScanHeapForObjects(target, result, scan_options)) {
+    result.SetStatus(eReturnStatusFailed);
+    return false;
+  }
+
+  auto lock = llscan.LockResults();
+
+  if (scan_options.live_only &&
+      !llscan.MarkLiveObjects(target, result, scan_options)) {
+    result.SetStatus(eReturnStatusFailed);
+    return false;
+  }
+
+  // Load V8 constants from postmortem data
+  llv8.Load(target);
+
+  TypeRecordMap& mapstoinstances = llscan.GetMapsToInstances();
+  auto it = mapstoinstances.find("(String)");
+  if (it == mapstoinstances.end()) {
+    if (out.json())
+      out.Printf(
+          "{\"duplicated\":0,\"copies\":0,\"wasted\":0,\"values\":[]}\n");
+    else
+      out.Printf("No strings found\n");
+    result.SetStatus(eReturnStatusSuccessFinishResult);
+    return true;
+  }
+
+  std::vector<uint64_t> addresses;
+  for (uint64_t address : it->second->GetInstances()) {
+    if (scan_options.live_only && !llscan.IsLive(address)) continue;
+    addresses.push_back(address);
+  }
+
+  FlatStringReader reader(&llscan, &llv8, target);
+  DupRecordRuns runs;
+  std::vector<std::vector<DupRecord>> records(llscan.ParallelWorkers());
+
+  ScanProgress progress(d, "Hashing strings", addresses.size(), false,
+                        scan_options);
+  uint64_t done = llscan.ParallelFor(
+      addresses, progress, [&](size_t worker, uint64_t address) {
+        std::vector<DupRecord>& mine = records[worker];
+        DupRecord record;
+        record.address = address;
+        if (!reader.Hash(record.address, &record.hash, &record.size)) return;
+        mine.push_back(record);
+        if (mine.size() >= DupRecordRuns::kRunRecords) runs.Add(mine);
+      });
+  for (std::vector<DupRecord>& mine : records) runs.Add(mine);
+
+  if (done != addresses.size()) {
+    result.SetError("Stopped before every string was hashed\n");
+    return false;
+  }
+
+  class Value {
+   public:
+    uint64_t address;
+    uint64_t copies;
+    uint64_t wasted;
+
+    bool operator>(const Value& other) const { return wasted > other.wasted; }
+  };
+
+  // The value wasting the least so far is on top.
+  std::priority_queue<Value, std::vector<Value>, std::greater<Value>> top;
+  uint64_t total_values = 0;
+  uint64_t total_copies = 0;
+  uint64_t total_wasted = 0;
+
+  // Strings with the same hash are almost always equal, compare them anyway.
+  bool merged = runs.Merge([&](const std::vector<DupRecord>& records) {
+    class Distinct {
+     public:
+      std::string chars;
+      int64_t char_size;
+      Value value;
+    };
+    std::vector<Distinct> distinct;
+
+    for (const DupRecord& record : records) {
+      Distinct candidate;
+      if (!reader.Read(record.address, &candidate.chars,
+                       &candidate.char_size)) {
+        continue;
+      }
+
+      bool found = false;
+      for (Distinct& seen : distinct) {
+        if (seen.char_size != candidate.char_size ||
+            seen.chars != candidate.chars) {
+          continue;
+        }
+        seen.value.copies++;
+        seen.value.wasted += record.size;
+        found = true;
+        break;
+      }
+      if (found) continue;
+
+      // The first copy isn't wasted.
+      candidate.value = {record.address, 1, 0};
+      distinct.push_back(std::move(candidate));
+    }
+
+    for (Distinct& seen : distinct) {
+      if (seen.value.copies < 2) continue;
+
+      total_values++;
+      total_copies += seen.value.copies;
+      total_wasted += seen.value.wasted;
+      if (top.size() < count_) {
+        top.push(seen.value);
+      } else if (seen.value.wasted > top.top().wasted) {
+        top.pop();
+        top.push(seen.value);
+      }
+    }
+    return !progress.interrupted();
+  });
+
+  if (!merged) {
+    result.SetError("Interrupted\n");
+    return false;
+  }
+
+  std::vector<Value> sorted;
+  for (; !top.empty(); top.pop()) sorted.push_back(top.top());
+
+  v8::Value::InspectOptions inspect_options;
+  if (out.json()) {
+    JSONWriter& json = out.json_writer();
+    json.BeginObject();
+    json.Member("duplicated", total_values);
+    json.Member("copies", total_copies);
+    json.Member("wasted", total_wasted);
+    json.Key("values");
+    json.BeginArray();
+    for (auto v = sorted.rbegin(); v != sorted.rend(); ++v) {
+      v8::Error err;
+      v8::String str(&llv8, v->address);
+      json.BeginObject();
+      json.Key("address");
+      json.Address(v->address);
+      json.Member("copies", v->copies);
+      json.Member("wasted", v->wasted);
+      json.Member("inspect", str.Inspect(&inspect_options, err));
+      json.EndObject();
+    }
+    json.EndArray();
+    json.EndObject();
+    result.SetStatus(eReturnStatusSuccessFinishResult);
+    return true;
+  }
+
+  out.Printf("%" PRIu64 " values are duplicated in %" PRIu64
+             " strings, wasting %" PRIu64 " bytes\n",
+             total_values, total_copies, total_wasted);
+  if (sorted.empty()) {
+    result.SetStatus(eReturnStatusSuccessFinishResult);
+    return true;
+  }
+
+  out.Printf("     Copies     Wasted Value\n");
+  out.Printf(" ---------- ---------- -----\n");
+  for (auto v = sorted.rbegin(); v != sorted.rend(); ++v) {
+    v8::Error err;
+    v8::String str(&llv8, v->address);
+    std::string preview = str.Inspect(&inspect_options, err);
+    out.Printf(" %10" PRIu64 " %10" PRIu64 " %s\n", v->copies, v->wasted,
+               preview.c_str());
+  }
+
+  result.SetStatus(eReturnStatusSuccessFinishResult);
+  return true;
+}
+
+
+bool StringStatsCmd::DoExecute(SBDebugger d, char** cmd,
+                               SBCommandReturnObject& result) {
+  OutputSink out(d, result);
+  if (!ParseOutputOptions(cmd, &out, result)) return false;
+
+  SBTarget target = d.GetSelectedTarget();
+  if (!target.IsValid()) {
+    result.SetError("No valid process, please start something\n");
+    return false;
+  }
+
+  ScanOptions scan_options;
+  scan_options.json = out.json();
+  if (!ParseCountOptions(cmd, &scan_options, kDefaultCount, &count_,
+                         nullptr)) {
+    result.SetError("USAGE: v8 stringstats [flags]\n");
+    return false;
+  }
+
+  /* Ensure we have a map of objects. */
+  if (!llscan.ScanHeapForObjects(target, result, scan_options)) {
+    result.SetStatus(eReturnStatusFailed);
+    return false;
+  }
+
+  auto lock = llscan.LockResults();
+
+  if (scan_options.live_only &&
+      !llscan.MarkLiveObjects(target, result, scan_options)) {
+    result.SetStatus(eReturnStatusFailed);
+    return false;
+  }
+
+  // Load V8 constants from postmortem data
+  llv8.Load(target);
+
+  TypeRecordMap& mapstoinstances = llscan.GetMapsToInstances();
+  auto it = mapstoinstances.find("(String)");
+  if (it == mapstoinstances.end()) {
+    if (out.json())
+      out.Printf("{\"complete\":true,\"representations\":[]}\n");
+    else
+      out.Printf("No strings found\n");
+    result.SetStatus(eReturnStatusSuccessFinishResult);
+    return true;
+  }
+
+  // Indexed by representation and encoding, one byte first.
+  Usage usage[kNumRepresentations][2];
+  ConsMap cons;
+  std::unordered_map<uint64_t, Parent> parents;
+
+  uint64_t total = it->second->GetInstanceCount();
+  ScanProgress progress(d, "Sizing strings", total, false, scan_options);
+  ObjectSizer sizer;
+  uint64_t done = 0;
+  bool complete = true;
+  for (uint64_t address : it->second->GetInstances()) {
+    if ((++done & 0x3ff) == 0 && !progress.Update(done, 0)) {
+      complete = false;
+      break;
+    }
+    if (scan_options.live_only && !llscan.IsLive(address)) continue;
+
+    v8::Error err;
+    v8::String str(&llv8, address);
+    int64_t type = str.GetType(err);
+    if (err.Fail()) continue;
+    int64_t size = sizer.ShallowSize(str, err);
+    if (err.Fail()) continue;
+
+    Representation repr = GetRepresentation(type);
+    bool two_byte = (type & llv8.string()->kEncodingMask) ==
+                    llv8.string()->kTwoByteStringTag;
+    usage[repr][two_byte].count++;
+    usage[repr][two_byte].size += size;
+
+    if (repr == kCons) {
+      v8::ConsString rope(&llv8, address);
+      v8::String first = rope.First(err);
+      if (err.Fail()) continue;
+      v8::String second = rope.Second(err);
+      if (err.Fail()) continue;
+      cons[address] = std::make_pair(first.raw(), second.raw());
+    } else if (repr == kExternal) {
+      v8::ExternalString external(str);
+      v8::Smi length = external.Length(err);
+      if (err.Fail()) continue;
+
+      // Short external strings don't tell where their characters are.
+      external.ResourceData(err);
+      if (err.Fail()) continue;
+      usage[repr][two_byte].off_heap += length.GetValue() * (two_byte ? 2 : 1);
+    } else if (repr == kSliced) {
+      v8::SlicedString slice(&llv8, address);
+      v8::String parent = slice.Parent(err);
+      if (err.Fail()) continue;
+      v8::Smi offset = slice.Offset(err);
+      if (err.Fail()) continue;
+      v8::Smi length = slice.Length(err);
+      if (err.Fail()) continue;
+
+      // Slices have the encoding of their parent.
+      Parent& p = parents[parent.raw()];
+      p.char_size = two_byte ? 2 : 1;
+      p.slices.push_back(std::make_pair(offset.GetValue(), length.GetValue()));
+    }
+  }
+
+  JSONWriter& json = out.json_writer();
+  if (out.json()) {
+    json.BeginObject();
+    json.Member("complete", complete);
+    json.Key("representations");
+    json.BeginArray();
+  } else {
+    if (!complete) {
+      out.Printf("PARTIAL RESULT: stopped after %" PRIu64 " of %" PRIu64
+                 " strings.\n",
+                 done, total);
+    }
+    out.Printf(
+        "Representation Encoding      Count       Bytes    Off-heap\n");
+    out.Printf(
+        " ------------- -------- ---------- ----------- -----------\n");
+  }
+  Usage sum;
+  for (int repr = 0; repr < kNumRepresentations; repr++) {
+    for (int two_byte = 0; two_byte < 2; two_byte++) {
+      const Usage& u = usage[repr][two_byte];
+      if (u.count == 0) continue;
+      const char* name = RepresentationName(static_cast<Representation>(repr));
+      const char* encoding = two_byte ? "two-byte" : "one-byte";
+      if (out.json()) {
+        json.BeginObject();
+        json.Member("representation", name);
+        json.Member("encoding", encoding);
+        json.Member("count", u.count);
+        json.Member("size", u.size);
+        json.Member("off_heap", u.off_heap);
+        json.EndObject();
+      } else {
+        out.Printf(" %-13s %-8s %10" PRIu64 " %11" PRIu64 " %11" PRIu64 "\n",
+                   name, encoding, u.count, u.size, u.off_heap);
+      }
+      sum.count += u.count;
+      sum.size += u.size;
+      sum.off_heap += u.off_heap;
+    }
+  }
+  if (out.json()) {
+    json.EndArray();
+    json.Key("total");
+    json.BeginObject();
+    json.Member("count", sum.count);
+    json.Member("size", sum.size);
+    json.Member("off_heap", sum.off_heap);
+    json.EndObject();
+  } else {
+    out.Printf(" %-13s %-8s %10" PRIu64 " %11" PRIu64 " %11" PRIu64 "\n",
+               "(total)", "", sum.count, sum.size, sum.off_heap);
+  }
+
+  // Only ropes that aren't half of a longer rope are counted.
+  std::unordered_map<uint64_t, uint64_t> depths;
+  ComputeDepths(cons, depths);
+  std::unordered_set<uint64_t> halves;
+  for (auto const& entry : cons) {
+    halves.insert(entry.second.first);
+    halves.insert(entry.second.second);
+  }
+
+  std::vector<uint64_t> ropes_by_depth;
+  uint64_t ropes = 0;
+  uint64_t deepest = 0;
+  uint64_t deepest_address = 0;
+  for (auto const& entry : depths) {
+    if (halves.count(entry.first) != 0) continue;
+
+    // Depths 1, 2-3, 4-7 and so on share a row.
+    size_t row = 63 - __builtin_clzll(entry.second);
+    if (ropes_by_depth.size() <= row) ropes_by_depth.resize(row + 1);
+    ropes_by_depth[row]++;
+    ropes++;
+    if (entry.second > deepest) {
+      deepest = entry.second;
+      deepest_address = entry.first;
+    }
+  }
+
+  if (ropes != 0 && out.json()) {
+    json.Key("ropes");
+    json.BeginObject();
+    json.Member("count", ropes);
+    json.Member("deepest", deepest);
+    json.Key("deepest_address");
+    json.Address(deepest_address);
+    json.Key("depths");
+    json.BeginArray();
+    for (size_t row = 0; row < ropes_by_depth.size(); row++) {
+      uint64_t low = 1ULL << row;
+      json.BeginObject();
+      json.Member("min", low);
+      json.Member("max", (low << 1) - 1);
+      json.Member("ropes", ropes_by_depth[row]);
+      json.EndObject();
+    }
+    json.EndArray();
+    json.EndObject();
+  } else if (ropes != 0) {
+    out.Printf("\nCons string depth, %" PRIu64
+               " ropes, the deepest has %" PRIu64 " levels at 0x%016" PRIx64
+               ":\n",
+               ropes, deepest, deepest_address);
+    out.Printf("           Depth      Ropes\n");
+    out.Printf(" --------------- ----------\n");
+    for (size_t row = 0; row < ropes_by_depth.size(); row++) {
+      uint64_t low = 1ULL << row;
+      uint64_t high = (low << 1) - 1;
+      char depth[32];
+      if (low == high) {
+        snprintf(depth, sizeof(depth), "%" PRIu64, low);
+      } else {
+        snprintf(depth, sizeof(depth), "%" PRIu64 "-%" PRIu64, low, high);
+      }
+      out.Printf(" %15s %10" PRIu64 "\n", depth, ropes_by_depth[row]);
+    }
+  }
+
+  class Retainer {
+   public:
+    uint64_t address;
+    uint64_t retained;
+    uint64_t used;
+    uint64_t slices;
+
+    inline uint64_t unused() const { return retained - used; }
+  };
+
+  std::vector<Retainer> retainers;
+  for (auto& entry : parents) {
+    v8::Error err;
+    v8::String parent(&llv8, entry.first);
+    v8::Smi length = parent.Length(err);
+    if (err.Fail()) continue;
+
+    Parent& p = entry.second;
+    p.length = length.GetValue();
+    int64_t used = std::min(CoveredLength(p.slices), p.length);
+    Retainer retainer = {entry.first,
+                         static_cast<uint64_t>(p.length * p.char_size),
+                         static_cast<uint64_t>(used * p.char_size),
+                         p.slices.size()};
+    retainers.push_back(retainer);
+  }
+
+  std::sort(retainers.begin(), retainers.end(),
+            [](const Retainer& a, const Retainer& b) {
+              return a.unused() > b.unused();
+            });
+  if (retainers.size() > count_) retainers.resize(count_);
+
+  v8::Value::InspectOptions inspect_options;
+  if (out.json()) {
+    json.Key("sliced_parents");
+    json.BeginArray();
+    for (const Retainer& r : retainers) {
+      v8::Error err;
+      v8::String parent(&llv8, r.address);
+      json.BeginObject();
+      json.Key("address");
+      json.Address(r.address);
+      json.Member("retained", r.retained);
+      json.Member("used", r.used);
+      json.Member("slices", r.slices);
+      json.Member("inspect", parent.Inspect(&inspect_options, err));
+      json.EndObject();
+    }
+    json.EndArray();
+    json.EndObject();
+  } else if (!retainers.empty()) {
+    out.Printf("\nSliced string parents, by the bytes no slice uses:\n");
+    out.Printf("   Retained       Used    Ratio     Slices Parent\n");
+    out.Printf(" ---------- ---------- -------- ---------- ------\n");
+    for (const Retainer& r : retainers) {
+      v8::Error err;
+      v8::String parent(&llv8, r.address);
+      std::string preview = parent.Inspect(&inspect_options, err);
+      double ratio =
+          r.used == 0 ? 0 : static_cast<double>(r.retained) / r.used;
+      out.Printf(" %10" PRIu64 " %10" PRIu64 " %8.1f %10" PRIu64 " %s\n",
+                 r.retained, r.used, ratio, r.slices, preview.c_str());
+    }
+  }
+
+  result.SetStatus(eReturnStatusSuccessFinishResult);
+  return true;
+}
+
+
+StringStatsCmd::Representation StringStatsCmd::GetRepresentation(
+    int64_t type) {
+  int64_t repr = type & llv8.string()->kRepresentationMask;
+  if (repr == llv8.string()->kSeqStringTag) return kSeq;
+  if (repr == llv8.string()->kConsStringTag) return kCons;
+  if (repr == llv8.string()->kSlicedStringTag) return kSliced;
+  if (repr == llv8.string()->kThinStringTag) return kThin;
+  if (repr == llv8.string()->kExternalStringTag) return kExternal;
+  return kOther;
+}
+
+
+const char* StringStatsCmd::RepresentationName(Representation repr) {
+  switch (repr) {
+    case kSeq:
+      return "sequential";
+    case kCons:
+      return "cons";
+    case kSliced:
+      return "sliced";
+    case kThin:
+      return "thin";
+    case kExternal:
+      return "external";
+    default:
+      return "other";
+  }
+}
+
+
+void StringStatsCmd::ComputeDepths(
+    const ConsMap& cons, std::unordered_map<uint64_t, uint64_t>& depths) {
+  // Ropes can be far too deep to recurse into.
+  std::vector<uint64_t> stack;
+  std::unordered_set<uint64_t> on_stack;
+
+  for (auto const& entry : cons) {
+    if (depths.count(entry.first) != 0) continue;
+    stack.push_back(entry.first);
+    on_stack.insert(entry.first);
+
+    while (!stack.empty()) {
+      uint64_t address = stack.back();
+      const std::pair<uint64_t, uint64_t>& rope = cons.find(address)->second;
+
+      uint64_t depth = 0;
+      bool ready = true;
+      for (uint64_t half : {rope.first, rope.second}) {
+        auto depth_it = depths.find(half);
+        if (depth_it != depths.end()) {
+          depth = std::max(depth, depth_it->second);
+          continue;
+        }
+        // Flat strings are leaves, so are cycles in a corrupt heap.
+        if (cons.count(half) == 0 || on_stack.count(half) != 0) continue;
+
+        stack.push_back(half);
+        on_stack.insert(half);
+        ready = false;
+      }
+      if (!ready) continue;
+
+      depths[address] = depth + 1;
+      stack.pop_back();
+      on_stack.erase(address);
+    }
+  }
+}
+
+
+int64_t StringStatsCmd::CoveredLength(SliceList& slices) {
+  std::sort(slices.begin(), slices.end());
+
+  int64_t covered = 0;
+  int64_t end = 0;
+  for (auto const& slice : slices) {
+    int64_t start = std::max(slice.first, end);
+    int64_t slice_end = slice.first + slice.second;
+    if (slice_end > start) {
+      covered += slice_end - start;
+      end = slice_end;
+    }
+  }
+  return covered;
+}
+
+
+bool GrepStringsCmd::DoExecute(SBDebugger d, char** cmd,
+                               SBCommandReturnObject& result) {
+  OutputSink out(d, result);
+  if (!ParseOutputOptions(cmd, &out, result)) return false;
+
+  SBTarget target = d.GetSelectedTarget();
+  if (!target.IsValid()) {
+    result.SetError("No valid process, please start something\n");
+    return false;
+  }
+
+  ScanOptions scan_options;
+  scan_options.json = out.json();
+  char** start = ParseScanOptions(cmd, &scan_options);
+  if (start == nullptr || *start == nullptr) {
+    result.SetError("USAGE: v8 grepstrings [--regex] pattern\n");
+    return false;
+  }
+  // Check for extra parameters or parameters that needed quoting.
+  if (start[1] != nullptr) {
+    result.SetError("Extra search parameter or unquoted string specified.");
+    return false;
+  }
+
+  std::string pattern = start[0];
+  std::string literal = pattern;
+  std::regex regex;
+  if (regex_) {
+    try {
+      regex = std::regex(pattern);
+    } catch (const std::regex_error&) {
+      result.SetError("Invalid regular expression\n");
+      return false;
+    }
+    literal = RequiredLiteral(pattern);
+  }
+
+  /* Ensure we have a map of objects. */
+  if (!llscan.ScanHeapForObjects(target, result, scan_options)) {
+    result.SetStatus(eReturnStatusFailed);
+    return false;
+  }
+
+  auto lock = llscan.LockResults();
+
+  if (scan_options.live_only &&
+      !llscan.MarkLiveObjects(target, result, scan_options)) {
+    result.SetStatus(eReturnStatusFailed);
+    return false;
+  }
+
+  // Load V8 constants from postmortem data
+  llv8.Load(target);
+
+  TypeRecordMap& mapstoinstances = llscan.GetMapsToInstances();
+  auto it = mapstoinstances.find("(String)");
+  if (it == mapstoinstances.end()) {
+    if (out.json())
+      out.Printf("{\"complete\":true,\"strings\":[]}\n");
+    else
+      out.Printf("No strings found\n");
+    result.SetStatus(eReturnStatusSuccessFinishResult);
+    return true;
+  }
+  std::set<uint64_t>& strings = it->second->GetInstances();
+
+  FlatStringReader reader(&llscan, &llv8, target);
+  StringFlattener flattener(&reader, &llv8);
+  std::vector<uint64_t> matches;
+  uint64_t done = 0;
+  bool complete = true;
+
+  /* Only flatten the ropes that aren't part of a longer one, the others are
+   * searched as part of it. Ropes are allocated after their halves, so going
+   * from the highest address down mostly meets a rope before the ropes in it
+   * and drops those as they come up.
+   */
+  std::unordered_set<uint64_t> sub_ropes;
+
+  // The progress of the search ends before the reference scan starts its own.
+  {
+    ScanProgress progress(d, "Searching strings", strings.size(), false,
+                          scan_options);
+    std::string chars;
+    std::string utf8;
+    for (auto string = strings.rbegin(); string != strings.rend(); ++string) {
+      uint64_t address = *string;
+      if ((++done & 0x3ff) == 0 && !progress.Update(done, matches.size())) {
+        complete = false;
+        break;
+      }
+      if (sub_ropes.erase(address) != 0) continue;
+      if (scan_options.live_only && !llscan.IsLive(address)) continue;
+
+      // Flat halves of ropes can have holders of their own.
+      int64_t char_size;
+      if (!flattener.Flatten(address, &chars, &char_size, &sub_ropes)) {
+        continue;
+      }
+
+      // Search the characters as the other commands print them.
+      std::string* text = &chars;
+      if (char_size == 2) {
+        size_t length = chars.size() / 2;
+        utf8.resize(Utf8Capacity(length));
+        utf8.resize(Utf16ToUtf8(chars.data(), length, &utf8[0]));
+        text = &utf8;
+      }
+
+      if (!literal.empty() &&
+          memmem(text->data(), text->size(), literal.data(), literal.size()) ==
+              nullptr) {
+        continue;
+      }
+      if (regex_ && !std::regex_search(*text, regex)) continue;
+
+      matches.push_back(address);
+    }
+  }
+  std::reverse(matches.begin(), matches.end());
+
+  if (!complete && !out.json()) {
+    out.Printf("PARTIAL RESULT: stopped after %" PRIu64 " of %" PRIu64
+               " strings.\n",
+               done, static_cast<uint64_t>(strings.size()));
+  }
+  if (matches.empty() && out.json()) {
+    out.Printf("{\"complete\":%s,\"strings\":[]}\n",
+               complete ? "true" : "false");
+    result.SetStatus(eReturnStatusSuccessFinishResult);
+    return true;
+  } else if (matches.empty()) {
+    out.Printf("No strings match %s\n", pattern.c_str());
+    result.SetStatus(eReturnStatusSuccessFinishResult);
+    return true;
+  }
+
+  // Reuse the reference index when findrefs has built it.
+  HolderScanner holders(matches);
+  bool indexed = llscan.AreReferencesByValueLoaded();
+  FindReferencesCmd findrefs;
+  if (!indexed && !findrefs.ScanForReferences(&holders, d, scan_options)) {
+    complete = false;
+    if (!out.json()) {
+      out.Printf(
+          "PARTIAL RESULT: reference scan stopped early, some holders are "
+          "missing.\n");
+    }
+  }
+
+  JSONWriter& json = out.json_writer();
+  if (out.json()) {
+    json.BeginObject();
+    json.Member("complete", complete);
+    json.Key("strings");
+    json.BeginArray();
+  }
+
+  v8::Value::InspectOptions inspect_options;
+  for (uint64_t address : matches) {
+    v8::Error err;
+    v8::String str(&llv8, address);
+    std::string preview = str.Inspect(&inspect_options, err);
+    if (out.json()) {
+      json.BeginObject();
+      json.Key("address");
+      json.Address(address);
+      json.Member("inspect", preview);
+    } else {
+      out.Printf("0x%016" PRIx64 ": %s\n", address, preview.c_str());
+    }
+
+    ReferencesVector* references = indexed
+                                       ? llscan.GetReferencesByValue(address)
+                                       : &holders.GetHolders(address);
+    FindReferencesCmd::ReferenceScanner printer(v8::Value(&llv8, address));
+    findrefs.PrintReferences(out, references, &printer,
+                             scan_options.live_only);
+    if (out.json()) json.EndObject();
+  }
+
+  if (out.json()) {
+    json.EndArray();
+    json.EndObject();
+  } else {
+    out.Printf("%" PRIu64 " strings match %s\n",
+               static_cast<uint64_t>(matches.size()), pattern.c_str());
+  }
+
+  result.SetStatus(eReturnStatusSuccessFinishResult);
+  return true;
+}
+
+
+std::string GrepStringsCmd::RequiredLiteral(const std::string& pattern) {
+  // Any one of the alternatives could match.
+  if (pattern.find('|') != std::string::npos) return std::string();
+
+  std::string best;
+  std::string run;
+  int groups = 0;
+  size_t i = 0;
+  while (i < pattern.size()) {
+    char c = pattern[i];
+    size_t width = 1;
+    bool literal = false;
+
+    if (c == '\\' && i + 1 < pattern.size()) {
+      // Escaped punctuation is literal, escapes like \d are not. Skip all of
+      // \xhh, \uhhhh, \cX and backreferences, their text isn't matched.
+      width = 2;
+      c = pattern[i + 1];
+      literal = ispunct(static_cast<unsigned char>(c)) != 0;
+      if (c == 'x') {
+        width = 4;
+      } else if (c == 'u') {
+        width = 6;
+      } else if (c == 'c') {
+        width = 3;
+      } else if (isdigit(static_cast<unsigned char>(c))) {
+        while (i + width < pattern.size() &&
+               isdigit(static_cast<unsigned char>(pattern[i + width]))) {
+          width++;
+        }
+      }
+      width = std::min(width, pattern.size() - i);
+    } else if (c == '{') {
+      // Skip the whole {m,n} quantifier.
+      size_t end = pattern.find('}', i);
+      width = end == std::string::npos ? pattern.size() - i : end + 1 - i;
+    } else if (c == '[') {
+      // Skip over the character class.
+      size_t end = i + 1;
+      if (end < pattern.size() && pattern[end] == '^') end++;
+      if (end < pattern.size() && pattern[end] == ']') end++;
+      for (; end < pattern.size() && pattern[end] != ']'; end++) {
+        if (pattern[end] == '\\') end++;
+      }
+      width = end + 1 - i;
+    } else if (c == '(') {
+      groups++;
+    } else if (c == ')') {
+      groups--;
+    } else {
+      literal = strchr("^$.?*+}", c) == nullptr;
+    }
+
+    // Characters that may be repeated zero times aren't required.
+    char next = i + width < pattern.size() ? pattern[i + width] : '\0';
+    if (next == '?' || next == '*' || next == '{') literal = false;
+
+    if (literal && groups == 0) {
+      run.push_back(c);
+    } else {
+      if (run.size() > best.size()) best = run;
+      run.clear();
+    }
+    i += width;
+  }
+  if (run.size() > best.size()) best = run;
+
+  return best;
+}
+
+
+char** GrepStringsCmd::ParseScanOptions(char** cmd, ScanOptions* options) {
+  static struct option opts[] = {{"regex", no_argument, nullptr, 'r'},
+                                 {"timeout", required_argument, nullptr, 't'},
+                                 {"live-only", no_argument, nullptr, 'L'},
+                                 {nullptr, 0, nullptr, 0}};
+
+  int argc = 1;
+  for (char** p = cmd; p != nullptr && *p != nullptr; p++) argc++;
+
+  char* args[argc];
+
+  // Make this look like a command line, we need a valid element at index 0
+  // for getopt_long to use in its error messages.
+  char name[] = "llscan";
+  args[0] = name;
+  for (int i = 0; i < argc - 1; i++) args[i + 1] = cmd[i];
+
+  regex_ = false;
+
+  bool valid = true;
+
+  // Reset getopts.
+  optind = 0;
+  opterr = 1;
+  do {
+    int arg = getopt_long(argc, args, "rt:L", opts, nullptr);
+    if (arg == -1) break;
+
+    switch (arg) {
+      case 'r':
+        regex_ = true;
+        break;
+      case 't':
+        if (!ParseCount(optarg, &options->timeout)) valid = false;
+        break;
+      case 'L':
+        options->live_only = true;
+        break;
+      default:
+        continue;
+    }
+  } while (true);
+
+  if (cmd == nullptr) return nullptr;
+
+  // getopt_long moves the pattern after the options, keep that order.
+  for (int i = 1; i < argc; i++) cmd[i - 1] = args[i];
+  if (!valid) return nullptr;
+  return &cmd[optind - 1];
+}
+
+
+HolderScanner::HolderScanner(const std::vector<uint64_t>& values) {
+  for (uint64_t value : values) holders_[value];
+}
+
+
+void HolderScanner::Add(uint64_t value, uint64_t holder) {
+  auto it = holders_.find(value);
+  if (it == holders_.end()) return;
+
+  // Only list each holder once.
+  ReferencesVector& holders = it->second;
+  if (holders.empty() || holders.back() != holder) holders.push_back(holder);
+}
+
+
+void HolderScanner::ScanRefs(v8::JSObject& js_obj, v8::Error& err) {
+  int64_t length = js_obj.GetArrayLength(err);
+  for (int64_t i = 0; i < length; ++i) {
+    v8::Value v = js_obj.GetArrayElement(i, err);
+
+    // Array is borked, or not array at all - skip it
+    if (!err.Success()) break;
+    Add(v.raw(), js_obj.raw());
+  }
+
+  std::vector<std::pair<v8::Value, v8::Value>> entries = js_obj.Entries(err);
+  if (err.Fail()) return;
+  for (auto const& entry : entries) Add(entry.second.raw(), js_obj.raw());
+}
+
+
+void HolderScanner::ScanRefs(v8::String& str, v8::Error& err) {
+  v8::LLV8* v8 = str.v8();
+  int64_t repr = str.Representation(err);
+  if (err.Fail()) return;
+
+  // Concatenated, sliced and thin strings refer to other strings.
+  if (repr == v8->string()->kSlicedStringTag) {
+    v8::SlicedString sliced_str(str);
+    v8::String parent = sliced_str.Parent(err);
+    if (err.Success()) Add(parent.raw(), str.raw());
+  } else if (repr == v8->string()->kConsStringTag) {
+    v8::ConsString cons_str(str);
+    v8::String first = cons_str.First(err);
+    if (err.Success()) Add(first.raw(), str.raw());
+    v8::String second = cons_str.Second(err);
+    if (err.Success()) Add(second.raw(), str.raw());
+  } else if (repr == v8->string()->kThinStringTag) {
+    v8::ThinString thin_str(str);
+    v8::String actual = thin_str.Actual(err);
+    if (err.Success()) Add(actual.raw(), str.raw());
+  }
+}
+
+}  // namespace llnode
@@ -0,0 +1,289 @@
+#ifndef SRC_LLSTRINGS_H_
+#define SRC_LLSTRINGS_H_
+
+#include <lldb/API/LLDB.h>
+#include <stdio.h>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "src/llnode.h"
+#include "src/llscan.h"
+
+namespace llnode {
+
+class DupStringsCmd : public CommandBase {
+ public:
+  DupStringsCmd() : count_(kDefaultCount) {}
+  ~DupStringsCmd() override {}
+
+  bool DoExecute(lldb::SBDebugger d, char** cmd,
+                 lldb::SBCommandReturnObject& result) override;
+
+ private:
+  static const uint64_t kDefaultCount = 20;
+
+  uint64_t count_;
+};
+
+class StringStatsCmd : public CommandBase {
+ public:
+  StringStatsCmd() : count_(kDefaultCount) {}
+  ~StringStatsCmd() override {}
+
+  bool DoExecute(lldb::SBDebugger d, char** cmd,
+                 lldb::SBCommandReturnObject& result) override;
+
+ private:
+  enum Representation {
+    kSeq,
+    kCons,
+    kSliced,
+    kThin,
+    kExternal,
+    kOther,
+    kNumRepresentations
+  };
+
+  // First and second halves of every cons string.
+  typedef std::unordered_map<uint64_t, std::pair<uint64_t, uint64_t>> ConsMap;
+  // Offset and length of slices, in characters.
+  typedef std::vector<std::pair<int64_t, int64_t>> SliceList;
+
+  class Usage {
+   public:
+    uint64_t count = 0;
+    uint64_t size = 0;
+    // Characters of external strings, outside of the V8 heap.
+    uint64_t off_heap = 0;
+  };
+
+  class Parent {
+   public:
+    int64_t length = 0;
+    int64_t char_size = 0;
+    SliceList slices;
+  };
+
+  static const uint64_t kDefaultCount = 10;
+
+  Representation GetRepresentation(int64_t type);
+  static const char* RepresentationName(Representation repr);
+
+  /* Depth of every rope, leaves are flat strings. Cons strings not found by
+   * the scan count as leaves.
+   */
+  static void ComputeDepths(const ConsMap& cons,
+                            std::unordered_map<uint64_t, uint64_t>& depths);
+  // Characters of the parent covered by at least one slice.
+  static int64_t CoveredLength(SliceList& slices);
+
+  uint64_t count_;
+};
+
+class GrepStringsCmd : public CommandBase {
+ public:
+  GrepStringsCmd() : regex_(false) {}
+  ~GrepStringsCmd() override {}
+
+  bool DoExecute(lldb::SBDebugger d, char** cmd,
+                 lldb::SBCommandReturnObject& result) override;
+
+  char** ParseScanOptions(char** cmd, ScanOptions* options);
+
+ private:
+  /* The longest run of plain characters every match of `pattern` has to
+   * contain, strings without it are skipped before running the regex. Empty
+   * when no such run can be found.
+   */
+  static std::string RequiredLiteral(const std::string& pattern);
+
+  bool regex_;
+};
+
+/* Finds the objects referring to a few strings, keeping the references to
+ * those strings only rather than to every value in the heap.
+ */
+class HolderScanner : public FindReferencesCmd::ObjectScanner {
+ public:
+  explicit HolderScanner(const std::vector<uint64_t>& values);
+
+  void ScanRefs(v8::JSObject& js_obj, v8::Error& err) override;
+  void ScanRefs(v8::String& str, v8::Error& err) override;
+
+  inline ReferencesVector& GetHolders(uint64_t value) {
+    return holders_[value];
+  }
+
+ private:
+  void Add(uint64_t value, uint64_t holder);
+
+  std::unordered_map<uint64_t, ReferencesVector> holders_;
+};
+
+/* A 64-bit hash of a stream of bytes, mixed in a word at a time. */
+class ContentHash {
+ public:
+  explicit ContentHash(uint64_t seed) : hash_(seed), length_(0) {}
+
+  // Every call but the last one must pass a multiple of eight bytes.
+  void Update(const unsigned char* data, uint64_t size);
+  uint64_t Finish() const;
+
+ private:
+  inline void Mix(uint64_t word);
+
+  uint64_t hash_;
+  uint64_t length_;
+};
+
+/* Reads the characters of flat strings, sequential and external, with
+ * LLScan::ReadMemory so several threads can read at once when the scan reads
+ * from a core file. Only the first string seen with each map goes through
+ * LLV8, under a lock.
+ */
+class FlatStringReader : public WordReader {
+ public:
+  FlatStringReader(LLScan* scan, v8::LLV8* llv8, lldb::SBTarget target);
+
+  /* Hash the characters of the string at `address`, one and two byte strings
+   * with the same bytes hash differently. Fails for strings that don't hold
+   * their characters. `size` is set to the size of the string, including the
+   * characters of external strings.
+   */
+  bool Hash(uint64_t address, uint64_t* hash, uint64_t* size);
+
+  // The raw characters of the string at `address` and their width in bytes.
+  bool Read(uint64_t address, std::string* chars, int64_t* char_size);
+
+  /* The representation tag of the string at `address` and the width of its
+   * characters in bytes, looked up by its map. Fails for anything that isn't
+   * a string.
+   */
+  bool Representation(uint64_t address, int64_t* representation,
+                      int64_t* char_size);
+
+  /* Held whenever the reader uses LLV8, lock it to use LLV8 from other
+   * threads reading alongside it.
+   */
+  inline std::recursive_mutex& llv8_mutex() { return mutex_; }
+
+ private:
+  struct Header {
+    // Address of the first character.
+    uint64_t chars;
+    int64_t char_size;
+    int64_t length;
+    // Size of the string object.
+    uint64_t size;
+    // Bytes outside of the V8 heap, the characters of external strings.
+    uint64_t off_heap;
+  };
+
+  class StringMap {
+   public:
+    // 1 or 2 for flat strings, 0 for anything else.
+    int64_t char_size;
+    bool external;
+    // The representation tag, -1 for maps of anything but strings.
+    int64_t representation;
+    // 1 or 2 whatever the representation.
+    int64_t width;
+  };
+
+  static const uint64_t kReadSize = 64 * 1024;
+  // Longer lengths come from reading something that isn't a string.
+  static const int64_t kMaxLength = (1LL << 30) - 25;
+
+  bool ReadHeader(uint64_t address, Header* header);
+  StringMap GetStringMap(uint64_t map);
+
+  int64_t length_offset_;
+  int64_t one_byte_chars_offset_;
+  int64_t two_byte_chars_offset_;
+  int64_t resource_data_offset_;
+
+  std::recursive_mutex mutex_;
+  std::unordered_map<uint64_t, StringMap> string_maps_;
+};
+
+/* Reads the characters of strings of any representation, the way
+ * String::ToString does, but with the characters of flat strings read in bulk
+ * by a FlatStringReader.
+ */
+class StringFlattener {
+ public:
+  StringFlattener(FlatStringReader* reader, v8::LLV8* llv8)
+      : reader_(reader), llv8_(llv8) {}
+
+  /* The raw characters of the string at `address`, `char_size` bytes each.
+   * Fails for short external strings, they don't cache their characters.
+   * The ropes found inside a rope are added to `sub_ropes` when given.
+   */
+  bool Flatten(uint64_t address, std::string* chars, int64_t* char_size,
+               std::unordered_set<uint64_t>* sub_ropes = nullptr);
+
+ private:
+  // Append the characters of `address`, converted to `char_size` bytes each.
+  bool Append(uint64_t address, int64_t char_size, std::string* chars,
+              std::unordered_set<uint64_t>* sub_ropes);
+
+  FlatStringReader* reader_;
+  v8::LLV8* llv8_;
+};
+
+class DupRecord {
+ public:
+  uint64_t hash;
+  uint64_t address;
+  uint64_t size;
+
+  inline bool operator<(const DupRecord& other) const {
+    return hash != other.hash ? hash < other.hash : address < other.address;
+  }
+};
+
+/* Sorted runs of string hashes, merged once every string is hashed. Runs go
+ * to temporary files once kMemoryRecords records are held in memory, so the
+ * memory used stays bounded however many strings the heap has.
+ */
+class DupRecordRuns {
+ public:
+  DupRecordRuns() : in_memory_(0) {}
+  ~DupRecordRuns();
+
+  // Sort `records` and take them as a new run, leaving `records` empty.
+  void Add(std::vector<DupRecord>& records);
+
+  /* Call `group` with every set of two or more records sharing a hash, in
+   * hash order. Returns false when `group` does.
+   */
+  bool Merge(std::function<bool(const std::vector<DupRecord>&)> group);
+
+  // Records each thread collects before adding them as a run.
+  static const size_t kRunRecords = 256 * 1024;
+
+ private:
+  class Run {
+   public:
+    FILE* file_ = nullptr;
+    std::vector<DupRecord> records_;
+    size_t next_ = 0;
+  };
+
+  static const size_t kMemoryRecords = 4 * 1024 * 1024;
+  static const size_t kReadRecords = 4096;
+
+  bool Next(Run& run, DupRecord* record);
+
+  std::mutex mutex_;
+  std::vector<Run> runs_;
+  size_t in_memory_;
+};
+
+}  // namespace llnode
+
+#endif  // SRC_LLSTRINGS_H_
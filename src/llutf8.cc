@@ -0,0 +1,114 @@
+#include <stdint.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "src/llutf8.h"
+
+namespace llnode {
+
+inline static uint32_t LoadUnit(const char* p) {
+  return static_cast<uint8_t>(p[0]) | (static_cast<uint8_t>(p[1]) << 8);
+}
+
+
+/* Encode the code unit at `in[*i]`, or the surrogate pair starting there, and
+ * move `*i` past it.
+ */
+inline static char* Encode(const char* in, size_t length, size_t* i,
+                           char* out) {
+  uint32_t c = LoadUnit(in + *i * 2);
+  (*i)++;
+
+  if (c < 0x80) {
+    *out++ = static_cast<char>(c);
+    return out;
+  }
+  if (c < 0x800) {
+    *out++ = static_cast<char>(0xc0 | (c >> 6));
+    *out++ = static_cast<char>(0x80 | (c & 0x3f));
+    return out;
+  }
+
+  if (c >= 0xd800 && c <= 0xdfff) {
+    uint32_t next = *i < length ? LoadUnit(in + *i * 2) : 0;
+    if (c <= 0xdbff && next >= 0xdc00 && next <= 0xdfff) {
+      c = 0x10000 + ((c - 0xd800) << 10) + (next - 0xdc00);
+      (*i)++;
+      *out++ = static_cast<char>(0xf0 | (c >> 18));
+      *out++ = static_cast<char>(0x80 | ((c >> 12) & 0x3f));
+      *out++ = static_cast<char>(0x80 | ((c >> 6) & 0x3f));
+      *out++ = static_cast<char>(0x80 | (c & 0x3f));
+      return out;
+    }
+
+    // Unpaired surrogates have no UTF-8 encoding.
+    c = 0xfffd;
+  }
+
+  *out++ = static_cast<char>(0xe0 | (c >> 12));
+  *out++ = static_cast<char>(0x80 | ((c >> 6) & 0x3f));
+  *out++ = static_cast<char>(0x80 | (c & 0x3f));
+  return out;
+}
+
+
+size_t Utf16ToUtf8(const char* in, size_t length, char* out) {
+  char* start = out;
+  size_t i = 0;
+
+  while (i < length) {
+#if defined(__SSE2__)
+    const __m128i non_ascii = _mm_set1_epi16(static_cast<short>(0xff80));
+    while (i + 8 <= length) {
+      __m128i units =
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i * 2));
+      __m128i high = _mm_and_si128(units, non_ascii);
+      if (_mm_movemask_epi8(_mm_cmpeq_epi16(high, _mm_setzero_si128())) !=
+          0xffff) {
+        break;
+      }
+
+      _mm_storel_epi64(reinterpret_cast<__m128i*>(out),
+                       _mm_packus_epi16(units, units));
+      i += 8;
+      out += 8;
+    }
+#endif
+
+    // Text that isn't ASCII tends to stay that way, so only go back to the
+    // vector loop once an ASCII code unit comes up.
+    if (i < length) out = Encode(in, length, &i, out);
+    while (i < length && LoadUnit(in + i * 2) >= 0x80) {
+      out = Encode(in, length, &i, out);
+    }
+  }
+
+  return out - start;
+}
+
+
+size_t Latin1ToUtf8(const char* in, size_t length, char* out) {
+  char* start = out;
+  for (size_t i = 0; i < length; i++) {
+    unsigned char c = static_cast<unsigned char>(in[i]);
+    if (c < 0x80) {
+      *out++ = static_cast<char>(c);
+    } else {
+      *out++ = static_cast<char>(0xc0 | (c >> 6));
+      *out++ = static_cast<char>(0x80 | (c & 0x3f));
+    }
+  }
+  return out - start;
+}
+
+
+size_t Utf16ToUtf8Scalar(const char* in, size_t length, char* out) {
+  char* start = out;
+  size_t i = 0;
+  while (i < length) out = Encode(in, length, &i, out);
+  return out - start;
+}
+
+}  // namespace llnode
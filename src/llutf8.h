@@ -0,0 +1,29 @@
+#ifndef SRC_LLUTF8_H_
+#define SRC_LLUTF8_H_
+
+#include <stddef.h>
+
+namespace llnode {
+
+// The longest UTF-8 encoding of `length` UTF-16 code units.
+inline size_t Utf8Capacity(size_t length) { return length * 3; }
+
+/* Transcode the `length` little endian UTF-16 code units at `in` to UTF-8 at
+ * `out`, which must have room for Utf8Capacity(length) bytes. Runs of ASCII
+ * are copied with SSE2 when the compiler targets it, as it does for every
+ * x86-64 build. Unpaired surrogates become U+FFFD. Returns the number of
+ * bytes written.
+ */
+size_t Utf16ToUtf8(const char* in, size_t length, char* out);
+
+/* Transcode `length` Latin-1 characters, the characters of one byte strings,
+ * to UTF-8 at `out`, which must have room for Utf8Capacity(length) bytes.
+ */
+size_t Latin1ToUtf8(const char* in, size_t length, char* out);
+
+// The same one code unit at a time, for comparison in the benchmark.
+size_t Utf16ToUtf8Scalar(const char* in, size_t length, char* out);
+
+}  // namespace llnode
+
+#endif  // SRC_LLUTF8_H_
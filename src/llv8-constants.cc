@@ -181,6 +181,7 @@ void Map::Load() {
                    "class_Map__constructor__Object");
   kInstanceDescriptorsOffset =
       LoadConstant("class_Map__instance_descriptors__DescriptorArray");
+  kBitField2Offset = LoadConstant("class_Map__bit_field2__char");
   kBitField3Offset =
       LoadConstant("class_Map__bit_field3__int", "class_Map__bit_field3__SMI");
   kInObjectPropertiesOffset = LoadConstant(
@@ -190,6 +191,10 @@ void Map::Load() {
 
   kDictionaryMapShift = LoadConstant("bit_field3_dictionary_map_shift");
 
+  kElementsKindMask = LoadConstant("bit_field2_elements_kind_mask");
+  kElementsKindShift = LoadConstant("bit_field2_elements_kind_shift");
+  kDictionaryElements = LoadConstant("elements_dictionary_elements");
+
   kNumberOfOwnDescriptorsShift =
       LoadConstant("bit_field3_number_of_own_descriptors_shift");
   kNumberOfOwnDescriptorsMask =
@@ -381,6 +386,27 @@ void ThinString::Load() {
   kActualOffset = LoadConstant("class_ThinString__actual__String");
 }
 
+
+void ExternalString::Load() {
+  common_->Load();
+
+  // Older metadata doesn't describe external strings, the pointer to their
+  // resource follows the String header.
+  int64_t length_offset = LoadConstant("class_String__length__SMI");
+  int64_t resource_offset =
+      length_offset == -1 ? -1 : length_offset + common_->kPointerSize;
+  kResourceOffset =
+      LoadConstant("class_ExternalString__resource__Object", resource_offset);
+
+  // The resource caches a pointer to its characters, except in short
+  // external strings.
+  kResourceDataOffset =
+      kResourceOffset == -1 ? -1 : kResourceOffset + common_->kPointerSize;
+
+  kShortExternalStringMask = LoadConstant("ShortExternalStringMask", 0x10);
+  kShortExternalStringTag = LoadConstant("ShortExternalStringTag", 0x10);
+}
+
 void FixedArrayBase::Load() {
   kLengthOffset = LoadConstant("class_FixedArrayBase__length__SMI");
 }
@@ -524,6 +550,32 @@ void NameDictionary::Load() {
   kPrefixSize = LoadConstant("class_NameDictionaryShape__prefix_size__int",
                              "namedictionaryshape_prefix_size") +
                 kPrefixStartIndex;
+
+  // HashTable's header, ahead of the prefix. Not in the postmortem data.
+  kNumberOfElementsIndex = 0;
+  kCapacityIndex = 2;
+}
+
+
+void MemoryChunk::Load() {
+  // The page header isn't in the postmortem metadata, these have been the
+  // same since V8 4.x.
+  common_->Load();
+
+  kSizeOffset = 0;
+  kFlagsOffset = kSizeOffset + common_->kPointerSize;
+
+  kIsExecutable = 1 << 0;
+  kInFromSpace = 1 << 3;
+  kInToSpace = 1 << 4;
+
+  // V8 5.1 halved the page size, later versions halved it again.
+  if (common_->CheckLowestVersion(5, 1, 0))
+    kPageSize = 512 * 1024;
+  else
+    kPageSize = 1024 * 1024;
+  kAlignment = 256 * 1024;
+  kMaxChunkSize = 1LL << 31;
 }
 
 
@@ -565,6 +617,9 @@ void Types::Load() {
   kCodeType = LoadConstant("type_Code__CODE_TYPE");
   kJSFunctionType = LoadConstant("type_JSFunction__JS_FUNCTION_TYPE");
   kFixedArrayType = LoadConstant("type_FixedArray__FIXED_ARRAY_TYPE");
+  kFixedDoubleArrayType =
+      LoadConstant("type_FixedDoubleArray__FIXED_DOUBLE_ARRAY_TYPE");
+  kByteArrayType = LoadConstant("type_ByteArray__BYTE_ARRAY_TYPE");
   kJSArrayBufferType = LoadConstant("type_JSArrayBuffer__JS_ARRAY_BUFFER_TYPE");
   kJSTypedArrayType = LoadConstant("type_JSTypedArray__JS_TYPED_ARRAY_TYPE");
   kJSRegExpType = LoadConstant("type_JSRegExp__JS_REGEXP_TYPE");
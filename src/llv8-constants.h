@@ -86,6 +86,7 @@ class Map : public Module {
   int64_t kInstanceAttrsOffset;
   int64_t kMaybeConstructorOffset;
   int64_t kInstanceDescriptorsOffset;
+  int64_t kBitField2Offset;
   int64_t kBitField3Offset;
   int64_t kInObjectPropertiesOffset;
   int64_t kInstanceSizeOffset;
@@ -93,6 +94,9 @@ class Map : public Module {
   int64_t kNumberOfOwnDescriptorsMask;
   int64_t kNumberOfOwnDescriptorsShift;
   int64_t kDictionaryMapShift;
+  int64_t kElementsKindMask;
+  int64_t kElementsKindShift;
+  int64_t kDictionaryElements;
 
  protected:
   void Load();
@@ -308,6 +312,20 @@ class ThinString : public Module {
   void Load();
 };
 
+class ExternalString : public Module {
+ public:
+  MODULE_DEFAULT_METHODS(ExternalString);
+
+  int64_t kResourceOffset;
+  int64_t kResourceDataOffset;
+
+  int64_t kShortExternalStringMask;
+  int64_t kShortExternalStringTag;
+
+ protected:
+  void Load();
+};
+
 class FixedArrayBase : public Module {
  public:
   MODULE_DEFAULT_METHODS(FixedArrayBase);
@@ -441,6 +459,33 @@ class NameDictionary : public Module {
   int64_t kPrefixStartIndex;
   int64_t kPrefixSize;
 
+  int64_t kNumberOfElementsIndex;
+  int64_t kCapacityIndex;
+
+ protected:
+  void Load();
+};
+
+class MemoryChunk : public Module {
+ public:
+  MODULE_DEFAULT_METHODS(MemoryChunk);
+
+  // The largest regular page, later V8s use smaller ones.
+  int64_t kPageSize;
+  /* Every chunk starts at a multiple of the smallest page size of any V8,
+   * the same as CoreFile::kV8PageAlignment.
+   */
+  int64_t kAlignment;
+  // Anything larger isn't a chunk header.
+  int64_t kMaxChunkSize;
+
+  int64_t kSizeOffset;
+  int64_t kFlagsOffset;
+
+  int64_t kIsExecutable;
+  int64_t kInFromSpace;
+  int64_t kInToSpace;
+
  protected:
   void Load();
 };
@@ -486,6 +531,8 @@ class Types : public Module {
   int64_t kCodeType;
   int64_t kJSFunctionType;
   int64_t kFixedArrayType;
+  int64_t kFixedDoubleArrayType;
+  int64_t kByteArrayType;
   int64_t kJSArrayBufferType;
   int64_t kJSTypedArrayType;
   int64_t kJSRegExpType;
@@ -165,6 +165,20 @@ inline int64_t Map::InstanceSize(Error& err) {
          v8()->common()->kPointerSize;
 }
 
+inline int64_t Map::ElementsKind(Error& err) {
+  int64_t offset = v8()->map()->kBitField2Offset;
+  int64_t mask = v8()->map()->kElementsKindMask;
+  if (offset == -1 || mask == -1) {
+    err = Error::Failure("No elements kind in the postmortem data");
+    return -1;
+  }
+
+  int64_t field = v8()->LoadUnsigned(LeaField(offset), 1, err);
+  if (err.Fail()) return -1;
+
+  return (field & mask) >> v8()->map()->kElementsKindShift;
+}
+
 ACCESSOR(JSObject, Properties, js_object()->kPropertiesOffset, HeapObject)
 ACCESSOR(JSObject, Elements, js_object()->kElementsOffset, HeapObject)
 
@@ -350,6 +364,35 @@ inline std::string ThinString::ToString(Error& err) {
   return tmp;
 }
 
+inline int64_t ExternalString::ResourceData(Error& err) {
+  int64_t type = GetType(err);
+  if (err.Fail()) return -1;
+
+  if ((type & v8()->external_string()->kShortExternalStringMask) ==
+          v8()->external_string()->kShortExternalStringTag ||
+      v8()->external_string()->kResourceDataOffset == -1) {
+    err = Error::Failure("External string data isn't cached");
+    return -1;
+  }
+
+  return LoadField(v8()->external_string()->kResourceDataOffset, err);
+}
+
+inline std::string ExternalString::ToString(Error& err) {
+  int64_t encoding = Encoding(err);
+  if (err.Fail()) return std::string();
+
+  int64_t data = ResourceData(err);
+  if (err.Fail()) return std::string();
+
+  Smi len = Length(err);
+  if (err.Fail()) return std::string();
+
+  if (encoding == v8()->string()->kTwoByteStringTag)
+    return v8()->LoadTwoByteString(data, len.GetValue(), err);
+  return v8()->LoadString(data, len.GetValue(), err);
+}
+
 inline int64_t FixedArray::LeaData() const {
   return LeaField(v8()->fixed_array()->kDataOffset);
 }
@@ -446,6 +489,20 @@ inline int64_t NameDictionary::Length(Error& err) {
   return res;
 }
 
+inline int64_t NameDictionary::NumberOfElements(Error& err) {
+  int64_t index = v8()->name_dictionary()->kNumberOfElementsIndex;
+  Smi count = FixedArray::Get<Smi>(index, err);
+  if (err.Fail()) return -1;
+  return count.GetValue();
+}
+
+inline int64_t NameDictionary::Capacity(Error& err) {
+  int64_t index = v8()->name_dictionary()->kCapacityIndex;
+  Smi capacity = FixedArray::Get<Smi>(index, err);
+  if (err.Fail()) return -1;
+  return capacity.GetValue();
+}
+
 inline JSFunction Context::Closure(Error& err) {
   return FixedArray::Get<JSFunction>(v8()->context()->kClosureIndex, err);
 }
@@ -1,8 +1,11 @@
 #include <assert.h>
+#include <string.h>
 
 #include <algorithm>
 #include <cinttypes>
 
+#include "llcore.h"
+#include "llutf8.h"
 #include "llv8-inl.h"
 #include "llv8.h"
 
@@ -43,6 +46,7 @@ void LLV8::Load(SBTarget target) {
   cons_string.Assign(target, &common);
   sliced_string.Assign(target, &common);
   thin_string.Assign(target, &common);
+  external_string.Assign(target, &common);
   fixed_array_base.Assign(target, &common);
   fixed_array.Assign(target, &common);
   fixed_typed_array_base.Assign(target, &common);
@@ -53,12 +57,93 @@ void LLV8::Load(SBTarget target) {
   js_date.Assign(target, &common);
   descriptor_array.Assign(target, &common);
   name_dictionary.Assign(target, &common);
+  memory_chunk.Assign(target, &common);
   frame.Assign(target, &common);
   types.Assign(target, &common);
 }
 
 
+void LLV8::ReadFromCore(CoreFile* core) {
+  core_ = core;
+  if (core == nullptr) return;
+
+  pointer_size_ = process_.GetAddressByteSize();
+  big_endian_ = process_.GetByteOrder() == lldb::eByteOrderBig;
+
+  // The constants are looked up through lldb the first time they are used.
+  common();
+  smi();
+  heap_obj();
+  map();
+  js_object();
+  heap_number();
+  js_array();
+  js_function();
+  shared_info();
+  code();
+  scope_info();
+  context();
+  script();
+  string();
+  one_byte_string();
+  two_byte_string();
+  cons_string();
+  sliced_string();
+  thin_string();
+  external_string();
+  fixed_array_base();
+  fixed_array();
+  fixed_typed_array_base();
+  oddball();
+  js_array_buffer();
+  js_array_buffer_view();
+  js_regexp();
+  js_date();
+  descriptor_array();
+  name_dictionary();
+  memory_chunk();
+  frame();
+  types();
+}
+
+
+bool LLV8::ReadMemory(int64_t addr, void* buf, size_t size) {
+  if (core_ != nullptr)
+    return core_->ReadMemory(static_cast<uint64_t>(addr), buf, size);
+
+  SBError sberr;
+  process_.ReadMemory(static_cast<addr_t>(addr), buf, size, sberr);
+  return sberr.Success();
+}
+
+
+// Only used when reading from a core file, lldb decodes words itself.
+bool LLV8::ReadUnsigned(int64_t addr, uint32_t byte_size, int64_t* value) {
+  uint8_t buf[8];
+  if (byte_size > sizeof(buf) || !ReadMemory(addr, buf, byte_size))
+    return false;
+
+  uint64_t result = 0;
+  for (uint32_t i = 0; i < byte_size; i++) {
+    uint32_t shift = big_endian_ ? (byte_size - 1 - i) * 8 : i * 8;
+    result |= static_cast<uint64_t>(buf[i]) << shift;
+  }
+  *value = static_cast<int64_t>(result);
+  return true;
+}
+
+
 int64_t LLV8::LoadPtr(int64_t addr, Error& err) {
+  if (core_ != nullptr) {
+    int64_t value;
+    if (!ReadUnsigned(addr, pointer_size_, &value)) {
+      err = Error::Failure("Failed to load V8 value");
+      return -1;
+    }
+    err = Error::Ok();
+    return value;
+  }
+
   SBError sberr;
   int64_t value =
       process_.ReadPointerFromMemory(static_cast<addr_t>(addr), sberr);
@@ -74,6 +159,16 @@ int64_t LLV8::LoadPtr(int64_t addr, Error& err) {
 
 
 int64_t LLV8::LoadUnsigned(int64_t addr, uint32_t byte_size, Error& err) {
+  if (core_ != nullptr) {
+    int64_t value;
+    if (!ReadUnsigned(addr, byte_size, &value)) {
+      err = Error::Failure("Failed to load V8 value");
+      return -1;
+    }
+    err = Error::Ok();
+    return value;
+  }
+
   SBError sberr;
   int64_t value = process_.ReadUnsignedFromMemory(static_cast<addr_t>(addr),
                                                   byte_size, sberr);
@@ -90,10 +185,17 @@ int64_t LLV8::LoadUnsigned(int64_t addr, uint32_t byte_size, Error& err) {
 
 
 double LLV8::LoadDouble(int64_t addr, Error& err) {
-  SBError sberr;
-  int64_t value = process_.ReadUnsignedFromMemory(static_cast<addr_t>(addr),
-                                                  sizeof(double), sberr);
-  if (sberr.Fail()) {
+  int64_t value;
+  bool loaded;
+  if (core_ != nullptr) {
+    loaded = ReadUnsigned(addr, sizeof(double), &value);
+  } else {
+    SBError sberr;
+    value = process_.ReadUnsignedFromMemory(static_cast<addr_t>(addr),
+                                            sizeof(double), sberr);
+    loaded = sberr.Success();
+  }
+  if (!loaded) {
     // TODO(indutny): add more information
     err = Error::Failure("Failed to load V8 double value");
     return -1.0;
@@ -106,9 +208,7 @@ double LLV8::LoadDouble(int64_t addr, Error& err) {
 
 std::string LLV8::LoadBytes(int64_t length, int64_t addr, Error& err) {
   uint8_t* buf = new uint8_t[length + 1];
-  SBError sberr;
-  process_.ReadMemory(addr, buf, static_cast<size_t>(length), sberr);
-  if (sberr.Fail()) {
+  if (!ReadMemory(addr, buf, static_cast<size_t>(length))) {
     err = Error::Failure("Failed to load V8 raw buffer");
     delete[] buf;
     return std::string();
@@ -131,10 +231,7 @@ std::string LLV8::LoadString(int64_t addr, int64_t length, Error& err) {
   }
 
   char* buf = new char[length + 1];
-  SBError sberr;
-  process_.ReadMemory(static_cast<addr_t>(addr), buf,
-                      static_cast<size_t>(length), sberr);
-  if (sberr.Fail()) {
+  if (!ReadMemory(addr, buf, static_cast<size_t>(length))) {
     // TODO(indutny): add more information
     err = Error::Failure("Failed to load V8 one byte string");
     delete[] buf;
@@ -156,21 +253,17 @@ std::string LLV8::LoadTwoByteString(int64_t addr, int64_t length, Error& err) {
     return std::string();
   }
 
-  char* buf = new char[length * 2 + 1];
-  SBError sberr;
-  process_.ReadMemory(static_cast<addr_t>(addr), buf,
-                      static_cast<size_t>(length * 2), sberr);
-  if (sberr.Fail()) {
+  char* buf = new char[length * 2];
+  if (!ReadMemory(addr, buf, static_cast<size_t>(length * 2))) {
     // TODO(indutny): add more information
     err = Error::Failure("Failed to load V8 two byte string");
     delete[] buf;
     return std::string();
   }
 
-  for (int64_t i = 0; i < length; i++) buf[i] = buf[i * 2];
-  buf[length] = '\0';
-
-  std::string res = buf;
+  std::string res;
+  res.resize(Utf8Capacity(length));
+  res.resize(Utf16ToUtf8(buf, length, &res[0]));
   delete[] buf;
   err = Error::Ok();
   return res;
@@ -179,10 +272,7 @@ std::string LLV8::LoadTwoByteString(int64_t addr, int64_t length, Error& err) {
 
 uint8_t* LLV8::LoadChunk(int64_t addr, int64_t length, Error& err) {
   uint8_t* buf = new uint8_t[length];
-  SBError sberr;
-  process_.ReadMemory(static_cast<addr_t>(addr), buf,
-                      static_cast<size_t>(length), sberr);
-  if (sberr.Fail()) {
+  if (!ReadMemory(addr, buf, static_cast<size_t>(length))) {
     // TODO(indutny): add more information
     err = Error::Failure("Failed to load V8 memory chunk");
     delete[] buf;
@@ -970,9 +1060,16 @@ std::string String::ToString(Error& err) {
     return sliced.ToString(err);
   }
 
-  // TODO(indutny): add support for external strings
   if (repr == v8()->string()->kExternalStringTag) {
-    return std::string("(external)");
+    ExternalString external(this);
+    std::string value = external.ToString(err);
+
+    // Short external strings only keep their characters in the resource.
+    if (err.Fail()) {
+      err = Error::Ok();
+      return std::string("(external)");
+    }
+    return value;
   }
 
   if (repr == v8()->string()->kThinStringTag) {
@@ -1960,5 +2057,166 @@ std::string JSArray::Inspect(InspectOptions* options, Error& err) {
   return res + ">";
 }
 
+
+int64_t MemoryChunk::Size(Error& err) {
+  int64_t alignment = v8_->memory_chunk()->kAlignment;
+  if (address_ & (alignment - 1)) return 0;
+
+  int64_t size = v8_->LoadPtr(address_ + v8_->memory_chunk()->kSizeOffset, err);
+  if (err.Fail()) return 0;
+
+  // Chunks are whole OS pages, at least as large as the smallest V8 page.
+  if (size < alignment || size > v8_->memory_chunk()->kMaxChunkSize ||
+      (size & 0xfff) != 0)
+    return 0;
+  return size;
+}
+
+
+MemoryChunk::Space MemoryChunk::GetSpace(Error& err) {
+  int64_t size = Size(err);
+  if (err.Fail() || size == 0) return kUnknownSpace;
+
+  int64_t flags =
+      v8_->LoadPtr(address_ + v8_->memory_chunk()->kFlagsOffset, err);
+  if (err.Fail()) return kUnknownSpace;
+
+  // Code pages are bigger than the others, they have guard pages.
+  if (flags & v8_->memory_chunk()->kIsExecutable) return kCodeSpace;
+
+  int64_t new_space =
+      v8_->memory_chunk()->kInFromSpace | v8_->memory_chunk()->kInToSpace;
+  if (flags & new_space) return kNewSpace;
+
+  // Regular pages are a power of two no larger than kPageSize, large object
+  // chunks are sized to fit their object.
+  bool power_of_two = (size & (size - 1)) == 0;
+  if (power_of_two && size <= v8_->memory_chunk()->kPageSize) return kOldSpace;
+  return kLargeObjectSpace;
+}
+
+
+const char* MemoryChunk::SpaceName(Space space) {
+  switch (space) {
+    case kNewSpace:
+      return "new";
+    case kOldSpace:
+      return "old";
+    case kCodeSpace:
+      return "code";
+    case kLargeObjectSpace:
+      return "large";
+    default:
+      return "unknown";
+  }
+}
+
+
+bool MemoryChunk::ParseSpaceName(const char* name, Space* space) {
+  for (int i = 0; i < kNumSpaces; i++) {
+    Space s = static_cast<Space>(i);
+    if (strcmp(name, SpaceName(s)) == 0) {
+      *space = s;
+      return true;
+    }
+  }
+  return false;
+}
+
+
+SizeFormula SizeFormula::ForMap(Map map, Error& err) {
+  LLV8* v8 = map.v8();
+  int64_t pointer_size = v8->common()->kPointerSize;
+
+  SizeFormula formula;
+  formula.alignment_ = pointer_size;
+
+  int64_t instance_size = map.InstanceSize(err);
+  if (err.Fail()) return formula;
+
+  // Zero means the instances are variable sized
+  if (instance_size != 0) {
+    formula.header_ = instance_size;
+    return formula;
+  }
+
+  int64_t type = map.GetType(err);
+  if (err.Fail()) return formula;
+
+  if (type < v8->types()->kFirstNonstringType) {
+    // Only sequential strings hold their characters in the object itself
+    int64_t repr = type & v8->string()->kRepresentationMask;
+    if (repr != v8->string()->kSeqStringTag) return formula;
+
+    formula.length_ = kStringLength;
+    if ((type & v8->string()->kEncodingMask) ==
+        v8->string()->kOneByteStringTag) {
+      formula.header_ = v8->one_byte_string()->kCharsOffset;
+      formula.element_size_ = 1;
+    } else {
+      formula.header_ = v8->two_byte_string()->kCharsOffset;
+      formula.element_size_ = 2;
+    }
+  } else if (type == v8->types()->kFixedArrayType) {
+    formula.length_ = kArrayLength;
+    formula.header_ = v8->fixed_array()->kDataOffset;
+    formula.element_size_ = pointer_size;
+  } else if (type == v8->types()->kFixedDoubleArrayType) {
+    formula.length_ = kArrayLength;
+    formula.header_ = v8->fixed_array()->kDataOffset;
+    formula.element_size_ = sizeof(double);
+  } else if (type == v8->types()->kByteArrayType) {
+    formula.length_ = kArrayLength;
+    formula.header_ = v8->fixed_array()->kDataOffset;
+    formula.element_size_ = 1;
+  } else if (type == v8->types()->kCodeType) {
+    // Instructions follow the header, the whole object is aligned to
+    // kCodeAlignment which is 32 bytes on every architecture node runs on.
+    formula.length_ = kCodeLength;
+    formula.header_ = v8->code()->kStartOffset;
+    formula.element_size_ = 1;
+    formula.alignment_ = 32;
+  }
+
+  return formula;
+}
+
+
+int64_t SizeFormula::Size(HeapObject object, Error& err) const {
+  int64_t length = 0;
+  switch (length_) {
+    case kNoLength:
+      return header_;
+    case kArrayLength: {
+      FixedArrayBase array(object);
+      Smi smi = array.Length(err);
+      if (err.Fail()) return 0;
+      length = smi.GetValue();
+      break;
+    }
+    case kStringLength: {
+      String str(object);
+      Smi smi = str.Length(err);
+      if (err.Fail()) return 0;
+      length = smi.GetValue();
+      break;
+    }
+    case kCodeLength: {
+      Code code(object);
+      length = code.Size(err);
+      if (err.Fail()) return 0;
+      break;
+    }
+  }
+
+  if (length < 0) {
+    err = Error::Failure("Invalid object length");
+    return 0;
+  }
+
+  int64_t size = header_ + length * element_size_;
+  return (size + alignment_ - 1) & ~(alignment_ - 1);
+}
+
 }  // namespace v8
 }  // namespace llnode
@@ -9,8 +9,21 @@
 
 namespace llnode {
 
+class CoreFile;
 class FindJSObjectsVisitor;
 class FindReferencesCmd;
+class SampleVisitor;
+class ObjectSizer;
+class HeapMarker;
+class FlatStringReader;
+class StringStatsCmd;
+class StringFlattener;
+class GrepStringsCmd;
+class HolderScanner;
+class PropertyReader;
+class ElementsReader;
+class WordReader;
+class ElementsStatsCmd;
 
 namespace v8 {
 
@@ -123,6 +136,7 @@ class Map : public HeapObject {
   inline int64_t BitField3(Error& err);
   inline int64_t InObjectProperties(Error& err);
   inline int64_t InstanceSize(Error& err);
+  inline int64_t ElementsKind(Error& err);
 
   inline bool IsDictionary(Error& err);
   inline int64_t NumberOfOwnDescriptors(Error& err);
@@ -227,6 +241,16 @@ class ThinString : public String {
   inline std::string ToString(Error& err);
 };
 
+class ExternalString : public String {
+ public:
+  V8_VALUE_DEFAULT_METHODS(ExternalString, String)
+
+  // Address of the characters, outside of the V8 heap.
+  inline int64_t ResourceData(Error& err);
+
+  inline std::string ToString(Error& err);
+};
+
 class HeapNumber : public HeapObject {
  public:
   V8_VALUE_DEFAULT_METHODS(HeapNumber, HeapObject)
@@ -371,6 +395,9 @@ class NameDictionary : public FixedArray {
   inline Value GetKey(int index, Error& err);
   inline Value GetValue(int index, Error& err);
   inline int64_t Length(Error& err);
+  // The number of properties and of entries there is room for.
+  inline int64_t NumberOfElements(Error& err);
+  inline int64_t Capacity(Error& err);
 };
 
 class Context : public FixedArray {
@@ -431,6 +458,63 @@ class JSArrayBufferView : public JSObject {
   std::string Inspect(InspectOptions* options, Error& err);
 };
 
+/* How to work out the shallow size of the objects sharing a Map. The Map
+ * gives the size of fixed sized objects directly, variable sized ones need
+ * their length field too. Computed once per Map, so it is cheap enough to
+ * use for every object found during a heap scan.
+ */
+class SizeFormula {
+ public:
+  SizeFormula()
+      : header_(0), element_size_(0), length_(kNoLength), alignment_(1) {}
+
+  static SizeFormula ForMap(Map map, Error& err);
+
+  int64_t Size(HeapObject object, Error& err) const;
+
+  inline bool IsVariable() const { return length_ != kNoLength; }
+
+ private:
+  enum LengthField { kNoLength, kArrayLength, kStringLength, kCodeLength };
+
+  int64_t header_;
+  int64_t element_size_;
+  LengthField length_;
+  int64_t alignment_;
+};
+
+/* The header V8 keeps at the start of every chunk of the heap, regular pages
+ * and the chunks of large objects, it tells which space the objects in the
+ * chunk belong to. Only the first page of a large object chunk has one.
+ */
+class MemoryChunk {
+ public:
+  enum Space {
+    kNewSpace,
+    kOldSpace,
+    kCodeSpace,
+    kLargeObjectSpace,
+    kUnknownSpace,
+    kNumSpaces
+  };
+
+  // The chunk whose header would be at `address`.
+  MemoryChunk(LLV8* v8, int64_t address) : v8_(v8), address_(address) {}
+
+  inline int64_t address() const { return address_; }
+
+  // The bytes the chunk spans, 0 when there is no chunk header at address().
+  int64_t Size(Error& err);
+  Space GetSpace(Error& err);
+
+  static const char* SpaceName(Space space);
+  static bool ParseSpaceName(const char* name, Space* space);
+
+ private:
+  LLV8* v8_;
+  int64_t address_;
+};
+
 class JSFrame : public Value {
  public:
   V8_VALUE_DEFAULT_METHODS(JSFrame, Value)
@@ -452,14 +536,27 @@ class JSFrame : public Value {
 
 class LLV8 {
  public:
-  LLV8() : target_(lldb::SBTarget()) {}
+  LLV8()
+      : target_(lldb::SBTarget()),
+        core_(nullptr),
+        pointer_size_(8),
+        big_endian_(false) {}
 
   void Load(lldb::SBTarget target);
 
+  /* Load every constant now and read memory from `core` instead of through
+   * lldb, so this LLV8 can be used from a thread lldb isn't used on. Call it
+   * after Load(), nullptr reads through lldb again.
+   */
+  void ReadFromCore(CoreFile* core);
+
  private:
   template <class T>
   inline T LoadValue(int64_t addr, Error& err);
 
+  bool ReadMemory(int64_t addr, void* buf, size_t size);
+  bool ReadUnsigned(int64_t addr, uint32_t byte_size, int64_t* value);
+
   int64_t LoadConstant(const char* name);
   int64_t LoadPtr(int64_t addr, Error& err);
   int64_t LoadUnsigned(int64_t addr, uint32_t byte_size, Error& err);
@@ -471,6 +568,9 @@ class LLV8 {
 
   lldb::SBTarget target_;
   lldb::SBProcess process_;
+  CoreFile* core_;
+  uint32_t pointer_size_;
+  bool big_endian_;
 
   constants::Common common;
   constants::Smi smi;
@@ -491,6 +591,7 @@ class LLV8 {
   constants::ConsString cons_string;
   constants::SlicedString sliced_string;
   constants::ThinString thin_string;
+  constants::ExternalString external_string;
   constants::FixedArrayBase fixed_array_base;
   constants::FixedTypedArrayBase fixed_typed_array_base;
   constants::FixedArray fixed_array;
@@ -501,6 +602,7 @@ class LLV8 {
   constants::JSDate js_date;
   constants::DescriptorArray descriptor_array;
   constants::NameDictionary name_dictionary;
+  constants::MemoryChunk memory_chunk;
   constants::Frame frame;
   constants::Types types;
 
@@ -519,6 +621,7 @@ class LLV8 {
   friend class ConsString;
   friend class SlicedString;
   friend class ThinString;
+  friend class ExternalString;
   friend class HeapNumber;
   friend class JSObject;
   friend class JSArray;
@@ -535,8 +638,22 @@ class LLV8 {
   friend class JSRegExp;
   friend class JSDate;
   friend class CodeMap;
+  friend class SizeFormula;
+  friend class MemoryChunk;
   friend class llnode::FindJSObjectsVisitor;
   friend class llnode::FindReferencesCmd;
+  friend class llnode::SampleVisitor;
+  friend class llnode::ObjectSizer;
+  friend class llnode::HeapMarker;
+  friend class llnode::FlatStringReader;
+  friend class llnode::StringStatsCmd;
+  friend class llnode::StringFlattener;
+  friend class llnode::GrepStringsCmd;
+  friend class llnode::HolderScanner;
+  friend class llnode::PropertyReader;
+  friend class llnode::ElementsReader;
+  friend class llnode::ElementsStatsCmd;
+  friend class llnode::WordReader;
 };
 
 #undef V8_VALUE_DEFAULT_METHODS
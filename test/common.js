@@ -164,11 +164,11 @@ Session.prototype.send = function send(line, callback) {
 
 
 exports.generateRanges = function generateRanges(cb) {
-  let script;
-  if (process.platform === 'darwin')
-    script = path.join(__dirname, '..', 'scripts', 'otool2segments.py');
-  else
-    script = path.join(__dirname, '..', 'scripts', 'readelf2segments.py');
+  // llnode reads the memory ranges of ELF cores directly.
+  if (process.platform !== 'darwin')
+    return process.nextTick(cb, null);
+
+  const script = path.join(__dirname, '..', 'scripts', 'otool2segments.py');
 
   const proc = spawn(script, [ exports.core ], {
     stdio: [ null, 'pipe', 'inherit' ]
@@ -75,4 +75,20 @@ function closure() {
   c.method();
 }
 
+function Unreachable() {
+  this.garbage = true;
+}
+
+// Nothing refers to the array once this returns. Its elements are a large
+// object, the pointers past its first page must not keep the Unreachable
+// instance alive.
+function makeGarbage() {
+  const unreachable = new Unreachable();
+  const garbage = [];
+  for (let i = 0; i < 200000; i++)
+    garbage.push(unreachable);
+  return garbage.length;
+}
+
+makeGarbage();
 closure();
@@ -121,12 +121,12 @@ tape('v8 inspect', (t) => {
     thin = thinMatch[1];
 
     const extMatch = lines.match(
-        /.externalized-string=(0x[0-9a-f]+):<String: "\(external\)">/);
+        /.externalized-string=(0x[0-9a-f]+):<String: "string that will...">/);
     t.ok(extMatch, '.externalized-string ExternalString property');
     ext = extMatch[1];
 
     const extSlicedMatch = lines.match(
-        /.sliced-externalized-string=(0x[0-9a-f]+):<String: "\(external\)">/);
+        /.sliced-externalized-string=(0x[0-9a-f]+):<String: "t will be ext/);
     t.ok(extSlicedMatch,
          '.sliced-externalized-string Sliced ExternalString property');
     extSliced = extSlicedMatch[1];
@@ -1,9 +1,6 @@
 'use strict';
 
-// No `process save-core` on linuxes :(
-if (process.platform !== 'darwin')
-  return;
-
+const fs = require('fs');
 const tape = require('tape');
 
 const common = require('./common');
@@ -37,13 +34,283 @@ tape('v8 findrefs and friends', (t) => {
   sess.wait(/lldb\-/, () => {
     t.ok(true, 'Generated ranges');
 
-    sess.send('v8 findjsobjects');
+    sess.send('v8 findjsobjects --sample 50');
+    // Just a separator
+    sess.send('version');
+  });
+
+  sess.linesUntil(/lldb\-/, (lines) => {
+    t.ok(/Estimated from \d+ of \d+ blocks/.test(lines.join('\n')),
+         'findjsobjects --sample should print an estimate');
+
+    sess.send('v8 findjsobjects --timeout 600');
     // Just a separator
     sess.send('version');
   });
 
   sess.linesUntil(/lldb\-/, (lines) => {
     t.ok(/\d+ Zlib/.test(lines.join('\n')), 'Zlib should be in findjsobjects');
+    t.notOk(/PARTIAL RESULT/.test(lines.join('\n')),
+            'findjsobjects should scan the whole heap');
+
+    sess.send('v8 findjsobjects --owned');
+    // Just a separator
+    sess.send('version');
+  });
+
+  sess.linesUntil(/lldb\-/, (lines) => {
+    t.ok(/Owned Size/.test(lines.join('\n')),
+         'findjsobjects --owned should print owned sizes');
+
+    sess.send('v8 findjsobjects --spaces');
+    // Just a separator
+    sess.send('version');
+  });
+
+  sess.linesUntil(/lldb\-/, (lines) => {
+    t.ok(/\d+ \(total\)/.test(lines.join('\n')),
+         'findjsobjects --spaces should print a total per space');
+
+    sess.send('v8 findjsobjects --live-only');
+    // Just a separator
+    sess.send('version');
+  });
+
+  sess.linesUntil(/lldb\-/, (lines) => {
+    t.ok(/\d+ Zlib/.test(lines.join('\n')), 'Zlib should be live');
+    t.ok(/Unreachable: \d+ objects/.test(lines.join('\n')),
+         'findjsobjects --live-only should report unreachable objects');
+
+    sess.send('v8 findjsinstances --live-only Unreachable');
+    // Just a separator
+    sess.send('version');
+  });
+
+  sess.linesUntil(/lldb\-/, (lines) => {
+    const output = lines.join('\n');
+    t.notOk(/<Object: Unreachable/.test(output),
+            'findjsinstances --live-only should leave out garbage');
+    t.ok(/Unreachable: 1 instances left out/.test(output),
+         'the object only a dead large array refers to should be unreachable');
+
+    sess.send('v8 findlargest -n 3');
+    // Just a separator
+    sess.send('version');
+  });
+
+  sess.linesUntil(/lldb\-/, (lines) => {
+    const rows = lines.filter((line) => /^ +\d+ .* 0x[0-9a-f]+:</.test(line));
+    t.equal(rows.length, 3, 'findlargest should list 3 objects');
+
+    sess.send('v8 dupstrings -n 5');
+    // Just a separator
+    sess.send('version');
+  });
+
+  sess.linesUntil(/lldb\-/, (lines) => {
+    t.ok(/values are duplicated in \d+ strings/.test(lines.join('\n')),
+         'dupstrings should report the duplicated values');
+
+    sess.send('v8 stringstats');
+    // Just a separator
+    sess.send('version');
+  });
+
+  sess.linesUntil(/lldb\-/, (lines) => {
+    const output = lines.join('\n');
+    t.ok(/ cons +one-byte +\d+/.test(output),
+         'stringstats should count the cons strings');
+    t.ok(/ external +one-byte +\d+ +\d+ +[1-9]\d*/.test(output),
+         'stringstats should count external strings as off-heap bytes');
+    t.ok(/Sliced string parents/.test(output),
+         'stringstats should list the sliced string parents');
+
+    sess.send('v8 grepstrings --regex "sm[a-z]+er, but"');
+    // Just a separator
+    sess.send('version');
+  });
+
+  sess.linesUntil(/lldb\-/, (lines) => {
+    const output = lines.join('\n');
+    t.ok(/<String: "this could be a/.test(output),
+         'grepstrings should find the cons string');
+    t.ok(/\.cons-string=0x[0-9a-f]+/.test(output),
+         'grepstrings should list the holder of the cons string');
+
+    // Quantifiers and escapes aren't literal text to look for.
+    sess.send('v8 grepstrings --regex "bi{0,2}t smaller"');
+    sess.send('v8 grepstrings --regex "\\x61 bit smaller"');
+    sess.send('v8 grepstrings --regex "a b\\u0069t smaller"');
+    // Just a separator
+    sess.send('version');
+  });
+
+  sess.linesUntil(/lldb\-/, (lines) => {
+    const output = lines.join('\n');
+    t.ok(/\d+ strings match bi\{0,2\}t smaller/.test(output),
+         'grepstrings --regex should match across a quantifier');
+    t.ok(/\d+ strings match \\x61 bit smaller/.test(output),
+         'grepstrings --regex should match a \\x escape');
+    t.ok(/\d+ strings match a b\\u0069t smaller/.test(output),
+         'grepstrings --regex should match a \\u escape');
+
+    sess.send('v8 findjsinstances --fields x,y,missing Class');
+    // Just a separator
+    sess.send('version');
+  });
+
+  sess.linesUntil(/lldb\-/, (lines) => {
+    const output = lines.join('\n');
+    t.ok(/^address\tx\ty\tmissing$/m.test(output),
+         'findjsinstances --fields should print a header');
+    t.ok(/^0x[0-9a-f]+\t1\t123\.456\t$/m.test(output),
+         'findjsinstances --fields should print the properties');
+
+    sess.send('v8 fieldhist Class x');
+    // Just a separator
+    sess.send('version');
+  });
+
+  sess.linesUntil(/lldb\-/, (lines) => {
+    t.ok(/^ +1 +\d+ <Smi: 1>$/m.test(lines.join('\n')),
+         'fieldhist should count the values of the property');
+
+    sess.send('v8 elementsstats');
+    // Just a separator
+    sess.send('version');
+  });
+
+  sess.linesUntil(/lldb\-/, (lines) => {
+    const output = lines.join('\n');
+    t.ok(/^\d+ objects with elements, \d+ bytes of/m.test(output),
+         'elementsstats should total the backing stores');
+    t.ok(/^ +packed( smi| double)? +\d+ +\d+ +\d+$/m.test(output),
+         'elementsstats should count the elements kinds');
+
+    sess.send('v8 findjsinstances --where "x == 1 && y > 100" Class');
+    sess.send('v8 findjsinstances --where "x == 2 || has(missing)" Class');
+    // Just a separator
+    sess.send('version');
+  });
+
+  sess.linesUntil(/lldb\-/, (lines) => {
+    const matches = lines.filter((line) => /<Object: Class>/.test(line));
+    t.equal(matches.length, 1, 'findjsinstances --where should filter');
+
+    sess.send(`v8 findjsinstances --out ${common.core}.out Class`);
+    // Just a separator
+    sess.send('version');
+  });
+
+  sess.linesUntil(/lldb\-/, (lines) => {
+    t.ok(/Wrote \d+ bytes to/.test(lines.join('\n')),
+         '--out should report the bytes written');
+    const written = fs.readFileSync(`${common.core}.out`, 'utf8');
+    t.ok(/<Object: Class>/.test(written), '--out should write the output');
+    fs.unlinkSync(`${common.core}.out`);
+
+    sess.send('v8 findjsobjects --json');
+    // Just a separator
+    sess.send('version');
+  });
+
+  sess.linesUntil(/lldb\-/, (lines) => {
+    const line = lines.find((line) => /^\{/.test(line));
+    const types = line ? JSON.parse(line).types : [];
+    const found = types.find((type) => type.name === 'Class');
+    t.ok(found && found.instances > 0,
+         'findjsobjects --json should list the types');
+
+    sess.send('v8 findjsinstances --limit 1 Array');
+    // Just a separator
+    sess.send('version');
+  });
+
+  let firstPage;
+  let secondPage;
+  sess.linesUntil(/lldb\-/, (lines) => {
+    const output = lines.join('\n');
+    const match = output.match(/(0x[0-9a-f]+):<Array/);
+    firstPage = match && match[1];
+    t.ok(firstPage, 'findjsinstances --limit should list an instance');
+    t.ok(/Listed results 1 to 1\./.test(output),
+         'findjsinstances --limit should list one page');
+
+    sess.send('v8 findjsinstances --next');
+    // Just a separator
+    sess.send('version');
+  });
+
+  sess.linesUntil(/lldb\-/, (lines) => {
+    const output = lines.join('\n');
+    const match = output.match(/(0x[0-9a-f]+):<Array/);
+    secondPage = match && match[1];
+    t.ok(secondPage && secondPage !== firstPage,
+         'findjsinstances --next should list the next instance');
+    t.ok(/Listed results 2 to 2\./.test(output),
+         'findjsinstances --next should go on from the last page');
+
+    sess.send('v8 findjsinstances --offset 1 --limit 1 Array');
+    // Just a separator
+    sess.send('version');
+  });
+
+  sess.linesUntil(/lldb\-/, (lines) => {
+    const output = lines.join('\n');
+    const match = output.match(/(0x[0-9a-f]+):<Array/);
+    t.equal(match && match[1], secondPage,
+            'findjsinstances --offset should skip the first instances');
+
+    sess.send('v8 findjsinstances --limit 1 Class');
+    sess.send('v8 findjsinstances --next');
+    // Just a separator
+    sess.send('version');
+  });
+
+  sess.linesUntil(/lldb\-/, (lines) => {
+    const output = lines.join('\n');
+    t.ok(/Listed results 1 to 1\./.test(output),
+         'findjsinstances --limit should list the only instance');
+    t.ok(/No more results/.test(output),
+         'findjsinstances --next should stop after the last page');
+
+    sess.send('v8 findjsinstances --sample 5 Class');
+    // Just a separator
+    sess.send('version');
+  });
+
+  sess.linesUntil(/lldb\-/, (lines) => {
+    const output = lines.join('\n');
+    t.ok(/1 instances of Class, \d+ bytes\. A sample of 1:/.test(output),
+         'findjsinstances --sample should print the totals');
+    t.ok(/<Object: Class>/.test(output),
+         'findjsinstances --sample should inspect the sample');
+
+    sess.send('v8 shapes Class');
+    // Just a separator
+    sess.send('version');
+  });
+
+  sess.linesUntil(/lldb\-/, (lines) => {
+    const output = lines.join('\n');
+    t.ok(/^Class has 1 maps:$/m.test(output), 'shapes should count the maps');
+    t.ok(/Properties: x, y, hashmap$/m.test(output),
+         'shapes should list the properties of the map');
+
+    sess.send('v8 findjsobjects --dictionaries');
+    // Just a separator
+    sess.send('version');
+  });
+
+  sess.linesUntil(/lldb\-/, (lines) => {
+    t.ok(/Avg Capacity +Avg Used Dict Bytes Name/.test(lines.join('\n')),
+         'findjsobjects --dictionaries should print the report');
+
+    sess.send('v8 scan status');
+  });
+
+  sess.wait(/Heap scan:/, (line) => {
+    t.ok(/Heap scan: complete/.test(line), 'Heap scan should be complete');
 
     sess.send('v8 findjsinstances Zlib');
     // Just a separator
@@ -38,6 +38,30 @@ tape('usage messages', (t) => {
   sess.stderr.linesUntil(/USAGE/, (lines) => {
     t.ok(/^error: USAGE: v8 findrefs expr$/.test(removeBlankLines(lines)[0]),
          'findrefs usage message');
+    sess.send('v8 stringstats -n 0');
+  });
+
+  sess.stderr.linesUntil(/USAGE/, (lines) => {
+    const re = /^error: USAGE: v8 stringstats \[flags\]$/;
+
+    t.ok(re.test(removeBlankLines(lines)[0]),
+         'stringstats usage message for a count of 0');
+    sess.send('v8 dupstrings -n 5x');
+  });
+
+  sess.stderr.linesUntil(/USAGE/, (lines) => {
+    const re = /^error: USAGE: v8 dupstrings \[-n count\]$/;
+
+    t.ok(re.test(removeBlankLines(lines)[0]),
+         'dupstrings usage message for a bad count');
+    sess.send('v8 findjsobjects --timeout 10s');
+  });
+
+  sess.stderr.linesUntil(/USAGE/, (lines) => {
+    const re = /^error: USAGE: v8 findjsobjects \[flags\]$/;
+
+    t.ok(re.test(removeBlankLines(lines)[0]),
+         'findjsobjects usage message for a bad timeout');
     sess.quit();
     t.end();
   });